@@ -0,0 +1,254 @@
+// Replication fault-injection harness: starts a cluster of broker processes on
+// local ports, publishes through every member with quorum acknowledgements
+// while members are killed (SIGKILL) and restarted one at a time, then checks
+// that every acknowledged message can still be fetched from the cluster.
+//
+// A message the broker acknowledged must be held by a member that is up at
+// the end; messages whose publish failed may or may not be. Each partition's
+// copies are also compared, which shows whether restarted members caught up.
+// Exits with 1 if an acknowledged message is lost.
+//
+//   ./failover_harness [--server PATH] [--members N] [--replicas K] [--partitions N] [--base-port P]
+//                      [--messages N] [--kills N] [--kill-interval-ms N] [--log-dir DIR]
+
+#include "../client_api/publisher.h"
+#include "../client_api/subscriber.h"
+#include "../common/network.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const char* TOPIC = "failover";
+
+struct Options {
+    std::string server = "./server";
+    size_t members = 3;
+    size_t replicas = 1;
+    size_t partitions = 6;
+    int basePort = 9300;
+    size_t messages = 3000;
+    size_t kills = 3;
+    size_t killIntervalMs = 1500;
+    std::string logDir;
+};
+
+class BrokerProcesses {
+public:
+    explicit BrokerProcesses(const Options& options) : options(options), pids(options.members, -1) {}
+
+    ~BrokerProcesses() {
+        for (size_t i = 0; i < pids.size(); ++i) {
+            kill(i);
+        }
+    }
+
+    int port(size_t member) const { return options.basePort + static_cast<int>(member); }
+
+    bool start(size_t member) {
+        std::string members;
+        for (size_t i = 0; i < options.members; ++i) {
+            members += (i > 0 ? "," : "") + std::string("127.0.0.1:") + std::to_string(port(i));
+        }
+        std::vector<std::string> args = {
+            options.server, "--port", std::to_string(port(member)), "--cluster", members,
+            "--node-id", std::to_string(member), "--replicas", std::to_string(options.replicas),
+            "--partitions", std::to_string(options.partitions), "--cluster-reconnect-ms", "200",
+            "--replication-timeout-ms", "2000",
+        };
+        std::string log = options.logDir.empty() ? "/dev/null"
+                                                 : options.logDir + "/member-" + std::to_string(member) + ".log";
+        pid_t pid = fork();
+        if (pid < 0) {
+            return false;
+        }
+        if (pid == 0) {
+            int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd >= 0) {
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+            }
+            std::vector<char*> argv;
+            for (auto& arg : args) {
+                argv.push_back(&arg[0]);
+            }
+            argv.push_back(nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        pids[member] = pid;
+        return waitListening(member);
+    }
+
+    void kill(size_t member) {
+        if (pids[member] <= 0) {
+            return;
+        }
+        ::kill(pids[member], SIGKILL);
+        waitpid(pids[member], nullptr, 0);
+        pids[member] = -1;
+    }
+
+private:
+    bool waitListening(size_t member) {
+        for (int attempt = 0; attempt < 100; ++attempt) {
+            int fd = createConnection("127.0.0.1", port(member));
+            if (fd >= 0) {
+                closeConnection(fd);
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        std::cerr << "Member " << member << " did not start listening on port " << port(member) << std::endl;
+        return false;
+    }
+
+    const Options& options;
+    std::vector<pid_t> pids;
+};
+
+// Every message of the partition the member holds, oldest first.
+static std::vector<std::string> readPartition(int port, uint16_t partition) {
+    std::vector<std::string> payloads;
+    Subscriber subscriber("127.0.0.1", port);
+    if (!subscriber.connect()) {
+        return payloads;
+    }
+    uint64_t offset = 0;
+    while (true) {
+        std::vector<Message> messages;
+        uint64_t next = offset;
+        if (!subscriber.fetch(TOPIC, "", offset, 1000, messages, next, partition) || next == offset) {
+            break;
+        }
+        for (const auto& message : messages) {
+            payloads.push_back(message.content);
+        }
+        offset = next;
+    }
+    subscriber.disconnect();
+    return payloads;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        size_t number = std::strtoull(value.c_str(), nullptr, 10);
+        if (arg == "--server") {
+            options.server = value;
+        } else if (arg == "--members" && number > 1) {
+            options.members = number;
+        } else if (arg == "--replicas") {
+            options.replicas = number;
+        } else if (arg == "--partitions" && number > 0) {
+            options.partitions = number;
+        } else if (arg == "--base-port" && number > 0 && number < 65000) {
+            options.basePort = static_cast<int>(number);
+        } else if (arg == "--messages" && number > 0) {
+            options.messages = number;
+        } else if (arg == "--kills") {
+            options.kills = number;
+        } else if (arg == "--kill-interval-ms" && number > 0) {
+            options.killIntervalMs = number;
+        } else if (arg == "--log-dir") {
+            options.logDir = value;
+        } else {
+            std::cerr << "Invalid option: " << arg << " " << value << std::endl;
+            return 2;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    BrokerProcesses cluster(options);
+    for (size_t member = 0; member < options.members; ++member) {
+        if (!cluster.start(member)) {
+            return 2;
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000)); // links up, members synced
+
+    std::mutex ackedMutex;
+    std::set<std::string> acked;
+    std::atomic<size_t> failed(0);
+    std::atomic<bool> publishing(true);
+
+    // One publisher per member, each pipelining its share of the messages.
+    std::vector<std::thread> publishers;
+    for (size_t member = 0; member < options.members; ++member) {
+        publishers.emplace_back([&, member] {
+            Publisher publisher("127.0.0.1", cluster.port(member), 64);
+            publisher.setAcks(PublishAcks::Quorum);
+            for (size_t i = member; i < options.messages; i += options.members) {
+                std::string payload = "m" + std::to_string(i);
+                publisher.publishAsync(TOPIC, payload, "key" + std::to_string(i), [&, payload](const PublishAck& ack) {
+                    if (ack.success) {
+                        std::lock_guard<std::mutex> lock(ackedMutex);
+                        acked.insert(payload);
+                    } else {
+                        ++failed;
+                    }
+                });
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+            publisher.flush(10000);
+            publisher.close();
+        });
+    }
+
+    std::thread killer([&] {
+        std::mt19937 random(42);
+        for (size_t kill = 0; kill < options.kills && publishing; ++kill) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.killIntervalMs));
+            size_t member = random() % options.members;
+            std::cout << "Killing member " << member << std::endl;
+            cluster.kill(member);
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.killIntervalMs / 2));
+            std::cout << "Restarting member " << member << std::endl;
+            cluster.start(member);
+        }
+    });
+
+    for (auto& thread : publishers) {
+        thread.join();
+    }
+    publishing = false;
+    killer.join();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500)); // restarted members catch up
+
+    std::set<std::string> held;
+    size_t agreeing = 0;
+    for (size_t partition = 0; partition < options.partitions; ++partition) {
+        std::set<std::vector<std::string>> copies;
+        std::cout << "Partition " << partition << ":";
+        for (size_t member = 0; member < options.members; ++member) {
+            std::vector<std::string> payloads = readPartition(cluster.port(member), static_cast<uint16_t>(partition));
+            std::cout << " " << payloads.size();
+            held.insert(payloads.begin(), payloads.end());
+            if (!payloads.empty()) {
+                copies.insert(std::move(payloads));
+            }
+        }
+        agreeing += copies.size() <= 1 ? 1 : 0;
+        std::cout << (copies.size() <= 1 ? "" : " (copies differ)") << std::endl;
+    }
+
+    size_t lost = 0;
+    for (const auto& payload : acked) {
+        lost += held.count(payload) ? 0 : 1;
+    }
+    std::cout << "Acknowledged " << acked.size() << ", failed " << failed << ", lost " << lost << "; "
+              << agreeing << " of " << options.partitions << " partitions have identical copies" << std::endl;
+    return lost == 0 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// High dynamic range histogram (the HdrHistogram layout): values from 1 to
+// highest are counted with a fixed number of significant decimal digits.
+// Every power-of-two range of values is split into the same number of linear
+// steps (1024 for 3 digits), so the relative error of any reported percentile
+// is bounded (0.1% with 3 digits) while the counts array stays a few hundred
+// KB. Not thread-safe; keep one per thread and add() them.
+class HdrHistogram {
+public:
+    explicit HdrHistogram(uint64_t highest = 3600ULL * 1000 * 1000 * 1000, int digits = 3)
+            : highestTrackable(highest), total(0), minimum(UINT64_MAX), maximum(0), sum(0) {
+        uint64_t largestSingleUnit = 2 * static_cast<uint64_t>(std::pow(10, digits));
+        subBucketCountMagnitude = static_cast<int>(std::ceil(std::log2(static_cast<double>(largestSingleUnit))));
+        subBucketHalfCountMagnitude = subBucketCountMagnitude - 1;
+        subBucketCount = uint64_t(1) << subBucketCountMagnitude;
+        subBucketHalfCount = subBucketCount / 2;
+        subBucketMask = subBucketCount - 1;
+
+        int buckets = 1;
+        uint64_t smallestUntrackable = subBucketCount;
+        while (smallestUntrackable <= highest) {
+            if (smallestUntrackable > (UINT64_MAX >> 1)) {
+                ++buckets;
+                break;
+            }
+            smallestUntrackable <<= 1;
+            ++buckets;
+        }
+        counts.assign(static_cast<size_t>(buckets + 1) * subBucketHalfCount, 0);
+    }
+
+    // Values above the trackable range are clamped to it.
+    void record(uint64_t value, uint64_t count = 1) {
+        value = std::min(value, highestTrackable);
+        counts[indexOf(value)] += count;
+        total += count;
+        sum += static_cast<double>(value) * count;
+        minimum = std::min(minimum, value);
+        maximum = std::max(maximum, value);
+    }
+
+    // other must have the same range and precision.
+    void add(const HdrHistogram& other) {
+        for (size_t i = 0; i < counts.size() && i < other.counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        minimum = std::min(minimum, other.minimum);
+        maximum = std::max(maximum, other.maximum);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total == 0 ? 0 : minimum; }
+    uint64_t max() const { return maximum; }
+    double mean() const { return total == 0 ? 0 : sum / total; }
+
+    // The highest value equivalent to the one at percentile (0..100].
+    uint64_t valueAtPercentile(double percentile) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>(std::ceil(std::min(percentile, 100.0) / 100.0 * total));
+        target = std::max<uint64_t>(target, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= target) {
+                return std::min(highestEquivalent(valueAt(i)), maximum);
+            }
+        }
+        return maximum;
+    }
+
+private:
+    int bucketOf(uint64_t value) const {
+        int pow2Ceiling = 64 - __builtin_clzll(value | subBucketMask);
+        return pow2Ceiling - (subBucketHalfCountMagnitude + 1);
+    }
+
+    size_t indexOf(uint64_t value) const {
+        int bucket = bucketOf(value);
+        uint64_t subBucket = value >> bucket;
+        return (static_cast<size_t>(bucket + 1) << subBucketHalfCountMagnitude) + (subBucket - subBucketHalfCount);
+    }
+
+    uint64_t valueAt(size_t index) const {
+        int bucket = static_cast<int>(index >> subBucketHalfCountMagnitude) - 1;
+        uint64_t subBucket = (index & (subBucketHalfCount - 1)) + subBucketHalfCount;
+        if (bucket < 0) {
+            subBucket -= subBucketHalfCount;
+            bucket = 0;
+        }
+        return subBucket << bucket;
+    }
+
+    uint64_t highestEquivalent(uint64_t value) const {
+        int bucket = bucketOf(value);
+        uint64_t subBucket = value >> bucket;
+        int rangeBucket = subBucket >= subBucketCount ? bucket + 1 : bucket;
+        uint64_t lowest = subBucket << bucket;
+        return lowest + (uint64_t(1) << rangeBucket) - 1;
+    }
+
+    uint64_t highestTrackable;
+    int subBucketCountMagnitude;
+    int subBucketHalfCountMagnitude;
+    uint64_t subBucketCount;
+    uint64_t subBucketHalfCount;
+    uint64_t subBucketMask;
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t minimum;
+    uint64_t maximum;
+    double sum;
+};
+
+#endif // HDR_HISTOGRAM_H
@@ -0,0 +1,116 @@
+// Durable log benchmark: append throughput into memory-mapped segments and
+// restart (recovery) time, for growing log sizes.
+//
+// For each log size a fresh data directory is filled through LogStore, closed
+// (which syncs), and reopened; the restart time covers mapping every segment,
+// scanning the indexes and visiting every stored UUID, which is what the
+// broker does to rebuild offsets and dedup state.
+//
+//   ./log_store_bench [--dir PATH] [--max-messages N] [--payload N] [--fsync-ms N] [--fsync-messages N]
+
+#include "../broker/log_store.h"
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <uuid/uuid.h>
+
+static void removeTree(const std::string& path) {
+    std::string command = "rm -rf '" + path + "'";
+    if (std::system(command.c_str()) != 0) {
+        std::cerr << "Failed to remove " << path << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string dir = "/tmp/log_store_bench";
+    size_t maxMessages = 1000000;
+    size_t payloadSize = 256;
+    PersistenceConfig persistence;
+    RetentionConfig retention;
+    retention.maxBytes = 0; // keep everything so restart time reflects the full log
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        size_t number = std::strtoull(value.c_str(), nullptr, 10);
+        if (arg == "--dir") {
+            dir = value;
+        } else if (arg == "--max-messages" && number > 0) {
+            maxMessages = number;
+        } else if (arg == "--payload" && number > 0) {
+            payloadSize = number;
+        } else if (arg == "--fsync-ms" && number > 0) {
+            persistence.fsyncIntervalMs = number;
+        } else if (arg == "--fsync-messages" && number > 0) {
+            persistence.fsyncMessages = number;
+        } else {
+            std::cerr << "Invalid option: " << arg << " " << value << std::endl;
+            return 1;
+        }
+    }
+    persistence.dataDir = dir;
+
+    // Distinct UUIDs, so the recovered dedup state has the real cardinality.
+    std::string payload(payloadSize, 'x');
+    std::vector<SharedMessagePtr> messages;
+    for (int i = 0; i < 1024; ++i) {
+        uuid_t uuid;
+        char text[37];
+        uuid_generate(uuid);
+        uuid_unparse_lower(uuid, text);
+        messages.push_back(SharedMessage::create("bench", payload, text));
+    }
+
+    std::cout << std::setw(12) << "messages" << std::setw(12) << "log MB" << std::setw(16) << "append msg/s"
+              << std::setw(12) << "MB/s" << std::setw(14) << "restart ms" << std::endl;
+    for (size_t count = 10000; count <= maxMessages; count *= 10) {
+        removeTree(dir);
+
+        double appendSeconds;
+        {
+            LogStore store(persistence, retention);
+            std::vector<std::shared_ptr<TopicStore>> recovered;
+            if (!store.open(recovered)) {
+                return 1;
+            }
+            std::shared_ptr<TopicStore> topic = store.openTopic("bench");
+            auto start = std::chrono::steady_clock::now();
+            for (size_t offset = 0; offset < count; ++offset) {
+                if (!topic->append(offset, *messages[offset % messages.size()])) {
+                    return 1;
+                }
+            }
+            store.syncAll();
+            appendSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t uuids = 0;
+        {
+            LogStore store(persistence, retention);
+            std::vector<std::shared_ptr<TopicStore>> recovered;
+            if (!store.open(recovered)) {
+                return 1;
+            }
+            for (const auto& topic : recovered) {
+                topic->forEachUuid([&](const uint8_t*) { ++uuids; });
+            }
+        }
+        double restartMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (uuids != count) {
+            std::cerr << "Recovered " << uuids << " of " << count << " messages" << std::endl;
+            return 1;
+        }
+
+        double megabytes = static_cast<double>(count) * messages[0]->size() / (1024 * 1024);
+        std::cout << std::setw(12) << count << std::fixed << std::setprecision(1) << std::setw(12) << megabytes
+                  << std::setprecision(0) << std::setw(16) << count / appendSeconds
+                  << std::setprecision(1) << std::setw(12) << megabytes / appendSeconds
+                  << std::setw(14) << restartMs << std::endl;
+    }
+    removeTree(dir);
+    return 0;
+}
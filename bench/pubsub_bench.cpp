@@ -0,0 +1,356 @@
+// End-to-end load generator: P publishers and S subscribers in this process
+// against a running broker. Publishers are driven by T threads at a target
+// aggregate rate, spread over N topics, and each topic has F subscribers
+// (the fan-out). Reports throughput and end-to-end and publish-ack latency
+// percentiles as JSON on stdout; progress, and what the client library
+// prints, goes to stderr.
+//
+// Each message carries the time it was meant to be sent (its slot in the
+// fixed-rate schedule) and the time it was actually sent. A sender that falls
+// behind, e.g. because the publisher's in-flight window is full, sends late
+// but keeps its schedule, so latency measured from the intended time includes
+// the queueing a real client would have seen (the coordinated-omission
+// correction); "end_to_end_uncorrected" measures from the actual send for
+// comparison. With --rate 0 there is no schedule and the two are the same.
+// Messages meant for the warm-up period are not counted.
+//
+//   ./pubsub_bench [--host H] [--port P] [--publishers P] [--subscribers S] [--threads T]
+//                  [--topics N] [--fanout F] [--size BYTES] [--rate MSGS_PER_S] [--duration-s N]
+//                  [--warmup-s N] [--batch N] [--in-flight N]
+
+#include "../client_api/publisher.h"
+#include "../client_api/subscriber.h"
+#include "hdr_histogram.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Publishers and subscribers share this process, so one monotonic clock
+// timestamps both ends.
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    size_t publishers = 1;
+    size_t subscribers = 1;
+    size_t threads = 1;
+    size_t topics = 1;
+    size_t fanout = 1;
+    size_t size = 128;
+    size_t rate = 10000; // messages per second over all publishers; 0 = as fast as possible
+    size_t durationS = 10;
+    size_t warmupS = 2;
+    size_t batch = 1;
+    size_t inFlight = 1024;
+};
+
+// Payload: "<intended ns>:<sent ns>:" padded to the message size.
+static const size_t HEADER_SIZE = 42;
+
+static std::string makePayload(uint64_t intended, uint64_t sent, size_t size) {
+    char header[HEADER_SIZE + 1];
+    int length = std::snprintf(header, sizeof(header), "%llu:%llu:", static_cast<unsigned long long>(intended),
+                               static_cast<unsigned long long>(sent));
+    std::string payload(header, length);
+    if (payload.size() < size) {
+        payload.append(size - payload.size(), 'x');
+    }
+    return payload;
+}
+
+static bool parsePayload(const std::string& payload, uint64_t& intended, uint64_t& sent) {
+    char* end = nullptr;
+    intended = std::strtoull(payload.c_str(), &end, 10);
+    if (*end != ':') {
+        return false;
+    }
+    sent = std::strtoull(end + 1, &end, 10);
+    return *end == ':';
+}
+
+static std::string topicName(size_t index) {
+    return "bench." + std::to_string(index);
+}
+
+// Written only by the owning publisher's I/O thread (acks) or driver thread
+// (sent), and read once both are done.
+struct PublisherStats {
+    HdrHistogram ackLatency;
+    uint64_t sent = 0;
+    uint64_t acked = 0; // in the measured window
+    std::atomic<uint64_t> ackedTotal{0};
+    std::atomic<uint64_t> failed{0};
+};
+
+// Written only by the subscriber's I/O thread.
+struct SubscriberStats {
+    HdrHistogram latency;
+    HdrHistogram uncorrected;
+    uint64_t delivered = 0; // in the measured window
+    std::atomic<uint64_t> deliveredTotal{0};
+};
+
+static void writeLatency(std::ostream& out, const char* name, const HdrHistogram& histogram, bool last) {
+    auto us = [](double ns) { return ns / 1000.0; };
+    out << "    \"" << name << "\": {\"count\": " << histogram.count() << ", \"min\": " << us(histogram.min())
+        << ", \"mean\": " << us(histogram.mean()) << ", \"p50\": " << us(histogram.valueAtPercentile(50))
+        << ", \"p90\": " << us(histogram.valueAtPercentile(90)) << ", \"p99\": " << us(histogram.valueAtPercentile(99))
+        << ", \"p999\": " << us(histogram.valueAtPercentile(99.9)) << ", \"max\": " << us(histogram.max()) << "}"
+        << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        size_t number = std::strtoull(value.c_str(), nullptr, 10);
+        if (arg == "--host") {
+            options.host = value;
+        } else if (arg == "--port" && number > 0 && number < 65536) {
+            options.port = static_cast<int>(number);
+        } else if (arg == "--publishers" && number > 0) {
+            options.publishers = number;
+        } else if (arg == "--subscribers") {
+            options.subscribers = number;
+        } else if (arg == "--threads" && number > 0) {
+            options.threads = number;
+        } else if (arg == "--topics" && number > 0) {
+            options.topics = number;
+        } else if (arg == "--fanout") {
+            options.fanout = number;
+        } else if (arg == "--size") {
+            options.size = number;
+        } else if (arg == "--rate") {
+            options.rate = number;
+        } else if (arg == "--duration-s" && number > 0) {
+            options.durationS = number;
+        } else if (arg == "--warmup-s") {
+            options.warmupS = number;
+        } else if (arg == "--batch" && number > 0) {
+            options.batch = number;
+        } else if (arg == "--in-flight" && number > 0) {
+            options.inFlight = number;
+        } else {
+            std::cerr << "Invalid option: " << arg << " " << value << std::endl;
+            return 2;
+        }
+    }
+    // A topic's subscribers are distinct subscribers.
+    if (options.fanout > options.subscribers) {
+        std::cerr << "--fanout " << options.fanout << " needs at least as many subscribers" << std::endl;
+        return 2;
+    }
+    options.threads = std::min(options.threads, options.publishers);
+    signal(SIGPIPE, SIG_IGN);
+    std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf()); // keeps stdout for the results
+
+    // Topic t goes to subscribers t * F .. t * F + F - 1, modulo S.
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    std::vector<std::unique_ptr<SubscriberStats>> subscriberStats;
+    std::atomic<uint64_t> measureFrom(UINT64_MAX); // intended times before this are warm-up
+    std::atomic<uint64_t> measureUntil(UINT64_MAX);
+    for (size_t i = 0; i < options.subscribers; ++i) {
+        subscribers.emplace_back(new Subscriber(options.host, options.port));
+        subscriberStats.emplace_back(new SubscriberStats());
+        if (!subscribers.back()->connect()) {
+            std::cerr << "Subscriber " << i << " could not connect to " << options.host << ":" << options.port
+                      << std::endl;
+            return 2;
+        }
+    }
+    for (size_t topic = 0; topic < options.topics; ++topic) {
+        for (size_t k = 0; k < options.fanout; ++k) {
+            size_t index = (topic * options.fanout + k) % options.subscribers;
+            SubscriberStats* stats = subscriberStats[index].get();
+            bool subscribed = subscribers[index]->subscribe(topicName(topic), [&, stats](const Message& message) {
+                uint64_t received = nowNs();
+                uint64_t intended = 0;
+                uint64_t sent = 0;
+                if (!parsePayload(message.content, intended, sent)) {
+                    return;
+                }
+                ++stats->deliveredTotal;
+                if (intended >= measureFrom.load() && intended < measureUntil.load()) {
+                    stats->latency.record(received - intended);
+                    stats->uncorrected.record(received - sent);
+                    ++stats->delivered;
+                }
+            });
+            if (!subscribed) {
+                std::cerr << "Subscriber " << index << " could not subscribe to " << topicName(topic) << std::endl;
+                return 2;
+            }
+        }
+    }
+
+    BatchConfig batching;
+    batching.maxMessages = options.batch;
+    std::vector<std::unique_ptr<Publisher>> publishers;
+    std::vector<std::unique_ptr<PublisherStats>> publisherStats;
+    for (size_t i = 0; i < options.publishers; ++i) {
+        publishers.emplace_back(new Publisher(options.host, options.port, options.inFlight, batching));
+        publisherStats.emplace_back(new PublisherStats());
+    }
+
+    std::cerr << "Running " << options.publishers << " publishers on " << options.threads << " threads, "
+              << options.subscribers << " subscribers, " << options.topics << " topics x " << options.fanout
+              << " fan-out, " << options.size << "-byte messages at "
+              << (options.rate == 0 ? std::string("max") : std::to_string(options.rate)) << " msg/s for "
+              << options.warmupS << "+" << options.durationS << " s" << std::endl;
+
+    uint64_t start = nowNs() + 100 * 1000 * 1000; // every thread starts on the same schedule
+    uint64_t warmupEnd = start + options.warmupS * 1000000000ULL;
+    uint64_t end = warmupEnd + options.durationS * 1000000000ULL;
+    measureFrom = warmupEnd;
+    measureUntil = end;
+
+    // Thread t drives publishers t, t + T, ... and sends every T-th slot of
+    // the aggregate schedule, offset by t.
+    std::vector<std::thread> drivers;
+    for (size_t t = 0; t < options.threads; ++t) {
+        drivers.emplace_back([&, t] {
+            std::vector<size_t> owned;
+            for (size_t p = t; p < options.publishers; p += options.threads) {
+                owned.push_back(p);
+            }
+            uint64_t interval = options.rate == 0 ? 0 : 1000000000ULL * options.threads / options.rate;
+            uint64_t offset = options.rate == 0 ? 0 : 1000000000ULL * t / options.rate;
+            for (uint64_t k = 0;; ++k) {
+                uint64_t now = nowNs();
+                uint64_t intended = options.rate == 0 ? std::max(now, start) : start + offset + k * interval;
+                if (intended >= end) {
+                    break;
+                }
+                if (now < intended) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(intended - now));
+                }
+                size_t index = owned[k % owned.size()];
+                PublisherStats* stats = publisherStats[index].get();
+                bool measured = intended >= warmupEnd;
+                size_t topic = (k * options.threads + t) % options.topics;
+                publishers[index]->publishAsync(
+                        topicName(topic), makePayload(intended, nowNs(), options.size),
+                        [stats, intended, measured](const PublishAck& ack) {
+                            if (!ack.success) {
+                                ++stats->failed;
+                                return;
+                            }
+                            ++stats->ackedTotal;
+                            if (measured) {
+                                stats->ackLatency.record(nowNs() - intended);
+                                ++stats->acked;
+                            }
+                        });
+                ++stats->sent;
+            }
+        });
+    }
+    for (auto& thread : drivers) {
+        thread.join();
+    }
+    for (auto& publisher : publishers) {
+        publisher->flush(10000);
+    }
+
+    // Ack callbacks run just after flush() sees the acks. Then every
+    // acknowledged message should reach each of its topic's subscribers.
+    Clock::time_point drainDeadline = Clock::now() + std::chrono::seconds(5);
+    uint64_t acked = 0;
+    while (true) {
+        uint64_t settled = 0;
+        uint64_t sentTotal = 0;
+        acked = 0;
+        for (const auto& stats : publisherStats) {
+            acked += stats->ackedTotal;
+            settled += stats->ackedTotal + stats->failed;
+            sentTotal += stats->sent;
+        }
+        if (settled >= sentTotal || Clock::now() >= drainDeadline) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t expected = acked * options.fanout;
+    uint64_t delivered = 0;
+    while (true) {
+        delivered = 0;
+        for (const auto& stats : subscriberStats) {
+            delivered += stats->deliveredTotal;
+        }
+        if (delivered >= expected || Clock::now() >= drainDeadline) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (auto& publisher : publishers) {
+        publisher->close();
+    }
+    for (auto& subscriber : subscribers) {
+        subscriber->disconnect();
+    }
+
+    HdrHistogram latency;
+    HdrHistogram uncorrected;
+    HdrHistogram ackLatency;
+    uint64_t sent = 0;
+    uint64_t failed = 0;
+    uint64_t ackedMeasured = 0;
+    uint64_t deliveredMeasured = 0;
+    for (const auto& stats : publisherStats) {
+        ackLatency.add(stats->ackLatency);
+        sent += stats->sent;
+        failed += stats->failed;
+        ackedMeasured += stats->acked;
+    }
+    for (const auto& stats : subscriberStats) {
+        latency.add(stats->latency);
+        uncorrected.add(stats->uncorrected);
+        deliveredMeasured += stats->delivered;
+    }
+
+    double seconds = static_cast<double>(options.durationS);
+    double publishRate = ackedMeasured / seconds;
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"config\": {\"publishers\": " << options.publishers << ", \"subscribers\": " << options.subscribers
+        << ", \"threads\": " << options.threads << ", \"topics\": " << options.topics
+        << ", \"fanout\": " << options.fanout << ", \"message_size\": " << options.size
+        << ", \"target_rate\": " << options.rate << ", \"duration_s\": " << options.durationS
+        << ", \"warmup_s\": " << options.warmupS << ", \"batch\": " << options.batch
+        << ", \"in_flight\": " << options.inFlight << "},\n";
+    out << "  \"sent\": " << sent << ",\n";
+    out << "  \"acked\": " << acked << ",\n";
+    out << "  \"failed\": " << failed << ",\n";
+    out << "  \"delivered\": " << delivered << ",\n";
+    out << "  \"expected_deliveries\": " << expected << ",\n";
+    out << "  \"publish_rate\": " << publishRate << ",\n";
+    out << "  \"publish_mb_per_s\": " << publishRate * options.size / (1024 * 1024) << ",\n";
+    out << "  \"delivery_rate\": " << deliveredMeasured / seconds << ",\n";
+    out << "  \"latency_us\": {\n";
+    writeLatency(out, "end_to_end", latency, false);
+    writeLatency(out, "end_to_end_uncorrected", uncorrected, false);
+    writeLatency(out, "publish_ack", ackLatency, true);
+    out << "  }\n";
+    out << "}\n";
+    std::cout.rdbuf(stdoutBuffer);
+    std::cout << out.str();
+
+    if (delivered < expected) {
+        std::cerr << "Only " << delivered << " of " << expected << " deliveries arrived" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,410 @@
+// Microbenchmarks for the broker's per-message hot paths: message encoding and
+// decoding (text and binary), building the shared message, finding a topic's
+// subscribers (exact and wildcard), the dedup window, and topic log reads and
+// appends. Each runs single-threaded on in-process structures, no sockets.
+//
+// A small Google Benchmark-style runner: every benchmark is a function timed
+// over a loop of state.keepRunning(), parameterized by the cross product of
+// its argument lists, and run with a growing iteration count until one run
+// takes at least --min-time-ms. Setup before the loop is not timed. Results
+// are a table, or JSON with --format json.
+//
+//   ./pubsub_microbench [--filter SUBSTRING] [--min-time-ms N] [--format table|json]
+
+#include "../broker/connection.h"
+#include "../broker/shared_message.h"
+#include "../broker/subscription_trie.h"
+#include "../broker/topic_log.h"
+#include "../broker/topic_registry.h"
+#include "../common/dedup_window.h"
+#include "../common/message.h"
+#include "../common/wire.h"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps the compiler from discarding a result the loop does nothing else with.
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+class BenchmarkState {
+public:
+    BenchmarkState(uint64_t iterations, const std::vector<int64_t>& args)
+            : iterations(iterations), remaining(iterations), args(args), items(0), bytes(0), started(false) {}
+
+    // The timed loop: while (state.keepRunning()) { ... }
+    bool keepRunning() {
+        if (!started) {
+            started = true;
+            start = Clock::now();
+        }
+        if (remaining == 0) {
+            finish = Clock::now();
+            return false;
+        }
+        --remaining;
+        return true;
+    }
+
+    int64_t arg(size_t index) const { return args[index]; }
+    uint64_t iterationCount() const { return iterations; }
+    // Totals over the whole loop, reported per second.
+    void setItemsProcessed(uint64_t count) { items = count; }
+    void setBytesProcessed(uint64_t count) { bytes = count; }
+
+    double elapsedNs() const { return std::chrono::duration<double, std::nano>(finish - start).count(); }
+    uint64_t itemsProcessed() const { return items; }
+    uint64_t bytesProcessed() const { return bytes; }
+
+private:
+    uint64_t iterations;
+    uint64_t remaining;
+    std::vector<int64_t> args;
+    uint64_t items;
+    uint64_t bytes;
+    bool started;
+    Clock::time_point start;
+    Clock::time_point finish;
+};
+
+struct Benchmark {
+    std::string name;
+    std::vector<std::string> argNames;
+    std::vector<std::vector<int64_t>> argValues; // one list per argument
+    std::function<void(BenchmarkState&)> run;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double nsPerIteration;
+    double itemsPerSecond;
+    double bytesPerSecond;
+};
+
+static std::vector<std::vector<int64_t>> crossProduct(const std::vector<std::vector<int64_t>>& lists) {
+    std::vector<std::vector<int64_t>> combinations(1);
+    for (const auto& list : lists) {
+        std::vector<std::vector<int64_t>> extended;
+        for (const auto& prefix : combinations) {
+            for (int64_t value : list) {
+                extended.push_back(prefix);
+                extended.back().push_back(value);
+            }
+        }
+        combinations.swap(extended);
+    }
+    return combinations;
+}
+
+static std::string runName(const Benchmark& benchmark, const std::vector<int64_t>& args) {
+    std::string name = benchmark.name;
+    for (size_t i = 0; i < args.size(); ++i) {
+        name += "/" + benchmark.argNames[i] + ":" + std::to_string(args[i]);
+    }
+    return name;
+}
+
+// Grows the iteration count, by at most 10x per run, until a run is long
+// enough to trust.
+static Result runBenchmark(const Benchmark& benchmark, const std::vector<int64_t>& args, double minTimeNs) {
+    std::string name = runName(benchmark, args);
+    uint64_t iterations = 1;
+    while (true) {
+        BenchmarkState state(iterations, args);
+        benchmark.run(state);
+        double elapsed = state.elapsedNs();
+        if (elapsed >= minTimeNs || iterations >= 1000000000ULL) {
+            double seconds = elapsed / 1e9;
+            return Result{name, iterations, elapsed / iterations,
+                          seconds > 0 ? state.itemsProcessed() / seconds : 0,
+                          seconds > 0 ? state.bytesProcessed() / seconds : 0};
+        }
+        double scale = elapsed > 0 ? minTimeNs * 1.4 / elapsed : 10;
+        iterations = std::max<uint64_t>(iterations + 1, static_cast<uint64_t>(iterations * std::min(scale, 10.0)));
+    }
+}
+
+static Message sampleMessage(size_t payloadSize) {
+    Message message;
+    message.type = "publish";
+    message.topic = "bench.topic";
+    message.content.assign(payloadSize, 'x');
+    message.clientId = 42;
+    message.uuid = "123e4567-e89b-12d3-a456-426614174000";
+    return message;
+}
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static DedupKey keyFor(uint64_t i) {
+    return DedupKey{mix64(i + 1), mix64(~i)};
+}
+
+static std::vector<Benchmark> benchmarks() {
+    const std::vector<int64_t> payloadSizes = {16, 256, 4096, 65536};
+    std::vector<Benchmark> list;
+
+    // Encoding and decoding.
+    list.push_back({"text/serialize", {"payload"}, {payloadSizes}, [](BenchmarkState& state) {
+        Message message = sampleMessage(state.arg(0));
+        while (state.keepRunning()) {
+            std::string serialized = message.serialize();
+            doNotOptimize(serialized);
+        }
+        state.setBytesProcessed(state.iterationCount() * state.arg(0));
+    }});
+    list.push_back({"text/deserialize", {"payload"}, {payloadSizes}, [](BenchmarkState& state) {
+        std::string serialized = sampleMessage(state.arg(0)).serialize();
+        while (state.keepRunning()) {
+            Message message = Message::deserialize(serialized);
+            doNotOptimize(message);
+        }
+        state.setBytesProcessed(state.iterationCount() * state.arg(0));
+    }});
+    list.push_back({"binary/serialize", {"payload"}, {payloadSizes}, [](BenchmarkState& state) {
+        Message message = sampleMessage(state.arg(0));
+        uint64_t sequence = 0;
+        while (state.keepRunning()) {
+            std::string frame = message.serializeBinary(++sequence);
+            doNotOptimize(frame);
+        }
+        state.setBytesProcessed(state.iterationCount() * state.arg(0));
+    }});
+    list.push_back({"binary/decode", {"payload"}, {payloadSizes}, [](BenchmarkState& state) {
+        std::string frame = sampleMessage(state.arg(0)).serializeBinary(1);
+        while (state.keepRunning()) {
+            FrameView view;
+            size_t consumed = 0;
+            decodeFrame(frame.data(), frame.size(), view, consumed);
+            Message message = Message::fromFrame(view);
+            doNotOptimize(message);
+        }
+        state.setBytesProcessed(state.iterationCount() * state.arg(0));
+    }});
+    list.push_back({"shared_message/create", {"payload"}, {payloadSizes}, [](BenchmarkState& state) {
+        Message message = sampleMessage(state.arg(0));
+        while (state.keepRunning()) {
+            auto shared = SharedMessage::create(message.topic, message.content, message.uuid);
+            doNotOptimize(shared);
+        }
+        state.setBytesProcessed(state.iterationCount() * state.arg(0));
+    }});
+
+    // Routing: the subscriber snapshot a publish takes under its topic's
+    // shard lock, and matching a topic against wildcard patterns.
+    list.push_back({"routing/exact", {"topics", "subscribers"}, {{1, 1000, 10000}, {1, 16, 256}},
+                    [](BenchmarkState& state) {
+        size_t topicCount = state.arg(0);
+        size_t subscriberCount = state.arg(1);
+        std::vector<std::shared_ptr<Connection>> connections;
+        for (size_t i = 0; i < subscriberCount; ++i) {
+            connections.push_back(std::make_shared<Connection>(-1, -1, OutboundQueueConfig()));
+        }
+        TopicRegistry registry;
+        std::vector<std::string> names;
+        for (size_t i = 0; i < topicCount; ++i) {
+            names.push_back("bench.topic." + std::to_string(i));
+            registry.withTopic(names.back(), [&](TopicState& topic) { topic.subscribers = connections; });
+        }
+        std::vector<std::shared_ptr<Connection>> targets;
+        size_t next = 0;
+        while (state.keepRunning()) {
+            registry.withTopic(names[next], [&](TopicState& topic) { targets = topic.subscribers; });
+            doNotOptimize(targets.data());
+            next = next + 1 == topicCount ? 0 : next + 1;
+        }
+        state.setItemsProcessed(state.iterationCount() * subscriberCount);
+    }});
+    list.push_back({"routing/pattern", {"patterns", "subscribers"}, {{10, 1000, 10000}, {1, 16}},
+                    [](BenchmarkState& state) {
+        size_t patternCount = state.arg(0);
+        size_t subscriberCount = state.arg(1);
+        SubscriptionTrie trie;
+        std::vector<std::shared_ptr<Connection>> connections;
+        for (size_t i = 0; i < subscriberCount; ++i) {
+            connections.push_back(std::make_shared<Connection>(-1, -1, OutboundQueueConfig()));
+        }
+        std::vector<std::string> topics;
+        for (size_t i = 0; i < patternCount; ++i) {
+            for (const auto& connection : connections) {
+                trie.add("metrics." + std::to_string(i) + ".+", connection);
+            }
+            topics.push_back("metrics." + std::to_string(i) + ".cpu");
+        }
+        size_t next = 0;
+        while (state.keepRunning()) {
+            auto matched = trie.match(topics[next]);
+            doNotOptimize(matched.data());
+            next = next + 1 == patternCount ? 0 : next + 1;
+        }
+        state.setItemsProcessed(state.iterationCount());
+    }});
+
+    // Deduplication: the id of every publish is checked and recorded.
+    list.push_back({"dedup/key_from_text", {}, {}, [](BenchmarkState& state) {
+        std::string uuid = sampleMessage(0).uuid;
+        while (state.keepRunning()) {
+            DedupKey key = dedupKeyFromText(uuid);
+            doNotOptimize(key);
+        }
+        state.setItemsProcessed(state.iterationCount());
+    }});
+    list.push_back({"dedup/insert_new", {"window", "bloom"}, {{1 << 10, 1 << 16, 1 << 20}, {0, 1}},
+                    [](BenchmarkState& state) {
+        DedupConfig config;
+        config.windowMessages = state.arg(0);
+        config.windowMs = 0;
+        config.bloomFilter = state.arg(1) != 0;
+        DedupWindow window(config);
+        auto now = DedupWindow::Clock::now();
+        uint64_t i = 0;
+        while (state.keepRunning()) {
+            bool inserted = window.insert(keyFor(i++), now);
+            doNotOptimize(inserted);
+        }
+        state.setItemsProcessed(state.iterationCount());
+    }});
+    list.push_back({"dedup/insert_duplicate", {"window", "bloom"}, {{1 << 10, 1 << 16, 1 << 20}, {0, 1}},
+                    [](BenchmarkState& state) {
+        DedupConfig config;
+        config.windowMessages = state.arg(0);
+        config.windowMs = 0;
+        config.bloomFilter = state.arg(1) != 0;
+        DedupWindow window(config);
+        auto now = DedupWindow::Clock::now();
+        uint64_t held = config.windowMessages / 2;
+        for (uint64_t i = 0; i < held; ++i) {
+            window.insert(keyFor(i), now);
+        }
+        uint64_t i = 0;
+        while (state.keepRunning()) {
+            bool inserted = window.insert(keyFor(i), now);
+            doNotOptimize(inserted);
+            i = i + 1 == held ? 0 : i + 1;
+        }
+        state.setItemsProcessed(state.iterationCount());
+    }});
+
+    // Topic logs: a poller reading what was appended since its last read
+    // (GET_MESSAGES, FETCH), and appends with retention dropping segments.
+    list.push_back({"log/read_tail", {"log_messages", "batch"}, {{1000, 100000, 1000000}, {1, 100}},
+                    [](BenchmarkState& state) {
+        RetentionConfig retention;
+        retention.maxBytes = 0;
+        TopicLog log(retention);
+        auto message = SharedMessage::create("bench.topic", std::string(64, 'x'), sampleMessage(0).uuid);
+        for (int64_t i = 0; i < state.arg(0); ++i) {
+            log.append(message);
+        }
+        size_t batch = state.arg(1);
+        std::vector<SharedMessagePtr> out;
+        while (state.keepRunning()) {
+            out.clear();
+            uint64_t next = log.read(log.endOffset() - batch, batch, out);
+            doNotOptimize(next);
+        }
+        state.setItemsProcessed(state.iterationCount() * batch);
+    }});
+    list.push_back({"log/append", {"payload"}, {payloadSizes}, [](BenchmarkState& state) {
+        RetentionConfig retention;
+        retention.maxBytes = 16 * 1024 * 1024;
+        TopicLog log(retention);
+        auto message = SharedMessage::create("bench.topic", std::string(state.arg(0), 'x'), sampleMessage(0).uuid);
+        auto now = TopicLog::Clock::now();
+        while (state.keepRunning()) {
+            uint64_t offset = log.append(message, now);
+            doNotOptimize(offset);
+        }
+        state.setItemsProcessed(state.iterationCount()); // the log holds references; no bytes are copied
+    }});
+
+    return list;
+}
+
+static std::string humanRate(double perSecond, const char* unit) {
+    if (perSecond <= 0) {
+        return "";
+    }
+    const char* prefixes[] = {"", "k", "M", "G"};
+    int prefix = 0;
+    while (perSecond >= 1000 && prefix < 3) {
+        perSecond /= 1000;
+        ++prefix;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << perSecond << " " << prefixes[prefix] << unit << "/s";
+    return out.str();
+}
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    double minTimeMs = 200;
+    bool json = false;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        size_t number = std::strtoull(value.c_str(), nullptr, 10);
+        if (arg == "--filter") {
+            filter = value;
+        } else if (arg == "--min-time-ms" && number > 0) {
+            minTimeMs = static_cast<double>(number);
+        } else if (arg == "--format" && (value == "table" || value == "json")) {
+            json = value == "json";
+        } else {
+            std::cerr << "Invalid option: " << arg << " " << value << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    if (!json) {
+        std::cout << std::left << std::setw(52) << "Benchmark" << std::right << std::setw(14) << "ns/op"
+                  << std::setw(14) << "iterations" << std::setw(18) << "items" << std::setw(18) << "bytes"
+                  << std::endl;
+    }
+    for (const auto& benchmark : benchmarks()) {
+        for (const auto& args : crossProduct(benchmark.argValues)) {
+            if (!filter.empty() && runName(benchmark, args).find(filter) == std::string::npos) {
+                continue;
+            }
+            Result result = runBenchmark(benchmark, args, minTimeMs * 1e6);
+            if (json) {
+                results.push_back(result);
+                continue;
+            }
+            std::cout << std::left << std::setw(52) << result.name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(14) << result.nsPerIteration << std::setw(14) << result.iterations
+                      << std::setw(18) << humanRate(result.itemsPerSecond, "") << std::setw(18)
+                      << humanRate(result.bytesPerSecond, "B") << std::endl;
+        }
+    }
+    if (json) {
+        std::cout << "{\n  \"min_time_ms\": " << minTimeMs << ",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& result = results[i];
+            std::cout << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+                      << ", \"ns_per_op\": " << result.nsPerIteration << ", \"items_per_second\": "
+                      << result.itemsPerSecond << ", \"bytes_per_second\": " << result.bytesPerSecond << "}"
+                      << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        std::cout << "  ]\n}" << std::endl;
+    }
+    return 0;
+}
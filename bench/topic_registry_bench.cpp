@@ -0,0 +1,167 @@
+// Contention benchmark: the sharded TopicRegistry against the previous design,
+// a std::map topic table behind one global mutex.
+//
+// Every thread runs a publish-heavy mix (append to the topic log and snapshot
+// the subscriber list) with occasional subscribe/unsubscribe, each thread on
+// its own set of topics, and the aggregate throughput is reported per thread
+// count.
+//
+//   ./topic_registry_bench [--ops N] [--topics N] [--max-threads N]
+
+#include "../broker/topic_registry.h"
+#include "../broker/connection.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LOG_LIMIT 1024
+
+class GlobalLockRegistry {
+public:
+    void publish(const std::string& topic, const SharedMessagePtr& message,
+                 std::vector<std::shared_ptr<Connection>>& targets) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& log = messages[topic];
+        if (log.size() >= LOG_LIMIT) {
+            log.clear();
+        }
+        log.push_back(message);
+        targets = subscriptions[topic];
+    }
+
+    void subscribe(const std::string& topic, const std::shared_ptr<Connection>& connection) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& subs = subscriptions[topic];
+        if (std::find(subs.begin(), subs.end(), connection) == subs.end()) {
+            subs.push_back(connection);
+        }
+    }
+
+    void unsubscribe(const std::string& topic, const std::shared_ptr<Connection>& connection) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& subs = subscriptions[topic];
+        subs.erase(std::remove(subs.begin(), subs.end(), connection), subs.end());
+    }
+
+private:
+    std::mutex mtx;
+    std::map<std::string, std::vector<std::shared_ptr<Connection>>> subscriptions;
+    std::map<std::string, std::vector<SharedMessagePtr>> messages;
+};
+
+class ShardedRegistry {
+public:
+    void publish(const std::string& topic, const SharedMessagePtr& message,
+                 std::vector<std::shared_ptr<Connection>>& targets) {
+        registry.withTopic(topic, [&](TopicState& state) {
+            state.log.append(message);
+            targets = state.subscribers;
+        });
+    }
+
+    void subscribe(const std::string& topic, const std::shared_ptr<Connection>& connection) {
+        registry.withTopic(topic, [&](TopicState& state) {
+            auto& subs = state.subscribers;
+            if (std::find(subs.begin(), subs.end(), connection) == subs.end()) {
+                subs.push_back(connection);
+            }
+        });
+    }
+
+    void unsubscribe(const std::string& topic, const std::shared_ptr<Connection>& connection) {
+        registry.withTopic(topic, [&](TopicState& state) {
+            auto& subs = state.subscribers;
+            subs.erase(std::remove(subs.begin(), subs.end(), connection), subs.end());
+        });
+    }
+
+private:
+    static RetentionConfig benchRetention() {
+        RetentionConfig retention;
+        retention.maxMessages = LOG_LIMIT;
+        return retention;
+    }
+
+    TopicRegistry registry{64, benchRetention()};
+};
+
+template <typename Registry>
+double run(int threadCount, int opsPerThread, int topicsPerThread) {
+    Registry registry;
+    SharedMessagePtr message = SharedMessage::create("bench", std::string(128, 'x'),
+                                                     "00000000-0000-0000-0000-000000000000");
+
+    std::vector<std::vector<std::string>> topicNames(threadCount);
+    std::vector<std::shared_ptr<Connection>> subscribers;
+    for (int t = 0; t < threadCount; ++t) {
+        subscribers.push_back(std::make_shared<Connection>(-1, -1, OutboundQueueConfig()));
+        for (int i = 0; i < topicsPerThread; ++i) {
+            topicNames[t].push_back("topic." + std::to_string(t) + "." + std::to_string(i));
+            registry.subscribe(topicNames[t].back(), subscribers[t]);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            std::vector<std::shared_ptr<Connection>> targets;
+            const auto& names = topicNames[t];
+            for (int op = 0; op < opsPerThread; ++op) {
+                const std::string& topic = names[op % names.size()];
+                switch (op % 10) {
+                    case 8: registry.unsubscribe(topic, subscribers[t]); break;
+                    case 9: registry.subscribe(topic, subscribers[t]); break;
+                    default: registry.publish(topic, message, targets); break;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(threadCount) * opsPerThread / seconds;
+}
+
+int main(int argc, char* argv[]) {
+    int ops = 200000;
+    int topics = 16;
+    int maxThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        int value = std::atoi(argv[i + 1]);
+        if (value <= 0) {
+            std::cerr << "Invalid value for " << arg << std::endl;
+            return 1;
+        }
+        if (arg == "--ops") {
+            ops = value;
+        } else if (arg == "--topics") {
+            topics = value;
+        } else if (arg == "--max-threads") {
+            maxThreads = value;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << std::setw(8) << "threads" << std::setw(18) << "global ops/s"
+              << std::setw(18) << "sharded ops/s" << std::setw(10) << "speedup" << std::endl;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        double global = run<GlobalLockRegistry>(threads, ops, topics);
+        double sharded = run<ShardedRegistry>(threads, ops, topics);
+        std::cout << std::setw(8) << threads << std::fixed << std::setprecision(0)
+                  << std::setw(18) << global << std::setw(18) << sharded
+                  << std::setw(9) << std::setprecision(2) << sharded / global << "x" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,320 @@
+#include "cluster.h"
+#include <algorithm>
+#include <iostream>
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t fnv1a(std::string_view data) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static std::shared_ptr<const std::string> encodeRequest(Opcode opcode, std::string_view topic,
+                                                        std::string_view payload, uint8_t flags = 0,
+                                                        uint64_t sequence = 0) {
+    FrameHeader header;
+    header.opcode = opcode;
+    header.flags = flags;
+    header.sequence = sequence;
+    auto frame = std::make_shared<std::string>(frameSize(topic, payload), '\0');
+    encodeFrame(header, topic, payload, &(*frame)[0], frame->size());
+    return frame;
+}
+
+Cluster::Cluster(const ClusterConfig& config)
+        : members(config.members), selfIndex(config.nodeId < 0 ? 0 : static_cast<size_t>(config.nodeId)),
+          replicaCount(config.replicas), readyMembers(0), links(config.members.size()), nextSequence(1),
+          awaitingSync(0), followers(config.members.size()), nextSession(1) {
+    for (const auto& member : members) {
+        memberSeeds.push_back(mix64(fnv1a(member.host + ":" + std::to_string(member.port))));
+    }
+    // A replicating member first waits to hear from every other one; links
+    // that cannot be opened release it.
+    if (replicating()) {
+        awaitingSync = (members.size() == 64 ? ~uint64_t(0) : (uint64_t(1) << members.size()) - 1)
+                       & ~(uint64_t(1) << selfIndex);
+    }
+}
+
+// Highest random weight: the member whose seed mixes with the partition to the
+// largest value owns it. Adding or removing a member only moves the
+// partitions that member wins or held.
+size_t Cluster::ownerOf(std::string_view topic, uint16_t partition) const {
+    uint64_t key = fnv1a(topic) ^ (static_cast<uint64_t>(partition) * 0x9e3779b97f4a7c15ULL);
+    size_t owner = 0;
+    uint64_t best = 0;
+    for (size_t i = 0; i < memberSeeds.size(); ++i) {
+        uint64_t weight = mix64(key ^ memberSeeds[i]);
+        if (i == 0 || weight > best) {
+            owner = i;
+            best = weight;
+        }
+    }
+    return owner;
+}
+
+// The count members with the highest weights for the partition, best first.
+// Returns how many were written to out.
+size_t Cluster::rank(std::string_view topic, uint16_t partition, size_t* out, size_t count) const {
+    uint64_t key = fnv1a(topic) ^ (static_cast<uint64_t>(partition) * 0x9e3779b97f4a7c15ULL);
+    uint64_t weights[MAX_REPLICATED_MEMBERS];
+    uint64_t taken = 0;
+    size_t candidates = std::min(memberSeeds.size(), MAX_REPLICATED_MEMBERS);
+    for (size_t i = 0; i < candidates; ++i) {
+        weights[i] = mix64(key ^ memberSeeds[i]);
+    }
+    count = std::min(count, candidates);
+    for (size_t n = 0; n < count; ++n) {
+        size_t best = candidates;
+        for (size_t i = 0; i < candidates; ++i) {
+            if (!((taken >> i) & 1) && (best == candidates || weights[i] > weights[best])) {
+                best = i;
+            }
+        }
+        taken |= uint64_t(1) << best;
+        out[n] = best;
+    }
+    return count;
+}
+
+std::vector<size_t> Cluster::replicasOf(std::string_view topic, uint16_t partition) const {
+    std::vector<size_t> replicas(std::min(replicaCount + 1, size()));
+    replicas.resize(rank(topic, partition, replicas.data(), replicas.size()));
+    return replicas;
+}
+
+size_t Cluster::leaderOf(std::string_view topic, uint16_t partition) const {
+    if (!replicating()) {
+        return ownerOf(topic, partition);
+    }
+    size_t replicas[MAX_REPLICATED_MEMBERS];
+    size_t count = rank(topic, partition, replicas, replicaCount + 1);
+    uint64_t readyMask = readyMembers.load();
+    for (size_t i = 0; i < count; ++i) {
+        if ((readyMask >> replicas[i]) & 1) {
+            return replicas[i];
+        }
+    }
+    return replicas[0];
+}
+
+void Cluster::setReady(size_t member, bool isReady) {
+    uint64_t bit = uint64_t(1) << member;
+    if (isReady) {
+        readyMembers.fetch_or(bit);
+    } else {
+        readyMembers.fetch_and(~bit);
+    }
+}
+
+bool Cluster::synced(size_t member) {
+    std::lock_guard<std::mutex> lock(mtx);
+    awaitingSync &= ~(uint64_t(1) << member);
+    return awaitingSync == 0 && becomeReadyLocked();
+}
+
+bool Cluster::forceReady() {
+    std::lock_guard<std::mutex> lock(mtx);
+    awaitingSync = 0;
+    return becomeReadyLocked();
+}
+
+bool Cluster::becomeReadyLocked() {
+    if (!replicating() || ready(selfIndex)) {
+        return false;
+    }
+    setReady(selfIndex, true);
+    for (const auto& link : links) {
+        if (link.connection) {
+            link.connection->enqueue(encodeRequest(Opcode::Peer, "", std::to_string(selfIndex), WIRE_FLAG_READY));
+        }
+    }
+    return true;
+}
+
+void Cluster::attach(size_t member, const std::shared_ptr<Connection>& link) {
+    std::lock_guard<std::mutex> lock(mtx);
+    links[member].connection = link;
+    bool isReady = !replicating() || ready(selfIndex);
+    if (!isReady) {
+        awaitingSync |= uint64_t(1) << member;
+    }
+    link->enqueue(encodeRequest(Opcode::Peer, "", std::to_string(selfIndex), isReady ? WIRE_FLAG_READY : 0));
+    for (const auto& subscription : interest) {
+        sendSubscription(*link, Opcode::Subscribe, subscription.first);
+    }
+}
+
+size_t Cluster::detach(const Connection& link) {
+    std::unordered_map<uint64_t, Completion> failed;
+    size_t member = size();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t i = 0; i < links.size(); ++i) {
+            if (links[i].connection.get() == &link) {
+                links[i].connection.reset();
+                failed.swap(links[i].pending);
+                member = i;
+                break;
+            }
+        }
+    }
+    for (auto& entry : failed) {
+        entry.second(Opcode::Unavailable, false);
+    }
+    return member;
+}
+
+void Cluster::forward(size_t member, const std::vector<std::shared_ptr<SharedMessage>>& messages, bool quorum,
+                      Completion done) {
+    size_t size = WIRE_BATCH_COUNT_SIZE;
+    for (const auto& message : messages) {
+        size += batchEntrySize(message->topic(), message->framedPayload());
+    }
+    std::string payload(size, '\0');
+    encodeBatchCount(static_cast<uint32_t>(messages.size()), &payload[0]);
+    size_t offset = WIRE_BATCH_COUNT_SIZE;
+    for (const auto& message : messages) {
+        uint8_t uuid[WIRE_UUID_SIZE];
+        parseUuid(message->uuid(), uuid);
+        offset += encodeBatchEntry(message->topic(), message->framedPayload(), uuid, message->partition(),
+                                   &payload[offset], payload.size() - offset);
+    }
+    uint8_t flags = messages.front()->attributes().raw().empty() ? 0 : WIRE_FLAG_ATTRIBUTES;
+    if (quorum) {
+        flags |= WIRE_FLAG_QUORUM;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        Link& link = links[member];
+        if (link.connection) {
+            uint64_t sequence = nextSequence++;
+            auto frame = encodeRequest(Opcode::PublishBatch, "", payload, flags, sequence);
+            // Links close rather than drop frames, and closing fails the
+            // forward through detach(), so a queued forward always completes.
+            if (link.connection->enqueue(std::move(frame)) != EnqueueResult::Disconnected) {
+                link.pending.emplace(sequence, std::move(done));
+                return;
+            }
+        }
+    }
+    done(Opcode::Unavailable, false);
+}
+
+void Cluster::complete(const Connection& link, uint64_t sequence, Opcode response, bool backpressure) {
+    Completion done;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& entry : links) {
+            if (entry.connection.get() != &link) {
+                continue;
+            }
+            auto it = entry.pending.find(sequence);
+            if (it != entry.pending.end()) {
+                done = std::move(it->second);
+                entry.pending.erase(it);
+            }
+            break;
+        }
+    }
+    if (done) {
+        done(response, backpressure);
+    }
+}
+
+void Cluster::addInterest(const std::string& subscription) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (++interest[subscription] > 1) {
+        return;
+    }
+    for (const auto& link : links) {
+        if (link.connection) {
+            sendSubscription(*link.connection, Opcode::Subscribe, subscription);
+        }
+    }
+}
+
+void Cluster::removeInterest(const std::string& subscription) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = interest.find(subscription);
+    if (it == interest.end() || --it->second > 0) {
+        return;
+    }
+    interest.erase(it);
+    for (const auto& link : links) {
+        if (link.connection) {
+            sendSubscription(*link.connection, Opcode::Unsubscribe, subscription);
+        }
+    }
+}
+
+uint64_t Cluster::addFollower(size_t member, const std::shared_ptr<Connection>& connection) {
+    std::lock_guard<std::mutex> lock(mtx);
+    Follower& entry = followers[member];
+    entry.connection = connection;
+    entry.session = nextSession++;
+    entry.syncing = 1;
+    return entry.session;
+}
+
+size_t Cluster::removeFollower(const Connection& connection) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (size_t i = 0; i < followers.size(); ++i) {
+        if (followers[i].connection.get() == &connection) {
+            followers[i] = Follower();
+            setReady(i, false);
+            return i;
+        }
+    }
+    return size();
+}
+
+std::shared_ptr<Connection> Cluster::follower(size_t member, uint64_t& session) {
+    std::lock_guard<std::mutex> lock(mtx);
+    session = followers[member].session;
+    return followers[member].connection;
+}
+
+size_t Cluster::followerOf(const Connection& connection, uint64_t& session) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (size_t i = 0; i < followers.size(); ++i) {
+        if (followers[i].connection.get() == &connection) {
+            session = followers[i].session;
+            return i;
+        }
+    }
+    return size();
+}
+
+void Cluster::beginSync(size_t member, uint64_t session) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (followers[member].session == session) {
+        ++followers[member].syncing;
+    }
+}
+
+bool Cluster::endSync(size_t member, uint64_t session) {
+    std::lock_guard<std::mutex> lock(mtx);
+    Follower& entry = followers[member];
+    return entry.session == session && entry.syncing > 0 && --entry.syncing == 0;
+}
+
+// Sequence 0 is never a forward, so complete() ignores the response.
+void Cluster::sendSubscription(Connection& link, Opcode opcode, const std::string& subscription) {
+    if (link.enqueue(encodeRequest(opcode, subscription, "")) == EnqueueResult::Disconnected) {
+        std::cerr << "Cluster link " << link.fd << " closed before " << opcodeName(opcode) << " " << subscription
+                  << " was sent" << std::endl;
+    }
+}
@@ -0,0 +1,142 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "server_config.h"
+#include "connection.h"
+#include "shared_message.h"
+
+// Several brokers sharing one topic space. Each topic partition is owned by
+// one member, picked by rendezvous hashing over the member list, so members
+// agree on owners without talking to each other. The owner appends the
+// partition's messages to its log and serves them. Another member that
+// receives a publish for the partition forwards it over a link.
+//
+// A link is a binary connection a member opens to each other member (see PEER
+// in wire.h). Links carry forwarded publishes one way and, because the topics
+// and patterns local clients subscribe to are registered on every other
+// member, the messages those members own back the other way. Every message
+// crosses a link at most twice, and a subscribing member receives it once
+// however many of its clients want it.
+//
+// With replicas configured, a partition is kept by the replicas + 1 members
+// with the highest weights. The first of them that is ready leads it: it takes
+// the publishes and streams its log to the others, its followers (see
+// REPLICATE in wire.h), over the links they opened to it. A member is ready
+// once the members it could reach have synced it; it then says so in PEER, and
+// stops being ready for the others when its link to them closes. So when a
+// leader dies, the next replica that holds a copy takes over, and a restarted
+// member only leads again after catching up. Thread-safe.
+class Cluster {
+public:
+    // Runs once per forward with the owner's response (PUBLISHED or INVALID),
+    // or UNAVAILABLE if the link was down or closed before it answered.
+    using Completion = std::function<void(Opcode response, bool backpressure)>;
+
+    explicit Cluster(const ClusterConfig& config);
+
+    bool enabled() const { return members.size() > 1; }
+    size_t size() const { return members.size(); }
+    size_t self() const { return selfIndex; }
+    const ClusterMember& member(size_t index) const { return members[index]; }
+
+    bool replicating() const { return enabled() && replicaCount > 0; }
+
+    size_t ownerOf(std::string_view topic, uint16_t partition) const;
+    // The members keeping the partition, leader candidates first; ownerOf()
+    // comes first.
+    std::vector<size_t> replicasOf(std::string_view topic, uint16_t partition) const;
+    // The partition's first ready replica, or its first replica if none is.
+    // Without replication, its owner whether it is up or not.
+    size_t leaderOf(std::string_view topic, uint16_t partition) const;
+    bool owns(std::string_view topic, uint16_t partition) const {
+        return !enabled() || leaderOf(topic, partition) == selfIndex;
+    }
+    // How many in-sync followers a quorum publish needs at least: with the
+    // leader, a majority of the replicas.
+    static size_t quorumFollowers(size_t replicas) { return replicas / 2; }
+
+    bool ready(size_t member) const { return (readyMembers.load() >> member) & 1; }
+    void setReady(size_t member, bool isReady);
+    // Called when member has synced this one, or turned out to be unreachable.
+    // Returns true if that made this member ready, which it then announces
+    // on every link.
+    bool synced(size_t member);
+    // Stops waiting for the members that have not synced this one yet.
+    bool forceReady();
+
+    // Takes a freshly opened link to member, and queues the PEER greeting and
+    // every registered subscription on it.
+    void attach(size_t member, const std::shared_ptr<Connection>& link);
+    // Forgets a closed link and fails the forwards still waiting on it.
+    // Returns the link's member, or size() for a connection that is not one.
+    size_t detach(const Connection& link);
+
+    // Sends messages, which member leads, as one PUBLISH_BATCH. They come from
+    // one client request, so they either all have attributes or none do, and
+    // they all asked for a quorum or none did.
+    void forward(size_t member, const std::vector<std::shared_ptr<SharedMessage>>& messages, bool quorum,
+                 Completion done);
+    // A response that arrived on a link.
+    void complete(const Connection& link, uint64_t sequence, Opcode response, bool backpressure);
+
+    // Topics and patterns local clients subscribe to, counted, so the other
+    // members hear about the first subscription and the last unsubscription.
+    void addInterest(const std::string& subscription);
+    void removeInterest(const std::string& subscription);
+
+    // Replication, on the leader's side: the connection each follower linked
+    // in with. A session number names one registration, so progress kept for
+    // an earlier one is recognized as stale.
+    uint64_t addFollower(size_t member, const std::shared_ptr<Connection>& connection);
+    // Returns the follower's member, or size() for a connection that is not
+    // one. It is no longer ready.
+    size_t removeFollower(const Connection& connection);
+    std::shared_ptr<Connection> follower(size_t member, uint64_t& session);
+    size_t followerOf(const Connection& connection, uint64_t& session);
+    // A follower's initial sync: one unit per partition still being sent, and
+    // one for the walk over the partitions. endSync() returns true when the
+    // last one is done.
+    void beginSync(size_t member, uint64_t session);
+    bool endSync(size_t member, uint64_t session);
+
+private:
+    struct Link {
+        std::shared_ptr<Connection> connection; // null while down
+        std::unordered_map<uint64_t, Completion> pending;
+    };
+
+    struct Follower {
+        std::shared_ptr<Connection> connection; // null while not linked
+        uint64_t session = 0;
+        size_t syncing = 0;
+    };
+
+    size_t rank(std::string_view topic, uint16_t partition, size_t* out, size_t count) const;
+    bool becomeReadyLocked();
+    static void sendSubscription(Connection& link, Opcode opcode, const std::string& subscription);
+
+    std::vector<ClusterMember> members;
+    std::vector<uint64_t> memberSeeds;
+    size_t selfIndex;
+    size_t replicaCount;
+    std::atomic<uint64_t> readyMembers; // one bit per member
+
+    std::mutex mtx;
+    std::vector<Link> links; // by member; this member's own entry stays empty
+    uint64_t nextSequence;
+    std::unordered_map<std::string, size_t> interest;
+    uint64_t awaitingSync; // members this one waits for before it is ready
+    std::vector<Follower> followers;
+    uint64_t nextSession;
+};
+
+#endif // CLUSTER_H
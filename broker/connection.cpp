@@ -0,0 +1,278 @@
+#include "connection.h"
+#include "metrics.h"
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define MAX_IOVECS 256
+
+Connection::Connection(int fd, int epollFd, const OutboundQueueConfig& limits)
+        : fd(fd), binary(false), lastActivityMs(0), idleTimer(0), link(false), peer(false), epollFd(epollFd), limits(limits), ownerThread(std::this_thread::get_id()),
+          outboundBytes(0), headOffset(0), writeArmed(false), closed(false), closing(false), messageCredit(0),
+          byteCredit(0), byteLimited(false), creditGranted(false) {}
+
+bool Connection::hasSpace(size_t incomingBytes, size_t incomingFrames) const {
+    // Frames larger than the limits are still accepted into an empty queue.
+    if (outbound.empty()) {
+        return true;
+    }
+    return outbound.size() + incomingFrames <= limits.maxMessages && outboundBytes + incomingBytes <= limits.maxBytes;
+}
+
+void Connection::armWrite(bool enable) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    if (enable) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        std::cerr << "Epoll modify failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    writeArmed = enable;
+}
+
+bool Connection::waitForSpace(std::unique_lock<std::mutex>& lock, size_t incomingBytes, size_t incomingFrames) {
+    // The owning reactor is the one that drains this queue; waiting on it from
+    // its own thread would deadlock.
+    if (ownerThread == std::this_thread::get_id()) {
+        return false;
+    }
+    if (!writeArmed) {
+        armWrite(true);
+    }
+    spaceAvailable.wait_for(lock, std::chrono::milliseconds(limits.blockTimeoutMs),
+                            [&] { return closed || closing || hasSpace(incomingBytes, incomingFrames); });
+    return !closed && !closing && hasSpace(incomingBytes, incomingFrames);
+}
+
+// Applies the overflow policy until the incoming frames fit.
+EnqueueResult Connection::makeRoom(std::unique_lock<std::mutex>& lock, size_t incomingBytes, size_t incomingFrames,
+                                   FrameKind kind, bool mayBlock, bool& admit) {
+    admit = true;
+    if (closed || closing) {
+        return EnqueueResult::Disconnected;
+    }
+    if (hasSpace(incomingBytes, incomingFrames)) {
+        return EnqueueResult::Queued;
+    }
+    if (limits.policy == OverflowPolicy::Disconnect) {
+        closeLocked();
+        return EnqueueResult::Disconnected;
+    }
+    if (limits.policy == OverflowPolicy::Block) {
+        // The owning reactor never waits, so it goes on to evict as below.
+        if (!mayBlock && ownerThread != std::this_thread::get_id()) {
+            admit = false;
+            return EnqueueResult::WouldBlock;
+        }
+        if (waitForSpace(lock, incomingBytes, incomingFrames)) {
+            return EnqueueResult::Queued;
+        }
+    }
+    if (closed || closing) {
+        return EnqueueResult::Disconnected;
+    }
+
+    // Never drop a frame that is already partly on the wire, nor a response.
+    EnqueueResult result = EnqueueResult::Queued;
+    size_t i = headOffset > 0 ? 1 : 0;
+    while (!hasSpace(incomingBytes, incomingFrames) && i < outbound.size()) {
+        if (outbound[i].kind != FrameKind::Notification) {
+            ++i;
+            continue;
+        }
+        size_t size = outbound[i].bytes->size();
+        outboundBytes -= size;
+        outbound.erase(outbound.begin() + static_cast<std::ptrdiff_t>(i));
+        Metrics::add(Metrics::OutboundFramesDropped);
+        Metrics::add(Metrics::OutboundFramesRemoved);
+        Metrics::add(Metrics::OutboundBytesRemoved, size);
+        result = EnqueueResult::Dropped;
+    }
+    // Only responses are left in the way.
+    if (!hasSpace(incomingBytes, incomingFrames) && kind == FrameKind::Notification) {
+        admit = false;
+        Metrics::add(Metrics::OutboundFramesDropped);
+        return EnqueueResult::Dropped;
+    }
+    return result;
+}
+
+EnqueueResult Connection::enqueue(OutboundFrame frame, bool callerFlushes, FrameKind kind, bool mayBlock) {
+    std::unique_lock<std::mutex> lock(outMutex);
+    bool admit;
+    EnqueueResult result = makeRoom(lock, frame->size(), 1, kind, mayBlock, admit);
+    if (result == EnqueueResult::Disconnected || !admit) {
+        return result;
+    }
+
+    outboundBytes += frame->size();
+    Metrics::add(Metrics::OutboundFramesQueued);
+    Metrics::add(Metrics::OutboundBytesQueued, frame->size());
+    outbound.push_back(QueuedFrame{std::move(frame), kind});
+    if (!writeArmed && !callerFlushes) {
+        armWrite(true);
+    }
+    return result;
+}
+
+EnqueueResult Connection::enqueueAll(std::vector<OutboundFrame> frames, bool callerFlushes) {
+    size_t bytes = 0;
+    for (const auto& frame : frames) {
+        bytes += frame->size();
+    }
+
+    std::unique_lock<std::mutex> lock(outMutex);
+    bool admit;
+    EnqueueResult result = makeRoom(lock, bytes, frames.size(), FrameKind::Response, true, admit);
+    if (result == EnqueueResult::Disconnected) {
+        return result;
+    }
+
+    outboundBytes += bytes;
+    Metrics::add(Metrics::OutboundFramesQueued, frames.size());
+    Metrics::add(Metrics::OutboundBytesQueued, bytes);
+    for (auto& frame : frames) {
+        outbound.push_back(QueuedFrame{std::move(frame), FrameKind::Response});
+    }
+    if (!writeArmed && !callerFlushes && !outbound.empty()) {
+        armWrite(true);
+    }
+    return result;
+}
+
+bool Connection::flush() {
+    std::lock_guard<std::mutex> lock(outMutex);
+    if (closed) {
+        return false;
+    }
+
+    while (!outbound.empty()) {
+        struct iovec iov[MAX_IOVECS];
+        size_t count = 0;
+        for (auto it = outbound.begin(); it != outbound.end() && count < MAX_IOVECS; ++it, ++count) {
+            size_t skip = count == 0 ? headOffset : 0;
+            iov[count].iov_base = const_cast<char*>(it->bytes->data()) + skip;
+            iov[count].iov_len = it->bytes->size() - skip;
+        }
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        ssize_t written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!writeArmed) {
+                    armWrite(true);
+                }
+                return true;
+            }
+            std::cerr << "Send failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        Metrics::add(Metrics::BytesOut, static_cast<uint64_t>(written));
+        size_t remaining = static_cast<size_t>(written);
+        size_t sentFrames = 0;
+        size_t sentBytes = 0;
+        while (remaining > 0) {
+            size_t left = outbound.front().bytes->size() - headOffset;
+            if (remaining < left) {
+                headOffset += remaining;
+                break;
+            }
+            remaining -= left;
+            sentBytes += outbound.front().bytes->size();
+            ++sentFrames;
+            outbound.pop_front();
+            headOffset = 0;
+        }
+        outboundBytes -= sentBytes;
+        Metrics::add(Metrics::OutboundFramesRemoved, sentFrames);
+        Metrics::add(Metrics::OutboundBytesRemoved, sentBytes);
+        spaceAvailable.notify_all();
+    }
+
+    if (writeArmed) {
+        armWrite(false);
+    }
+    return true;
+}
+
+void Connection::closeLocked() {
+    if (closed || closing) {
+        return;
+    }
+    // The reactor sees the shutdown as a hangup and closes the connection on its thread.
+    closing = true;
+    shutdown(fd, SHUT_RDWR);
+    spaceAvailable.notify_all();
+}
+
+void Connection::requestClose() {
+    std::lock_guard<std::mutex> lock(outMutex);
+    closeLocked();
+}
+
+void Connection::markClosed() {
+    std::lock_guard<std::mutex> lock(outMutex);
+    closed = true;
+    Metrics::add(Metrics::OutboundFramesRemoved, outbound.size());
+    Metrics::add(Metrics::OutboundBytesRemoved, outboundBytes);
+    outbound.clear();
+    outboundBytes = 0;
+    headOffset = 0;
+    spaceAvailable.notify_all();
+}
+
+size_t Connection::queuedMessages() {
+    std::lock_guard<std::mutex> lock(outMutex);
+    return outbound.size();
+}
+
+void Connection::grantCredit(uint32_t messages, uint32_t bytes) {
+    std::lock_guard<std::mutex> lock(creditMutex);
+    messageCredit += messages;
+    byteCredit += bytes;
+    byteLimited = byteLimited || bytes > 0;
+    creditGranted.store(true, std::memory_order_release);
+}
+
+bool Connection::takeCredit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(creditMutex);
+    if (messageCredit <= 0 || (byteLimited && byteCredit <= 0)) {
+        return false;
+    }
+    --messageCredit;
+    if (byteLimited) {
+        byteCredit -= static_cast<int64_t>(bytes);
+    }
+    return true;
+}
+
+void Connection::markStarved(const std::string& topic, uint16_t partition) {
+    std::lock_guard<std::mutex> lock(creditMutex);
+    auto key = std::make_pair(topic, partition);
+    if (std::find(starved.begin(), starved.end(), key) == starved.end()) {
+        starved.push_back(std::move(key));
+    }
+}
+
+std::vector<std::pair<std::string, uint16_t>> Connection::takeStarved() {
+    std::vector<std::pair<std::string, uint16_t>> out;
+    std::lock_guard<std::mutex> lock(creditMutex);
+    out.swap(starved);
+    return out;
+}
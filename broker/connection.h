@@ -0,0 +1,132 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "server_config.h"
+#include "../common/frame_reader.h"
+
+// Encoded bytes queued for a client. Notifications share one immutable buffer
+// across every subscriber they are fanned out to.
+using OutboundFrame = std::shared_ptr<const std::string>;
+
+// Only notifications pushed to subscribers may be discarded by the overflow
+// policy. Responses are what a client waits on (PUBLISHED, FETCHED and the
+// messages that follow it, ASSIGNED, ...) and are always queued, after
+// evicting notifications to make room for them, even past the limits: a burst
+// of pipelined requests is answered before the queue is flushed, and only a
+// client that does not read its own responses makes its queue grow.
+enum class FrameKind {
+    Response,
+    Notification,
+};
+
+enum class EnqueueResult {
+    Queued,
+    Dropped,      // queue full, the oldest queued notification (or this one) was discarded
+    Disconnected, // queue full under the Disconnect policy, or the connection is gone
+    WouldBlock,   // queue full under the Block policy and the caller may not wait; nothing was queued
+};
+
+// Per-client state. The read side is only touched by the reactor that accepted
+// the socket. The outbound queue may be fed from any thread: publishers append
+// frames and arm EPOLLOUT, and the owning reactor drains the queue with one
+// gathering sendmsg per burst whenever the socket is writable, so a slow
+// subscriber never blocks a publisher.
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(int fd, int epollFd, const OutboundQueueConfig& limits);
+
+    // callerFlushes: the caller is the owning reactor and calls flush() right
+    // after, so there is no need to arm EPOLLOUT. mayBlock: false returns
+    // WouldBlock instead of waiting for room under the Block policy.
+    EnqueueResult enqueue(OutboundFrame frame, bool callerFlushes = false, FrameKind kind = FrameKind::Response,
+                          bool mayBlock = true);
+    // Queues response frames back to back, with nothing from other threads in between.
+    EnqueueResult enqueueAll(std::vector<OutboundFrame> frames, bool callerFlushes = false);
+    // Writes as much of the queue as the socket accepts. Returns false if the
+    // connection failed and should be closed.
+    bool flush();
+    // Asks the owning reactor to close the connection (safe from any thread).
+    void requestClose();
+    // Called by the owning reactor just before it closes the descriptor.
+    void markClosed();
+
+    bool closeRequested() const { return closing; }
+    size_t queuedMessages();
+
+    // Flow control (see CREDIT in wire.h). Credit is taken by whichever thread
+    // publishes to a topic the connection reads, so it has its own lock.
+    void grantCredit(uint32_t messages, uint32_t bytes);
+    bool flowControlled() const { return creditGranted.load(std::memory_order_acquire); }
+    // Takes one message of the given size; false if the credit is used up. A
+    // message may overdraw the byte credit, so one larger than the whole
+    // window still goes out.
+    bool takeCredit(size_t bytes);
+    // Remembers a topic partition that ran out of credit with messages left,
+    // so the next grant resumes it. takeStarved() returns and forgets them.
+    void markStarved(const std::string& topic, uint16_t partition);
+    std::vector<std::pair<std::string, uint16_t>> takeStarved();
+
+    const int fd;
+    FrameReader reader;
+    std::atomic<bool> binary; // negotiated binary frames for pushed messages
+    std::unordered_set<std::string> topics; // topics holding state for this client (reactor thread only)
+    // Topics and patterns subscribed to, with the canonical form of each
+    // subscription's filter ("" for none), followed by '@' and the consumer
+    // name for an acknowledged subscription. Reactor thread only.
+    std::unordered_map<std::string, std::string> subscriptions;
+    // Idle eviction: when the client last sent anything, in steady clock
+    // milliseconds, and the timer that checks on it.
+    std::atomic<int64_t> lastActivityMs;
+    std::atomic<uint64_t> idleTimer;
+    // Cluster links (see cluster.h): link marks a connection this broker
+    // opened to another member, set before it is shared with other threads;
+    // peer marks one another member opened to this broker.
+    bool link;
+    std::atomic<bool> peer;
+
+private:
+    struct QueuedFrame {
+        OutboundFrame bytes;
+        FrameKind kind;
+    };
+
+    void armWrite(bool enable);
+    void closeLocked();
+    // Sets admit to false when the incoming notification itself is dropped.
+    EnqueueResult makeRoom(std::unique_lock<std::mutex>& lock, size_t incomingBytes, size_t incomingFrames,
+                           FrameKind kind, bool mayBlock, bool& admit);
+    bool waitForSpace(std::unique_lock<std::mutex>& lock, size_t incomingBytes, size_t incomingFrames);
+    bool hasSpace(size_t incomingBytes, size_t incomingFrames) const;
+
+    const int epollFd;
+    const OutboundQueueConfig limits;
+    const std::thread::id ownerThread;
+
+    std::mutex outMutex;
+    std::condition_variable spaceAvailable;
+    std::deque<QueuedFrame> outbound;
+    size_t outboundBytes;
+    size_t headOffset; // bytes of outbound.front() already written
+    bool writeArmed;
+    bool closed;
+    std::atomic<bool> closing;
+
+    std::mutex creditMutex;
+    int64_t messageCredit;
+    int64_t byteCredit;
+    bool byteLimited; // set by the first grant with byte credit
+    std::atomic<bool> creditGranted;
+    std::vector<std::pair<std::string, uint16_t>> starved;
+};
+
+#endif // CONNECTION_H
@@ -0,0 +1,40 @@
+#include "consumer_cursors.h"
+
+bool ConsumerCursors::get(const std::string& consumer, uint64_t& offset) const {
+    auto it = offsets.find(consumer);
+    if (it == offsets.end()) {
+        return false;
+    }
+    offset = it->second;
+    return true;
+}
+
+void ConsumerCursors::set(const std::string& consumer, uint64_t offset) {
+    auto it = offsets.insert_or_assign(consumer, offset).first;
+    heap.emplace(offset, &it->first);
+    // Frequent commits by the same consumers would otherwise grow the heap
+    // without bound between minOffset() calls.
+    if (heap.size() > 2 * offsets.size() + 64) {
+        rebuildHeap();
+    }
+}
+
+uint64_t ConsumerCursors::minOffset() {
+    while (!heap.empty()) {
+        const HeapEntry& top = heap.top();
+        if (offsets.at(*top.second) == top.first) {
+            return top.first;
+        }
+        heap.pop();
+    }
+    return UINT64_MAX;
+}
+
+void ConsumerCursors::rebuildHeap() {
+    std::vector<HeapEntry> entries;
+    entries.reserve(offsets.size());
+    for (const auto& entry : offsets) {
+        entries.emplace_back(entry.second, &entry.first);
+    }
+    heap = decltype(heap)(std::greater<HeapEntry>(), std::move(entries));
+}
@@ -0,0 +1,40 @@
+#ifndef CONSUMER_CURSORS_H
+#define CONSUMER_CURSORS_H
+
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Committed positions of the named consumers of one topic. A consumer's
+// offset is the next message it will fetch; it lives here, not on a
+// connection, so it survives reconnects.
+//
+// The smallest offset is tracked in a min-heap with lazy deletion: a commit
+// pushes a new entry, and stale entries are discarded when they reach the top.
+// Finding the slowest consumer is O(1) amortized rather than a scan of every
+// consumer. Not thread-safe; the topic's shard lock serializes access.
+class ConsumerCursors {
+public:
+    bool get(const std::string& consumer, uint64_t& offset) const;
+    void set(const std::string& consumer, uint64_t offset);
+
+    // Smallest committed offset, or UINT64_MAX without consumers.
+    uint64_t minOffset();
+
+    bool empty() const { return offsets.empty(); }
+    const std::unordered_map<std::string, uint64_t>& all() const { return offsets; }
+
+private:
+    // Points at the key in offsets; consumers are never removed, so it stays valid.
+    using HeapEntry = std::pair<uint64_t, const std::string*>;
+
+    void rebuildHeap();
+
+    std::unordered_map<std::string, uint64_t> offsets;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+};
+
+#endif // CONSUMER_CURSORS_H
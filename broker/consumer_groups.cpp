@@ -0,0 +1,92 @@
+#include "consumer_groups.h"
+#include <algorithm>
+
+bool ConsumerGroups::join(const std::string& topic, const std::string& group,
+                          const std::shared_ptr<Connection>& member, uint16_t partitions, Rebalance& rebalance) {
+    auto key = std::make_pair(topic, group);
+    Group& state = groups[key];
+    if (std::find(state.members.begin(), state.members.end(), member) != state.members.end()) {
+        return false;
+    }
+    if (state.members.empty()) {
+        state.partitions = partitions;
+        state.owners.assign(partitions, nullptr);
+    }
+    state.members.push_back(member);
+    memberships[member.get()].push_back(std::move(key));
+    assign(state, member.get(), rebalance);
+    return true;
+}
+
+bool ConsumerGroups::leave(const std::string& topic, const std::string& group, const Connection& member,
+                           Rebalance& rebalance) {
+    auto key = std::make_pair(topic, group);
+    auto it = groups.find(key);
+    if (it == groups.end()) {
+        return false;
+    }
+    Group& state = it->second;
+    auto position = std::find_if(state.members.begin(), state.members.end(),
+                                 [&](const std::shared_ptr<Connection>& m) { return m.get() == &member; });
+    if (position == state.members.end()) {
+        return false;
+    }
+    state.members.erase(position);
+
+    auto& joined = memberships[&member];
+    joined.erase(std::remove(joined.begin(), joined.end(), key), joined.end());
+    if (joined.empty()) {
+        memberships.erase(&member);
+    }
+
+    assign(state, nullptr, rebalance);
+    if (state.members.empty()) {
+        groups.erase(it);
+    }
+    return true;
+}
+
+std::vector<std::pair<std::string, std::string>> ConsumerGroups::groupsOf(const Connection& member) const {
+    auto it = memberships.find(&member);
+    return it == memberships.end() ? std::vector<std::pair<std::string, std::string>>() : it->second;
+}
+
+void ConsumerGroups::assign(Group& group, const Connection* joined, Rebalance& rebalance) {
+    size_t partitions = group.partitions;
+    size_t members = group.members.size();
+
+    std::vector<const Connection*> owners(partitions, nullptr);
+    for (size_t i = 0; i < members; ++i) {
+        for (size_t p = i * partitions / members; p < (i + 1) * partitions / members; ++p) {
+            owners[p] = group.members[i].get();
+        }
+    }
+
+    for (size_t p = 0; p < partitions; ++p) {
+        if (owners[p] == group.owners[p]) {
+            continue;
+        }
+        std::shared_ptr<Connection> owner;
+        for (size_t i = 0; i < members && owners[p]; ++i) {
+            if (group.members[i].get() == owners[p]) {
+                owner = group.members[i];
+            }
+        }
+        rebalance.owners.push_back(OwnerChange{static_cast<uint16_t>(p), std::move(owner)});
+    }
+
+    for (const auto& member : group.members) {
+        std::vector<uint16_t> current;
+        bool changed = member.get() == joined;
+        for (size_t p = 0; p < partitions; ++p) {
+            if (owners[p] == member.get()) {
+                current.push_back(static_cast<uint16_t>(p));
+            }
+            changed = changed || ((owners[p] == member.get()) != (group.owners[p] == member.get()));
+        }
+        if (changed) {
+            rebalance.assignments.emplace_back(member, std::move(current));
+        }
+    }
+    group.owners = std::move(owners);
+}
@@ -0,0 +1,59 @@
+#ifndef CONSUMER_GROUPS_H
+#define CONSUMER_GROUPS_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Connection;
+
+// Membership of every consumer group. A group reads one topic; each of the
+// topic's partitions is owned by exactly one member, which receives all of
+// that partition's messages, so members share the topic's load instead of
+// each receiving every message.
+//
+// Partitions are range-assigned in join order: with P partitions and M
+// members, member i owns partitions [i*P/M, (i+1)*P/M). Every join and leave
+// recomputes the assignment; members beyond the partition count own nothing
+// until someone leaves. Not thread-safe; the server serializes access.
+class ConsumerGroups {
+public:
+    struct OwnerChange {
+        uint16_t partition;
+        std::shared_ptr<Connection> owner; // null: the partition has no owner now
+    };
+
+    // What a join or leave changed: the partitions that moved, and the
+    // members whose set of partitions is different (plus the joining member).
+    struct Rebalance {
+        std::vector<OwnerChange> owners;
+        std::vector<std::pair<std::shared_ptr<Connection>, std::vector<uint16_t>>> assignments;
+    };
+
+    // Both return false, and change nothing, if the member already is (or is
+    // not) in the group.
+    bool join(const std::string& topic, const std::string& group, const std::shared_ptr<Connection>& member,
+              uint16_t partitions, Rebalance& rebalance);
+    bool leave(const std::string& topic, const std::string& group, const Connection& member,
+               Rebalance& rebalance);
+
+    // The (topic, group) pairs a connection is a member of.
+    std::vector<std::pair<std::string, std::string>> groupsOf(const Connection& member) const;
+
+private:
+    struct Group {
+        uint16_t partitions = 0;
+        std::vector<std::shared_ptr<Connection>> members; // in join order
+        std::vector<const Connection*> owners;            // per partition
+    };
+
+    static void assign(Group& group, const Connection* joined, Rebalance& rebalance);
+
+    std::map<std::pair<std::string, std::string>, Group> groups;
+    std::map<const Connection*, std::vector<std::pair<std::string, std::string>>> memberships;
+};
+
+#endif // CONSUMER_GROUPS_H
@@ -0,0 +1,23 @@
+#include "log_level.h"
+
+std::atomic<int> currentLogLevel(static_cast<int>(LogLevel::Info));
+
+bool parseLogLevel(std::string_view name, LogLevel& level) {
+    for (LogLevel candidate : {LogLevel::Error, LogLevel::Warn, LogLevel::Info, LogLevel::Debug}) {
+        if (name == logLevelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* logLevelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Error: return "error";
+        case LogLevel::Warn: return "warn";
+        case LogLevel::Info: return "info";
+        case LogLevel::Debug: return "debug";
+    }
+    return "info";
+}
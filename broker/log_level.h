@@ -0,0 +1,36 @@
+#ifndef LOG_LEVEL_H
+#define LOG_LEVEL_H
+
+#include <atomic>
+#include <string_view>
+
+// How much the broker prints. Errors always go to stderr. Warnings are
+// per-message trouble such as dropped notifications, info is lifecycle
+// (startup, cluster links, idle evictions), and debug adds a line for every
+// request and connection. The level can change while the broker runs.
+enum class LogLevel {
+    Error = 0,
+    Warn = 1,
+    Info = 2,
+    Debug = 3,
+};
+
+extern std::atomic<int> currentLogLevel;
+
+inline bool logEnabled(LogLevel level) {
+    return static_cast<int>(level) <= currentLogLevel.load(std::memory_order_relaxed);
+}
+
+inline void setLogLevel(LogLevel level) {
+    currentLogLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+inline LogLevel logLevel() {
+    return static_cast<LogLevel>(currentLogLevel.load(std::memory_order_relaxed));
+}
+
+// "error", "warn", "info" or "debug".
+bool parseLogLevel(std::string_view name, LogLevel& level);
+const char* logLevelName(LogLevel level);
+
+#endif // LOG_LEVEL_H
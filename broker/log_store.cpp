@@ -0,0 +1,636 @@
+#include "log_store.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TOPIC_DIR_PREFIX "topic-"
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Topic names may hold any byte; directory names keep [A-Za-z0-9._-] and
+// percent-escape the rest. Partitions other than 0 add "@<partition>", which
+// cannot come from an escaped name.
+static std::string escapeTopic(const std::string& topic, uint16_t partition) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string escaped = TOPIC_DIR_PREFIX;
+    for (unsigned char c : topic) {
+        if (std::isalnum(c) || c == '.' || c == '_' || c == '-') {
+            escaped += static_cast<char>(c);
+        } else {
+            escaped += '%';
+            escaped += hex[c >> 4];
+            escaped += hex[c & 0xF];
+        }
+    }
+    if (partition > 0) {
+        escaped += '@' + std::to_string(partition);
+    }
+    return escaped;
+}
+
+static bool unescapeTopic(const std::string& name, std::string& topic, uint16_t& partition) {
+    size_t prefix = std::strlen(TOPIC_DIR_PREFIX);
+    if (name.compare(0, prefix, TOPIC_DIR_PREFIX) != 0) {
+        return false;
+    }
+    size_t end = name.find('@', prefix);
+    partition = 0;
+    if (end != std::string::npos) {
+        char* last = nullptr;
+        unsigned long value = std::strtoul(name.c_str() + end + 1, &last, 10);
+        if (last == name.c_str() + end + 1 || *last != '\0' || value == 0 || value >= UINT16_MAX) {
+            return false;
+        }
+        partition = static_cast<uint16_t>(value);
+    } else {
+        end = name.size();
+    }
+    topic.clear();
+    for (size_t i = prefix; i < end; ++i) {
+        if (name[i] != '%') {
+            topic += name[i];
+            continue;
+        }
+        if (i + 2 >= end || !std::isxdigit(static_cast<unsigned char>(name[i + 1]))
+                || !std::isxdigit(static_cast<unsigned char>(name[i + 2]))) {
+            return false;
+        }
+        topic += static_cast<char>(std::stoi(name.substr(i + 1, 2), nullptr, 16));
+        i += 2;
+    }
+    return true;
+}
+
+static std::string segmentPath(const std::string& directory, uint64_t baseOffset, const char* extension) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020" PRIu64 "%s", baseOffset, extension);
+    return directory + "/" + name;
+}
+
+static void syncDirectory(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+// msync needs a page-aligned start address.
+static void syncRange(char* base, size_t from, size_t to) {
+    if (to <= from) {
+        return;
+    }
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t alignedFrom = from & ~(pageSize - 1);
+    if (msync(base + alignedFrom, to - alignedFrom, MS_SYNC) != 0) {
+        std::cerr << "msync failed: " << strerror(errno) << std::endl;
+    }
+}
+
+static char* mapFile(int fd, size_t size, bool writable) {
+    void* map = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? nullptr : static_cast<char*>(map);
+}
+
+SegmentFile::~SegmentFile() {
+    if (logMap) {
+        munmap(logMap, logCapacity);
+    }
+    if (index) {
+        munmap(index, indexCapacity * sizeof(IndexRecord));
+    }
+    if (writable) {
+        // Give back the preallocated tail. Recovery needs no trailing zero
+        // record: it also stops at the end of the file.
+        if (logFd >= 0 && ftruncate(logFd, static_cast<off_t>(logSize)) != 0) {
+            std::cerr << "Failed to truncate " << logPath << ": " << strerror(errno) << std::endl;
+        }
+        if (indexFd >= 0 && ftruncate(indexFd, static_cast<off_t>(indexCount * sizeof(IndexRecord))) != 0) {
+            std::cerr << "Failed to truncate " << indexPath << ": " << strerror(errno) << std::endl;
+        }
+    }
+    if (logFd >= 0) {
+        ::close(logFd);
+    }
+    if (indexFd >= 0) {
+        ::close(indexFd);
+    }
+}
+
+TopicStore::TopicStore(LogStore& owner, std::string topic, uint16_t partition, std::string directory)
+        : owner(owner), topicName(std::move(topic)), partitionNumber(partition), directory(std::move(directory)), cursorsChanged(false),
+          queuedForSync(false), nextOffset(0), totalBytes(0) {}
+
+bool TopicStore::recover() {
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return false;
+    }
+    std::vector<uint64_t> bases;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() == 24 && name.compare(20, 4, ".idx") == 0) {
+            bases.push_back(std::strtoull(name.c_str(), nullptr, 10));
+        }
+    }
+    closedir(dir);
+    std::sort(bases.begin(), bases.end());
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!loadCursors()) {
+        return false;
+    }
+    for (uint64_t base : bases) {
+        std::shared_ptr<SegmentFile> segment = openSegment(base);
+        if (!segment) {
+            return false;
+        }
+        if (segment->indexCount == 0) {
+            continue;
+        }
+        if (!segments.empty() && base != nextOffset) {
+            std::cerr << "Gap in the log of topic " << topicName << " before offset " << base
+                      << ", dropping older segments" << std::endl;
+            segments.clear();
+            totalBytes = 0;
+        }
+        segments.push_back(segment);
+        totalBytes += segment->logSize;
+        nextOffset = base + segment->indexCount;
+    }
+    return true;
+}
+
+std::shared_ptr<SegmentFile> TopicStore::openSegment(uint64_t baseOffset) {
+    auto segment = std::make_shared<SegmentFile>();
+    segment->baseOffset = baseOffset;
+    segment->sealed = true;
+    segment->logPath = segmentPath(directory, baseOffset, ".log");
+    segment->indexPath = segmentPath(directory, baseOffset, ".idx");
+    segment->logFd = ::open(segment->logPath.c_str(), O_RDONLY | O_CLOEXEC);
+    segment->indexFd = ::open(segment->indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat logStat, indexStat;
+    if (segment->logFd < 0 || segment->indexFd < 0
+            || fstat(segment->logFd, &logStat) != 0 || fstat(segment->indexFd, &indexStat) != 0) {
+        std::cerr << "Failed to open segment " << segment->indexPath << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    segment->logCapacity = static_cast<size_t>(logStat.st_size);
+    segment->indexCapacity = static_cast<size_t>(indexStat.st_size) / sizeof(IndexRecord);
+    if (segment->logCapacity > 0) {
+        segment->logMap = mapFile(segment->logFd, segment->logCapacity, false);
+    }
+    if (segment->indexCapacity > 0) {
+        segment->index = reinterpret_cast<IndexRecord*>(
+            mapFile(segment->indexFd, segment->indexCapacity * sizeof(IndexRecord), false));
+    }
+    if ((segment->logCapacity > 0 && !segment->logMap) || (segment->indexCapacity > 0 && !segment->index)) {
+        std::cerr << "Failed to map segment " << segment->indexPath << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    // Only the index is scanned. A record counts if it is the next offset and
+    // its frame lies inside the log file with a matching header; after a crash
+    // the index may have reached disk ahead of the log data it points to.
+    for (size_t i = 0; i < segment->indexCapacity; ++i) {
+        const IndexRecord& record = segment->index[i];
+        if (record.length == 0 || record.offset != baseOffset + i
+                || record.position + record.length > segment->logCapacity) {
+            break;
+        }
+        FrameHeader header;
+        if (decodeHeader(segment->logMap + record.position, record.length, header) != DecodeResult::Ok
+                || frameSize(header) != record.length
+                || std::memcmp(header.uuid, record.uuid, WIRE_UUID_SIZE) != 0) {
+            break;
+        }
+        segment->indexCount = i + 1;
+        segment->logSize = record.position + record.length;
+        segment->newestMs = record.timestampMs;
+    }
+    return segment;
+}
+
+std::shared_ptr<SegmentFile> TopicStore::createSegment(uint64_t baseOffset, size_t minLogBytes) {
+    const PersistenceConfig& config = owner.persistenceConfig();
+    auto segment = std::make_shared<SegmentFile>();
+    segment->baseOffset = baseOffset;
+    segment->writable = true;
+    segment->logPath = segmentPath(directory, baseOffset, ".log");
+    segment->indexPath = segmentPath(directory, baseOffset, ".idx");
+    segment->logCapacity = std::max(config.segmentFileBytes, minLogBytes);
+    segment->indexCapacity = std::max<size_t>(config.segmentIndexEntries, 1);
+
+    segment->logFd = ::open(segment->logPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    segment->indexFd = ::open(segment->indexPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segment->logFd < 0 || segment->indexFd < 0
+            || ftruncate(segment->logFd, static_cast<off_t>(segment->logCapacity)) != 0
+            || ftruncate(segment->indexFd, static_cast<off_t>(segment->indexCapacity * sizeof(IndexRecord))) != 0) {
+        std::cerr << "Failed to create segment " << segment->logPath << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    segment->logMap = mapFile(segment->logFd, segment->logCapacity, true);
+    segment->index = reinterpret_cast<IndexRecord*>(
+        mapFile(segment->indexFd, segment->indexCapacity * sizeof(IndexRecord), true));
+    if (!segment->logMap || !segment->index) {
+        std::cerr << "Failed to map segment " << segment->logPath << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    syncDirectory(directory);
+    return segment;
+}
+
+bool TopicStore::append(uint64_t offset, const SharedMessage& message) {
+    std::shared_ptr<const std::string> frame = message.binaryFrame();
+    bool becameDirty;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (segments.empty()) {
+            nextOffset = offset;
+        } else if (offset != nextOffset) {
+            std::cerr << "Out-of-order append to topic " << topicName << ": offset " << offset
+                      << ", expected " << nextOffset << std::endl;
+            return false;
+        }
+
+        SegmentFile* active = segments.empty() ? nullptr : segments.back().get();
+        if (!active || active->sealed || active->logSize + frame->size() > active->logCapacity
+                || active->indexCount == active->indexCapacity) {
+            int64_t now = nowMs();
+            sealActive();
+            enforceRetention(now);
+            std::shared_ptr<SegmentFile> segment = createSegment(offset, frame->size());
+            if (!segment) {
+                return false;
+            }
+            segments.push_back(segment);
+            active = segment.get();
+        }
+
+        std::memcpy(active->logMap + active->logSize, frame->data(), frame->size());
+        IndexRecord& record = active->index[active->indexCount];
+        record.offset = offset;
+        record.position = active->logSize;
+        record.reserved = 0;
+        record.timestampMs = nowMs();
+        std::memcpy(record.uuid, frame->data() + WIRE_HEADER_SIZE - WIRE_UUID_SIZE, WIRE_UUID_SIZE);
+        // The length goes last: a nonzero length is what makes the record valid.
+        record.length = static_cast<uint32_t>(frame->size());
+
+        active->logSize += frame->size();
+        active->indexCount++;
+        active->newestMs = record.timestampMs;
+        totalBytes += frame->size();
+        nextOffset = offset + 1;
+
+        becameDirty = markDirtyLocked();
+        if (!active->queuedForSync) {
+            active->queuedForSync = true;
+            unsynced.push_back(segments.back());
+        }
+    }
+
+    if (becameDirty) {
+        owner.markDirty(shared_from_this());
+    }
+    owner.noteAppend();
+    return true;
+}
+
+// Returns true if the store was clean, i.e. the caller must tell the owner.
+bool TopicStore::markDirtyLocked() {
+    if (queuedForSync) {
+        return false;
+    }
+    queuedForSync = true;
+    return true;
+}
+
+void TopicStore::saveCursor(const std::string& consumer, uint64_t offset) {
+    bool becameDirty;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        cursors[consumer] = offset;
+        cursorsChanged = true;
+        becameDirty = markDirtyLocked();
+    }
+    if (becameDirty) {
+        owner.markDirty(shared_from_this());
+    }
+}
+
+std::unordered_map<std::string, uint64_t> TopicStore::savedCursors() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return cursors;
+}
+
+// File format: repeated (name length u32, name, offset u64), host byte order.
+bool TopicStore::loadCursors() {
+    std::string path = directory + "/cursors";
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return errno == ENOENT;
+    }
+    uint32_t length;
+    while (std::fread(&length, sizeof(length), 1, file) == 1) {
+        std::string name(length, '\0');
+        uint64_t offset;
+        if ((length > 0 && std::fread(&name[0], 1, length, file) != length)
+                || std::fread(&offset, sizeof(offset), 1, file) != 1) {
+            std::cerr << "Truncated cursor file " << path << std::endl;
+            break;
+        }
+        cursors[name] = offset;
+    }
+    std::fclose(file);
+    return true;
+}
+
+void TopicStore::writeCursors(const std::unordered_map<std::string, uint64_t>& snapshot) {
+    std::string path = directory + "/cursors";
+    std::string temporary = path + ".tmp";
+    std::string data;
+    for (const auto& entry : snapshot) {
+        uint32_t length = static_cast<uint32_t>(entry.first.size());
+        data.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        data.append(entry.first);
+        data.append(reinterpret_cast<const char*>(&entry.second), sizeof(entry.second));
+    }
+
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to write " << temporary << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    bool ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()) && fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to save cursors of topic " << topicName << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    syncDirectory(directory);
+}
+
+void TopicStore::sealActive() {
+    // Sealed segments stay mapped for reads; their files are truncated to the
+    // used size when the segment is released.
+    if (!segments.empty()) {
+        segments.back()->sealed = true;
+    }
+}
+
+void TopicStore::enforceRetention(int64_t now) {
+    const RetentionConfig& limits = owner.retentionConfig();
+    while (!segments.empty()) {
+        const SegmentFile& oldest = *segments.front();
+        uint64_t count = nextOffset - oldest.baseOffset;
+        bool expired = limits.maxAgeMs > 0 && now - oldest.newestMs > static_cast<int64_t>(limits.maxAgeMs);
+        bool oversized = (limits.maxBytes > 0 && totalBytes > limits.maxBytes)
+                         || (limits.maxMessages > 0 && count > limits.maxMessages);
+        // Like the in-memory log, the active segment is only dropped for age.
+        if (!expired && (!oversized || !oldest.sealed)) {
+            break;
+        }
+        totalBytes -= oldest.logSize;
+        unlink(oldest.logPath.c_str());
+        unlink(oldest.indexPath.c_str());
+        segments.pop_front();
+    }
+}
+
+void TopicStore::sweepRetention() {
+    std::lock_guard<std::mutex> lock(mtx);
+    enforceRetention(nowMs());
+}
+
+uint64_t TopicStore::read(uint64_t offset, size_t maxMessages, std::vector<SharedMessagePtr>& out) {
+    std::lock_guard<std::mutex> lock(mtx);
+    offset = std::max(offset, startOffsetLocked());
+    if (offset >= nextOffset || maxMessages == 0) {
+        return std::min(offset, nextOffset);
+    }
+
+    auto it = std::upper_bound(segments.begin(), segments.end(), offset,
+                               [](uint64_t value, const std::shared_ptr<SegmentFile>& segment) {
+                                   return value < segment->baseOffset;
+                               });
+    --it;
+
+    size_t copied = 0;
+    for (; it != segments.end() && copied < maxMessages; ++it) {
+        const SegmentFile& segment = **it;
+        for (size_t i = offset - segment.baseOffset; i < segment.indexCount && copied < maxMessages; ++i) {
+            const IndexRecord& record = segment.index[i];
+            FrameView frame;
+            size_t consumed;
+            if (decodeFrame(segment.logMap + record.position, record.length, frame, consumed) != DecodeResult::Ok) {
+                std::cerr << "Corrupt frame at offset " << record.offset << " of topic " << topicName << std::endl;
+                return offset;
+            }
+            AttributesView attributes;
+            std::string_view body = frame.payload;
+            if ((frame.header.flags & WIRE_FLAG_ATTRIBUTES) && !AttributesView::split(frame.payload, attributes, body)) {
+                std::cerr << "Corrupt attributes at offset " << record.offset << " of topic " << topicName << std::endl;
+                return offset;
+            }
+            char uuidText[WIRE_UUID_TEXT_SIZE];
+            formatUuid(frame.header.uuid, uuidText);
+            auto message = SharedMessage::create(frame.topic, body, std::string_view(uuidText, WIRE_UUID_TEXT_SIZE),
+                                                 frame.header.partition, attributes.raw());
+            if (message) {
+                message->setOffset(record.offset);
+                out.push_back(std::move(message));
+            }
+            ++copied;
+            ++offset;
+        }
+    }
+    return offset;
+}
+
+uint64_t TopicStore::startOffsetLocked() const {
+    return segments.empty() ? nextOffset : segments.front()->baseOffset;
+}
+
+uint64_t TopicStore::startOffset() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return startOffsetLocked();
+}
+
+uint64_t TopicStore::endOffset() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return nextOffset;
+}
+
+size_t TopicStore::messageCount() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return static_cast<size_t>(nextOffset - startOffsetLocked());
+}
+
+void TopicStore::forEachUuid(const std::function<void(const uint8_t*)>& fn) {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto& segment : segments) {
+        for (size_t i = 0; i < segment->indexCount; ++i) {
+            fn(segment->index[i].uuid);
+        }
+    }
+}
+
+void TopicStore::sync() {
+    struct Pending {
+        std::shared_ptr<SegmentFile> segment;
+        size_t logEnd;
+        size_t indexEnd;
+    };
+    std::vector<Pending> work;
+    std::unordered_map<std::string, uint64_t> cursorSnapshot;
+    bool writeCursorFile;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& segment : unsynced) {
+            work.push_back(Pending{segment, segment->logSize, segment->indexCount});
+            segment->queuedForSync = false;
+        }
+        unsynced.clear();
+        writeCursorFile = cursorsChanged;
+        if (cursorsChanged) {
+            cursorSnapshot = cursors;
+            cursorsChanged = false;
+        }
+        queuedForSync = false;
+    }
+
+    // msync runs without the lock, so appends to this topic continue meanwhile.
+    for (auto& item : work) {
+        SegmentFile& segment = *item.segment;
+        syncRange(segment.logMap, segment.syncedLog, item.logEnd);
+        syncRange(reinterpret_cast<char*>(segment.index), segment.syncedIndex * sizeof(IndexRecord),
+                  item.indexEnd * sizeof(IndexRecord));
+        segment.syncedLog = item.logEnd;
+        segment.syncedIndex = item.indexEnd;
+    }
+    // Cursors are written after the messages they point past are on disk.
+    if (writeCursorFile) {
+        writeCursors(cursorSnapshot);
+    }
+}
+
+LogStore::LogStore(const PersistenceConfig& persistence, const RetentionConfig& retention)
+        : persistence(persistence), retention(retention), unsyncedMessages(0), stopping(false) {}
+
+LogStore::~LogStore() {
+    {
+        std::lock_guard<std::mutex> lock(flushMutex);
+        stopping = true;
+    }
+    flushWakeup.notify_all();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    syncAll();
+}
+
+bool LogStore::open(std::vector<std::shared_ptr<TopicStore>>& recovered) {
+    if (mkdir(persistence.dataDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create data directory " << persistence.dataDir << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    DIR* dir = opendir(persistence.dataDir.c_str());
+    if (!dir) {
+        std::cerr << "Failed to open data directory " << persistence.dataDir << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(dir)) {
+        names.push_back(entry->d_name);
+    }
+    closedir(dir);
+
+    for (const std::string& name : names) {
+        std::string topic;
+        uint16_t partition;
+        if (!unescapeTopic(name, topic, partition)) {
+            continue;
+        }
+        auto store = std::make_shared<TopicStore>(*this, topic, partition, persistence.dataDir + "/" + name);
+        if (!store->recover()) {
+            std::cerr << "Failed to recover topic " << topic << " partition " << partition << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(storesMutex);
+        stores[name] = store;
+        recovered.push_back(store);
+    }
+
+    flusher = std::thread(&LogStore::flushLoop, this);
+    return true;
+}
+
+std::shared_ptr<TopicStore> LogStore::openTopic(const std::string& topic, uint16_t partition) {
+    std::string name = escapeTopic(topic, partition);
+    std::lock_guard<std::mutex> lock(storesMutex);
+    auto it = stores.find(name);
+    if (it != stores.end()) {
+        return it->second;
+    }
+
+    std::string directory = persistence.dataDir + "/" + name;
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create " << directory << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    syncDirectory(persistence.dataDir);
+    auto store = std::make_shared<TopicStore>(*this, topic, partition, directory);
+    stores[name] = store;
+    return store;
+}
+
+void LogStore::markDirty(std::shared_ptr<TopicStore> store) {
+    std::lock_guard<std::mutex> lock(flushMutex);
+    dirty.push_back(std::move(store));
+}
+
+void LogStore::noteAppend() {
+    if (unsyncedMessages.fetch_add(1, std::memory_order_relaxed) + 1 == persistence.fsyncMessages) {
+        flushWakeup.notify_one();
+    }
+}
+
+void LogStore::syncAll() {
+    std::vector<std::shared_ptr<TopicStore>> batch;
+    {
+        std::lock_guard<std::mutex> lock(flushMutex);
+        batch.swap(dirty);
+    }
+    unsyncedMessages.store(0, std::memory_order_relaxed);
+    for (auto& store : batch) {
+        store->sync();
+    }
+}
+
+void LogStore::flushLoop() {
+    std::unique_lock<std::mutex> lock(flushMutex);
+    while (!stopping) {
+        flushWakeup.wait_for(lock, std::chrono::milliseconds(persistence.fsyncIntervalMs), [this] {
+            return stopping || unsyncedMessages.load(std::memory_order_relaxed) >= persistence.fsyncMessages;
+        });
+        lock.unlock();
+        syncAll();
+        lock.lock();
+    }
+}
@@ -0,0 +1,175 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "server_config.h"
+#include "shared_message.h"
+#include "../common/wire.h"
+
+// On-disk layout, one directory per topic:
+//
+//   <dataDir>/topic-<escaped name>/<base offset, 20 digits>.log
+//   <dataDir>/topic-<escaped name>/<base offset, 20 digits>.idx
+//
+// Partitions other than 0 live in topic-<escaped name>@<partition>.
+//
+// A .log file holds the topic's binary MESSAGE frames back to back. The .idx
+// file holds one fixed-size IndexRecord per frame. Both are preallocated and
+// written through a shared mapping. A record of all zeros marks the end of the
+// written data, so recovery only scans indexes and never replays payloads.
+// Records are in host byte order; data directories are not portable.
+//
+// Named consumer cursors are kept in <topic dir>/cursors, rewritten as a whole
+// (write to a temporary file, then rename) by the flusher when they change.
+struct IndexRecord {
+    uint64_t offset;
+    uint64_t position; // of the frame in the .log file
+    uint32_t length;   // frame size; 0 marks the end of the index
+    uint32_t reserved;
+    int64_t timestampMs;
+    uint8_t uuid[WIRE_UUID_SIZE];
+};
+static_assert(sizeof(IndexRecord) == 48, "IndexRecord is a fixed on-disk format");
+
+class LogStore;
+
+// A pair of mapped segment files. When the last reference goes away they are
+// unmapped and, if this process wrote them, truncated to their used size.
+struct SegmentFile {
+    uint64_t baseOffset = 0;
+    std::string logPath;
+    std::string indexPath;
+    int logFd = -1;
+    int indexFd = -1;
+    char* logMap = nullptr;
+    size_t logCapacity = 0;
+    size_t logSize = 0;
+    IndexRecord* index = nullptr;
+    size_t indexCapacity = 0;
+    size_t indexCount = 0;
+    int64_t newestMs = 0;
+    bool writable = false; // created by this process, so mapped read-write
+    bool sealed = false;   // no further appends
+    bool queuedForSync = false;
+    size_t syncedLog = 0;   // flusher progress
+    size_t syncedIndex = 0;
+
+    ~SegmentFile();
+};
+
+// The durable log of one topic. Appends come from the topic's publish path
+// (already serialized by its shard lock); the flusher thread syncs
+// concurrently, so the segment list has its own lock.
+class TopicStore : public std::enable_shared_from_this<TopicStore> {
+public:
+    TopicStore(LogStore& owner, std::string topic, uint16_t partition, std::string directory);
+
+    const std::string& topic() const { return topicName; }
+    uint16_t partition() const { return partitionNumber; }
+
+    // Maps the segments already on disk. Returns false on I/O errors.
+    bool recover();
+
+    // Appends the message's binary frame at offset, which must follow the
+    // previous append (the first append of an empty store may start anywhere).
+    bool append(uint64_t offset, const SharedMessage& message);
+
+    // Like TopicLog::read, materializing messages from the mapped frames.
+    uint64_t read(uint64_t offset, size_t maxMessages, std::vector<SharedMessagePtr>& out);
+
+    uint64_t startOffset();
+    uint64_t endOffset();
+    size_t messageCount();
+
+    // Visits the UUID of every stored message, oldest first.
+    void forEachUuid(const std::function<void(const uint8_t*)>& fn);
+
+    // Records a consumer's committed offset; written out on the next sync.
+    void saveCursor(const std::string& consumer, uint64_t offset);
+    // The cursors found by recover().
+    std::unordered_map<std::string, uint64_t> savedCursors();
+
+    // Flushes everything appended so far to disk.
+    void sync();
+
+    // Drops segments past the retention limits. Appends check them whenever a
+    // segment rolls over, which a topic that stopped receiving messages never
+    // does; the broker's retention sweep calls this for those.
+    void sweepRetention();
+
+private:
+    std::shared_ptr<SegmentFile> createSegment(uint64_t baseOffset, size_t minLogBytes);
+    std::shared_ptr<SegmentFile> openSegment(uint64_t baseOffset);
+    void sealActive();
+    void enforceRetention(int64_t nowMs);
+    uint64_t startOffsetLocked() const;
+    bool markDirtyLocked();
+    bool loadCursors();
+    void writeCursors(const std::unordered_map<std::string, uint64_t>& snapshot);
+
+    LogStore& owner;
+    std::string topicName;
+    uint16_t partitionNumber;
+    std::string directory;
+
+    std::mutex mtx;
+    std::deque<std::shared_ptr<SegmentFile>> segments;
+    std::vector<std::shared_ptr<SegmentFile>> unsynced;
+    std::unordered_map<std::string, uint64_t> cursors;
+    bool cursorsChanged;
+    bool queuedForSync; // on the owner's dirty list
+    uint64_t nextOffset;
+    size_t totalBytes;
+};
+
+// Owns every topic's durable log and the background flusher.
+class LogStore {
+public:
+    LogStore(const PersistenceConfig& persistence, const RetentionConfig& retention);
+    ~LogStore();
+
+    // Creates the data directory if needed and maps every topic found in it.
+    bool open(std::vector<std::shared_ptr<TopicStore>>& recovered);
+
+    // Returns the store of one topic partition, creating its directory on first use.
+    std::shared_ptr<TopicStore> openTopic(const std::string& topic, uint16_t partition = 0);
+
+    // Syncs every dirty topic now.
+    void syncAll();
+
+    const PersistenceConfig& persistenceConfig() const { return persistence; }
+    const RetentionConfig& retentionConfig() const { return retention; }
+
+private:
+    friend class TopicStore;
+
+    // Called by a topic when it first becomes dirty, and after every append.
+    void markDirty(std::shared_ptr<TopicStore> store);
+    void noteAppend();
+    void flushLoop();
+
+    PersistenceConfig persistence;
+    RetentionConfig retention;
+
+    std::mutex storesMutex;
+    std::unordered_map<std::string, std::shared_ptr<TopicStore>> stores; // by directory name
+
+    std::mutex flushMutex;
+    std::condition_variable flushWakeup;
+    std::vector<std::shared_ptr<TopicStore>> dirty;
+    std::atomic<size_t> unsyncedMessages;
+    bool stopping;
+    std::thread flusher;
+};
+
+#endif // LOG_STORE_H
@@ -1,7 +1,37 @@
 #include "server.h"
+#include <csignal>
+
+static Server* activeServer = nullptr;
+
+static void handleSignal(int) {
+    if (activeServer) {
+        activeServer->stop();
+    }
+}
+
+// SIGUSR1 switches debug logging on, and off again back to --log-level.
+static void toggleDebug(int) {
+    if (!activeServer) {
+        return;
+    }
+    LogLevel configured = activeServer->getConfig().logLevel;
+    setLogLevel(logLevel() == LogLevel::Debug ? configured : LogLevel::Debug);
+}
+
+int main(int argc, char* argv[]) {
+    ServerConfig config;
+    if (!config.parseArgs(argc, argv)) {
+        return 1;
+    }
+
+    Server server(config);
+    activeServer = &server;
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+    std::signal(SIGUSR1, toggleDebug);
+    std::signal(SIGPIPE, SIG_IGN);
 
-int main() {
-    Server server;
     server.start();
+    activeServer = nullptr;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,119 @@
+#include "message_filter.h"
+#include <algorithm>
+#include <charconv>
+
+static bool parseNumber(std::string_view text, double& out) {
+    if (text.empty()) {
+        return false;
+    }
+    auto result = std::from_chars(text.data(), text.data() + text.size(), out);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+std::shared_ptr<const MessageFilter> MessageFilter::parse(std::string_view expression) {
+    static const struct {
+        const char* token;
+        Op op;
+    } operators[] = {
+        // Two-character operators first, so "<=" is not read as "<".
+        {"!=", Op::NotEqual}, {"^=", Op::Prefix}, {"<=", Op::LessEqual}, {">=", Op::GreaterEqual},
+        {"=", Op::Equal}, {"<", Op::Less}, {">", Op::Greater},
+    };
+
+    auto filter = std::make_shared<MessageFilter>();
+    std::vector<std::string> canonicalClauses;
+    size_t start = 0;
+    while (start <= expression.size()) {
+        size_t end = expression.find('&', start);
+        if (end == std::string_view::npos) {
+            end = expression.size();
+        }
+        std::string_view text = expression.substr(start, end - start);
+        start = end + 1;
+
+        size_t position = text.find_first_of("!^<>=");
+        if (position == 0 || position == std::string_view::npos) {
+            return nullptr;
+        }
+        Clause clause;
+        clause.field = std::string(text.substr(0, position));
+        bool matched = false;
+        for (const auto& candidate : operators) {
+            std::string_view token(candidate.token);
+            if (text.compare(position, token.size(), token) == 0) {
+                clause.op = candidate.op;
+                clause.value = std::string(text.substr(position + token.size()));
+                matched = true;
+                break;
+            }
+        }
+        if (!matched) {
+            return nullptr;
+        }
+        bool numeric = clause.op != Op::Equal && clause.op != Op::NotEqual && clause.op != Op::Prefix;
+        if (numeric && !parseNumber(clause.value, clause.number)) {
+            return nullptr;
+        }
+        canonicalClauses.push_back(std::string(text));
+        filter->clauses.push_back(std::move(clause));
+    }
+
+    std::sort(canonicalClauses.begin(), canonicalClauses.end());
+    canonicalClauses.erase(std::unique(canonicalClauses.begin(), canonicalClauses.end()), canonicalClauses.end());
+    for (const std::string& clause : canonicalClauses) {
+        filter->canonicalForm += (filter->canonicalForm.empty() ? "" : "&") + clause;
+    }
+    return filter;
+}
+
+bool MessageFilter::matches(const SharedMessage& message) const {
+    std::string scratch;
+    for (const Clause& clause : clauses) {
+        std::string_view value;
+        if (!lookup(message, clause.field, scratch, value) || !test(clause, value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MessageFilter::lookup(const SharedMessage& message, const std::string& field, std::string& scratch,
+                           std::string_view& value) {
+    if (field == "payload") {
+        value = message.payload();
+    } else if (field == "topic") {
+        value = message.topic();
+    } else if (field == "partition") {
+        scratch = std::to_string(message.partition());
+        value = scratch;
+    } else if (field == "priority") {
+        scratch = std::to_string(message.attributes().priority());
+        value = scratch;
+    } else if (field == "timestamp") {
+        scratch = std::to_string(message.attributes().timestampMs());
+        value = scratch;
+    } else {
+        return message.attributes().get(field, value);
+    }
+    return true;
+}
+
+bool MessageFilter::test(const Clause& clause, std::string_view value) {
+    switch (clause.op) {
+        case Op::Equal: return value == clause.value;
+        case Op::NotEqual: return value != clause.value;
+        case Op::Prefix: return value.compare(0, clause.value.size(), clause.value) == 0;
+        default: break;
+    }
+    double number;
+    if (!parseNumber(value, number)) {
+        return false;
+    }
+    switch (clause.op) {
+        case Op::Less: return number < clause.number;
+        case Op::LessEqual: return number <= clause.number;
+        case Op::Greater: return number > clause.number;
+        case Op::GreaterEqual: return number >= clause.number;
+        default: return false;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef MESSAGE_FILTER_H
+#define MESSAGE_FILTER_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "shared_message.h"
+
+class Connection;
+
+// A subscription filter: clauses joined by '&', all of which must hold.
+//
+//   field=value    equal           field!=value   not equal
+//   field^=prefix  starts with     field<N  field<=N  field>N  field>=N
+//
+// Numeric comparisons parse the field as a number and fail if it is not one;
+// "price>=10&price<20" is a range. Fields are "payload", "topic", "partition",
+// "priority" and "timestamp" (0 when the message has no attributes); any other
+// name is an attribute, and a clause on an attribute the message does not have
+// fails.
+class MessageFilter {
+public:
+    // Returns null if the expression is malformed.
+    static std::shared_ptr<const MessageFilter> parse(std::string_view expression);
+
+    bool matches(const SharedMessage& message) const;
+
+    // Clauses in a fixed order, so equivalent expressions compare equal.
+    const std::string& canonical() const { return canonicalForm; }
+
+private:
+    enum class Op { Equal, NotEqual, Prefix, Less, LessEqual, Greater, GreaterEqual };
+
+    struct Clause {
+        std::string field;
+        Op op;
+        std::string value;
+        double number = 0; // value, for numeric comparisons
+    };
+
+    static bool lookup(const SharedMessage& message, const std::string& field, std::string& scratch,
+                       std::string_view& value);
+    static bool test(const Clause& clause, std::string_view value);
+
+    std::vector<Clause> clauses;
+    std::string canonicalForm;
+};
+
+using MessageFilterPtr = std::shared_ptr<const MessageFilter>;
+
+// The subscribers of a topic partition that share one filter. Grouping them
+// means each distinct filter is evaluated once per message, however many
+// subscribers use it.
+struct FilteredSubscribers {
+    MessageFilterPtr filter;
+    std::vector<std::shared_ptr<Connection>> subscribers;
+};
+
+#endif // MESSAGE_FILTER_H
@@ -0,0 +1,299 @@
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+const uint64_t Metrics::BUCKET_BOUNDS_NS[LATENCY_BUCKETS] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 500000000,
+    1000000000,
+};
+
+struct alignas(64) ThreadMetrics {
+    std::atomic<uint64_t> counters[Metrics::COUNTER_COUNT] = {};
+    std::atomic<uint64_t> buckets[Metrics::LATENCY_COUNT][Metrics::LATENCY_BUCKETS + 1] = {};
+    std::atomic<uint64_t> latencySumNs[Metrics::LATENCY_COUNT] = {};
+    std::atomic<uint64_t> latencyMaxNs[Metrics::LATENCY_COUNT] = {};
+};
+
+struct ThreadRegistry {
+    std::mutex mtx;
+    std::vector<std::unique_ptr<ThreadMetrics>> threads;
+};
+
+static ThreadRegistry& registry() {
+    static ThreadRegistry instance;
+    return instance;
+}
+
+static ThreadMetrics& local() {
+    thread_local ThreadMetrics* mine = [] {
+        ThreadRegistry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mtx);
+        all.threads.push_back(std::make_unique<ThreadMetrics>());
+        return all.threads.back().get();
+    }();
+    return *mine;
+}
+
+// Only the owning thread writes, so no read-modify-write is needed.
+static inline void bump(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void Metrics::add(Counter counter, uint64_t amount) {
+    bump(local().counters[counter], amount);
+}
+
+void Metrics::observe(Latency latency, std::chrono::nanoseconds elapsed) {
+    uint64_t ns = elapsed.count() > 0 ? static_cast<uint64_t>(elapsed.count()) : 0;
+    ThreadMetrics& mine = local();
+    size_t bucket = std::lower_bound(BUCKET_BOUNDS_NS, BUCKET_BOUNDS_NS + LATENCY_BUCKETS, ns) - BUCKET_BOUNDS_NS;
+    bump(mine.buckets[latency][bucket], 1);
+    bump(mine.latencySumNs[latency], ns);
+    if (ns > mine.latencyMaxNs[latency].load(std::memory_order_relaxed)) {
+        mine.latencyMaxNs[latency].store(ns, std::memory_order_relaxed);
+    }
+}
+
+Metrics::Snapshot Metrics::snapshot() {
+    Snapshot snapshot;
+    ThreadRegistry& all = registry();
+    std::lock_guard<std::mutex> lock(all.mtx);
+    for (const auto& thread : all.threads) {
+        for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+            snapshot.counters[i] += thread->counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t latency = 0; latency < LATENCY_COUNT; ++latency) {
+            for (size_t bucket = 0; bucket <= LATENCY_BUCKETS; ++bucket) {
+                snapshot.buckets[latency][bucket] += thread->buckets[latency][bucket].load(std::memory_order_relaxed);
+            }
+            snapshot.latencySumNs[latency] += thread->latencySumNs[latency].load(std::memory_order_relaxed);
+            snapshot.latencyMaxNs[latency] = std::max(snapshot.latencyMaxNs[latency],
+                                                      thread->latencyMaxNs[latency].load(std::memory_order_relaxed));
+        }
+    }
+    return snapshot;
+}
+
+const char* Metrics::latencyName(Latency latency) {
+    switch (latency) {
+        case PublishLatency: return "publish";
+        case FetchLatency: return "fetch";
+        case OtherLatency: return "other";
+        case LATENCY_COUNT: break;
+    }
+    return "other";
+}
+
+struct CounterInfo {
+    Metrics::Counter counter;
+    const char* name; // JSON key; the Prometheus name is pubsub_<name>_total
+    const char* help;
+};
+
+static const CounterInfo COUNTERS[] = {
+    {Metrics::Requests, "requests", "Client requests handled."},
+    {Metrics::MessagesPublished, "messages_published", "Messages appended to partitions this broker leads."},
+    {Metrics::MessagesReplicated, "messages_replicated", "Messages appended as a follower."},
+    {Metrics::MessagesDelivered, "messages_delivered", "Notifications queued for subscribers."},
+    {Metrics::DedupHits, "dedup_hits", "Publishes dropped as duplicates."},
+    {Metrics::BytesIn, "received_bytes", "Bytes read from sockets."},
+    {Metrics::BytesOut, "sent_bytes", "Bytes written to sockets."},
+    {Metrics::ConnectionsOpened, "connections_opened", "Connections accepted or opened."},
+    {Metrics::OutboundFramesDropped, "outbound_dropped", "Outbound frames discarded by the overflow policy."},
+};
+
+// Gauges kept as two counters. Each is summed over threads separately, so a
+// snapshot may see a removal before the addition it undoes.
+static uint64_t difference(const Metrics::Snapshot& totals, Metrics::Counter added, Metrics::Counter removed) {
+    return totals[added] > totals[removed] ? totals[added] - totals[removed] : 0;
+}
+
+static uint64_t connections(const Metrics::Snapshot& totals) {
+    return difference(totals, Metrics::ConnectionsOpened, Metrics::ConnectionsClosed);
+}
+
+static uint64_t queuedFrames(const Metrics::Snapshot& totals) {
+    return difference(totals, Metrics::OutboundFramesQueued, Metrics::OutboundFramesRemoved);
+}
+
+static uint64_t queuedBytes(const Metrics::Snapshot& totals) {
+    return difference(totals, Metrics::OutboundBytesQueued, Metrics::OutboundBytesRemoved);
+}
+
+static uint64_t latencyCount(const Metrics::Snapshot& totals, size_t latency) {
+    uint64_t count = 0;
+    for (size_t bucket = 0; bucket <= Metrics::LATENCY_BUCKETS; ++bucket) {
+        count += totals.buckets[latency][bucket];
+    }
+    return count;
+}
+
+// The upper bound of the bucket holding the percentile, or the largest value
+// seen if that is the last bucket.
+static uint64_t latencyPercentileNs(const Metrics::Snapshot& totals, size_t latency, double percentile) {
+    uint64_t count = latencyCount(totals, latency);
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(percentile / 100.0 * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < Metrics::LATENCY_BUCKETS; ++bucket) {
+        seen += totals.buckets[latency][bucket];
+        if (seen >= target) {
+            return std::min(Metrics::BUCKET_BOUNDS_NS[bucket], totals.latencyMaxNs[latency]);
+        }
+    }
+    return totals.latencyMaxNs[latency];
+}
+
+static void appendJsonString(std::ostringstream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+static std::string prometheusLabel(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void prometheusHeader(std::ostringstream& out, const std::string& name, const char* type, const char* help) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+std::string formatStatsJson(const MetricsReport& report) {
+    const Metrics::Snapshot& totals = report.totals;
+    std::ostringstream out;
+    out << "{\"uptime_seconds\":" << report.uptimeSeconds << ",\"counters\":{";
+    for (size_t i = 0; i < sizeof(COUNTERS) / sizeof(COUNTERS[0]); ++i) {
+        out << (i > 0 ? "," : "") << '"' << COUNTERS[i].name << "\":" << totals[COUNTERS[i].counter];
+    }
+    out << "},\"connections\":" << connections(totals) << ",\"outbound_queued_messages\":" << queuedFrames(totals)
+        << ",\"outbound_queued_bytes\":" << queuedBytes(totals) << ",\"dedup_ids\":" << report.dedupIds
+        << ",\"latency_us\":{";
+    for (size_t latency = 0; latency < Metrics::LATENCY_COUNT; ++latency) {
+        uint64_t count = latencyCount(totals, latency);
+        out << (latency > 0 ? "," : "") << '"' << Metrics::latencyName(static_cast<Metrics::Latency>(latency))
+            << "\":{\"count\":" << count
+            << ",\"mean\":" << (count > 0 ? totals.latencySumNs[latency] / 1000.0 / count : 0)
+            << ",\"p50\":" << latencyPercentileNs(totals, latency, 50) / 1000.0
+            << ",\"p99\":" << latencyPercentileNs(totals, latency, 99) / 1000.0
+            << ",\"p999\":" << latencyPercentileNs(totals, latency, 99.9) / 1000.0
+            << ",\"max\":" << totals.latencyMaxNs[latency] / 1000.0 << "}";
+    }
+    out << "},\"topics\":[";
+    for (size_t i = 0; i < report.topics.size(); ++i) {
+        const TopicMetrics& topic = report.topics[i];
+        out << (i > 0 ? "," : "") << "{\"topic\":";
+        appendJsonString(out, topic.topic);
+        out << ",\"partition\":" << topic.partition << ",\"start_offset\":" << topic.startOffset
+            << ",\"end_offset\":" << topic.endOffset << ",\"messages\":" << topic.endOffset - topic.startOffset
+            << ",\"bytes\":" << topic.bytes << ",\"subscribers\":" << topic.subscribers
+            << ",\"subscriber_lag\":" << topic.subscriberLag << ",\"consumer_lag\":{";
+        for (size_t c = 0; c < topic.consumerLag.size(); ++c) {
+            out << (c > 0 ? "," : "");
+            appendJsonString(out, topic.consumerLag[c].first);
+            out << ":" << topic.consumerLag[c].second;
+        }
+        out << "}}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+std::string formatPrometheus(const MetricsReport& report) {
+    const Metrics::Snapshot& totals = report.totals;
+    std::ostringstream out;
+    for (const auto& info : COUNTERS) {
+        std::string name = std::string("pubsub_") + info.name + "_total";
+        prometheusHeader(out, name, "counter", info.help);
+        out << name << " " << totals[info.counter] << "\n";
+    }
+
+    prometheusHeader(out, "pubsub_uptime_seconds", "gauge", "Seconds since the broker started.");
+    out << "pubsub_uptime_seconds " << report.uptimeSeconds << "\n";
+    prometheusHeader(out, "pubsub_connections", "gauge", "Open connections, cluster links included.");
+    out << "pubsub_connections " << connections(totals) << "\n";
+    prometheusHeader(out, "pubsub_outbound_queued_messages", "gauge", "Frames waiting in outbound queues.");
+    out << "pubsub_outbound_queued_messages " << queuedFrames(totals) << "\n";
+    prometheusHeader(out, "pubsub_outbound_queued_bytes", "gauge", "Bytes waiting in outbound queues.");
+    out << "pubsub_outbound_queued_bytes " << queuedBytes(totals) << "\n";
+    prometheusHeader(out, "pubsub_dedup_ids", "gauge", "Message ids remembered for deduplication.");
+    out << "pubsub_dedup_ids " << report.dedupIds << "\n";
+
+    prometheusHeader(out, "pubsub_request_duration_seconds", "histogram",
+                     "Time from parsing a request to queueing its response.");
+    for (size_t latency = 0; latency < Metrics::LATENCY_COUNT; ++latency) {
+        std::string label = std::string("request=\"") + Metrics::latencyName(static_cast<Metrics::Latency>(latency))
+                            + "\"";
+        uint64_t cumulative = 0;
+        for (size_t bucket = 0; bucket < Metrics::LATENCY_BUCKETS; ++bucket) {
+            cumulative += totals.buckets[latency][bucket];
+            out << "pubsub_request_duration_seconds_bucket{" << label << ",le=\""
+                << Metrics::BUCKET_BOUNDS_NS[bucket] / 1e9 << "\"} " << cumulative << "\n";
+        }
+        cumulative += totals.buckets[latency][Metrics::LATENCY_BUCKETS];
+        out << "pubsub_request_duration_seconds_bucket{" << label << ",le=\"+Inf\"} " << cumulative << "\n";
+        out << "pubsub_request_duration_seconds_sum{" << label << "} " << totals.latencySumNs[latency] / 1e9 << "\n";
+        out << "pubsub_request_duration_seconds_count{" << label << "} " << cumulative << "\n";
+    }
+
+    struct TopicGauge {
+        const char* name;
+        const char* help;
+        uint64_t (*value)(const TopicMetrics&);
+    };
+    const TopicGauge gauges[] = {
+        {"pubsub_topic_end_offset", "Offset the next message of the partition gets.",
+         [](const TopicMetrics& topic) { return topic.endOffset; }},
+        {"pubsub_topic_retained_messages", "Messages retained in the partition's log.",
+         [](const TopicMetrics& topic) { return topic.endOffset - topic.startOffset; }},
+        {"pubsub_topic_retained_bytes", "Bytes retained in the partition's log.",
+         [](const TopicMetrics& topic) { return static_cast<uint64_t>(topic.bytes); }},
+        {"pubsub_topic_subscribers", "Subscribers of the partition.",
+         [](const TopicMetrics& topic) { return static_cast<uint64_t>(topic.subscribers); }},
+        {"pubsub_topic_subscriber_lag", "Messages the furthest behind log-served subscriber has yet to receive.",
+         [](const TopicMetrics& topic) { return topic.subscriberLag; }},
+    };
+    for (const auto& gauge : gauges) {
+        prometheusHeader(out, gauge.name, "gauge", gauge.help);
+        for (const auto& topic : report.topics) {
+            out << gauge.name << "{topic=\"" << prometheusLabel(topic.topic) << "\",partition=\"" << topic.partition
+                << "\"} " << gauge.value(topic) << "\n";
+        }
+    }
+    prometheusHeader(out, "pubsub_consumer_lag", "gauge", "Messages between a named consumer's cursor and the end.");
+    for (const auto& topic : report.topics) {
+        for (const auto& consumer : topic.consumerLag) {
+            out << "pubsub_consumer_lag{topic=\"" << prometheusLabel(topic.topic) << "\",partition=\""
+                << topic.partition << "\",consumer=\"" << prometheusLabel(consumer.first) << "\"} " << consumer.second
+                << "\n";
+        }
+    }
+    return out.str();
+}
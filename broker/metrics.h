@@ -0,0 +1,92 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Broker-wide counters and latency histograms. Every thread that records
+// gets its own cache-line-aligned block of them on first use, and only that
+// thread writes it, with plain relaxed loads and stores, so recording is a
+// few instructions with no lock, no shared cache line and no atomic
+// read-modify-write. snapshot() sums the blocks of every thread on demand;
+// a sum may be a few increments behind, never torn. Blocks are kept after
+// their thread exits, so totals never go back.
+class Metrics {
+public:
+    enum Counter {
+        Requests,             // client requests handled
+        MessagesPublished,    // appended by this broker as leader (or standalone)
+        MessagesReplicated,   // appended as a follower
+        MessagesDelivered,    // notifications queued for subscribers: the fan-out
+        DedupHits,            // publishes dropped as duplicates
+        BytesIn,              // read from sockets
+        BytesOut,             // written to sockets
+        ConnectionsOpened,
+        ConnectionsClosed,
+        OutboundFramesQueued, // outbound queue depth is queued minus removed
+        OutboundFramesRemoved,
+        OutboundBytesQueued,
+        OutboundBytesRemoved,
+        OutboundFramesDropped, // discarded by the overflow policy
+        COUNTER_COUNT,
+    };
+
+    // How long the broker took to handle a request, from parsing it to
+    // queueing its response.
+    enum Latency {
+        PublishLatency, // PUBLISH, PUBLISH_BATCH
+        FetchLatency,   // FETCH, GET_MESSAGES
+        OtherLatency,
+        LATENCY_COUNT,
+    };
+
+    // Upper bounds of the latency buckets, in nanoseconds; a last bucket
+    // takes everything above.
+    static const size_t LATENCY_BUCKETS = 19;
+    static const uint64_t BUCKET_BOUNDS_NS[LATENCY_BUCKETS];
+
+    struct Snapshot {
+        uint64_t counters[COUNTER_COUNT] = {};
+        uint64_t buckets[LATENCY_COUNT][LATENCY_BUCKETS + 1] = {};
+        uint64_t latencySumNs[LATENCY_COUNT] = {};
+        uint64_t latencyMaxNs[LATENCY_COUNT] = {};
+
+        uint64_t operator[](Counter counter) const { return counters[counter]; }
+    };
+
+    static void add(Counter counter, uint64_t amount = 1);
+    static void observe(Latency latency, std::chrono::nanoseconds elapsed);
+    static Snapshot snapshot();
+    static const char* latencyName(Latency latency);
+};
+
+// One topic partition, as seen by the stats report.
+struct TopicMetrics {
+    std::string topic;
+    uint16_t partition = 0;
+    uint64_t startOffset = 0;
+    uint64_t endOffset = 0;
+    size_t bytes = 0;
+    size_t subscribers = 0;   // pushed, filtered, log-served and group
+    uint64_t subscriberLag = 0; // of the furthest behind log-served subscriber
+    std::vector<std::pair<std::string, uint64_t>> consumerLag; // named consumers, end offset minus cursor
+};
+
+// Everything STATS and the metrics endpoint report.
+struct MetricsReport {
+    Metrics::Snapshot totals;
+    double uptimeSeconds = 0;
+    size_t dedupIds = 0;
+    std::vector<TopicMetrics> topics;
+};
+
+// One line of JSON, for STATS.
+std::string formatStatsJson(const MetricsReport& report);
+// The Prometheus text exposition format, for the metrics endpoint.
+std::string formatPrometheus(const MetricsReport& report);
+
+#endif // METRICS_H
@@ -0,0 +1,162 @@
+#include "metrics_endpoint.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+// A scrape request is a request line and a few headers; anything longer is
+// not a scraper.
+#define MAX_REQUEST 8192
+
+MetricsEndpoint::MetricsEndpoint(Render render)
+        : render(std::move(render)), listenFd(-1), wakeFd(-1), running(false) {}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    if (listenFd != -1) close(listenFd);
+    if (wakeFd != -1) close(wakeFd);
+}
+
+bool MetricsEndpoint::open(int port) {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        std::cerr << "Metrics socket creation error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    int opt = 1;
+    if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+        std::cerr << "Metrics setsockopt error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        std::cerr << "Metrics bind failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (listen(listenFd, 16) < 0) {
+        std::cerr << "Metrics listen failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        std::cerr << "Eventfd creation failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    running = true;
+    return true;
+}
+
+void MetricsEndpoint::run() {
+    struct pollfd fds[2];
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakeFd;
+    fds[1].events = POLLIN;
+
+    while (running) {
+        int ready = poll(fds, 2, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Metrics poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[1].revents & POLLIN) break;
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        int client = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+                std::cerr << "Metrics accept failed: " << strerror(errno) << std::endl;
+            }
+            continue;
+        }
+        serve(client);
+        close(client);
+    }
+}
+
+void MetricsEndpoint::stop() {
+    running = false;
+    if (wakeFd != -1) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+static void sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        sent += static_cast<size_t>(n);
+    }
+}
+
+static std::string httpResponse(const char* status, const char* contentType, const std::string& body) {
+    std::string response = "HTTP/1.0 ";
+    response += status;
+    response += "\r\nContent-Type: ";
+    response += contentType;
+    response += "\r\nContent-Length: " + std::to_string(body.size());
+    response += "\r\nConnection: close\r\n\r\n";
+    response += body;
+    return response;
+}
+
+void MetricsEndpoint::serve(int client) {
+    // The socket is blocking; a timeout keeps a stalled client from holding
+    // the endpoint.
+    struct timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           request.find("\n\n") == std::string::npos) {
+        if (request.size() > MAX_REQUEST) return;
+        ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        request.append(buffer, static_cast<size_t>(n));
+    }
+
+    size_t lineEnd = request.find_first_of("\r\n");
+    std::string line = request.substr(0, lineEnd);
+    size_t methodEnd = line.find(' ');
+    if (methodEnd == std::string::npos) {
+        sendAll(client, httpResponse("400 Bad Request", "text/plain", "bad request\n"));
+        return;
+    }
+    std::string method = line.substr(0, methodEnd);
+    size_t pathEnd = line.find(' ', methodEnd + 1);
+    std::string path = line.substr(methodEnd + 1,
+                                   pathEnd == std::string::npos ? std::string::npos : pathEnd - methodEnd - 1);
+    size_t query = path.find('?');
+    if (query != std::string::npos) path.resize(query);
+
+    if (method != "GET") {
+        sendAll(client, httpResponse("405 Method Not Allowed", "text/plain", "method not allowed\n"));
+    } else if (path != "/metrics") {
+        sendAll(client, httpResponse("404 Not Found", "text/plain", "not found\n"));
+    } else {
+        sendAll(client, httpResponse("200 OK", "text/plain; version=0.0.4", render()));
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef METRICS_ENDPOINT_H
+#define METRICS_ENDPOINT_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+// A minimal HTTP/1.0 server for Prometheus scrapes: GET /metrics is answered
+// with render()'s output and the connection closed; anything else gets 404.
+// It runs on its own thread, one scrape at a time, so a slow scraper never
+// touches the reactors. Requests must arrive within a second.
+class MetricsEndpoint {
+public:
+    using Render = std::function<std::string()>;
+
+    explicit MetricsEndpoint(Render render);
+    ~MetricsEndpoint();
+
+    bool open(int port);
+    // Serves scrapes until stop().
+    void run();
+    void stop(); // safe from any thread
+
+private:
+    void serve(int client);
+
+    Render render;
+    int listenFd;
+    int wakeFd;
+    std::atomic<bool> running;
+};
+
+#endif // METRICS_ENDPOINT_H
@@ -0,0 +1,253 @@
+#include "reactor.h"
+#include "server.h"
+#include "timer_service.h"
+#include "metrics.h"
+#include "log_level.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+
+Reactor::Reactor(Server& server, int id)
+        : server(server), id(id), listenFd(-1), epollFd(-1), wakeFd(-1), timers(nullptr), running(false) {}
+
+Reactor::~Reactor() {
+    for (auto& client : clients) {
+        close(client.first);
+    }
+    if (listenFd != -1) close(listenFd);
+    if (wakeFd != -1) close(wakeFd);
+    if (epollFd != -1) close(epollFd);
+}
+
+bool Reactor::open(int port) {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        std::cerr << "Socket creation error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // SO_REUSEPORT lets every reactor bind its own listener to the same port;
+    // the kernel then load-balances new connections between them.
+    int opt = 1;
+    if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        std::cerr << "Setsockopt error: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        std::cerr << "Bind failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (listen(listenFd, SOMAXCONN) < 0) {
+        std::cerr << "Listen failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        std::cerr << "Epoll creation failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        std::cerr << "Eventfd creation failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listenFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) < 0) {
+        std::cerr << "Epoll add failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) < 0) {
+        std::cerr << "Epoll add failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    running = true;
+    return true;
+}
+
+bool Reactor::watchTimers(TimerService& service) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = service.fd();
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, service.fd(), &ev) < 0) {
+        std::cerr << "Epoll add failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    timers = &service;
+    return true;
+}
+
+bool Reactor::resolve(const std::string& host, int port, struct sockaddr_in& address) {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* resolved = nullptr;
+    int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &resolved);
+    if (status != 0) {
+        std::cerr << "Cannot resolve " << host << ": " << gai_strerror(status) << std::endl;
+        return false;
+    }
+    std::memcpy(&address, resolved->ai_addr, sizeof(address));
+    freeaddrinfo(resolved);
+    return true;
+}
+
+std::shared_ptr<Connection> Reactor::connectTo(const struct sockaddr_in& address, const OutboundQueueConfig& limits) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        std::cerr << "Socket creation error: " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    if (connect(sock, (const struct sockaddr *)&address, sizeof(address)) < 0 && errno != EINPROGRESS) {
+        char host[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        std::cerr << "Connect to " << host << ":" << ntohs(address.sin_port) << " failed: " << strerror(errno)
+                  << std::endl;
+        close(sock);
+        return nullptr;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = sock;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        std::cerr << "Epoll add failed: " << strerror(errno) << std::endl;
+        close(sock);
+        return nullptr;
+    }
+    auto connection = std::make_shared<Connection>(sock, epollFd, limits);
+    clients.emplace(sock, connection);
+    Metrics::add(Metrics::ConnectionsOpened);
+    return connection;
+}
+
+void Reactor::run() {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running) {
+        int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno != EINTR) {
+                std::cerr << "Epoll wait failed: " << strerror(errno) << std::endl;
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                acceptConnections();
+            } else if (fd == wakeFd) {
+                uint64_t value;
+                while (read(wakeFd, &value, sizeof(value)) > 0) {}
+            } else if (timers && fd == timers->fd()) {
+                timers->runExpired();
+            } else {
+                auto it = clients.find(fd);
+                if (it == clients.end()) {
+                    continue;
+                }
+                std::shared_ptr<Connection> connection = it->second;
+                uint32_t ready_events = events[i].events;
+
+                bool keepOpen = true;
+                if (ready_events & EPOLLOUT) {
+                    keepOpen = connection->flush();
+                }
+                if (keepOpen && (ready_events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                    keepOpen = server.handleClient(*connection);
+                }
+                if (!keepOpen || connection->closeRequested()) {
+                    closeClient(fd);
+                }
+            }
+        }
+    }
+}
+
+void Reactor::stop() {
+    running = false;
+    uint64_t one = 1;
+    if (wakeFd != -1 && write(wakeFd, &one, sizeof(one)) < 0) {
+        std::cerr << "Reactor wakeup failed: " << strerror(errno) << std::endl;
+    }
+}
+
+void Reactor::acceptConnections() {
+    // Edge-triggered: drain the accept queue until the kernel reports EAGAIN.
+    while (true) {
+        int client_socket = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                std::cerr << "Accept failed: " << strerror(errno) << std::endl;
+            }
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        int opt = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = client_socket;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+            std::cerr << "Epoll add failed: " << strerror(errno) << std::endl;
+            close(client_socket);
+            continue;
+        }
+
+        auto connection = std::make_shared<Connection>(client_socket, epollFd, server.getConfig().outbound);
+        clients.emplace(client_socket, connection);
+        server.addClient(connection);
+        Metrics::add(Metrics::ConnectionsOpened);
+        if (logEnabled(LogLevel::Debug)) {
+            std::cout << "New connection accepted on reactor " << id << std::endl;
+        }
+    }
+}
+
+void Reactor::closeClient(int client_socket) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, client_socket, nullptr);
+    // Drop the client's state before releasing the descriptor, otherwise another
+    // reactor could accept a new connection with the same fd number first.
+    auto it = clients.find(client_socket);
+    if (it != clients.end()) {
+        server.removeClient(*it->second);
+        it->second->markClosed();
+        clients.erase(it);
+        Metrics::add(Metrics::ConnectionsClosed);
+    }
+    close(client_socket);
+}
@@ -0,0 +1,51 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <netinet/in.h>
+#include "connection.h"
+
+class Server;
+class TimerService;
+
+// One edge-triggered epoll event loop. Every reactor owns its own SO_REUSEPORT
+// listening socket, so the kernel spreads incoming connections across reactors
+// and a connection stays on the reactor that accepted it for its whole life.
+class Reactor {
+public:
+    Reactor(Server& server, int id);
+    ~Reactor();
+
+    bool open(int port);
+    void run();
+    void stop();
+    // Runs the timers' due tasks on this reactor's thread. Call before run().
+    bool watchTimers(TimerService& timers);
+    // Looks up host's IPv4 address. It may block on DNS, so call it before the
+    // reactors run, never on their threads.
+    static bool resolve(const std::string& host, int port, struct sockaddr_in& address);
+    // Opens a connection to another server; call on this reactor's thread.
+    // It completes in the background: frames queued meanwhile go out once it
+    // is up, and if it fails the connection is closed like any other.
+    std::shared_ptr<Connection> connectTo(const struct sockaddr_in& address, const OutboundQueueConfig& limits);
+
+    int getId() const { return id; }
+
+private:
+    void acceptConnections();
+    void closeClient(int client_socket);
+
+    Server& server;
+    int id;
+    int listenFd;
+    int epollFd;
+    int wakeFd;
+    TimerService* timers;
+    std::atomic<bool> running;
+    std::unordered_map<int, std::shared_ptr<Connection>> clients;
+};
+
+#endif // REACTOR_H
@@ -1,248 +1,2090 @@
 #include "server.h"
+#include "reactor.h"
+#include "metrics_endpoint.h"
 #include "../common/message.h"
 #include <iostream>
 #include <sstream>
 #include <cstring>
 #include <cerrno>
 #include <algorithm>
+#include <map>
+#include <unordered_map>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <unistd.h>
-#include <poll.h>
+#include <thread>
+#include <chrono>
 
-#define PORT 8080
-#define BUFFER_SIZE 1024
+#define MAX_DISK_READ_MESSAGES 4096
+#define MAX_FETCH_MESSAGES 1024
+#define MAX_REPLICA_BYTES (256 * 1024)
 
-Server::Server() : running(true) {}
+static int64_t steadyMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-void Server::start() {
-    int server_fd;
-    struct sockaddr_in address;
-    int opt = 1;
-    int addrlen = sizeof(address);
+static void reportReady(const Cluster& cluster) {
+    if (!logEnabled(LogLevel::Info)) {
+        return;
+    }
+    std::cout << "Cluster member " << cluster.self() << " is synced and may lead partitions" << std::endl;
+}
+
+Server::Server(const ServerConfig& config)
+        : config(config), topics(64, config.retention), recentIds(config.dedup), nextPartition(0),
+          cluster(config.cluster), startTime(std::chrono::steady_clock::now()), running(true) {
+    setLogLevel(config.logLevel);
+}
+
+Server::~Server() = default;
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        std::cerr << "Socket creation error: " << strerror(errno) << std::endl;
+void Server::start() {
+    if (!timers.open() || (config.persistence.enabled() && !recoverTopics())) {
         return;
     }
 
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
-        std::cerr << "Setsockopt error: " << strerror(errno) << std::endl;
-        close(server_fd);
+    int threadCount = config.effectiveReactorThreads();
+    for (int i = 0; i < threadCount; i++) {
+        auto reactor = std::make_unique<Reactor>(*this, i);
+        if (!reactor->open(config.port)) {
+            reactors.clear();
+            return;
+        }
+        reactors.push_back(std::move(reactor));
+    }
+    if (!reactors.front()->watchTimers(timers)) {
+        reactors.clear();
         return;
     }
+    if (config.retention.maxAgeMs > 0) {
+        timers.schedule(std::chrono::milliseconds(config.retentionSweepMs), [this] { sweepRetention(); });
+    }
+    if (cluster.enabled()) {
+        if (logEnabled(LogLevel::Info)) {
+            std::cout << "Cluster member " << cluster.self() << " of " << cluster.size() << std::endl;
+        }
+        // Links are (re)opened on the first reactor, which must not block on DNS.
+        memberAddresses.resize(cluster.size());
+        for (size_t member = 0; member < cluster.size(); ++member) {
+            const ClusterMember& peer = cluster.member(member);
+            if (member != cluster.self() && !Reactor::resolve(peer.host, peer.port, memberAddresses[member])) {
+                reactors.clear();
+                return;
+            }
+        }
+        for (size_t member = 0; member < cluster.size(); ++member) {
+            if (member != cluster.self()) {
+                timers.schedule(std::chrono::milliseconds(0), [this, member] { connectPeer(member); });
+            }
+        }
+    }
+    if (cluster.replicating()) {
+        // A member that never answers, e.g. behind a connect that hangs, does
+        // not keep this one from leading forever.
+        timers.schedule(std::chrono::milliseconds(config.cluster.replicationTimeoutMs), [this] {
+            if (cluster.forceReady()) {
+                reportReady(cluster);
+            }
+        });
+    }
 
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    std::thread metricsThread;
+    if (config.metricsPort > 0) {
+        auto endpoint = std::make_unique<MetricsEndpoint>([this] {
+            return formatPrometheus(collectMetrics(std::string_view()));
+        });
+        if (!endpoint->open(config.metricsPort)) {
+            reactors.clear();
+            return;
+        }
+        metrics = std::move(endpoint);
+        metricsThread = std::thread(&MetricsEndpoint::run, metrics.get());
+    }
 
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        std::cerr << "Bind failed: " << strerror(errno) << std::endl;
-        close(server_fd);
-        return;
+    if (logEnabled(LogLevel::Info)) {
+        std::cout << "Server listening on 0.0.0.0:" << config.port
+                  << " with " << threadCount << " reactor thread(s)";
+        if (metrics) {
+            std::cout << ", metrics on port " << config.metricsPort;
+        }
+        std::cout << std::endl;
     }
 
-    if (listen(server_fd, 3) < 0) {
-        std::cerr << "Listen failed: " << strerror(errno) << std::endl;
-        close(server_fd);
-        return;
+    std::vector<std::thread> threads;
+    for (auto& reactor : reactors) {
+        threads.emplace_back(&Reactor::run, reactor.get());
+    }
+    for (auto& thread : threads) {
+        thread.join();
     }
+    if (metricsThread.joinable()) {
+        metrics->stop();
+        metricsThread.join();
+    }
+    reactors.clear();
+}
 
-    std::cout << "Server listening on 0.0.0.0:" << PORT << std::endl;
+bool Server::recoverTopics() {
+    auto started = std::chrono::steady_clock::now();
+    logStore = std::make_unique<LogStore>(config.persistence, config.retention);
+    std::vector<std::shared_ptr<TopicStore>> recovered;
+    if (!logStore->open(recovered)) {
+        return false;
+    }
 
-    std::vector<pollfd> fds;
-    fds.push_back({server_fd, POLLIN, 0});
+    // Offsets continue where the previous run stopped, and every stored UUID
+    // is deduplicated again. Payloads stay on disk until a poller asks for them.
+    size_t messageCount = 0;
+    for (const auto& store : recovered) {
+        if (store->partition() >= config.partitions.countFor(store->topic())) {
+            std::cerr << "Topic " << store->topic() << " has stored partition " << store->partition()
+                      << " beyond its configured partition count; it can be fetched but gets no new messages"
+                      << std::endl;
+        }
+        topics.withTopic(store->topic(), store->partition(), [&](TopicState& state) {
+            state.store = store;
+            state.log.resetOffset(store->endOffset());
+            for (const auto& cursor : store->savedCursors()) {
+                state.cursors.set(cursor.first, cursor.second);
+            }
+        });
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        store->forEachUuid([&](const uint8_t* uuid) {
+            // Ids that were not UUIDs are stored as zeros and cannot be restored.
+            DedupKey key = dedupKeyFromUuid(uuid);
+            if (!key.isZero()) {
+                recentIds.insert(key);
+            }
+            ++messageCount;
+        });
+    }
 
-    while(running) {
-        int poll_count = poll(fds.data(), fds.size(), -1);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    if (logEnabled(LogLevel::Info)) {
+        std::cout << "Recovered " << recovered.size() << " topic(s), " << messageCount << " message(s) from "
+                  << config.persistence.dataDir << " in " << ms << " ms" << std::endl;
+    }
+    return true;
+}
 
-        if (poll_count == -1) {
-            std::cerr << "Poll failed: " << strerror(errno) << std::endl;
-            continue;
+void Server::stop() {
+    running = false;
+    for (auto& reactor : reactors) {
+        reactor->stop();
+    }
+    if (metrics) {
+        metrics->stop();
+    }
+}
+
+bool Server::handleClient(Connection& connection) {
+    int client_socket = connection.fd;
+    std::string response;
+    if (config.idleTimeoutMs > 0) {
+        connection.lastActivityMs.store(steadyMs(), std::memory_order_relaxed);
+    }
+
+    // Sockets are edge-triggered, so keep reading until the kernel has nothing
+    // left. Every read may complete several pipelined requests; their responses
+    // are gathered and queued as one frame behind any pending notifications.
+    while (true) {
+        long valread = connection.reader.readFrom(client_socket);
+        if (valread < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Recv failed: " << strerror(errno) << std::endl;
+            return false;
         }
+        if (valread == 0) {
+            if (logEnabled(LogLevel::Debug)) {
+                std::cout << "Client disconnected" << std::endl;
+            }
+            return false;
+        }
+        Metrics::add(Metrics::BytesIn, static_cast<uint64_t>(valread));
 
-        for (size_t i = 0; i < fds.size(); i++) {
-            if (fds[i].revents & POLLIN) {
-                if (fds[i].fd == server_fd) {
-                    int client_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen);
-                    if (client_socket < 0) {
-                        std::cerr << "Accept failed: " << strerror(errno) << std::endl;
-                    } else {
-                        std::cout << "New connection accepted" << std::endl;
-                        fds.push_back({client_socket, POLLIN, 0});
-                    }
-                } else {
-                    handleClient(fds[i].fd);
+        StreamFrame frame;
+        FrameStatus status;
+        while ((status = connection.reader.next(frame)) == FrameStatus::Ready) {
+            if (connection.link) {
+                if (frame.binary) {
+                    handleLinkFrame(frame.frame, connection);
                 }
+            } else if (frame.binary) {
+                handleFrame(frame.frame, connection);
+            } else {
+                handleRequest(std::string(frame.text), connection);
             }
         }
+        if (status == FrameStatus::Invalid) {
+            std::cerr << "Malformed frame from client " << client_socket << std::endl;
+            return false;
+        }
+    }
 
-        fds.erase(std::remove_if(fds.begin() + 1, fds.end(),
-                                 [this](const pollfd& pfd) {
-                                     if (pfd.fd == -1) {
-                                         removeClient(pfd.fd);
-                                         return true;
-                                     }
-                                     return false;
-                                 }),
-                  fds.end());
+    StreamFrame legacy;
+    if (connection.reader.takeUnterminatedText(legacy)) {
+        handleRequest(std::string(legacy.text), connection);
     }
 
-    for (const auto& fd : fds) {
-        if (fd.fd != server_fd) {
-            close(fd.fd);
-        }
+    // Responses were queued without arming EPOLLOUT; write them all out now.
+    return !connection.closeRequested() && connection.flush();
+}
+
+static Metrics::Latency requestLatency(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::Publish:
+        case Opcode::PublishBatch:
+            return Metrics::PublishLatency;
+        case Opcode::Fetch:
+        case Opcode::GetMessages:
+            return Metrics::FetchLatency;
+        default:
+            return Metrics::OtherLatency;
     }
-    close(server_fd);
 }
 
-void Server::handleClient(int client_socket) {
-    char buffer[BUFFER_SIZE] = {0};
-    int valread = recv(client_socket, buffer, BUFFER_SIZE, 0);
-    if (valread <= 0) {
-        if (valread == 0) {
-            std::cout << "Client disconnected" << std::endl;
+void Server::handleRequest(const std::string& request, Connection& connection) {
+    auto received = std::chrono::steady_clock::now();
+    Message msg = Message::deserialize(request);
+
+    if (logEnabled(LogLevel::Debug)) {
+        std::cout << "Received request: " << request << std::endl;
+    }
+
+    if (msg.type == "HELLO") {
+        if (msg.content == "BIN1") {
+            connection.binary = true;
+            reply(connection, WIRE_HELLO_RESPONSE);
         } else {
-            std::cerr << "Recv failed: " << strerror(errno) << std::endl;
+            reply(connection, "INVALID_COMMAND\n");
         }
-        close(client_socket);
-        removeClient(client_socket);
         return;
     }
 
-    std::string request(buffer);
-    std::string response = handleRequest(request, client_socket);
-    send(client_socket, response.c_str(), response.length(), 0);
+    Opcode opcode = opcodeFromName(msg.type);
+    handleMessage(opcode, msg.topic, msg.content, msg.uuid, 0, 0, 0, connection, false);
+    Metrics::add(Metrics::Requests);
+    Metrics::observe(requestLatency(opcode), std::chrono::steady_clock::now() - received);
 }
 
-std::string Server::handleRequest(const std::string& request, int clientId) {
-    Message msg = Message::deserialize(request);
+void Server::handleFrame(const FrameView& frame, Connection& connection) {
+    auto received = std::chrono::steady_clock::now();
+    char uuidText[WIRE_UUID_TEXT_SIZE];
+    formatUuid(frame.header.uuid, uuidText);
 
-    std::cout << "Received request: " << request << std::endl;
+    if (logEnabled(LogLevel::Debug)) {
+        std::cout << "Received binary request: " << opcodeName(frame.header.opcode)
+                  << " on topic " << frame.topic << std::endl;
+    }
 
-    std::string response;
+    handleMessage(frame.header.opcode, frame.topic, frame.payload, std::string_view(uuidText, WIRE_UUID_TEXT_SIZE),
+                  frame.header.sequence, frame.header.partition, frame.header.flags, connection, true);
+    Metrics::add(Metrics::Requests);
+    Metrics::observe(requestLatency(frame.header.opcode), std::chrono::steady_clock::now() - received);
+}
 
-    if (msg.type == "SUBSCRIBE") {
-        subscribe(clientId, msg.topic);
-        response = "SUBSCRIBED:" + msg.topic + "\n";
-    } else if (msg.type == "UNSUBSCRIBE") {
-        unsubscribe(clientId, msg.topic);
-        response = "UNSUBSCRIBED:" + msg.topic + "\n";
-    } else if (msg.type == "PUBLISH") {
-        publish(msg.topic, msg.content, msg.uuid);
-        response = "PUBLISHED:" + msg.topic + "\n";
-    } else if (msg.type == "GET_MESSAGES") {
-        std::vector<std::string> clientMessages = getMessages(clientId, msg.topic);
-        if (clientMessages.empty()) {
-            response = "NO_MESSAGES\n";
-        } else {
+// Responses echo the request's sequence number so pipelining clients can match them.
+static std::string binaryResponse(Opcode opcode, std::string_view topic, uint64_t sequence,
+                                  std::string_view payload = "", uint8_t flags = 0, uint16_t partition = 0) {
+    FrameHeader header;
+    header.opcode = opcode;
+    header.sequence = sequence;
+    header.flags = flags;
+    header.partition = partition;
+
+    std::string frame(frameSize(topic, payload), '\0');
+    encodeFrame(header, topic, payload, &frame[0], frame.size());
+    return frame;
+}
+
+// Text offsets: a number, "earliest", "latest", or empty / "committed".
+static bool parseTextOffset(std::string_view text, uint64_t& offset) {
+    if (text.empty() || text == "committed") {
+        offset = WIRE_OFFSET_COMMITTED;
+    } else if (text == "earliest") {
+        offset = 0;
+    } else if (text == "latest") {
+        offset = WIRE_OFFSET_LATEST;
+    } else {
+        offset = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9' || offset > (WIRE_OFFSET_LATEST - 10) / 10) {
+                return false;
+            }
+            offset = offset * 10 + static_cast<uint64_t>(c - '0');
+        }
+    }
+    return true;
+}
+
+// Splits an optional trailing ":partition" off content.
+static bool parseTextPartition(std::string_view& content, size_t fields, uint16_t& partition) {
+    partition = 0;
+    size_t separators = static_cast<size_t>(std::count(content.begin(), content.end(), ':'));
+    if (separators < fields - 1) {
+        return false;
+    }
+    if (separators == fields - 1) {
+        return true;
+    }
+    size_t last = content.rfind(':');
+    uint64_t value;
+    if (!parseTextOffset(content.substr(last + 1), value) || value >= UINT16_MAX) {
+        return false;
+    }
+    partition = static_cast<uint16_t>(value);
+    content = content.substr(0, last);
+    return true;
+}
+
+// "consumer:offset:max[:partition]"
+static bool parseTextFetch(std::string_view content, FetchRequest& request, uint16_t& partition) {
+    if (!parseTextPartition(content, 3, partition)) {
+        return false;
+    }
+    size_t first = content.find(':');
+    size_t second = content.find(':', first + 1);
+    uint64_t maxMessages;
+    if (!parseTextOffset(content.substr(second + 1), maxMessages) || maxMessages > UINT32_MAX) {
+        return false;
+    }
+    request.consumer = content.substr(0, first);
+    request.maxMessages = static_cast<uint32_t>(maxMessages);
+    return parseTextOffset(content.substr(first + 1, second - first - 1), request.offset);
+}
+
+// "consumer:offset[:partition]"
+static bool parseTextSeek(std::string_view content, std::string_view& consumer, uint64_t& offset,
+                          uint16_t& partition) {
+    if (!parseTextPartition(content, 2, partition)) {
+        return false;
+    }
+    size_t separator = content.find(':');
+    consumer = content.substr(0, separator);
+    return parseTextOffset(content.substr(separator + 1), offset) && offset != WIRE_OFFSET_COMMITTED;
+}
+
+// "messages:bytes"
+static bool parseTextCredit(std::string_view content, uint32_t& messages, uint32_t& bytes) {
+    size_t separator = content.find(':');
+    uint64_t messageCount, byteCount;
+    if (separator == std::string_view::npos || !parseTextOffset(content.substr(0, separator), messageCount)
+            || !parseTextOffset(content.substr(separator + 1), byteCount) || content.substr(0, separator).empty()
+            || messageCount > UINT32_MAX || byteCount > UINT32_MAX) {
+        return false;
+    }
+    messages = static_cast<uint32_t>(messageCount);
+    bytes = static_cast<uint32_t>(byteCount);
+    return true;
+}
+
+void Server::reply(Connection& connection, std::string response) {
+    // Only called from the connection's own reactor, which flushes after the burst.
+    connection.enqueue(std::make_shared<const std::string>(std::move(response)), true);
+}
+
+void Server::handleMessage(Opcode opcode, std::string_view topic, std::string_view content, std::string_view uuid,
+                           uint64_t sequence, uint16_t partition, uint8_t flags, Connection& connection,
+                           bool binary) {
+    std::string topicName(topic);
+
+    switch (opcode) {
+        case Opcode::Subscribe: {
+            std::string_view consumer, filter = content;
+            bool acked = (flags & WIRE_FLAG_ACKED) != 0;
+            if ((acked && !decodeAckedSubscription(content, consumer, filter))
+                    || !subscribe(connection, topicName, filter, consumer)) {
+                reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+                break;
+            }
+            reply(connection, binary ? binaryResponse(Opcode::Subscribed, topic, sequence)
+                                     : "SUBSCRIBED:" + topicName + "\n");
+            break;
+        }
+        case Opcode::Unsubscribe:
+            unsubscribe(connection, topicName);
+            reply(connection, binary ? binaryResponse(Opcode::Unsubscribed, topic, sequence)
+                                     : "UNSUBSCRIBED:" + topicName + "\n");
+            break;
+        case Opcode::Publish: {
+            // Only the block's bounds are checked here; the body is never copied.
+            AttributesView attributes;
+            std::string_view body = content;
+            if ((flags & WIRE_FLAG_ATTRIBUTES) && !AttributesView::split(content, attributes, body)) {
+                reply(connection, binaryResponse(Opcode::Invalid, topic, sequence));
+                break;
+            }
+            bool backpressure = false;
+            bool quorum = (flags & WIRE_FLAG_QUORUM) != 0;
+            RemoteMessages remote;
+            std::shared_ptr<PendingPublish> pending = quorum ? startPublish(connection, topic, sequence, binary)
+                                                             : nullptr;
+            Opcode response = publish(topic, body, uuid, binary ? partition : 0, attributes.raw(), backpressure,
+                                      connection.peer ? nullptr : &remote, pending);
+            answerPublish(connection, topic, sequence, binary, response, backpressure, remote, pending, quorum);
+            break;
+        }
+        case Opcode::PublishBatch: {
+            bool backpressure = false;
+            bool quorum = (flags & WIRE_FLAG_QUORUM) != 0;
+            RemoteMessages remote;
+            std::shared_ptr<PendingPublish> pending = quorum ? startPublish(connection, topic, sequence, binary)
+                                                             : nullptr;
+            Opcode response = publishBatch(content, (flags & WIRE_FLAG_ATTRIBUTES) != 0, backpressure,
+                                           connection.peer ? nullptr : &remote, pending);
+            answerPublish(connection, topic, sequence, binary, response, backpressure, remote, pending, quorum);
+            break;
+        }
+        case Opcode::Fetch: {
+            // Requests may only name partitions the topic has; withTopic would create any other.
+            FetchRequest request;
+            bool valid = binary ? decodeFetchRequest(content, request) : parseTextFetch(content, request, partition);
+            if (valid && partition < config.partitions.countFor(topic)) {
+                fetch(connection, topic, partition, request, sequence, binary);
+            } else {
+                reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+            }
+            break;
+        }
+        case Opcode::Seek: {
+            std::string_view consumer;
+            uint64_t offset;
+            bool valid = binary ? decodeSeekRequest(content, consumer, offset)
+                                : parseTextSeek(content, consumer, offset, partition);
+            if (valid && !consumer.empty() && partition < config.partitions.countFor(topic)) {
+                seek(connection, topic, partition, consumer, offset, sequence, binary);
+            } else {
+                reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+            }
+            break;
+        }
+        case Opcode::JoinGroup:
+        case Opcode::LeaveGroup: {
+            std::string group(content);
+            if (topic.empty() || group.empty()) {
+                reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+                break;
+            }
+            bool join = opcode == Opcode::JoinGroup;
+            Opcode response = join ? Opcode::Joined : Opcode::Left;
+            // The response goes out before the ASSIGNED frames the change triggers.
+            reply(connection, binary ? binaryResponse(response, topic, sequence, group)
+                                     : std::string(opcodeName(response)) + ":" + topicName + ":" + group + "\n");
+            if (join) {
+                joinGroup(connection, topicName, group);
+            } else {
+                leaveGroup(connection, topicName, group);
+            }
+            break;
+        }
+        case Opcode::Credit: {
+            // Credit is granted silently; the messages it releases are the answer.
+            uint32_t messages, bytes;
+            if (binary ? decodeCredit(content, messages, bytes) : parseTextCredit(content, messages, bytes)) {
+                grantCredit(connection, messages, bytes);
+            } else {
+                reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+            }
+            break;
+        }
+        case Opcode::Ack: {
+            // Like credit, acknowledgements get no response.
+            std::vector<uint64_t> offsets;
+            bool cumulative = (flags & WIRE_FLAG_CUMULATIVE) != 0;
+            if (binary && decodeAckOffsets(content, offsets) && (!cumulative || offsets.size() == 1)
+                    && partition < config.partitions.countFor(topic)) {
+                acknowledge(connection, topic, partition, offsets, cumulative);
+            } else {
+                reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+            }
+            break;
+        }
+        case Opcode::Peer:
+            if (!binary) {
+                reply(connection, "INVALID_COMMAND\n");
+                break;
+            }
+            admitPeer(connection, content, flags);
+            break;
+        case Opcode::Replicated:
+            // Like ACK, no response.
+            if (connection.peer) {
+                replicated(connection, topic, partition, flags, content);
+            } else {
+                reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+            }
+            break;
+        case Opcode::GetMessages: {
+            std::vector<SharedMessagePtr> clientMessages = getMessages(connection, topicName);
+            if (clientMessages.empty()) {
+                reply(connection, binary ? binaryResponse(Opcode::NoMessages, topic, sequence) : "NO_MESSAGES\n");
+            }
+            // Retained messages are queued as the same shared frames used for push delivery.
             for (const auto& cmsg : clientMessages) {
-                response += "MESSAGE:" + msg.topic + ":" + cmsg + "\n";
+                connection.enqueue(cmsg->frameFor(binary), true);
             }
+            break;
         }
-    } else {
-        response = "INVALID_COMMAND\n";
+        case Opcode::Stats: {
+            std::string json = formatStatsJson(collectMetrics(topic));
+            reply(connection, binary ? binaryResponse(Opcode::StatsReport, topic, sequence, json)
+                                     : "STATS_REPORT:" + json + "\n");
+            break;
+        }
+        default:
+            reply(connection, binary ? binaryResponse(Opcode::Invalid, topic, sequence) : "INVALID_COMMAND\n");
+            break;
     }
+}
 
-    // Print out the subscriptions after handling the request
+// Takes one shard lock at a time, so the report is not a single snapshot
+// across topics; each partition's line is consistent in itself.
+MetricsReport Server::collectMetrics(std::string_view topicFilter) {
+    MetricsReport report;
+    report.totals = Metrics::snapshot();
+    report.uptimeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        std::cout << "Current subscriptions:" << std::endl;
-        for (const auto& sub : subscriptions) {
-            std::cout << "Topic: " << sub.first << ", Subscribers: ";
-            if (sub.second.empty()) {
-                std::cout << "None";
-            } else {
-                for (size_t i = 0; i < sub.second.size(); ++i) {
-                    std::cout << sub.second[i];
-                    if (i < sub.second.size() - 1) {
-                        std::cout << ", ";
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        report.dedupIds = recentIds.size();
+    }
+    topics.forEach([&](const TopicKey& key, const TopicState& state) {
+        if (!topicFilter.empty() && key.topic != topicFilter) {
+            return;
+        }
+        TopicMetrics topic;
+        topic.topic = key.topic;
+        topic.partition = key.partition;
+        topic.startOffset = state.log.startOffset();
+        topic.endOffset = state.log.endOffset();
+        if (state.store) {
+            topic.startOffset = std::min(topic.startOffset, state.store->startOffset());
+        }
+        topic.bytes = state.log.bytes();
+        topic.subscribers = state.subscribers.size() + state.flowSubscribers.size() + state.groupOwners.size();
+        for (const auto& group : state.filteredSubscribers) {
+            topic.subscribers += group.subscribers.size();
+        }
+        for (const auto& subscriber : state.flowSubscribers) {
+            if (subscriber.next < topic.endOffset) {
+                topic.subscriberLag = std::max(topic.subscriberLag, topic.endOffset - subscriber.next);
+            }
+        }
+        for (const auto& cursor : state.cursors.all()) {
+            topic.consumerLag.emplace_back(cursor.first,
+                                           cursor.second < topic.endOffset ? topic.endOffset - cursor.second : 0);
+        }
+        std::sort(topic.consumerLag.begin(), topic.consumerLag.end());
+        report.topics.push_back(std::move(topic));
+    });
+    std::sort(report.topics.begin(), report.topics.end(), [](const TopicMetrics& a, const TopicMetrics& b) {
+        return a.topic != b.topic ? a.topic < b.topic : a.partition < b.partition;
+    });
+    return report;
+}
+
+static bool topicIsUnused(const TopicState& state) {
+    return state.subscribers.empty() && state.filteredSubscribers.empty() && state.flowSubscribers.empty()
+           && state.log.empty() && state.readOffsets.empty() && !state.store
+           && state.cursors.empty() && state.groupOwners.empty();
+}
+
+static void removeSubscriber(std::vector<std::shared_ptr<Connection>>& subs, const Connection& connection) {
+    auto it = std::find_if(subs.begin(), subs.end(),
+                           [&](const std::shared_ptr<Connection>& sub) { return sub.get() == &connection; });
+    if (it != subs.end()) {
+        *it = std::move(subs.back());
+        subs.pop_back();
+    }
+}
+
+static void removeFlowSubscriber(std::vector<FlowSubscriber>& subs, const Connection& connection,
+                                 TimerService& timers) {
+    auto it = std::find_if(subs.begin(), subs.end(),
+                           [&](const FlowSubscriber& sub) { return sub.connection.get() == &connection; });
+    if (it != subs.end()) {
+        for (const auto& unacked : it->unacked) {
+            timers.cancel(unacked.second);
+        }
+        *it = std::move(subs.back());
+        subs.pop_back();
+    }
+}
+
+static void removeFilteredSubscriber(std::vector<FilteredSubscribers>& groups, const Connection& connection) {
+    for (auto it = groups.begin(); it != groups.end();) {
+        removeSubscriber(it->subscribers, connection);
+        it = it->subscribers.empty() ? groups.erase(it) : it + 1;
+    }
+}
+
+// Runs under the topic's shard lock. Plain and wildcard subscribers get every
+// message; each consumer group gets it once, through the member that owns the
+// partition. Wildcard matches are only recomputed after a pattern changed.
+Server::Delivery Server::deliveryTargets(TopicState& state, std::string_view topic) {
+    uint64_t generation = patterns.generation();
+    if (state.patternGeneration != generation) {
+        state.patternSubscribers = patterns.match(topic);
+        state.patternGeneration = generation;
+    }
+
+    Delivery delivery;
+    auto& targets = delivery.targets;
+    targets.reserve(state.subscribers.size() + state.patternSubscribers.size() + state.groupOwners.size());
+    targets = state.subscribers;
+    for (const auto& subscriber : state.patternSubscribers) {
+        // A member that subscribed to the topic and to a matching pattern gets
+        // one copy, which it fans out to its own clients.
+        if (subscriber->peer && std::find(state.subscribers.begin(), state.subscribers.end(), subscriber)
+                != state.subscribers.end()) {
+            continue;
+        }
+        targets.push_back(subscriber);
+    }
+    for (const auto& owner : state.groupOwners) {
+        targets.push_back(owner.second);
+    }
+    delivery.filtered = state.filteredSubscribers;
+    return delivery;
+}
+
+// A plain subscription covers every partition of the topic. Patterns go to
+// the trie instead and match topics as they are published to. Subscribers
+// with equivalent filters share one FilteredSubscribers entry. A flow
+// controlled connection reads exact topics from their logs instead, starting
+// with the next message published. So does an acknowledged subscription,
+// which starts at its consumer's committed cursor.
+bool Server::subscribe(Connection& connection, const std::string& topic, std::string_view filterExpression,
+                       std::string_view consumer) {
+    bool pattern = isTopicPattern(topic);
+    if (pattern && !isValidTopicPattern(topic)) {
+        return false;
+    }
+    MessageFilterPtr filter;
+    if (!filterExpression.empty()) {
+        filter = MessageFilter::parse(filterExpression);
+        if (!filter || pattern) {
+            return false; // filters apply to exact topics only
+        }
+    }
+    bool acked = !consumer.empty();
+    if (acked && pattern) {
+        return false;
+    }
+    std::string canonical = filter ? filter->canonical() : std::string();
+    if (acked) {
+        canonical.append("@").append(consumer);
+    }
+
+    // The connection's own map answers "already subscribed?" without scanning
+    // the topic's subscriber list. Subscribing again with another filter
+    // replaces the old one.
+    auto existing = connection.subscriptions.find(topic);
+    if (existing != connection.subscriptions.end() && existing->second == canonical) {
+        return true;
+    }
+    // Registered before the old subscription goes, so other members keep
+    // pushing the topic in between.
+    if (!connection.peer) {
+        cluster.addInterest(topic);
+    }
+    if (existing != connection.subscriptions.end()) {
+        unsubscribe(connection, topic);
+    }
+    connection.subscriptions.emplace(topic, canonical);
+
+    std::shared_ptr<Connection> subscriber = connection.shared_from_this();
+    if (pattern) {
+        patterns.add(topic, subscriber);
+        return true;
+    }
+    for (uint16_t partition = 0; partition < config.partitions.countFor(topic); ++partition) {
+        FlowDeliveries pending; // the backlog of an acknowledged subscription
+        DeliveryTurn turn;
+        topics.withTopic(topic, partition, [&](TopicState& state) {
+            if (acked || connection.flowControlled()) {
+                FlowSubscriber flow;
+                flow.connection = subscriber;
+                flow.filter = filter;
+                flow.next = state.log.endOffset();
+                if (acked) {
+                    flow.acked = true;
+                    flow.consumer.assign(consumer.data(), consumer.size());
+                    // A new consumer starts at the end; committing that now
+                    // lets a reconnect resume there even if it never acked.
+                    if (!state.cursors.get(flow.consumer, flow.next)) {
+                        commitCursor(state, flow.consumer, flow.next);
                     }
                 }
+                state.flowSubscribers.push_back(std::move(flow));
+                drainFlow(state, state.flowSubscribers.back(), topic, partition, pending);
+                turn.take(state.deliveryOrder);
+                return;
+            }
+            if (!filter) {
+                state.subscribers.push_back(subscriber);
+                return;
             }
-            std::cout << std::endl;
+            auto& groups = state.filteredSubscribers;
+            auto group = std::find_if(groups.begin(), groups.end(), [&](const FilteredSubscribers& g) {
+                return g.filter->canonical() == canonical;
+            });
+            if (group == groups.end()) {
+                group = groups.insert(groups.end(), FilteredSubscribers{filter, {}});
+            }
+            group->subscribers.push_back(subscriber);
+        });
+        FlowDeliveries held;
+        turn.wait();
+        for (const auto& entry : pending) {
+            deliver(entry.first, entry.second, &held);
+        }
+        turn.release();
+        for (const auto& entry : held) {
+            deliver(entry.first, entry.second);
         }
     }
+    connection.topics.insert(topic);
+    return true;
+}
 
-    return response;
+void Server::unsubscribe(Connection& connection, const std::string& topic) {
+    auto subscription = connection.subscriptions.find(topic);
+    if (subscription == connection.subscriptions.end()) {
+        return;
+    }
+    bool filtered = !subscription->second.empty();
+    connection.subscriptions.erase(subscription);
+    if (!connection.peer) {
+        cluster.removeInterest(topic);
+    }
+    if (isTopicPattern(topic)) {
+        patterns.remove(topic, connection);
+        return;
+    }
+
+    bool hasCursor = false;
+    for (uint16_t partition = 0; partition < config.partitions.countFor(topic); ++partition) {
+        topics.withExistingTopic(topic, partition, [&](TopicState& state) {
+            removeFlowSubscriber(state.flowSubscribers, connection, timers);
+            if (filtered) {
+                removeFilteredSubscriber(state.filteredSubscribers, connection);
+            } else {
+                removeSubscriber(state.subscribers, connection);
+            }
+            hasCursor = hasCursor || state.readOffsets.count(connection.fd) > 0;
+            return topicIsUnused(state);
+        });
+    }
+    if (!hasCursor) {
+        connection.topics.erase(topic);
+    }
 }
 
-void Server::subscribe(int clientId, const std::string& topic) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto& subs = subscriptions[topic];
-    if (std::find(subs.begin(), subs.end(), clientId) == subs.end()) {
-        subs.push_back(clientId);
+// Keyed messages go to the key's partition; keyless ones are spread round
+// robin over the partitions this member owns, if it owns any, so they need no
+// forwarding.
+uint16_t Server::choosePartition(std::string_view topic, uint16_t keyHash) {
+    uint16_t count = config.partitions.countFor(topic);
+    if (count <= 1) {
+        return 0;
+    }
+    if (keyHash != 0) {
+        return static_cast<uint16_t>((keyHash - 1) % count);
+    }
+    uint16_t start = static_cast<uint16_t>(nextPartition.fetch_add(1, std::memory_order_relaxed) % count);
+    for (uint16_t i = 0; cluster.enabled() && i < count; ++i) {
+        uint16_t partition = static_cast<uint16_t>((start + i) % count);
+        if (cluster.owns(topic, partition)) {
+            return partition;
+        }
     }
+    return start;
+}
+
+// A forwarded message names its partition. Members configured with fewer
+// partitions than the sender would otherwise create one nobody subscribes to.
+static uint16_t forwardedPartition(const PartitionConfig& partitions, std::string_view topic, uint16_t partition) {
+    return static_cast<uint16_t>(partition % partitions.countFor(topic));
+}
+
+// Members pass on what clients publish to them without deduplicating it, and
+// the owner checks it. Ids that are not UUIDs cross links as zeros, so those
+// cannot be checked once forwarded.
+static bool isDuplicate(DedupWindow& recentIds, const SharedMessage& message, bool forwarded,
+                        DedupWindow::Clock::time_point now) {
+    DedupKey key = dedupKeyFromText(message.uuid());
+    return !(forwarded && key.isZero()) && !recentIds.insert(key, now);
 }
 
-void Server::unsubscribe(int clientId, const std::string& topic) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto it = subscriptions.find(topic);
-    if (it != subscriptions.end()) {
-        auto& subs = it->second;
-        subs.erase(std::remove(subs.begin(), subs.end(), clientId), subs.end());
-        if (subs.empty()) {
-            subscriptions.erase(it);
+Opcode Server::publish(std::string_view topic, std::string_view message, std::string_view uuid, uint16_t keyHash,
+                       std::string_view attributes, bool& backpressure, RemoteMessages* remote,
+                       const std::shared_ptr<PendingPublish>& quorum) {
+    // Encode once; every subscriber queue and the retained log share this buffer.
+    uint16_t partition = remote ? choosePartition(topic, keyHash) : forwardedPartition(config.partitions, topic, keyHash);
+    std::shared_ptr<SharedMessage> shared = SharedMessage::create(topic, message, uuid, partition, attributes);
+    if (!shared) {
+        std::cerr << "Message on topic " << topic << " exceeds the frame size limits, rejected" << std::endl;
+        return Opcode::Invalid;
+    }
+    if (!cluster.owns(topic, partition)) {
+        if (!remote) {
+            return Opcode::Unavailable; // sent to a leader that has since handed over
+        }
+        remote->push_back(std::move(shared));
+        return Opcode::Published;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(dedupMutex);
+
+        // Check if the message with this UUID has already been processed
+        if (isDuplicate(recentIds, *shared, !remote, DedupWindow::Clock::now())) {
+            Metrics::add(Metrics::DedupHits);
+            if (logEnabled(LogLevel::Debug)) {
+                std::cout << "Duplicate message with UUID: " << uuid << " ignored." << std::endl;
+            }
+            return Opcode::Published;
         }
     }
+
+    if (!deferPublish(shared)) {
+        publishNow(shared, backpressure, quorum);
+    }
+    return Opcode::Published;
+}
+
+void Server::publishNow(const std::shared_ptr<SharedMessage>& message, bool& backpressure,
+                        const std::shared_ptr<PendingPublish>& quorum) {
+    std::string_view topic = message->topic();
+    uint16_t partition = message->partition();
+    Delivery delivery;
+    FlowDeliveries flow;
+    DeliveryTurn turn;
+    topics.withTopic(topic, partition, [&](TopicState& state) {
+        uint64_t first = state.log.endOffset();
+        appendToLog(state, topic, partition, message, TopicLog::Clock::now());
+        replicate(state, topic, partition, first, quorum);
+        delivery = deliveryTargets(state, topic);
+        backpressure = drainFlowSubscribers(state, topic, partition, flow);
+        turn.take(state.deliveryOrder);
+    });
+    Metrics::add(Metrics::MessagesPublished);
+    FlowDeliveries held;
+    turn.wait();
+    fanOut(delivery, message, &held);
+    for (const auto& entry : flow) {
+        deliver(entry.first, entry.second, &held);
+    }
+    turn.release();
+    for (const auto& entry : held) {
+        deliver(entry.first, entry.second);
+    }
 }
 
-void Server::publish(const std::string& topic, const std::string& message, const std::string& uuid) {
-    std::lock_guard<std::mutex> lock(mtx);
+// Holds a message with a "delay" attribute on a timer, after it has passed
+// deduplication, so a retried publish is still dropped. Returns false for a
+// message to publish now. A quorum publish of a delayed message is answered
+// once the message is held, without waiting for its followers.
+bool Server::deferPublish(const std::shared_ptr<SharedMessage>& message) {
+    if (message->delay().count() <= 0) {
+        return false;
+    }
+    timers.schedule(message->delay(), [this, message] {
+        bool backpressure;
+        publishNow(message, backpressure);
+    });
+    return true;
+}
+
+Opcode Server::publishBatch(std::string_view batch, bool withAttributes, bool& backpressure, RemoteMessages* remote,
+                            const std::shared_ptr<PendingPublish>& quorum) {
+    // Decode and encode every entry before touching shared state, so a
+    // malformed or oversized batch is rejected as a whole.
+    BatchReader reader(batch);
+    std::vector<std::shared_ptr<SharedMessage>> messages;
+    messages.reserve(std::min<size_t>(reader.count(), batch.size() / WIRE_BATCH_ENTRY_HEADER_SIZE));
+    BatchEntryView entry;
+    while (reader.next(entry)) {
+        AttributesView attributes;
+        std::string_view body = entry.payload;
+        if (withAttributes && !AttributesView::split(entry.payload, attributes, body)) {
+            return Opcode::Invalid;
+        }
+        char uuidText[WIRE_UUID_TEXT_SIZE];
+        formatUuid(entry.uuid, uuidText);
+        uint16_t partition = remote ? choosePartition(entry.topic, entry.keyHash)
+                                    : forwardedPartition(config.partitions, entry.topic, entry.keyHash);
+        auto shared = SharedMessage::create(entry.topic, body, std::string_view(uuidText, WIRE_UUID_TEXT_SIZE),
+                                            partition, attributes.raw());
+        if (!shared) {
+            std::cerr << "Message on topic " << entry.topic << " exceeds the frame size limits, batch rejected"
+                      << std::endl;
+            return Opcode::Invalid;
+        }
+        messages.push_back(std::move(shared));
+    }
+    if (!reader.valid()) {
+        return Opcode::Invalid;
+    }
+
+    if (!remote) {
+        for (const auto& message : messages) {
+            if (!cluster.owns(message->topic(), message->partition())) {
+                return Opcode::Unavailable;
+            }
+        }
+    } else {
+        messages.erase(std::remove_if(messages.begin(), messages.end(), [&](const std::shared_ptr<SharedMessage>& message) {
+            if (cluster.owns(message->topic(), message->partition())) {
+                return false;
+            }
+            remote->push_back(message);
+            return true;
+        }), messages.end());
+    }
+
+    {
+        auto now = DedupWindow::Clock::now();
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        messages.erase(std::remove_if(messages.begin(), messages.end(), [&](const std::shared_ptr<SharedMessage>& message) {
+            if (!isDuplicate(recentIds, *message, !remote, now)) {
+                return false;
+            }
+            Metrics::add(Metrics::DedupHits);
+            if (logEnabled(LogLevel::Debug)) {
+                std::cout << "Duplicate message with UUID: " << message->uuid() << " ignored." << std::endl;
+            }
+            return true;
+        }), messages.end());
+    }
+
+    messages.erase(std::remove_if(messages.begin(), messages.end(), [&](const std::shared_ptr<SharedMessage>& message) {
+        return deferPublish(message);
+    }), messages.end());
+
+    // Group by topic partition, keeping publish order within each, so every
+    // partition's shard lock is taken once per batch rather than once per message.
+    using PartitionRef = std::pair<std::string_view, uint16_t>;
+    std::vector<std::pair<PartitionRef, std::vector<std::shared_ptr<SharedMessage>>>> batches;
+    std::map<PartitionRef, size_t> batchIndex;
+    for (auto& message : messages) {
+        PartitionRef ref(message->topic(), message->partition());
+        auto inserted = batchIndex.emplace(ref, batches.size());
+        if (inserted.second) {
+            batches.emplace_back(ref, std::vector<std::shared_ptr<SharedMessage>>());
+        }
+        batches[inserted.first->second].second.push_back(std::move(message));
+    }
 
-    // Check if the message with this UUID has already been processed
-    if (processedUUIDs.find(uuid) != processedUUIDs.end()) {
-        std::cout << "Duplicate message with UUID: " << uuid << " ignored." << std::endl;
+    Delivery delivery;
+    FlowDeliveries flow;
+    for (const auto& batch : batches) {
+        std::string_view topic = batch.first.first;
+        uint16_t partition = batch.first.second;
+        flow.clear();
+        DeliveryTurn turn;
+        topics.withTopic(topic, partition, [&](TopicState& state) {
+            auto now = TopicLog::Clock::now();
+            uint64_t first = state.log.endOffset();
+            for (const auto& message : batch.second) {
+                appendToLog(state, topic, partition, message, now);
+            }
+            replicate(state, topic, partition, first, quorum);
+            delivery = deliveryTargets(state, topic);
+            backpressure = drainFlowSubscribers(state, topic, partition, flow) || backpressure;
+            turn.take(state.deliveryOrder);
+        });
+        Metrics::add(Metrics::MessagesPublished, batch.second.size());
+        FlowDeliveries held;
+        turn.wait();
+        for (const auto& message : batch.second) {
+            fanOut(delivery, message, &held);
+        }
+        for (const auto& entry : flow) {
+            deliver(entry.first, entry.second, &held);
+        }
+        turn.release();
+        for (const auto& entry : held) {
+            deliver(entry.first, entry.second);
+        }
+    }
+    return Opcode::Published;
+}
+
+// Runs under the topic's shard lock, which keeps memory and disk offsets in step.
+void Server::appendToLog(TopicState& state, std::string_view topic, uint16_t partition,
+                         const std::shared_ptr<SharedMessage>& message, TopicLog::Clock::time_point now) {
+    message->setOffset(state.log.endOffset());
+    uint64_t offset = state.log.append(message, now);
+    if (message->expiresAt() != TopicLog::Clock::time_point::max() || state.expiryTimer != 0) {
+        scheduleExpiry(state, topic, partition);
+    }
+    if (!logStore) {
         return;
     }
+    if (!state.store) {
+        state.store = logStore->openTopic(std::string(topic), partition);
+    }
+    if (state.store && state.store->endOffset() > offset) {
+        return; // a replica synced again over what it already stored
+    }
+    if (!state.store || !state.store->append(offset, *message)) {
+        std::cerr << "Failed to persist message at offset " << offset << " of topic " << topic
+                  << " partition " << partition << std::endl;
+    }
+}
 
-    // Add the UUID to the set of processed UUIDs
-    processedUUIDs.insert(uuid);
+void Server::fanOut(const Delivery& delivery, const SharedMessagePtr& message, FlowDeliveries* held) {
+    if (message->expired()) {
+        return; // held back by a delay past its TTL
+    }
+    // Fan-out happens outside the topic lock: each subscriber only gets a
+    // reference to the shared frame appended to its own outbound queue.
+    for (const auto& target : delivery.targets) {
+        deliver(target, message, held);
+    }
+    // Each distinct filter runs once, for all the subscribers that share it.
+    for (const auto& group : delivery.filtered) {
+        if (!group.filter->matches(*message)) {
+            continue;
+        }
+        for (const auto& target : group.subscribers) {
+            deliver(target, message, held);
+        }
+    }
+}
+
+void Server::deliver(const std::shared_ptr<Connection>& target, const SharedMessagePtr& message,
+                     FlowDeliveries* held) {
+    // Once one message for a connection is held back, the rest follow it.
+    bool behind = held && std::any_of(held->begin(), held->end(), [&](const FlowDeliveries::value_type& entry) {
+        return entry.first == target;
+    });
+    EnqueueResult result = behind ? EnqueueResult::WouldBlock
+                                  : target->enqueue(message->frameFor(target->binary), false,
+                                                    FrameKind::Notification, held == nullptr);
+    if (result == EnqueueResult::WouldBlock) {
+        held->emplace_back(target, message);
+        return;
+    }
+    if (result != EnqueueResult::Disconnected) {
+        Metrics::add(Metrics::MessagesDelivered);
+    }
+    if (!logEnabled(LogLevel::Warn)) {
+        return;
+    }
+    if (result == EnqueueResult::Dropped) {
+        std::cerr << "Outbound queue full for client " << target->fd << ", dropped oldest message" << std::endl;
+    } else if (result == EnqueueResult::Disconnected) {
+        std::cerr << "Client " << target->fd << " disconnected or too slow, notification dropped" << std::endl;
+    }
+}
+
+// A publish request answered only once other members are done with it: its
+// messages on partitions they lead were forwarded to them, or it asked for a
+// quorum and waits on followers. It is answered when the last of them is
+// done, with the worst response, or on timeout.
+struct PendingPublish {
+    std::mutex mtx;
+    std::weak_ptr<Connection> client;
+    std::string topic;
+    uint64_t sequence = 0;
+    bool binary = false;
+    size_t outstanding = 1; // the request itself, until it has started everything it waits on
+    Opcode response = Opcode::Published;
+    bool backpressure = false;
+    std::atomic<bool> finished{false};
+    std::atomic<uint64_t> timer{0};
+};
+
+static std::string publishResponse(Opcode response, std::string_view topic, uint64_t sequence, bool binary,
+                                   bool backpressure) {
+    if (binary) {
+        return binaryResponse(response, topic, sequence, "", backpressure ? WIRE_FLAG_BACKPRESSURE : 0);
+    }
+    if (response == Opcode::Invalid) {
+        return "INVALID_COMMAND\n";
+    }
+    return std::string(opcodeName(response)) + ":" + std::string(topic) + "\n";
+}
+
+void Server::answerPublish(Connection& connection, std::string_view topic, uint64_t sequence, bool binary,
+                           Opcode response, bool backpressure, const RemoteMessages& remote,
+                           std::shared_ptr<PendingPublish> pending, bool quorum) {
+    if (!pending && remote.empty()) {
+        reply(connection, publishResponse(response, topic, sequence, binary, backpressure));
+        return;
+    }
+    if (!pending) {
+        pending = startPublish(connection, topic, sequence, binary);
+    }
+    forwardPublishes(remote, quorum, pending);
+    if (quorum) {
+        pending->timer = timers.schedule(std::chrono::milliseconds(config.cluster.replicationTimeoutMs), [this, pending] {
+            settlePublish(pending, Opcode::Unavailable, false, true);
+        });
+    }
+    settlePublish(pending, response, backpressure);
+}
 
-    messages[topic].push_back(std::make_pair(message, uuid));
-    for (int subscriber : subscriptions[topic]) {
-        std::string notification = "MESSAGE:" + topic + ":" + message + ":" + uuid + "\n";
-        send(subscriber, notification.c_str(), notification.length(), 0);
+std::shared_ptr<PendingPublish> Server::startPublish(Connection& connection, std::string_view topic,
+                                                     uint64_t sequence, bool binary) {
+    auto publish = std::make_shared<PendingPublish>();
+    publish->client = connection.shared_from_this();
+    publish->topic.assign(topic.data(), topic.size());
+    publish->sequence = sequence;
+    publish->binary = binary;
+    return publish;
+}
+
+void Server::settlePublish(const std::shared_ptr<PendingPublish>& publish, Opcode response, bool backpressure,
+                           bool force) {
+    std::string frame;
+    {
+        std::lock_guard<std::mutex> lock(publish->mtx);
+        if (publish->finished) {
+            return;
+        }
+        if (response != Opcode::Published && publish->response != Opcode::Unavailable) {
+            publish->response = response;
+        }
+        publish->backpressure = publish->backpressure || backpressure;
+        if (!force && --publish->outstanding > 0) {
+            return;
+        }
+        publish->finished = true;
+        frame = publishResponse(publish->response, publish->topic, publish->sequence, publish->binary,
+                                publish->backpressure);
+    }
+    timers.cancel(publish->timer.exchange(0));
+    std::shared_ptr<Connection> connection = publish->client.lock();
+    if (connection) {
+        connection->enqueue(std::make_shared<const std::string>(std::move(frame)));
     }
 }
 
-std::vector<std::string> Server::getMessages(int clientId, const std::string& topic) {
-    std::lock_guard<std::mutex> lock(mtx);
-    std::vector<std::string> newMessages;
+// Messages this member leads are already published; the rest go to their
+// leaders, one batch per leader.
+void Server::forwardPublishes(const RemoteMessages& remote, bool quorum, const std::shared_ptr<PendingPublish>& pending) {
+    std::map<size_t, RemoteMessages> byLeader;
+    for (const auto& message : remote) {
+        byLeader[cluster.leaderOf(message->topic(), message->partition())].push_back(message);
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending->mtx);
+        pending->outstanding += byLeader.size();
+    }
+    for (const auto& leader : byLeader) {
+        cluster.forward(leader.first, leader.second, quorum, [this, pending](Opcode response, bool backpressure) {
+            settlePublish(pending, response, backpressure);
+        });
+    }
+}
 
-    size_t& lastReadIndex = clientMessageIndices[clientId][topic];
-    size_t currentSize = messages[topic].size();
+// Responses, pushed messages and replication on a link this member opened.
+void Server::handleLinkFrame(const FrameView& frame, Connection& link) {
+    switch (frame.header.opcode) {
+        case Opcode::Published:
+        case Opcode::Invalid:
+        case Opcode::Unavailable:
+            cluster.complete(link, frame.header.sequence, frame.header.opcode,
+                             (frame.header.flags & WIRE_FLAG_BACKPRESSURE) != 0);
+            break;
+        case Opcode::Message:
+            relay(frame);
+            break;
+        case Opcode::Replicate:
+            applyReplica(frame, link);
+            break;
+        case Opcode::Peer: {
+            // The other member has synced this one's copies of its partitions.
+            uint64_t member;
+            if (parseTextOffset(frame.payload, member) && member < cluster.size() && cluster.synced(member)) {
+                reportReady(cluster);
+            }
+            break;
+        }
+        default:
+            break; // SUBSCRIBED and UNSUBSCRIBED
+    }
+}
+
+// Fans a message another member leads out to this member's clients. It is not
+// logged here: FETCH and log-backed subscriptions are served by the leader,
+// or from this member's replica if it follows the partition.
+// Links are left out, so a message never travels on from a member that did
+// not publish it.
+void Server::relay(const FrameView& frame) {
+    AttributesView attributes;
+    std::string_view body = frame.payload;
+    if ((frame.header.flags & WIRE_FLAG_ATTRIBUTES) && !AttributesView::split(frame.payload, attributes, body)) {
+        std::cerr << "Malformed message on topic " << frame.topic << " from a cluster member, dropped" << std::endl;
+        return;
+    }
+    char uuidText[WIRE_UUID_TEXT_SIZE];
+    formatUuid(frame.header.uuid, uuidText);
+    std::shared_ptr<SharedMessage> message = SharedMessage::create(frame.topic, body,
+                                                                   std::string_view(uuidText, WIRE_UUID_TEXT_SIZE),
+                                                                   frame.header.partition, attributes.raw());
+    if (!message) {
+        return;
+    }
+    message->setOffset(frame.header.sequence);
+
+    Delivery delivery;
+    bool known = topics.withExistingTopic(frame.topic, frame.header.partition, [&](TopicState& state) {
+        delivery = deliveryTargets(state, frame.topic);
+        return false;
+    });
+    if (!known) {
+        delivery.targets = patterns.match(frame.topic); // only patterns want it
+    }
+    auto& targets = delivery.targets;
+    targets.erase(std::remove_if(targets.begin(), targets.end(), [](const std::shared_ptr<Connection>& target) {
+        return target->peer.load();
+    }), targets.end());
+    fanOut(delivery, message);
+}
+
+// Runs on the first reactor, which owns every link.
+void Server::connectPeer(size_t member) {
+    if (!running) {
+        return;
+    }
+    // A link that cannot keep up is closed and reopened rather than silently
+    // dropping forwarded publishes.
+    OutboundQueueConfig limits = config.outbound;
+    limits.policy = OverflowPolicy::Disconnect;
+    const ClusterMember& peer = cluster.member(member);
+    std::shared_ptr<Connection> link = reactors.front()->connectTo(memberAddresses[member], limits);
+    if (!link) {
+        if (cluster.synced(member)) {
+            reportReady(cluster);
+        }
+        timers.schedule(std::chrono::milliseconds(config.cluster.reconnectMs), [this, member] { connectPeer(member); });
+        return;
+    }
+    link->link = true;
+    link->binary = true;
+    cluster.attach(member, link);
+    if (logEnabled(LogLevel::Info)) {
+        std::cout << "Linking to cluster member " << member << " at " << peer.host << ":" << peer.port << std::endl;
+    }
+}
+
+// Another member's link. What it publishes is not forwarded again, and what
+// it subscribes to is not registered with other members. With replication it
+// also follows the partitions this member leads that it has replicas of, and
+// those are synced to it now. A member announcing it is ready again on the
+// same link is only marked ready.
+void Server::admitPeer(Connection& connection, std::string_view memberId, uint8_t flags) {
+    connection.peer = true;
+    connection.binary = true;
+    uint64_t member;
+    if (!parseTextOffset(memberId, member) || member >= cluster.size() || member == cluster.self()) {
+        std::cerr << "Cluster link from unknown member " << memberId << std::endl;
+        return;
+    }
+    bool isReady = (flags & WIRE_FLAG_READY) != 0;
+    if (logEnabled(LogLevel::Info)) {
+        std::cout << "Cluster member " << member << (isReady ? " linked, ready" : " linked") << std::endl;
+    }
+    if (!cluster.replicating()) {
+        return;
+    }
+    uint64_t session;
+    bool known = cluster.followerOf(connection, session) == member;
+    if (!known) {
+        session = cluster.addFollower(member, connection.shared_from_this());
+    }
+    // Marked first, so the partitions it leads from now on are not synced to it.
+    cluster.setReady(member, isReady);
+    if (!known) {
+        syncFollower(connection, member, session);
+    }
+}
+
+static uint64_t oldestOffset(TopicState& state) {
+    return state.store ? state.store->startOffset() : state.log.startOffset();
+}
+
+// Reads up to maxMessages starting at offset, which is first clamped to the
+// retained range. Offsets the in-memory log no longer holds are served from
+// disk, a bounded number per call so one request cannot pull a whole segment
+// set into memory. Returns the offset after the last message read.
+static uint64_t readLog(TopicState& state, uint64_t& offset, size_t maxMessages, std::vector<SharedMessagePtr>& out) {
+    offset = std::min(std::max(offset, oldestOffset(state)), state.log.endOffset());
+    uint64_t next = offset;
+    if (state.store && next < state.log.startOffset()) {
+        size_t behind = static_cast<size_t>(state.log.startOffset() - next);
+        next = state.store->read(next, std::min({behind, maxMessages, size_t(MAX_DISK_READ_MESSAGES)}), out);
+        if (next < state.log.startOffset()) {
+            return next;
+        }
+    }
+    return state.log.read(next, maxMessages - static_cast<size_t>(next - offset), out);
+}
+
+static ReplicaProgress& progressFor(TopicState& state, size_t member) {
+    for (auto& progress : state.replicas) {
+        if (progress.member == member) {
+            return progress;
+        }
+    }
+    state.replicas.emplace_back();
+    state.replicas.back().member = member;
+    return state.replicas.back();
+}
+
+// Runs under the topic's shard lock, after this member, as the partition's
+// leader, appended everything from first on. The followers that had the rest
+// of the log get the new messages now; the others catch up as they
+// acknowledge. A follower that linked in since the last append gets the whole
+// log instead, since its copy may hold anything. A quorum publish then waits
+// for enough of them to hold its messages.
+void Server::replicate(TopicState& state, std::string_view topic, uint16_t partition, uint64_t first,
+                       const std::shared_ptr<PendingPublish>& quorum) {
+    if (!cluster.replicating()) {
+        return;
+    }
+    std::vector<size_t> replicas = cluster.replicasOf(topic, partition);
+    for (size_t member : replicas) {
+        uint64_t session;
+        std::shared_ptr<Connection> follower = member == cluster.self() ? nullptr : cluster.follower(member, session);
+        if (!follower) {
+            continue;
+        }
+        ReplicaProgress& progress = progressFor(state, member);
+        if (progress.session != session) {
+            progress = ReplicaProgress();
+            progress.member = member;
+            progress.session = session;
+            progress.sent = oldestOffset(state);
+            sendReplica(state, topic, partition, progress, *follower, true);
+        } else if (progress.sent == first) {
+            sendReplica(state, topic, partition, progress, *follower, false);
+        }
+    }
+    if (!quorum || Cluster::quorumFollowers(replicas.size()) == 0) {
+        return;
+    }
+    while (!state.quorumWaits.empty() && state.quorumWaits.front().publish->finished) {
+        state.quorumWaits.pop_front(); // timed out
+    }
+    {
+        std::lock_guard<std::mutex> lock(quorum->mtx);
+        ++quorum->outstanding;
+    }
+    state.quorumWaits.push_back(QuorumWait{state.log.endOffset(), quorum});
+}
+
+// Runs under the topic's shard lock. Sends the follower the stretch of the log
+// from progress.sent on, as much as fits in one REPLICATE. With sync the frame
+// goes out even if it is empty, so the follower's copy starts where the log
+// does; so does one the follower fell behind retention for.
+void Server::sendReplica(TopicState& state, std::string_view topic, uint16_t partition, ReplicaProgress& progress,
+                         Connection& follower, bool sync) {
+    if (!sync && progress.sent >= state.log.endOffset()) {
+        return;
+    }
+    std::vector<SharedMessagePtr> messages;
+    uint64_t first = progress.sent;
+    readLog(state, first, MAX_FETCH_MESSAGES, messages);
+    sync = sync || first != progress.sent;
+
+    size_t count = 0;
+    size_t size = WIRE_REPLICA_OFFSET_SIZE;
+    while (count < messages.size() && (count == 0 || size + messages[count]->size() <= MAX_REPLICA_BYTES)) {
+        size += messages[count++]->size();
+    }
+    std::string payload(size, '\0');
+    encodeReplicaOffset(first, &payload[0]);
+    size_t offset = WIRE_REPLICA_OFFSET_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        std::shared_ptr<const std::string> frame = messages[i]->binaryFrame();
+        memcpy(&payload[offset], frame->data(), frame->size());
+        offset += frame->size();
+    }
+    // Lost frames are noticed by the next one, which then starts past the
+    // end of the follower's copy (see applyReplica()).
+    follower.enqueue(std::make_shared<const std::string>(
+        binaryResponse(Opcode::Replicate, topic, 0, payload, sync ? WIRE_FLAG_SYNC : 0, partition)));
+    progress.sent = first + count;
+}
+
+// Sends a member that just linked in everything it keeps of the partitions
+// this member leads. It is told so with a PEER once the last of them is sent,
+// which may take a few round trips for long logs.
+void Server::syncFollower(Connection& connection, size_t member, uint64_t session) {
+    topics.forEachMutable([&](const TopicKey& key, TopicState& state) {
+        if (!cluster.owns(key.topic, key.partition)) {
+            return;
+        }
+        std::vector<size_t> replicas = cluster.replicasOf(key.topic, key.partition);
+        if (std::find(replicas.begin(), replicas.end(), member) == replicas.end()) {
+            return;
+        }
+        ReplicaProgress& progress = progressFor(state, member);
+        progress = ReplicaProgress();
+        progress.member = member;
+        progress.session = session;
+        progress.sent = oldestOffset(state);
+        sendReplica(state, key.topic, key.partition, progress, connection, true);
+        if (progress.sent < state.log.endOffset()) {
+            progress.syncing = true;
+            cluster.beginSync(member, session);
+        }
+    });
+    if (cluster.endSync(member, session)) {
+        reply(connection, binaryResponse(Opcode::Peer, "", 0, std::to_string(cluster.self())));
+    }
+}
+
+// A follower reporting the end of its copy of a partition this member leads.
+// It is sent the next stretch it lacks, from where it says its copy ends if
+// it found a gap.
+void Server::replicated(Connection& connection, std::string_view topic, uint16_t partition, uint8_t flags,
+                        std::string_view payload) {
+    uint64_t end, session;
+    std::string_view rest;
+    size_t member = cluster.followerOf(connection, session);
+    if (member == cluster.size() || !decodeReplicaOffset(payload, end, rest)) {
+        return;
+    }
+    bool synced = false;
+    topics.withExistingTopic(topic, partition, [&](TopicState& state) {
+        auto progress = std::find_if(state.replicas.begin(), state.replicas.end(), [&](const ReplicaProgress& entry) {
+            return entry.member == member && entry.session == session;
+        });
+        if (progress == state.replicas.end()) {
+            return false;
+        }
+        if (flags & WIRE_FLAG_RESEND) {
+            // Every frame after a lost one reports the same gap.
+            if (progress->resendFrom == end) {
+                return false;
+            }
+            progress->resendFrom = end;
+            progress->sent = end;
+        }
+        progress->acked = end;
+        sendReplica(state, topic, partition, *progress, connection, false);
+        if (progress->syncing && progress->sent >= state.log.endOffset()) {
+            progress->syncing = false;
+            synced = cluster.endSync(member, session);
+        }
+        settleQuorum(state, topic, partition);
+        return false;
+    });
+    if (synced) {
+        reply(connection, binaryResponse(Opcode::Peer, "", 0, std::to_string(cluster.self())));
+    }
+}
+
+// Runs under the topic's shard lock. Answers the quorum publishes whose
+// messages every in-sync follower now holds: every one that is linked and
+// ready, so whichever of them takes over has them. Too few in-sync followers
+// for a majority leaves the publishes to time out.
+void Server::settleQuorum(TopicState& state, std::string_view topic, uint16_t partition) {
+    if (state.quorumWaits.empty()) {
+        return;
+    }
+    std::vector<size_t> replicas = cluster.replicasOf(topic, partition);
+    size_t inSync = 0;
+    uint64_t held = UINT64_MAX;
+    for (const auto& progress : state.replicas) {
+        uint64_t session;
+        if (progress.member == cluster.self() || !cluster.ready(progress.member)
+                || std::find(replicas.begin(), replicas.end(), progress.member) == replicas.end()
+                || !cluster.follower(progress.member, session) || session != progress.session) {
+            continue;
+        }
+        ++inSync;
+        held = std::min(held, progress.acked);
+    }
+    if (inSync < Cluster::quorumFollowers(replicas.size())) {
+        return;
+    }
+    while (!state.quorumWaits.empty() && state.quorumWaits.front().end <= held) {
+        settlePublish(state.quorumWaits.front().publish, Opcode::Published, false);
+        state.quorumWaits.pop_front();
+    }
+}
+
+// A REPLICATE from the leader of a partition this member follows. The copy is
+// extended with the messages it does not have yet, or replaced on SYNC, and
+// its new end is reported back. Replicas are not fanned out to subscribers,
+// which get the leader's messages pushed, but flow-controlled and acknowledged
+// subscriptions here read them. A frame that starts past the end of the copy
+// asks for a resend instead.
+void Server::applyReplica(const FrameView& frame, Connection& link) {
+    uint64_t first;
+    std::string_view entries;
+    if (!decodeReplicaOffset(frame.payload, first, entries)) {
+        std::cerr << "Malformed replica of topic " << frame.topic << " from a cluster member, dropped" << std::endl;
+        return;
+    }
+    std::string_view topic = frame.topic;
+    uint16_t partition = frame.header.partition;
+    if (partition >= config.partitions.countFor(topic)) {
+        std::cerr << "Replica of unknown partition " << partition << " of topic " << topic
+                  << " from a cluster member, dropped" << std::endl;
+        return;
+    }
+    std::vector<std::shared_ptr<SharedMessage>> messages;
+    while (!entries.empty()) {
+        FrameView entry;
+        size_t consumed;
+        AttributesView attributes;
+        if (decodeFrame(entries.data(), entries.size(), entry, consumed) != DecodeResult::Ok) {
+            std::cerr << "Malformed replica of topic " << topic << " from a cluster member, dropped" << std::endl;
+            return;
+        }
+        entries.remove_prefix(consumed);
+        std::string_view body = entry.payload;
+        if ((entry.header.flags & WIRE_FLAG_ATTRIBUTES) && !AttributesView::split(entry.payload, attributes, body)) {
+            std::cerr << "Malformed replica of topic " << topic << " from a cluster member, dropped" << std::endl;
+            return;
+        }
+        char uuidText[WIRE_UUID_TEXT_SIZE];
+        formatUuid(entry.header.uuid, uuidText);
+        auto message = SharedMessage::create(topic, body, std::string_view(uuidText, WIRE_UUID_TEXT_SIZE), partition,
+                                             attributes.raw());
+        if (!message) {
+            return;
+        }
+        messages.push_back(std::move(message));
+    }
 
-    for (size_t i = lastReadIndex; i < currentSize; ++i) {
-        const auto& pair = messages[topic][i];
-        newMessages.push_back(pair.first + ":" + pair.second); // message:uuid
+    bool gap = false;
+    uint64_t end = 0;
+    size_t skipped = 0;
+    FlowDeliveries flow;
+    DeliveryTurn turn;
+    topics.withTopic(topic, partition, [&](TopicState& state) {
+        if (frame.header.flags & WIRE_FLAG_SYNC) {
+            state.log.resetOffset(first);
+            state.replicas.clear();
+        }
+        end = state.log.endOffset();
+        if (first > end) {
+            gap = true;
+            return;
+        }
+        auto now = TopicLog::Clock::now();
+        skipped = static_cast<size_t>(std::min<uint64_t>(end - first, messages.size()));
+        for (size_t i = skipped; i < messages.size(); ++i) {
+            appendToLog(state, topic, partition, messages[i], now);
+        }
+        end = state.log.endOffset();
+        drainFlowSubscribers(state, topic, partition, flow);
+        turn.take(state.deliveryOrder);
+    });
+    if (!gap) {
+        Metrics::add(Metrics::MessagesReplicated, messages.size() - skipped);
+        // Retries of these publishes are still dropped after a takeover.
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        for (size_t i = skipped; i < messages.size(); ++i) {
+            DedupKey key = dedupKeyFromText(messages[i]->uuid());
+            if (!key.isZero()) {
+                recentIds.insert(key);
+            }
+        }
+    }
+    FlowDeliveries held;
+    turn.wait();
+    for (const auto& entry : flow) {
+        deliver(entry.first, entry.second, &held);
+    }
+    turn.release();
+    for (const auto& entry : held) {
+        deliver(entry.first, entry.second);
     }
 
-    lastReadIndex = currentSize;
+    char position[WIRE_REPLICA_OFFSET_SIZE];
+    encodeReplicaOffset(end, position);
+    reply(link, binaryResponse(Opcode::Replicated, topic, 0, std::string_view(position, sizeof(position)),
+                               gap ? WIRE_FLAG_RESEND : 0, partition));
+}
 
-    // Only remove messages that have been read by all subscribed clients
-    bool canRemoveMessages = true;
-    for (const auto& clientIndices : clientMessageIndices) {
-        if (clientIndices.second.count(topic) > 0 && clientIndices.second.at(topic) < currentSize) {
-            canRemoveMessages = false;
+// Runs under the topic's shard lock. Reads the messages the subscriber has
+// credit for; the rest wait in the log for the next grant. Messages its filter
+// rejects, and expired ones, are skipped without using credit. An acknowledged subscriber also
+// waits while it has maxUnacked messages outstanding, until ACKs make room.
+// Returns how many messages the subscriber is behind the end of the log.
+uint64_t Server::drainFlow(TopicState& state, FlowSubscriber& subscriber, std::string_view topic,
+                           uint16_t partition, FlowDeliveries& out) {
+    std::vector<SharedMessagePtr> messages;
+    while (subscriber.next < state.log.endOffset()) {
+        messages.clear();
+        uint64_t first = subscriber.next;
+        uint64_t next = readLog(state, first, MAX_FETCH_MESSAGES, messages);
+        subscriber.next = first; // retention may have dropped older messages
+        for (const auto& message : messages) {
+            if ((subscriber.filter && !subscriber.filter->matches(*message)) || message->expired()) {
+                ++subscriber.next;
+                continue;
+            }
+            if (subscriber.acked && subscriber.unacked.size() >= config.maxUnacked) {
+                return state.log.endOffset() - subscriber.next;
+            }
+            if (subscriber.connection->flowControlled() && !subscriber.connection->takeCredit(message->size())) {
+                subscriber.connection->markStarved(std::string(topic), partition);
+                return state.log.endOffset() - subscriber.next;
+            }
+            out.emplace_back(subscriber.connection, message);
+            if (subscriber.acked) {
+                trackUnacked(subscriber, topic, partition, message->offset());
+            }
+            ++subscriber.next;
+        }
+        if (next == first) {
             break;
         }
     }
+    return state.log.endOffset() - subscriber.next;
+}
+
+// Runs under the topic's shard lock. Returns whether the subscribers' combined
+// lag has reached the backpressure threshold.
+bool Server::drainFlowSubscribers(TopicState& state, std::string_view topic, uint16_t partition,
+                                  FlowDeliveries& out) {
+    uint64_t lag = 0;
+    for (auto& subscriber : state.flowSubscribers) {
+        lag += drainFlow(state, subscriber, topic, partition, out);
+    }
+    return config.backpressureLag > 0 && lag >= config.backpressureLag;
+}
 
-    if (canRemoveMessages) {
-        messages[topic].clear();
-        for (auto& clientIndices : clientMessageIndices) {
-            clientIndices.second[topic] = 0;
+// Resumes the topic partitions that ran dry, now that there is credit again.
+void Server::grantCredit(Connection& connection, uint32_t messages, uint32_t bytes) {
+    connection.grantCredit(messages, bytes);
+    for (const auto& starved : connection.takeStarved()) {
+        FlowDeliveries flow;
+        DeliveryTurn turn;
+        topics.withExistingTopic(starved.first, starved.second, [&](TopicState& state) {
+            for (auto& subscriber : state.flowSubscribers) {
+                if (subscriber.connection.get() == &connection) {
+                    drainFlow(state, subscriber, starved.first, starved.second, flow);
+                }
+            }
+            turn.take(state.deliveryOrder);
+            return false;
+        });
+        FlowDeliveries held;
+        turn.wait();
+        for (const auto& entry : flow) {
+            deliver(entry.first, entry.second, &held);
+        }
+        turn.release();
+        for (const auto& entry : held) {
+            deliver(entry.first, entry.second);
         }
     }
+}
+
+// Every message of an acknowledged subscription before this offset has been
+// acknowledged or skipped by its filter.
+static uint64_t acknowledgedUpTo(const FlowSubscriber& subscriber) {
+    return subscriber.unacked.empty() ? subscriber.next : subscriber.unacked.begin()->first;
+}
+
+// Acknowledged offsets are forgotten, and the consumer's cursor moves up to
+// the oldest message still unacknowledged, which is where a new subscription
+// under the same name would start again. The room this makes is filled at once.
+void Server::acknowledge(Connection& connection, std::string_view topic, uint16_t partition,
+                         const std::vector<uint64_t>& offsets, bool cumulative) {
+    FlowDeliveries flow;
+    DeliveryTurn turn;
+    topics.withExistingTopic(topic, partition, [&](TopicState& state) {
+        turn.take(state.deliveryOrder);
+        for (auto& subscriber : state.flowSubscribers) {
+            if (subscriber.connection.get() != &connection || !subscriber.acked) {
+                continue;
+            }
+            auto& unacked = subscriber.unacked;
+            if (cumulative) {
+                auto end = unacked.lower_bound(offsets.front());
+                for (auto it = unacked.begin(); it != end; ++it) {
+                    timers.cancel(it->second);
+                }
+                unacked.erase(unacked.begin(), end);
+            } else {
+                for (uint64_t offset : offsets) {
+                    auto it = unacked.find(offset);
+                    if (it != unacked.end()) {
+                        timers.cancel(it->second);
+                        unacked.erase(it);
+                    }
+                }
+            }
+            commitCursor(state, subscriber.consumer, acknowledgedUpTo(subscriber));
+            drainFlow(state, subscriber, topic, partition, flow);
+        }
+        return false;
+    });
+    FlowDeliveries held;
+    turn.wait();
+    for (const auto& entry : flow) {
+        deliver(entry.first, entry.second, &held);
+    }
+    turn.release();
+    for (const auto& entry : held) {
+        deliver(entry.first, entry.second);
+    }
+}
+
+// Runs under the topic's shard lock.
+void Server::trackUnacked(FlowSubscriber& subscriber, std::string_view topic, uint16_t partition, uint64_t offset) {
+    uint64_t timer = 0;
+    if (config.ackTimeoutMs > 0) {
+        std::weak_ptr<Connection> target = subscriber.connection;
+        timer = timers.schedule(std::chrono::milliseconds(config.ackTimeoutMs),
+                                [this, target, topic = std::string(topic), partition, offset] {
+                                    redeliver(target, topic, partition, offset);
+                                });
+    }
+    subscriber.unacked[offset] = timer;
+}
+
+// Pushes a message again if the subscriber still has not acknowledged it, and
+// starts a new timer for it. A message that expired or that retention dropped
+// in the meantime cannot be redelivered and counts as acknowledged.
+void Server::redeliver(const std::weak_ptr<Connection>& target, const std::string& topic, uint16_t partition,
+                       uint64_t offset) {
+    std::shared_ptr<Connection> connection = target.lock();
+    if (!connection || connection->closeRequested()) {
+        return;
+    }
+    FlowDeliveries flow;
+    topics.withExistingTopic(topic, partition, [&](TopicState& state) {
+        for (auto& subscriber : state.flowSubscribers) {
+            if (subscriber.connection != connection || !subscriber.acked) {
+                continue;
+            }
+            auto it = subscriber.unacked.find(offset);
+            if (it == subscriber.unacked.end()) {
+                continue;
+            }
+            std::vector<SharedMessagePtr> messages;
+            uint64_t first = offset;
+            readLog(state, first, 1, messages);
+            if (first != offset || messages.empty() || messages.front()->expired()) {
+                std::cerr << "Unacknowledged message at offset " << offset << " of topic " << topic
+                          << " partition " << partition << " is no longer retained" << std::endl;
+                subscriber.unacked.erase(it);
+                commitCursor(state, subscriber.consumer, acknowledgedUpTo(subscriber));
+                continue;
+            }
+            flow.emplace_back(connection, messages.front());
+            trackUnacked(subscriber, topic, partition, offset);
+        }
+        return false;
+    });
+    for (const auto& entry : flow) {
+        deliver(entry.first, entry.second);
+    }
+}
+
+// Runs under the topic's shard lock. Keeps one timer per partition, due when
+// its oldest segment expires. A later segment cannot expire first, because
+// the log only ever drops its oldest, so this is the only deadline needed.
+void Server::scheduleExpiry(TopicState& state, std::string_view topic, uint16_t partition) {
+    TopicLog::Clock::time_point expiry = state.log.oldestExpiry();
+    if (state.expiryTimer != 0) {
+        if (state.expiryTimerAt <= expiry) {
+            return; // the timer fires first and looks again
+        }
+        timers.cancel(state.expiryTimer);
+        state.expiryTimer = 0;
+    }
+    if (expiry == TopicLog::Clock::time_point::max()) {
+        return;
+    }
+    state.expiryTimerAt = expiry;
+    state.expiryTimer = timers.schedule(expiry - TopicLog::Clock::now(), [this, topic = std::string(topic), partition] {
+        expireTopic(topic, partition);
+    });
+}
+
+void Server::expireTopic(const std::string& topic, uint16_t partition) {
+    topics.withExistingTopic(topic, partition, [&](TopicState& state) {
+        state.expiryTimer = 0;
+        state.log.enforceRetention();
+        scheduleExpiry(state, topic, partition);
+        return topicIsUnused(state);
+    });
+}
+
+// Age limits are otherwise only checked when a segment rolls over, which a
+// topic that stopped receiving messages never does, in memory or on disk.
+void Server::sweepRetention() {
+    auto now = TopicLog::Clock::now();
+    topics.forEachMutable([&](const TopicKey&, TopicState& state) {
+        state.log.enforceRetention(now);
+        if (state.store) {
+            state.store->sweepRetention();
+        }
+    });
+    timers.schedule(std::chrono::milliseconds(config.retentionSweepMs), [this] { sweepRetention(); });
+}
+
+void Server::addClient(const std::shared_ptr<Connection>& connection) {
+    if (config.idleTimeoutMs == 0) {
+        return;
+    }
+    connection->lastActivityMs = steadyMs();
+    std::weak_ptr<Connection> target = connection;
+    connection->idleTimer = timers.schedule(std::chrono::milliseconds(config.idleTimeoutMs),
+                                            [this, target] { checkIdle(target); });
+}
+
+// Closes the connection if it has been idle for the whole timeout, or checks
+// again when it would have been.
+void Server::checkIdle(const std::weak_ptr<Connection>& target) {
+    std::shared_ptr<Connection> connection = target.lock();
+    if (!connection || connection->closeRequested() || connection->peer) {
+        return; // quiet links are normal
+    }
+    int64_t idle = steadyMs() - connection->lastActivityMs.load(std::memory_order_relaxed);
+    int64_t timeout = static_cast<int64_t>(config.idleTimeoutMs);
+    if (idle >= timeout) {
+        if (logEnabled(LogLevel::Info)) {
+            std::cout << "Closing client " << connection->fd << " after " << idle << " ms idle" << std::endl;
+        }
+        connection->requestClose();
+        return;
+    }
+    connection->idleTimer = timers.schedule(std::chrono::milliseconds(timeout - idle),
+                                            [this, target] { checkIdle(target); });
+}
+
+std::vector<SharedMessagePtr> Server::getMessages(Connection& connection, const std::string& topic) {
+    std::vector<SharedMessagePtr> newMessages;
+    connection.topics.insert(topic);
+
+    // Each poller only holds an offset per partition; memory is bounded by the
+    // topic's retention limits, not by the slowest (or a dead) poller.
+    for (uint16_t partition = 0; partition < config.partitions.countFor(topic); ++partition) {
+        topics.withTopic(topic, partition, [&](TopicState& state) {
+            state.log.enforceRetention();
+            auto inserted = state.readOffsets.emplace(connection.fd, oldestOffset(state));
+            uint64_t& offset = inserted.first->second;
+            offset = readLog(state, offset, SIZE_MAX, newMessages);
+        });
+    }
+    newMessages.erase(std::remove_if(newMessages.begin(), newMessages.end(), [](const SharedMessagePtr& message) {
+        return message->expired();
+    }), newMessages.end());
 
     return newMessages;
 }
 
-void Server::removeClient(int clientId) {
-    std::lock_guard<std::mutex> lock(mtx);
-    for (auto& pair : subscriptions) {
-        pair.second.erase(std::remove(pair.second.begin(), pair.second.end(), clientId), pair.second.end());
+void Server::fetch(Connection& connection, std::string_view topic, uint16_t partition, const FetchRequest& request,
+                   uint64_t sequence, bool binary) {
+    std::string consumer(request.consumer);
+    size_t limit = request.maxMessages > 0 ? request.maxMessages : MAX_FETCH_MESSAGES;
+    // The response is queued in one piece, so it has to fit in the outbound queue.
+    limit = std::min({limit, size_t(MAX_FETCH_MESSAGES), std::max<size_t>(config.outbound.maxMessages, 2) - 1});
+
+    std::vector<SharedMessagePtr> messages;
+    uint64_t first = 0;
+    uint64_t next = 0;
+    topics.withTopic(topic, partition, [&](TopicState& state) {
+        state.log.enforceRetention();
+        first = request.offset;
+        if (first == WIRE_OFFSET_COMMITTED && (consumer.empty() || !state.cursors.get(consumer, first))) {
+            first = 0; // a new consumer starts at the oldest retained message
+        } else if (first == WIRE_OFFSET_LATEST) {
+            first = state.log.endOffset();
+        }
+        next = readLog(state, first, limit, messages);
+        if (!consumer.empty()) {
+            commitCursor(state, consumer, next);
+        }
+    });
+
+    // FETCHED first, then exactly next - first messages, with no pushed
+    // notification in between.
+    std::vector<OutboundFrame> frames;
+    frames.reserve(messages.size() + 1);
+    if (binary) {
+        char range[WIRE_OFFSET_RANGE_SIZE];
+        encodeOffsetRange(first, next, range);
+        FrameHeader header;
+        header.opcode = Opcode::Fetched;
+        header.sequence = sequence;
+        header.partition = partition;
+        auto response = std::make_shared<std::string>(frameSize(topic, std::string_view(range, sizeof(range))), '\0');
+        encodeFrame(header, topic, std::string_view(range, sizeof(range)), &(*response)[0], response->size());
+        frames.push_back(std::move(response));
+    } else {
+        frames.push_back(std::make_shared<const std::string>(
+            "FETCHED:" + std::string(topic) + ":" + std::to_string(first) + ":" + std::to_string(next) + "\n"));
+    }
+    for (const auto& message : messages) {
+        frames.push_back(message->frameFor(binary));
+    }
+    if (connection.enqueueAll(std::move(frames), true) == EnqueueResult::Dropped && logEnabled(LogLevel::Warn)) {
+        std::cerr << "Outbound queue full for client " << connection.fd << ", dropped oldest message" << std::endl;
+    }
+}
+
+void Server::seek(Connection& connection, std::string_view topic, uint16_t partition, std::string_view consumer,
+                  uint64_t offset, uint64_t sequence, bool binary) {
+    std::string consumerName(consumer);
+    topics.withTopic(topic, partition, [&](TopicState& state) {
+        if (offset == WIRE_OFFSET_LATEST || offset == WIRE_OFFSET_COMMITTED) {
+            offset = state.log.endOffset();
+        }
+        offset = std::min(std::max(offset, oldestOffset(state)), state.log.endOffset());
+        commitCursor(state, consumerName, offset);
+    });
+
+    if (binary) {
+        char position[WIRE_SEEK_HEADER_SIZE];
+        encodeSeekHeader(offset, position);
+        FrameHeader header;
+        header.opcode = Opcode::SeekOk;
+        header.sequence = sequence;
+        header.partition = partition;
+        std::string response(frameSize(topic, std::string_view(position, sizeof(position))), '\0');
+        encodeFrame(header, topic, std::string_view(position, sizeof(position)), &response[0], response.size());
+        reply(connection, std::move(response));
+    } else {
+        reply(connection, "SEEK_OK:" + std::string(topic) + ":" + std::to_string(offset) + "\n");
+    }
+}
+
+// Runs under the topic's shard lock.
+void Server::commitCursor(TopicState& state, const std::string& consumer, uint64_t offset) {
+    state.cursors.set(consumer, offset);
+    if (state.store) {
+        state.store->saveCursor(consumer, offset);
+    }
+    if (config.retention.dropConsumed) {
+        state.log.truncateBefore(state.cursors.minOffset());
+    }
+}
+
+void Server::joinGroup(Connection& connection, const std::string& topic, const std::string& group) {
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    ConsumerGroups::Rebalance rebalance;
+    if (groups.join(topic, group, connection.shared_from_this(), config.partitions.countFor(topic), rebalance)) {
+        applyRebalance(topic, group, rebalance, connection);
+    }
+}
+
+void Server::leaveGroup(Connection& connection, const std::string& topic, const std::string& group) {
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    ConsumerGroups::Rebalance rebalance;
+    if (groups.leave(topic, group, connection, rebalance)) {
+        applyRebalance(topic, group, rebalance, connection);
+    }
+}
+
+// Runs under groupsMutex, so concurrent rebalances of one group apply in order.
+void Server::applyRebalance(const std::string& topic, const std::string& group,
+                            const ConsumerGroups::Rebalance& rebalance, Connection& requester) {
+    for (const auto& change : rebalance.owners) {
+        topics.withTopic(topic, change.partition, [&](TopicState& state) {
+            auto& owners = state.groupOwners;
+            auto it = std::find_if(owners.begin(), owners.end(),
+                                   [&](const std::pair<std::string, std::shared_ptr<Connection>>& owner) {
+                                       return owner.first == group;
+                                   });
+            if (!change.owner) {
+                if (it != owners.end()) {
+                    owners.erase(it);
+                }
+            } else if (it != owners.end()) {
+                it->second = change.owner;
+            } else {
+                owners.emplace_back(group, change.owner);
+            }
+        });
+    }
+
+    Assignment assignment;
+    assignment.group = group;
+    assignment.partitionCount = config.partitions.countFor(topic);
+    for (const auto& member : rebalance.assignments) {
+        std::string frame;
+        if (member.first->binary) {
+            assignment.partitions = member.second;
+            std::string payload(assignmentSize(assignment), '\0');
+            encodeAssignment(assignment, &payload[0]);
+            frame = binaryResponse(Opcode::Assigned, topic, 0, payload);
+        } else {
+            frame = "ASSIGNED:" + topic + ":" + group + ":" + std::to_string(assignment.partitionCount) + ":";
+            for (size_t i = 0; i < member.second.size(); ++i) {
+                frame += (i > 0 ? "," : "") + std::to_string(member.second[i]);
+            }
+            frame += "\n";
+        }
+        member.first->enqueue(std::make_shared<const std::string>(std::move(frame)), member.first.get() == &requester);
+    }
+}
+
+void Server::removeClient(Connection& connection) {
+    timers.cancel(connection.idleTimer.exchange(0));
+    if (connection.link) {
+        size_t member = cluster.detach(connection);
+        if (member < cluster.size() && cluster.synced(member)) {
+            reportReady(cluster);
+        }
+        if (member < cluster.size() && running) {
+            std::cerr << "Link to cluster member " << member << " closed, reconnecting in "
+                      << config.cluster.reconnectMs << " ms" << std::endl;
+            timers.schedule(std::chrono::milliseconds(config.cluster.reconnectMs),
+                            [this, member] { connectPeer(member); });
+        }
+    }
+    if (connection.peer && cluster.replicating()) {
+        // Its partitions fail over to the next replica that is ready.
+        size_t member = cluster.removeFollower(connection);
+        if (member < cluster.size()) {
+            std::cerr << "Cluster member " << member << " unlinked" << std::endl;
+            // Quorum publishes no longer wait for it.
+            topics.forEachMutable([&](const TopicKey& key, TopicState& state) {
+                settleQuorum(state, key.topic, key.partition);
+            });
+        }
+    }
+    for (const auto& subscription : connection.subscriptions) {
+        if (isTopicPattern(subscription.first)) {
+            patterns.remove(subscription.first, connection);
+        }
+        if (!connection.peer) {
+            cluster.removeInterest(subscription.first);
+        }
+    }
+    connection.subscriptions.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        for (const auto& membership : groups.groupsOf(connection)) {
+            ConsumerGroups::Rebalance rebalance;
+            groups.leave(membership.first, membership.second, connection, rebalance);
+            applyRebalance(membership.first, membership.second, rebalance, connection);
+        }
+    }
+
+    // Only the topics this client touched need visiting, not the whole table.
+    for (const std::string& topic : connection.topics) {
+        for (uint16_t partition = 0; partition < config.partitions.countFor(topic); ++partition) {
+            topics.withExistingTopic(topic, partition, [&](TopicState& state) {
+                removeSubscriber(state.subscribers, connection);
+                removeFilteredSubscriber(state.filteredSubscribers, connection);
+                removeFlowSubscriber(state.flowSubscribers, connection, timers);
+                state.readOffsets.erase(connection.fd); // Remove the client's read offset
+                return topicIsUnused(state);
+            });
+        }
     }
-    clientMessageIndices.erase(clientId); // Remove the client's message indices
+    connection.topics.clear();
 }
@@ -2,32 +2,159 @@
 #define SERVER_H
 
 #include <string>
-#include <map>
 #include <vector>
 #include <mutex>
 #include <atomic>
-#include <unordered_set>
+#include <memory>
+#include <chrono>
+#include <netinet/in.h>
+#include "server_config.h"
+#include "connection.h"
+#include "shared_message.h"
+#include "topic_registry.h"
+#include "log_store.h"
+#include "consumer_groups.h"
+#include "subscription_trie.h"
+#include "message_filter.h"
+#include "timer_service.h"
+#include "cluster.h"
+#include "metrics.h"
+#include "../common/message.h"
+
+class Reactor;
+class MetricsEndpoint;
+struct PendingPublish;
 
 class Server {
 public:
-    Server();
+    explicit Server(const ServerConfig& config = ServerConfig());
+    ~Server();
     void start();
+    void stop();
+
+    const ServerConfig& getConfig() const { return config; }
+
+    // Called by reactors on their own thread.
+    void addClient(const std::shared_ptr<Connection>& connection);
+    bool handleClient(Connection& connection);
+    void removeClient(Connection& connection);
 
 private:
-    void handleClient(int client_socket);
-    std::string handleRequest(const std::string& request, int clientId);
-    void subscribe(int clientId, const std::string& topic);
-    void unsubscribe(int clientId, const std::string& topic);
-    void publish(const std::string& topic, const std::string& message, const std::string& uuid);
-    std::vector<std::string> getMessages(int clientId, const std::string& topic);
-    void removeClient(int clientId);
-
-    std::map<std::string, std::vector<int>> subscriptions;
-    std::map<std::string, std::vector<std::pair<std::string, std::string>>> messages; // <topic, <message, uuid>>
-    std::unordered_set<std::string> processedUUIDs;
-    std::mutex mtx;
+    void handleRequest(const std::string& request, Connection& connection);
+    void handleFrame(const FrameView& frame, Connection& connection);
+    void handleMessage(Opcode opcode, std::string_view topic, std::string_view content, std::string_view uuid,
+                       uint64_t sequence, uint16_t partition, uint8_t flags, Connection& connection, bool binary);
+    void reply(Connection& connection, std::string response);
+    // consumer is empty except for acknowledged subscriptions.
+    bool subscribe(Connection& connection, const std::string& topic, std::string_view filterExpression,
+                   std::string_view consumer = std::string_view());
+    void unsubscribe(Connection& connection, const std::string& topic);
+    // Messages on partitions another cluster member leads, which publish() and
+    // publishBatch() leave to the caller to forward. A null RemoteMessages*
+    // marks a publish forwarded by another member: its key hashes are the
+    // partitions themselves, and it is only published if this member leads
+    // them all (UNAVAILABLE otherwise).
+    using RemoteMessages = std::vector<std::shared_ptr<SharedMessage>>;
+    // Both return the response for what was published here, and in
+    // backpressure whether the partitions published to are past the
+    // backpressure threshold. A quorum publish also waits on its followers.
+    Opcode publish(std::string_view topic, std::string_view message, std::string_view uuid, uint16_t keyHash,
+                   std::string_view attributes, bool& backpressure, RemoteMessages* remote,
+                   const std::shared_ptr<PendingPublish>& quorum);
+    void publishNow(const std::shared_ptr<SharedMessage>& message, bool& backpressure,
+                    const std::shared_ptr<PendingPublish>& quorum = nullptr);
+    bool deferPublish(const std::shared_ptr<SharedMessage>& message);
+    uint16_t choosePartition(std::string_view topic, uint16_t keyHash);
+    // Who messages on one topic partition go to. Filtered groups are evaluated
+    // per message, after the topic lock is released.
+    struct Delivery {
+        std::vector<std::shared_ptr<Connection>> targets;
+        std::vector<FilteredSubscribers> filtered;
+    };
+    Delivery deliveryTargets(TopicState& state, std::string_view topic);
+    Opcode publishBatch(std::string_view batch, bool withAttributes, bool& backpressure, RemoteMessages* remote,
+                        const std::shared_ptr<PendingPublish>& quorum);
+    // Answers a publish request now, or once what it waits on is done.
+    void answerPublish(Connection& connection, std::string_view topic, uint64_t sequence, bool binary,
+                       Opcode response, bool backpressure, const RemoteMessages& remote,
+                       std::shared_ptr<PendingPublish> pending, bool quorum);
+    std::shared_ptr<PendingPublish> startPublish(Connection& connection, std::string_view topic, uint64_t sequence,
+                                                 bool binary);
+    // One thing the publish waited on is done; force answers it at once.
+    void settlePublish(const std::shared_ptr<PendingPublish>& publish, Opcode response, bool backpressure,
+                       bool force = false);
+    void forwardPublishes(const RemoteMessages& remote, bool quorum, const std::shared_ptr<PendingPublish>& pending);
+    void handleLinkFrame(const FrameView& frame, Connection& link);
+    void relay(const FrameView& frame);
+    void connectPeer(size_t member);
+    void admitPeer(Connection& connection, std::string_view memberId, uint8_t flags);
+    // Replication (see cluster.h). The leader's side runs under the topic's
+    // shard lock; the follower applies what it is sent in applyReplica().
+    void replicate(TopicState& state, std::string_view topic, uint16_t partition, uint64_t first,
+                   const std::shared_ptr<PendingPublish>& quorum);
+    void sendReplica(TopicState& state, std::string_view topic, uint16_t partition, ReplicaProgress& progress,
+                     Connection& follower, bool sync);
+    void syncFollower(Connection& connection, size_t member, uint64_t session);
+    void replicated(Connection& connection, std::string_view topic, uint16_t partition, uint8_t flags,
+                    std::string_view payload);
+    void settleQuorum(TopicState& state, std::string_view topic, uint16_t partition);
+    void applyReplica(const FrameView& frame, Connection& link);
+    // Messages read from a log for flow-controlled subscribers, sent after the
+    // topic lock is released.
+    using FlowDeliveries = std::vector<std::pair<std::shared_ptr<Connection>, SharedMessagePtr>>;
+    uint64_t drainFlow(TopicState& state, FlowSubscriber& subscriber, std::string_view topic, uint16_t partition,
+                       FlowDeliveries& out);
+    bool drainFlowSubscribers(TopicState& state, std::string_view topic, uint16_t partition, FlowDeliveries& out);
+    void grantCredit(Connection& connection, uint32_t messages, uint32_t bytes);
+    void acknowledge(Connection& connection, std::string_view topic, uint16_t partition,
+                     const std::vector<uint64_t>& offsets, bool cumulative);
+    void trackUnacked(FlowSubscriber& subscriber, std::string_view topic, uint16_t partition, uint64_t offset);
+    void redeliver(const std::weak_ptr<Connection>& target, const std::string& topic, uint16_t partition,
+                   uint64_t offset);
+    void scheduleExpiry(TopicState& state, std::string_view topic, uint16_t partition);
+    void expireTopic(const std::string& topic, uint16_t partition);
+    void checkIdle(const std::weak_ptr<Connection>& target);
+    void sweepRetention();
+    void appendToLog(TopicState& state, std::string_view topic, uint16_t partition,
+                     const std::shared_ptr<SharedMessage>& message, TopicLog::Clock::time_point now);
+    bool recoverTopics();
+    // With held, the caller holds a DeliveryTurn and must not wait: a message
+    // for a full queue under the Block policy, and every later one for the
+    // same connection, is appended to held instead, to be delivered once the
+    // turn is released.
+    void fanOut(const Delivery& delivery, const SharedMessagePtr& message, FlowDeliveries* held = nullptr);
+    void deliver(const std::shared_ptr<Connection>& target, const SharedMessagePtr& message,
+                 FlowDeliveries* held = nullptr);
+    std::vector<SharedMessagePtr> getMessages(Connection& connection, const std::string& topic);
+    void fetch(Connection& connection, std::string_view topic, uint16_t partition, const FetchRequest& request,
+               uint64_t sequence, bool binary);
+    void seek(Connection& connection, std::string_view topic, uint16_t partition, std::string_view consumer,
+              uint64_t offset, uint64_t sequence, bool binary);
+    void commitCursor(TopicState& state, const std::string& consumer, uint64_t offset);
+    void joinGroup(Connection& connection, const std::string& topic, const std::string& group);
+    void leaveGroup(Connection& connection, const std::string& topic, const std::string& group);
+    void applyRebalance(const std::string& topic, const std::string& group,
+                        const ConsumerGroups::Rebalance& rebalance, Connection& requester);
+    // For STATS and the metrics endpoint; an empty filter reports every topic.
+    MetricsReport collectMetrics(std::string_view topicFilter);
+
+    ServerConfig config;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+
+    std::unique_ptr<LogStore> logStore; // declared before topics, which hold its TopicStores
+    TopicRegistry topics;
+    DedupWindow recentIds; // UUIDs of recently published messages
+    std::mutex dedupMutex;
+    SubscriptionTrie patterns; // wildcard subscriptions
+    ConsumerGroups groups;
+    std::mutex groupsMutex; // taken before any shard lock
+    std::atomic<uint64_t> nextPartition; // spreads keyless publishes
+    TimerService timers; // ticked by the first reactor
+    Cluster cluster;     // links live on the first reactor
+    std::vector<struct sockaddr_in> memberAddresses; // resolved once, before the reactors run
+    std::chrono::steady_clock::time_point startTime;
+    std::unique_ptr<MetricsEndpoint> metrics; // with --metrics-port, on its own thread
     std::atomic<bool> running;
-    std::map<int, std::map<std::string, size_t>> clientMessageIndices;
 };
 
 #endif // SERVER_H
\ No newline at end of file
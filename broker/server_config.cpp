@@ -0,0 +1,216 @@
+#include "server_config.h"
+#include <iostream>
+#include <cstdlib>
+#include <thread>
+
+// For limits and intervals where 0 means unlimited, disabled or never.
+static bool parseSizeAllowZero(const char* text, size_t& out) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0' || text[0] == '-') {
+        return false;
+    }
+    out = static_cast<size_t>(value);
+    return true;
+}
+
+static bool parseSize(const char* text, size_t& out) {
+    size_t value;
+    if (!parseSizeAllowZero(text, value) || value == 0) {
+        return false;
+    }
+    out = value;
+    return true;
+}
+
+static bool parsePolicy(const std::string& text, OverflowPolicy& out) {
+    if (text == "drop-oldest") {
+        out = OverflowPolicy::DropOldest;
+    } else if (text == "disconnect") {
+        out = OverflowPolicy::Disconnect;
+    } else if (text == "block") {
+        out = OverflowPolicy::Block;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parseSwitch(const std::string& text, bool& out) {
+    if (text == "on") {
+        out = true;
+    } else if (text == "off") {
+        out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#define MAX_PARTITIONS 1024
+
+static bool parsePartitions(const char* text, size_t& out) {
+    return parseSize(text, out) && out <= MAX_PARTITIONS;
+}
+
+// "NAME=N"; the name is everything before the last '='.
+static bool parseTopicPartitions(const std::string& text, std::unordered_map<std::string, size_t>& out) {
+    size_t separator = text.rfind('=');
+    size_t count;
+    if (separator == std::string::npos || separator == 0 || !parsePartitions(text.c_str() + separator + 1, count)) {
+        return false;
+    }
+    out[text.substr(0, separator)] = count;
+    return true;
+}
+
+static bool parseInt(const char* text, int& out) {
+    char* end = nullptr;
+    long value = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 0 || value > 1000000) {
+        return false;
+    }
+    out = static_cast<int>(value);
+    return true;
+}
+
+// "host:port,host:port,..."
+static bool parseMembers(const std::string& text, std::vector<ClusterMember>& out) {
+    out.clear();
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string member = text.substr(start, end - start);
+        size_t separator = member.rfind(':');
+        ClusterMember parsed;
+        if (separator == std::string::npos || separator == 0
+                || !parseInt(member.c_str() + separator + 1, parsed.port) || parsed.port == 0 || parsed.port > 65535) {
+            return false;
+        }
+        parsed.host = member.substr(0, separator);
+        out.push_back(std::move(parsed));
+        start = end + 1;
+    }
+    return true;
+}
+
+bool ServerConfig::parseArgs(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+
+        bool ok;
+        if (arg == "--port") {
+            ok = parseInt(value, port);
+        } else if (arg == "--threads") {
+            ok = parseInt(value, reactorThreads);
+        } else if (arg == "--queue-messages") {
+            ok = parseSize(value, outbound.maxMessages);
+        } else if (arg == "--queue-bytes") {
+            ok = parseSize(value, outbound.maxBytes);
+        } else if (arg == "--overflow") {
+            ok = parsePolicy(value, outbound.policy);
+        } else if (arg == "--block-timeout-ms") {
+            ok = parseInt(value, outbound.blockTimeoutMs);
+        } else if (arg == "--retention-bytes") {
+            ok = parseSizeAllowZero(value, retention.maxBytes);
+        } else if (arg == "--retention-messages") {
+            ok = parseSizeAllowZero(value, retention.maxMessages);
+        } else if (arg == "--retention-ms") {
+            ok = parseSizeAllowZero(value, retention.maxAgeMs);
+        } else if (arg == "--segment-messages") {
+            ok = parseSize(value, retention.segmentMessages);
+        } else if (arg == "--segment-bytes") {
+            ok = parseSize(value, retention.segmentBytes);
+        } else if (arg == "--retention-consumed") {
+            ok = parseSwitch(value, retention.dropConsumed);
+        } else if (arg == "--data-dir") {
+            persistence.dataDir = value;
+            ok = !persistence.dataDir.empty();
+        } else if (arg == "--fsync-ms") {
+            ok = parseSize(value, persistence.fsyncIntervalMs);
+        } else if (arg == "--fsync-messages") {
+            ok = parseSize(value, persistence.fsyncMessages);
+        } else if (arg == "--segment-file-bytes") {
+            ok = parseSize(value, persistence.segmentFileBytes);
+        } else if (arg == "--segment-index-entries") {
+            ok = parseSize(value, persistence.segmentIndexEntries);
+        } else if (arg == "--dedup-window-messages") {
+            ok = parseSize(value, dedup.windowMessages);
+        } else if (arg == "--dedup-window-ms") {
+            ok = parseSizeAllowZero(value, dedup.windowMs);
+        } else if (arg == "--dedup-bloom") {
+            ok = parseSwitch(value, dedup.bloomFilter);
+        } else if (arg == "--partitions") {
+            ok = parsePartitions(value, partitions.defaultPartitions);
+        } else if (arg == "--topic-partitions") {
+            ok = parseTopicPartitions(value, partitions.perTopic);
+        } else if (arg == "--backpressure-lag") {
+            ok = parseSizeAllowZero(value, backpressureLag);
+        } else if (arg == "--ack-timeout-ms") {
+            ok = parseSizeAllowZero(value, ackTimeoutMs);
+        } else if (arg == "--max-unacked") {
+            ok = parseSize(value, maxUnacked);
+        } else if (arg == "--idle-timeout-ms") {
+            ok = parseSizeAllowZero(value, idleTimeoutMs);
+        } else if (arg == "--retention-sweep-ms") {
+            ok = parseSize(value, retentionSweepMs);
+        } else if (arg == "--cluster") {
+            ok = parseMembers(value, cluster.members);
+        } else if (arg == "--node-id") {
+            ok = parseInt(value, cluster.nodeId);
+        } else if (arg == "--cluster-reconnect-ms") {
+            ok = parseSize(value, cluster.reconnectMs);
+        } else if (arg == "--replicas") {
+            ok = parseSizeAllowZero(value, cluster.replicas);
+        } else if (arg == "--replication-timeout-ms") {
+            ok = parseSize(value, cluster.replicationTimeoutMs);
+        } else if (arg == "--log-level") {
+            ok = parseLogLevel(value, logLevel);
+        } else if (arg == "--metrics-port") {
+            ok = parseInt(value, metricsPort) && metricsPort <= 65535;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+    if (!cluster.members.empty() && (cluster.nodeId < 0 || cluster.nodeId >= static_cast<int>(cluster.members.size()))) {
+        std::cerr << "--node-id must name this broker's position in --cluster" << std::endl;
+        return false;
+    }
+    if (cluster.replicating() && cluster.members.size() > MAX_REPLICATED_MEMBERS) {
+        std::cerr << "--replicas supports at most " << MAX_REPLICATED_MEMBERS << " cluster members" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+uint16_t PartitionConfig::countFor(std::string_view topic) const {
+    if (!perTopic.empty()) {
+        auto it = perTopic.find(std::string(topic));
+        if (it != perTopic.end()) {
+            return static_cast<uint16_t>(it->second);
+        }
+    }
+    return static_cast<uint16_t>(defaultPartitions);
+}
+
+int ServerConfig::effectiveReactorThreads() const {
+    if (reactorThreads > 0) {
+        return reactorThreads;
+    }
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw > 0 ? static_cast<int>(hw) : 1;
+}
@@ -0,0 +1,120 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "log_level.h"
+#include "../common/dedup_window.h"
+
+// What a connection does when its outbound queue is full.
+enum class OverflowPolicy {
+    DropOldest, // discard the oldest queued notification
+    Disconnect, // close the slow connection
+    Block,      // make the publisher wait, up to blockTimeoutMs, then drop oldest
+};
+
+struct OutboundQueueConfig {
+    size_t maxMessages = 4096;
+    size_t maxBytes = 8 * 1024 * 1024;
+    OverflowPolicy policy = OverflowPolicy::DropOldest;
+    int blockTimeoutMs = 100;
+};
+
+// Per-topic retention. Limits are enforced by dropping whole segments from the
+// head of the log, so a topic may exceed them by at most one segment. 0 means
+// unlimited.
+struct RetentionConfig {
+    size_t maxBytes = 64 * 1024 * 1024;
+    size_t maxMessages = 0;
+    size_t maxAgeMs = 0;
+    size_t segmentMessages = 1024;     // a segment is sealed when it holds this many
+    size_t segmentBytes = 1024 * 1024; // ... or this many bytes
+    bool dropConsumed = false;         // also drop segments every named consumer has passed
+};
+
+// Durable mode: published messages are appended to memory-mapped segment files
+// under dataDir (disabled when empty) and synced to disk every fsyncIntervalMs
+// or every fsyncMessages appends, whichever comes first. Disk segments follow
+// the same RetentionConfig limits as the in-memory log.
+struct PersistenceConfig {
+    std::string dataDir;
+    size_t fsyncIntervalMs = 100;
+    size_t fsyncMessages = 10000;
+    size_t segmentFileBytes = 16 * 1024 * 1024;
+    size_t segmentIndexEntries = 64 * 1024;
+
+    bool enabled() const { return !dataDir.empty(); }
+};
+
+// How many partitions each topic is split into. Topics not listed in perTopic
+// get defaultPartitions; 1 keeps a topic unpartitioned.
+struct PartitionConfig {
+    size_t defaultPartitions = 1;
+    std::unordered_map<std::string, size_t> perTopic;
+
+    uint16_t countFor(std::string_view topic) const;
+};
+
+struct ClusterMember {
+    std::string host;
+    int port = 0;
+};
+
+// Brokers that share one topic space (see cluster.h). Every member is started
+// with the same member list, in the same order, and its own position in it.
+// A list of one member, or none, runs a standalone broker. With replicas,
+// every partition is also copied to that many followers, which take over when
+// its leader fails (at most MAX_REPLICATED_MEMBERS members).
+struct ClusterConfig {
+    std::vector<ClusterMember> members;
+    int nodeId = -1;
+    size_t reconnectMs = 1000; // wait before reopening a link that closed
+    size_t replicas = 0;
+    // How long a quorum publish waits for its followers, and a restarted
+    // member for the others to sync it, before giving up.
+    size_t replicationTimeoutMs = 5000;
+
+    bool enabled() const { return members.size() > 1; }
+    bool replicating() const { return enabled() && replicas > 0; }
+};
+
+const size_t MAX_REPLICATED_MEMBERS = 64;
+
+struct ServerConfig {
+    int port = 8080;
+    int reactorThreads = 0; // 0 = one reactor per hardware thread
+    OutboundQueueConfig outbound;
+    RetentionConfig retention;
+    PersistenceConfig persistence;
+    DedupConfig dedup;
+    PartitionConfig partitions;
+    ClusterConfig cluster;
+    // Combined lag, in messages, of a partition's flow-controlled subscribers
+    // at which PUBLISHED responses start carrying WIRE_FLAG_BACKPRESSURE.
+    // 0 disables the signal.
+    size_t backpressureLag = 10000;
+    // Acknowledged subscriptions: how long a pushed message may go without an
+    // ACK before it is pushed again (0 never redelivers), and how many
+    // unacknowledged messages one subscription may have before the broker
+    // stops pushing to it.
+    size_t ackTimeoutMs = 30000;
+    size_t maxUnacked = 1000;
+    // Connections that send nothing for this long are closed (0 keeps them).
+    size_t idleTimeoutMs = 0;
+    // How often quiet topics are checked against retention.maxAgeMs; busy
+    // ones are also checked whenever a segment rolls over.
+    size_t retentionSweepMs = 1000;
+    LogLevel logLevel = LogLevel::Info;
+    // Port of the HTTP endpoint serving GET /metrics to Prometheus (0 disables).
+    int metricsPort = 0;
+
+    // Parses "--port N" / "--threads N" style arguments. Returns false on bad input.
+    bool parseArgs(int argc, char* argv[]);
+    int effectiveReactorThreads() const;
+};
+
+#endif // SERVER_CONFIG_H
@@ -0,0 +1,92 @@
+#include "shared_message.h"
+#include <algorithm>
+#include <charconv>
+
+// Longer TTLs and delays are ignored; they would overflow the clock.
+#define MAX_ATTRIBUTE_MS (100LL * 365 * 24 * 3600 * 1000)
+
+static bool attributeMs(const AttributesView& attributes, const char* key, int64_t& ms) {
+    std::string_view value;
+    if (!attributes.get(key, value)) {
+        return false;
+    }
+    auto result = std::from_chars(value.data(), value.data() + value.size(), ms);
+    return result.ec == std::errc() && result.ptr == value.data() + value.size() && ms >= 0 && ms <= MAX_ATTRIBUTE_MS;
+}
+
+std::shared_ptr<SharedMessage> SharedMessage::create(std::string_view topic, std::string_view payload,
+                                                     std::string_view uuid, uint16_t partition,
+                                                     std::string_view attributes) {
+    std::shared_ptr<SharedMessage> message(new SharedMessage());
+
+    FrameHeader header;
+    header.opcode = Opcode::Message;
+    header.partition = partition;
+    parseUuid(uuid, header.uuid);
+
+    std::string joined;
+    std::string_view framed = payload;
+    if (!attributes.empty()) {
+        header.flags |= WIRE_FLAG_ATTRIBUTES;
+        joined.reserve(attributes.size() + payload.size());
+        joined.append(attributes.data(), attributes.size()).append(payload.data(), payload.size());
+        framed = joined;
+    }
+
+    message->binary.resize(frameSize(topic, framed));
+    if (encodeFrame(header, topic, framed, &message->binary[0], message->binary.size()) == 0) {
+        return nullptr;
+    }
+    const char* start = message->binary.data() + WIRE_HEADER_SIZE + topic.size();
+    if (!attributes.empty()) {
+        std::string_view body;
+        if (!AttributesView::split(std::string_view(start, framed.size()), message->attributesView, body)) {
+            return nullptr;
+        }
+        message->readTimers();
+    }
+    message->topicView = std::string_view(message->binary.data() + WIRE_HEADER_SIZE, topic.size());
+    message->payloadView = std::string_view(start + attributes.size(), payload.size());
+    message->partitionNumber = partition;
+    message->uuidText.assign(uuid.data(), uuid.size());
+    return message;
+}
+
+// A TTL counts from the message's timestamp, which is stamped into the frame
+// here if the publisher left it unset, so the expiry survives a trip to disk.
+void SharedMessage::readTimers() {
+    int64_t ms;
+    if (attributeMs(attributesView, WIRE_ATTRIBUTE_DELAY, ms)) {
+        publishDelay = std::chrono::milliseconds(ms);
+    }
+    if (!attributeMs(attributesView, WIRE_ATTRIBUTE_TTL, ms)) {
+        return;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    int64_t timestamp = attributesView.timestampMs();
+    if (timestamp == 0) {
+        timestamp = now;
+        setAttributesTimestamp(&binary[0] + (attributesView.raw().data() - binary.data()), timestamp);
+    }
+    int64_t age = std::min<int64_t>(std::max<int64_t>(now - timestamp, -MAX_ATTRIBUTE_MS), MAX_ATTRIBUTE_MS);
+    expiry = Clock::now() + std::chrono::milliseconds(ms - age);
+}
+
+void SharedMessage::setOffset(uint64_t offset) {
+    logOffset = offset;
+    setFrameSequence(&binary[0], offset);
+}
+
+std::shared_ptr<const std::string> SharedMessage::binaryFrame() const {
+    return std::shared_ptr<const std::string>(shared_from_this(), &binary);
+}
+
+std::shared_ptr<const std::string> SharedMessage::textFrame() const {
+    std::call_once(textOnce, [this] {
+        text.reserve(8 + topicView.size() + 1 + payloadView.size() + 1 + uuidText.size() + 1);
+        text.append("MESSAGE:").append(topicView).append(":").append(payloadView)
+            .append(":").append(uuidText).append("\n");
+    });
+    return std::shared_ptr<const std::string>(shared_from_this(), &text);
+}
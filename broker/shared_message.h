@@ -0,0 +1,80 @@
+#ifndef SHARED_MESSAGE_H
+#define SHARED_MESSAGE_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include "../common/wire.h"
+
+// A published message, encoded once and never modified afterwards. Subscriber
+// outbound queues and the retained topic log all hold references to the same
+// instance, so fanning a message out costs one pointer per subscriber.
+//
+// The binary MESSAGE frame is the canonical storage; topic() and payload() are
+// views into it. The text notification is only built if a text client needs it.
+// Attributes, if any, sit in the frame ahead of the payload; attributes() reads
+// them in place, so routing on them never copies or decodes the whole block.
+// The one exception to immutability is the offset, which is set when the
+// message is appended to its partition's log, before anyone else can see it.
+// The "ttl" and "delay" attributes (see wire.h) are read once, on creation.
+class SharedMessage : public std::enable_shared_from_this<SharedMessage> {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // attributes is an encoded block (see AttributesView), or empty for none.
+    static std::shared_ptr<SharedMessage> create(std::string_view topic, std::string_view payload,
+                                                 std::string_view uuid, uint16_t partition = 0,
+                                                 std::string_view attributes = std::string_view());
+
+    // Written to the frame's sequence field, which MESSAGE frames use for it.
+    void setOffset(uint64_t offset);
+    uint64_t offset() const { return logOffset; }
+
+    // Clock::time_point::max() for a message without a TTL.
+    Clock::time_point expiresAt() const { return expiry; }
+    bool expired() const { return expiry != Clock::time_point::max() && Clock::now() >= expiry; }
+    // How long the broker holds the message before publishing it.
+    std::chrono::milliseconds delay() const { return publishDelay; }
+
+    std::string_view topic() const { return topicView; }
+    uint16_t partition() const { return partitionNumber; }
+    std::string_view payload() const { return payloadView; }
+    const AttributesView& attributes() const { return attributesView; }
+    // The frame's payload: the attributes block, if any, then payload().
+    std::string_view framedPayload() const {
+        return std::string_view(binary).substr(WIRE_HEADER_SIZE + topicView.size());
+    }
+    const std::string& uuid() const { return uuidText; }
+    size_t size() const { return binary.size(); }
+
+    // Frames share ownership with the message, so queues can hold them directly.
+    std::shared_ptr<const std::string> binaryFrame() const;
+    std::shared_ptr<const std::string> textFrame() const;
+    std::shared_ptr<const std::string> frameFor(bool binaryClient) const {
+        return binaryClient ? binaryFrame() : textFrame();
+    }
+
+private:
+    SharedMessage() = default;
+    void readTimers();
+
+    std::string binary;
+    std::string uuidText;
+    std::string_view topicView;
+    std::string_view payloadView;
+    AttributesView attributesView;
+    uint16_t partitionNumber = 0;
+    uint64_t logOffset = 0;
+    Clock::time_point expiry = Clock::time_point::max();
+    std::chrono::milliseconds publishDelay{0};
+
+    mutable std::once_flag textOnce;
+    mutable std::string text;
+};
+
+using SharedMessagePtr = std::shared_ptr<const SharedMessage>;
+
+#endif // SHARED_MESSAGE_H
@@ -0,0 +1,140 @@
+#include "subscription_trie.h"
+#include <algorithm>
+#include <mutex>
+
+static std::vector<std::string_view> splitLevels(std::string_view topic) {
+    std::vector<std::string_view> levels;
+    size_t start = 0;
+    while (true) {
+        size_t end = topic.find(TOPIC_LEVEL_SEPARATOR, start);
+        if (end == std::string_view::npos) {
+            levels.push_back(topic.substr(start));
+            return levels;
+        }
+        levels.push_back(topic.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+bool isTopicPattern(std::string_view topic) {
+    return topic.find_first_of("+#") != std::string_view::npos;
+}
+
+bool isValidTopicPattern(std::string_view pattern) {
+    std::vector<std::string_view> levels = splitLevels(pattern);
+    for (size_t i = 0; i < levels.size(); ++i) {
+        std::string_view level = levels[i];
+        if (level == "#" && i + 1 != levels.size()) {
+            return false;
+        }
+        // Wildcards stand for whole levels only.
+        if (level.size() > 1 && level.find_first_of("+#") != std::string_view::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void eraseSubscriber(std::vector<std::shared_ptr<Connection>>& subscribers, const Connection& subscriber,
+                            bool& removed) {
+    auto it = std::find_if(subscribers.begin(), subscribers.end(),
+                           [&](const std::shared_ptr<Connection>& s) { return s.get() == &subscriber; });
+    if (it != subscribers.end()) {
+        *it = std::move(subscribers.back());
+        subscribers.pop_back();
+        removed = true;
+    }
+}
+
+SubscriptionTrie::SubscriptionTrie() : changes(1) {}
+
+bool SubscriptionTrie::add(std::string_view pattern, const std::shared_ptr<Connection>& subscriber) {
+    std::vector<std::string_view> levels = splitLevels(pattern);
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    Node* node = &root;
+    for (std::string_view level : levels) {
+        if (level == "#") {
+            break;
+        }
+        std::unique_ptr<Node>& next = level == "+" ? node->anyLevel : node->children[std::string(level)];
+        if (!next) {
+            next = std::make_unique<Node>();
+        }
+        node = next.get();
+    }
+
+    auto& list = levels.back() == "#" ? node->restSubscribers : node->subscribers;
+    if (std::find(list.begin(), list.end(), subscriber) != list.end()) {
+        return false;
+    }
+    list.push_back(subscriber);
+    changes.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+bool SubscriptionTrie::remove(std::string_view pattern, const Connection& subscriber) {
+    std::vector<std::string_view> levels = splitLevels(pattern);
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    if (!removeFrom(root, levels, 0, subscriber)) {
+        return false;
+    }
+    changes.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+// Removes the subscriber at the end of the pattern's path and prunes the nodes
+// that become empty on the way back up.
+bool SubscriptionTrie::removeFrom(Node& node, const std::vector<std::string_view>& levels, size_t depth,
+                                  const Connection& subscriber) {
+    bool removed = false;
+    if (depth == levels.size() || levels[depth] == "#") {
+        eraseSubscriber(depth == levels.size() ? node.subscribers : node.restSubscribers, subscriber, removed);
+        return removed;
+    }
+
+    std::string_view level = levels[depth];
+    if (level == "+") {
+        if (node.anyLevel && (removed = removeFrom(*node.anyLevel, levels, depth + 1, subscriber))
+                && node.anyLevel->empty()) {
+            node.anyLevel.reset();
+        }
+        return removed;
+    }
+    auto it = node.children.find(std::string(level));
+    if (it != node.children.end() && (removed = removeFrom(*it->second, levels, depth + 1, subscriber))
+            && it->second->empty()) {
+        node.children.erase(it);
+    }
+    return removed;
+}
+
+std::vector<std::shared_ptr<Connection>> SubscriptionTrie::match(std::string_view topic) const {
+    std::vector<std::string_view> levels = splitLevels(topic);
+    std::vector<std::shared_ptr<Connection>> out;
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        collect(root, levels, 0, out);
+    }
+    // A subscriber with several matching patterns still gets one copy.
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+void SubscriptionTrie::collect(const Node& node, const std::vector<std::string_view>& levels, size_t depth,
+                               std::vector<std::shared_ptr<Connection>>& out) {
+    out.insert(out.end(), node.restSubscribers.begin(), node.restSubscribers.end());
+    if (depth == levels.size()) {
+        out.insert(out.end(), node.subscribers.begin(), node.subscribers.end());
+        return;
+    }
+    if (!node.children.empty()) {
+        auto it = node.children.find(std::string(levels[depth]));
+        if (it != node.children.end()) {
+            collect(*it->second, levels, depth + 1, out);
+        }
+    }
+    if (node.anyLevel) {
+        collect(*node.anyLevel, levels, depth + 1, out);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef SUBSCRIPTION_TRIE_H
+#define SUBSCRIPTION_TRIE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class Connection;
+
+// Topic levels are separated by '.'. In a subscription pattern, a '+' level
+// matches exactly one level and a final '#' level matches any number of
+// remaining levels, including none: "metrics.+.cpu" matches "metrics.web1.cpu",
+// and "metrics.#" matches "metrics" and "metrics.web1.cpu".
+const char TOPIC_LEVEL_SEPARATOR = '.';
+
+// '+' and '#' are reserved for patterns, as in MQTT: a subscription containing
+// either is a pattern, and it is only valid if they stand for whole levels.
+bool isTopicPattern(std::string_view topic);
+bool isValidTopicPattern(std::string_view pattern);
+
+// Wildcard subscriptions, stored as a trie of topic levels. Matching a topic
+// walks one path per wildcard branch, so its cost grows with the topic's depth
+// rather than with the number of patterns. generation() changes whenever a
+// pattern is added or removed, which lets callers cache the match of a topic
+// until then. Thread-safe: matches share a lock, changes take it exclusively.
+class SubscriptionTrie {
+public:
+    SubscriptionTrie();
+
+    // Both return false if nothing changed.
+    bool add(std::string_view pattern, const std::shared_ptr<Connection>& subscriber);
+    bool remove(std::string_view pattern, const Connection& subscriber);
+
+    // Every subscriber with a pattern matching topic, each once.
+    std::vector<std::shared_ptr<Connection>> match(std::string_view topic) const;
+
+    uint64_t generation() const { return changes.load(std::memory_order_acquire); }
+
+private:
+    struct Node {
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> anyLevel;                         // '+'
+        std::vector<std::shared_ptr<Connection>> subscribers;   // pattern ends here
+        std::vector<std::shared_ptr<Connection>> restSubscribers; // pattern ends here with '#'
+
+        bool empty() const {
+            return children.empty() && !anyLevel && subscribers.empty() && restSubscribers.empty();
+        }
+    };
+
+    static void collect(const Node& node, const std::vector<std::string_view>& levels, size_t depth,
+                        std::vector<std::shared_ptr<Connection>>& out);
+    static bool removeFrom(Node& node, const std::vector<std::string_view>& levels, size_t depth,
+                           const Connection& subscriber);
+
+    mutable std::shared_mutex mtx;
+    Node root;
+    std::atomic<uint64_t> changes;
+};
+
+#endif // SUBSCRIPTION_TRIE_H
@@ -0,0 +1,82 @@
+#include "timer_service.h"
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+TimerService::TimerService(std::chrono::milliseconds tick)
+        : tick(std::max<Clock::duration>(tick, std::chrono::milliseconds(1))), started(Clock::now()), timerFd(-1),
+          armed(false) {}
+
+TimerService::~TimerService() {
+    if (timerFd != -1) close(timerFd);
+}
+
+bool TimerService::open() {
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0) {
+        std::cerr << "Timerfd creation failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+uint64_t TimerService::tickAt(Clock::time_point time) const {
+    return static_cast<uint64_t>((time - started) / tick);
+}
+
+TimerService::TimerId TimerService::schedule(Clock::duration delay, Task task) {
+    // Rounded up, so a task never runs early.
+    uint64_t deadline = tickAt(Clock::now() + delay + tick - Clock::duration(1));
+    std::lock_guard<std::mutex> lock(mtx);
+    TimerId id = wheel.schedule(deadline, std::move(task));
+    armLocked(true);
+    return id;
+}
+
+bool TimerService::cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return wheel.cancel(id);
+}
+
+void TimerService::runExpired() {
+    uint64_t expirations;
+    while (read(timerFd, &expirations, sizeof(expirations)) > 0) {}
+
+    std::vector<Task> due;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        wheel.advance(tickAt(Clock::now()), due);
+    }
+    // Tasks run unlocked, so they can take shard locks and schedule more timers.
+    for (auto& task : due) {
+        task();
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    armLocked(wheel.size() > 0);
+}
+
+// Periodic while timers are pending: the wheel has no cheap "next deadline",
+// and one wakeup per tick is negligible next to the I/O it runs alongside.
+void TimerService::armLocked(bool enable) {
+    if (enable == armed || timerFd == -1) {
+        return;
+    }
+    itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+    if (enable) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tick).count();
+        spec.it_interval.tv_sec = ns / 1000000000;
+        spec.it_interval.tv_nsec = ns % 1000000000;
+        spec.it_value = spec.it_interval;
+    }
+    if (timerfd_settime(timerFd, 0, &spec, nullptr) < 0) {
+        std::cerr << "Timerfd update failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    armed = enable;
+}
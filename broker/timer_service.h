@@ -0,0 +1,48 @@
+#ifndef TIMER_SERVICE_H
+#define TIMER_SERVICE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include "timer_wheel.h"
+
+// The broker's timers, on one hierarchical wheel (see timer_wheel.h). A timerfd
+// ticks the wheel while any timer is pending and is disarmed otherwise, so an
+// idle broker never wakes up for it. The fd is watched by the first reactor,
+// which runs due tasks on its own thread between I/O events; there is no
+// thread or heap entry per timer. schedule() and cancel() are O(1) and may be
+// called from any thread, including from a running task.
+class TimerService {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Task = std::function<void()>;
+    using TimerId = TimerWheel<Task>::TimerId; // 0 is never a timer
+
+    explicit TimerService(std::chrono::milliseconds tick = std::chrono::milliseconds(10));
+    ~TimerService();
+
+    bool open();
+    int fd() const { return timerFd; }
+
+    // Runs task once delay has passed, rounded up to the next tick.
+    TimerId schedule(Clock::duration delay, Task task);
+    // Returns false if the timer already ran or was cancelled. A task that is
+    // due may already be running, so tasks still check that they are wanted.
+    bool cancel(TimerId id);
+    // Runs every task that is due. Called when fd() is readable.
+    void runExpired();
+
+private:
+    uint64_t tickAt(Clock::time_point time) const;
+    void armLocked(bool enable);
+
+    const Clock::duration tick;
+    const Clock::time_point started;
+    int timerFd;
+    std::mutex mtx;
+    TimerWheel<Task> wheel;
+    bool armed;
+};
+
+#endif // TIMER_SERVICE_H
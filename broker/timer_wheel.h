@@ -0,0 +1,186 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hierarchical hashed timing wheel. Time moves in ticks. Level 0 has one slot
+// per tick of the current 64-tick block, level 1 one slot per block of the
+// current 64^2 ticks, and so on up to level 3 (64^4 ticks; later deadlines
+// wait in its first slot, which is only reached when the top level wraps).
+// When a coarse slot comes up, its timers are cascaded into the finer levels,
+// so every timer moves at most three times before it fires.
+//
+// Timers live in one node pool, linked into their slot by index, so
+// scheduling and cancelling are O(1) and reuse freed nodes instead of
+// allocating. A timer id names a node and its generation, which makes
+// cancelling a timer that already fired (or was cancelled) a harmless no-op.
+// Not thread-safe.
+template <typename T>
+class TimerWheel {
+public:
+    using TimerId = uint64_t; // 0 is never a timer
+
+    explicit TimerWheel(uint64_t startTick = 0) : now(startTick), pending(0), freeList(NIL) {
+        for (auto& level : slots) {
+            for (auto& head : level) {
+                head = NIL;
+            }
+        }
+    }
+
+    uint64_t currentTick() const { return now; }
+    size_t size() const { return pending; }
+
+    // A deadline that has already passed fires on the next advance.
+    TimerId schedule(uint64_t deadline, T value) {
+        uint32_t index = allocate();
+        Node& node = nodes[index];
+        node.deadline = deadline > now ? deadline : now + 1;
+        node.value = std::move(value);
+        node.active = true;
+        place(index, now);
+        ++pending;
+        return (static_cast<uint64_t>(node.generation) << 32) | (index + 1);
+    }
+
+    // Returns false if the timer already fired or was cancelled.
+    bool cancel(TimerId id) {
+        uint32_t index = static_cast<uint32_t>(id & 0xffffffffu) - 1;
+        if (id == 0 || index >= nodes.size()) {
+            return false;
+        }
+        Node& node = nodes[index];
+        if (!node.active || node.generation != static_cast<uint32_t>(id >> 32)) {
+            return false;
+        }
+        unlink(index);
+        release(index);
+        --pending;
+        return true;
+    }
+
+    // Moves the wheel forward to tick and appends every expired timer's value,
+    // in deadline order.
+    void advance(uint64_t tick, std::vector<T>& expired) {
+        while (now < tick) {
+            if (pending == 0) {
+                now = tick;
+                return;
+            }
+            uint64_t next = now + 1;
+            // Coarser levels first, so a timer due at next reaches level 0 in time.
+            for (int level = LEVELS - 1; level > 0; --level) {
+                if ((next & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) == 0) {
+                    cascade(level, slotOf(next, level), next);
+                }
+            }
+            uint32_t index = slots[0][slotOf(next, 0)];
+            slots[0][slotOf(next, 0)] = NIL;
+            now = next;
+            while (index != NIL) {
+                uint32_t following = nodes[index].next;
+                expired.push_back(std::move(nodes[index].value));
+                release(index);
+                --pending;
+                index = following;
+            }
+        }
+    }
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const size_t SLOTS = size_t(1) << SLOT_BITS;
+    static const uint32_t NIL = UINT32_MAX;
+
+    struct Node {
+        uint64_t deadline = 0;
+        T value = T();
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        uint32_t generation = 0;
+        uint8_t level = 0;
+        uint8_t slot = 0;
+        bool active = false;
+    };
+
+    static size_t slotOf(uint64_t tick, int level) {
+        return static_cast<size_t>((tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+    }
+
+    // Files the timer at the finest level whose current revolution, as of
+    // tick base, contains the deadline.
+    void place(uint32_t index, uint64_t base) {
+        Node& node = nodes[index];
+        int level = 0;
+        while (level < LEVELS && (node.deadline >> (SLOT_BITS * (level + 1))) != (base >> (SLOT_BITS * (level + 1)))) {
+            ++level;
+        }
+        if (level == LEVELS) {
+            node.level = LEVELS - 1;
+            node.slot = 0;
+        } else {
+            node.level = static_cast<uint8_t>(level);
+            node.slot = static_cast<uint8_t>(slotOf(node.deadline, level));
+        }
+        uint32_t& head = slots[node.level][node.slot];
+        node.prev = NIL;
+        node.next = head;
+        if (head != NIL) {
+            nodes[head].prev = index;
+        }
+        head = index;
+    }
+
+    void unlink(uint32_t index) {
+        Node& node = nodes[index];
+        if (node.prev != NIL) {
+            nodes[node.prev].next = node.next;
+        } else {
+            slots[node.level][node.slot] = node.next;
+        }
+        if (node.next != NIL) {
+            nodes[node.next].prev = node.prev;
+        }
+    }
+
+    void cascade(int level, size_t slot, uint64_t base) {
+        uint32_t index = slots[level][slot];
+        slots[level][slot] = NIL;
+        while (index != NIL) {
+            uint32_t following = nodes[index].next;
+            place(index, base);
+            index = following;
+        }
+    }
+
+    uint32_t allocate() {
+        if (freeList == NIL) {
+            nodes.emplace_back();
+            return static_cast<uint32_t>(nodes.size() - 1);
+        }
+        uint32_t index = freeList;
+        freeList = nodes[index].next;
+        return index;
+    }
+
+    void release(uint32_t index) {
+        Node& node = nodes[index];
+        node.value = T();
+        node.active = false;
+        ++node.generation;
+        node.next = freeList;
+        freeList = index;
+    }
+
+    std::vector<Node> nodes;
+    uint32_t slots[LEVELS][SLOTS];
+    uint64_t now;
+    size_t pending;
+    uint32_t freeList;
+};
+
+#endif // TIMER_WHEEL_H
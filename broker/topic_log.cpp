@@ -0,0 +1,119 @@
+#include "topic_log.h"
+#include <algorithm>
+
+// Emptied segments kept for reuse; enough to roll over without allocating.
+#define MAX_SPARE_SEGMENTS 2
+
+TopicLog::TopicLog(const RetentionConfig& retention) : limits(retention), nextOffset(0), totalBytes(0) {
+    limits.segmentMessages = std::max<size_t>(limits.segmentMessages, 1);
+    limits.segmentBytes = std::max<size_t>(limits.segmentBytes, 1);
+}
+
+uint64_t TopicLog::append(SharedMessagePtr message, Clock::time_point now) {
+    if (segments.empty() || segments.back()->entries.size() >= limits.segmentMessages
+            || segments.back()->bytes >= limits.segmentBytes) {
+        // Rolling a segment is also when expired ones are dropped.
+        enforceRetention(now);
+        segments.push_back(allocateSegment(nextOffset));
+    }
+
+    Segment& active = *segments.back();
+    active.bytes += message->size();
+    active.newest = now;
+    active.expiresAt = std::max(active.expiresAt, message->expiresAt());
+    totalBytes += message->size();
+    active.entries.push_back(std::move(message));
+
+    while (segments.size() > 1
+            && ((limits.maxBytes > 0 && totalBytes > limits.maxBytes)
+                || (limits.maxMessages > 0 && messageCount() > limits.maxMessages))) {
+        dropOldestSegment();
+    }
+    return nextOffset++;
+}
+
+uint64_t TopicLog::read(uint64_t offset, size_t maxMessages, std::vector<SharedMessagePtr>& out) const {
+    offset = std::max(offset, startOffset());
+    if (offset >= nextOffset || maxMessages == 0) {
+        return std::min(offset, nextOffset);
+    }
+
+    // Segments are contiguous in offset order; find the one holding offset.
+    auto it = std::upper_bound(segments.begin(), segments.end(), offset,
+                               [](uint64_t value, const std::unique_ptr<Segment>& segment) {
+                                   return value < segment->baseOffset;
+                               });
+    --it;
+
+    size_t copied = 0;
+    for (; it != segments.end() && copied < maxMessages; ++it) {
+        const Segment& segment = **it;
+        size_t first = static_cast<size_t>(offset - segment.baseOffset);
+        size_t count = std::min(segment.entries.size() - first, maxMessages - copied);
+        out.insert(out.end(), segment.entries.begin() + first, segment.entries.begin() + first + count);
+        copied += count;
+        offset += count;
+    }
+    return offset;
+}
+
+void TopicLog::resetOffset(uint64_t offset) {
+    while (!segments.empty()) {
+        dropOldestSegment();
+    }
+    nextOffset = offset;
+}
+
+void TopicLog::truncateBefore(uint64_t offset) {
+    while (segments.size() > 1
+            && segments.front()->baseOffset + segments.front()->entries.size() <= offset) {
+        dropOldestSegment();
+    }
+}
+
+void TopicLog::enforceRetention(Clock::time_point now) {
+    while (!segments.empty() && overLimits(now)) {
+        dropOldestSegment();
+    }
+}
+
+bool TopicLog::overLimits(Clock::time_point now) const {
+    const Segment& oldest = *segments.front();
+    if (limits.maxAgeMs > 0 && now - oldest.newest > std::chrono::milliseconds(limits.maxAgeMs)) {
+        return true;
+    }
+    if (now >= oldest.expiresAt) {
+        return true;
+    }
+    // The active segment is only dropped for age or TTL; size limits keep it.
+    if (segments.size() == 1) {
+        return false;
+    }
+    return (limits.maxBytes > 0 && totalBytes > limits.maxBytes)
+           || (limits.maxMessages > 0 && messageCount() > limits.maxMessages);
+}
+
+std::unique_ptr<TopicLog::Segment> TopicLog::allocateSegment(uint64_t baseOffset) {
+    std::unique_ptr<Segment> segment;
+    if (!spare.empty()) {
+        segment = std::move(spare.back());
+        spare.pop_back();
+    } else {
+        segment.reset(new Segment());
+    }
+    segment->baseOffset = baseOffset;
+    segment->expiresAt = Clock::time_point::min();
+    return segment;
+}
+
+void TopicLog::dropOldestSegment() {
+    std::unique_ptr<Segment> segment = std::move(segments.front());
+    segments.pop_front();
+    totalBytes -= segment->bytes;
+
+    if (spare.size() < MAX_SPARE_SEGMENTS) {
+        segment->entries.clear(); // keeps the slot array's capacity
+        segment->bytes = 0;
+        spare.push_back(std::move(segment));
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef TOPIC_LOG_H
+#define TOPIC_LOG_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "server_config.h"
+#include "shared_message.h"
+
+// Append-only, offset-addressed message log for one topic.
+//
+// The log is a queue of fixed-capacity segments. Sealed segments are recycled
+// through a small free list with their slot arrays intact, so once a busy
+// topic has rolled over a few times its appends stop allocating, while a quiet
+// topic only pays for the slots it uses. Retention drops the oldest segment
+// as a unit: one pop from the front of the queue, regardless of how many
+// messages the log holds. Readers address messages by offset; an offset that
+// has been reclaimed resumes at the oldest retained message. A segment whose
+// messages all have TTLs expires with the last of them.
+//
+// Not thread-safe; the owning topic's shard lock serializes access.
+class TopicLog {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TopicLog(const RetentionConfig& retention);
+
+    // Appends a message and enforces the count and byte limits. Returns its offset.
+    uint64_t append(SharedMessagePtr message, Clock::time_point now = Clock::now());
+
+    // Copies up to maxMessages messages starting at offset into out and returns
+    // the offset following the last one copied.
+    uint64_t read(uint64_t offset, size_t maxMessages, std::vector<SharedMessagePtr>& out) const;
+
+    // Discards the log and continues numbering at offset, e.g. after recovery.
+    void resetOffset(uint64_t offset);
+
+    // Drops whole sealed segments that end at or before offset.
+    void truncateBefore(uint64_t offset);
+
+    // Drops segments that fall outside the retention limits, including age and
+    // message TTLs.
+    void enforceRetention(Clock::time_point now = Clock::now());
+
+    // When the oldest segment expires; Clock::time_point::max() if it never does.
+    Clock::time_point oldestExpiry() const {
+        return segments.empty() ? Clock::time_point::max() : segments.front()->expiresAt;
+    }
+
+    uint64_t startOffset() const { return segments.empty() ? nextOffset : segments.front()->baseOffset; }
+    uint64_t endOffset() const { return nextOffset; }
+    size_t messageCount() const { return static_cast<size_t>(nextOffset - startOffset()); }
+    size_t bytes() const { return totalBytes; }
+    bool empty() const { return nextOffset == startOffset(); }
+
+private:
+    struct Segment {
+        uint64_t baseOffset = 0;
+        size_t bytes = 0;
+        Clock::time_point newest;
+        Clock::time_point expiresAt; // of its last message to expire
+        std::vector<SharedMessagePtr> entries;
+    };
+
+    std::unique_ptr<Segment> allocateSegment(uint64_t baseOffset);
+    void dropOldestSegment();
+    bool overLimits(Clock::time_point now) const;
+
+    RetentionConfig limits;
+    std::deque<std::unique_ptr<Segment>> segments;
+    std::vector<std::unique_ptr<Segment>> spare;
+    uint64_t nextOffset;
+    size_t totalBytes;
+};
+
+#endif // TOPIC_LOG_H
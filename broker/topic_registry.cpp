@@ -0,0 +1,30 @@
+#include "topic_registry.h"
+
+static size_t roundUpPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+TopicRegistry::TopicRegistry(size_t shardCount, const RetentionConfig& retention)
+        : shards(roundUpPowerOfTwo(shardCount > 0 ? shardCount : 1)), mask(shards.size() - 1), retention(retention) {}
+
+void TopicRegistry::forEach(const std::function<void(const TopicKey&, const TopicState&)>& fn) {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : shard.topics) {
+            fn(entry.first, entry.second);
+        }
+    }
+}
+
+void TopicRegistry::forEachMutable(const std::function<void(const TopicKey&, TopicState&)>& fn) {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& entry : shard.topics) {
+            fn(entry.first, entry.second);
+        }
+    }
+}
@@ -0,0 +1,230 @@
+#ifndef TOPIC_REGISTRY_H
+#define TOPIC_REGISTRY_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "shared_message.h"
+#include "topic_log.h"
+#include "log_store.h"
+#include "consumer_cursors.h"
+#include "message_filter.h"
+
+class Connection;
+struct PendingPublish;
+
+// A subscription served from the partition's log rather than pushed as
+// messages are published: a flow-controlled one (see CREDIT in wire.h), which
+// reads from next as its credit allows, or an acknowledged one (see ACK),
+// which also stops when it has too many messages unacknowledged. Messages it
+// cannot take yet stay in the log.
+struct FlowSubscriber {
+    std::shared_ptr<Connection> connection;
+    MessageFilterPtr filter; // null for none
+    uint64_t next = 0;
+    bool acked = false;
+    std::string consumer;                 // acknowledged subscriptions commit its cursor
+    std::map<uint64_t, uint64_t> unacked; // offset -> its redelivery timer (see TimerService)
+};
+
+// A follower's place in the replication stream of a partition this broker
+// leads (see cluster.h). The next REPLICATE starts at sent; a follower behind
+// the end of the log is sent the next stretch whenever it acknowledges one.
+struct ReplicaProgress {
+    size_t member = 0;
+    uint64_t session = 0;              // the follower registration this belongs to
+    uint64_t sent = 0;
+    uint64_t acked = 0;                // end of the follower's copy, as it last reported
+    uint64_t resendFrom = UINT64_MAX;  // the gap being repaired, so repeated reports of it are ignored
+    bool syncing = false;              // counted in the follower's initial sync
+};
+
+// A quorum publish waiting for its followers to hold the log up to end.
+struct QuorumWait {
+    uint64_t end;
+    std::shared_ptr<PendingPublish> publish;
+};
+
+// Keeps what is pushed for one topic partition in offset order. Messages are
+// taken from a partition under its shard lock but fanned out after the lock
+// is released, so two threads publishing to it could otherwise hand a
+// subscriber offsets N + 1 and N in that order. Whoever takes messages under
+// the lock also takes the next turn, and waits for it before pushing them.
+class DeliveryOrder {
+public:
+    uint64_t take() { return next++; } // under the shard lock
+
+    void await(uint64_t turn) {
+        std::unique_lock<std::mutex> lock(mutex);
+        turnDone.wait(lock, [&] { return serving == turn; });
+    }
+
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++serving;
+        }
+        turnDone.notify_all();
+    }
+
+private:
+    uint64_t next = 0; // guarded by the shard lock
+    std::mutex mutex;
+    std::condition_variable turnDone;
+    uint64_t serving = 0;
+};
+
+// One turn in a partition's DeliveryOrder, taken under the shard lock and
+// waited for after it is released; it ends when this goes out of scope. A
+// thread holds at most one turn at a time, takes no lock but connection
+// queues while holding it, and never waits for room in one, so turns cannot
+// deadlock. A message for a queue that is full under the Block policy is held
+// back until the turn ends, so that subscriber alone may receive it after
+// messages other publishers delivered in the meantime.
+class DeliveryTurn {
+public:
+    DeliveryTurn() = default;
+    DeliveryTurn(const DeliveryTurn&) = delete;
+    DeliveryTurn& operator=(const DeliveryTurn&) = delete;
+    ~DeliveryTurn() { release(); }
+
+    void take(const std::shared_ptr<DeliveryOrder>& from) {
+        order = from;
+        turn = order->take();
+    }
+
+    void wait() {
+        if (order && !waited) {
+            order->await(turn);
+            waited = true;
+        }
+    }
+
+    void release() {
+        if (order) {
+            wait();
+            order->finish();
+            order.reset();
+            waited = false;
+        }
+    }
+
+private:
+    std::shared_ptr<DeliveryOrder> order;
+    uint64_t turn = 0;
+    bool waited = false;
+};
+
+// Everything the broker keeps for one topic partition (unpartitioned topics
+// have just partition 0).
+struct TopicState {
+    explicit TopicState(const RetentionConfig& retention) : log(retention) {}
+
+    std::vector<std::shared_ptr<Connection>> subscribers;
+    std::vector<FilteredSubscribers> filteredSubscribers; // one entry per distinct filter
+    std::vector<FlowSubscriber> flowSubscribers;
+    TopicLog log;
+    std::shared_ptr<TopicStore> store;             // durable copy of the log, if persistence is on
+    std::unordered_map<int, uint64_t> readOffsets; // next GET_MESSAGES offset per client
+    ConsumerCursors cursors;                       // named FETCH consumers
+    // Consumer groups reading this partition, each through the one member it
+    // is currently assigned to. Group members are not in subscribers.
+    std::vector<std::pair<std::string, std::shared_ptr<Connection>>> groupOwners;
+    // Wildcard subscribers whose pattern matches this topic, cached until the
+    // subscription trie's generation moves past patternGeneration.
+    std::vector<std::shared_ptr<Connection>> patternSubscribers;
+    uint64_t patternGeneration = 0;
+    uint64_t expiryTimer = 0; // due when the log's oldest segment expires (see TimerService)
+    TopicLog::Clock::time_point expiryTimerAt;
+    std::vector<ReplicaProgress> replicas; // while this broker leads the partition
+    std::deque<QuorumWait> quorumWaits;    // ordered by end
+    std::shared_ptr<DeliveryOrder> deliveryOrder = std::make_shared<DeliveryOrder>();
+};
+
+struct TopicKey {
+    std::string topic;
+    uint16_t partition;
+
+    bool operator==(const TopicKey& other) const { return partition == other.partition && topic == other.topic; }
+};
+
+struct TopicKeyHash {
+    size_t operator()(const TopicKey& key) const {
+        return std::hash<std::string>()(key.topic) ^ (static_cast<size_t>(key.partition) * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
+// Topic table split into hash-partitioned shards, each with its own lock, so
+// requests on unrelated topics do not contend. A topic partition always maps
+// to the same shard; operations on it are serialized by that shard's lock.
+// Partitions of one topic usually land in different shards.
+class TopicRegistry {
+public:
+    explicit TopicRegistry(size_t shardCount = 64, const RetentionConfig& retention = RetentionConfig());
+
+    // Runs fn(TopicState&) under the partition's shard lock, creating it if needed.
+    template <typename Fn>
+    auto withTopic(std::string_view topic, uint16_t partition, Fn&& fn) {
+        TopicKey key{std::string(topic), partition};
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return fn(shard.topics.try_emplace(std::move(key), retention).first->second);
+    }
+
+    template <typename Fn>
+    auto withTopic(std::string_view topic, Fn&& fn) {
+        return withTopic(topic, 0, std::forward<Fn>(fn));
+    }
+
+    // Runs fn(TopicState&) only if the partition exists; fn returns true when
+    // it holds no more state and can be dropped. Returns whether it existed.
+    template <typename Fn>
+    bool withExistingTopic(std::string_view topic, uint16_t partition, Fn&& fn) {
+        TopicKey key{std::string(topic), partition};
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.topics.find(key);
+        if (it == shard.topics.end()) {
+            return false;
+        }
+        if (fn(it->second)) {
+            shard.topics.erase(it);
+        }
+        return true;
+    }
+
+    template <typename Fn>
+    bool withExistingTopic(std::string_view topic, Fn&& fn) {
+        return withExistingTopic(topic, 0, std::forward<Fn>(fn));
+    }
+
+    // Visits every topic partition, holding one shard lock at a time.
+    void forEach(const std::function<void(const TopicKey&, const TopicState&)>& fn);
+    void forEachMutable(const std::function<void(const TopicKey&, TopicState&)>& fn);
+
+    size_t shardCount() const { return shards.size(); }
+
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<TopicKey, TopicState, TopicKeyHash> topics;
+    };
+
+    Shard& shardFor(const TopicKey& key) {
+        return shards[TopicKeyHash()(key) & mask];
+    }
+
+    std::vector<Shard> shards;
+    size_t mask;
+    RetentionConfig retention;
+};
+
+#endif // TOPIC_REGISTRY_H
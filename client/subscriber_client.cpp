@@ -2,17 +2,12 @@
 #include "../common/message.h"
 #include <iostream>
 #include <thread>
-#include <chrono>
 #include <atomic>
-#include <vector>
-#include <map>
 #include <mutex>
 #include <queue>
 #include <condition_variable>
 
 std::atomic<bool> running(true);
-std::map<std::string, std::atomic<bool>> pollThreadRunning;
-std::mutex pollThreadsMutex;
 
 std::mutex outputMutex;
 std::queue<std::string> outputQueue;
@@ -47,25 +42,17 @@ void outputThread() {
     }
 }
 
-void pollMessages(Subscriber& subscriber, const std::string& topic) {
-    queueOutput("\nStarted polling thread for topic: " + topic + "\n");
+// Runs on the subscriber's I/O thread as each message arrives.
+void printMessage(const Message& message) {
+    queueOutput("\nReceived message on topic '" + message.topic + "':\n" +
+                "  Content: " + message.content + "\n" +
+                "  Client ID: " + std::to_string(message.clientId) + "\n" +
+                "  UUID: " + message.uuid + "\n");
     queueOutput("Enter command (subscribe/unsubscribe/quit): ");
-    while (pollThreadRunning[topic]) {
-        Message message;
-        if (subscriber.getNextMessage(topic, message)) {
-            queueOutput("\nReceived message on topic '" + topic + "':\n" +
-                        "  Content: " + message.content + "\n" +
-                        "  Client ID: " + std::to_string(message.clientId) + "\n" +
-                        "  UUID: " + message.uuid + "\n");
-            queueOutput("Enter command (subscribe/unsubscribe/quit): ");
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
 }
 
 void handleCommands(Subscriber& subscriber) {
     std::string command, topic;
-    std::map<std::string, std::thread> pollThreads;
 
     while (running) {
         queueOutput("Enter command (subscribe/unsubscribe/quit): ");
@@ -79,27 +66,15 @@ void handleCommands(Subscriber& subscriber) {
             std::cin >> topic;
 
             if (command == "subscribe") {
-                if (subscriber.subscribe(topic)) {
+                if (subscriber.subscribe(topic, printMessage)) {
                     queueOutput("Successfully subscribed to topic: " + topic + "\n");
-                    std::lock_guard<std::mutex> lock(pollThreadsMutex);
-                    if (pollThreads.find(topic) == pollThreads.end()) {
-                        pollThreadRunning[topic] = true;
-                        pollThreads[topic] = std::thread(pollMessages, std::ref(subscriber), topic);
-                        queueOutput("Created polling thread for topic: " + topic + "\n");
-                    }
                 } else {
                     queueOutput("Failed to subscribe to topic: " + topic + "\n");
                 }
             } else { // unsubscribe
                 if (subscriber.unsubscribe(topic)) {
+                    subscriber.setMessageHandler(topic, nullptr);
                     queueOutput("Successfully unsubscribed from topic: " + topic + "\n");
-                    std::lock_guard<std::mutex> lock(pollThreadsMutex);
-                    if (pollThreads.find(topic) != pollThreads.end()) {
-                        pollThreadRunning[topic] = false;
-                        pollThreads[topic].join();
-                        pollThreads.erase(topic);
-                        queueOutput("Removed polling thread for topic: " + topic + "\n");
-                    }
                 } else {
                     queueOutput("Failed to unsubscribe from topic: " + topic + "\n");
                 }
@@ -108,12 +83,6 @@ void handleCommands(Subscriber& subscriber) {
             queueOutput("Invalid command. Please use 'subscribe', 'unsubscribe', or 'quit'.\n");
         }
     }
-
-    // Clean up remaining threads
-    for (auto& pair : pollThreads) {
-        pollThreadRunning[pair.first] = false;
-        pair.second.join();
-    }
 }
 
 int main() {
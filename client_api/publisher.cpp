@@ -2,47 +2,490 @@
 #include "../common/network.h"
 #include "../common/message.h"
 #include <iostream>
+#include <chrono>
 #include <cstdlib>
 #include <ctime>
 #include <cerrno>
 #include <cstring>
+#include <algorithm>
+#include <sys/socket.h>
 #include <uuid/uuid.h>
 
-Publisher::Publisher(const std::string& serverAddress, int serverPort)
-        : serverAddress(serverAddress), serverPort(serverPort) {
+#define MAX_RECONNECT_ATTEMPTS 5
+#define RECONNECT_BACKOFF_MS 100
+#define PUBLISH_TIMEOUT_MS 30000
+
+Publisher::Publisher(const std::string& serverAddress, int serverPort, size_t maxInFlight,
+                     const BatchConfig& batching)
+        : serverAddress(serverAddress), serverPort(serverPort), maxInFlight(maxInFlight > 0 ? maxInFlight : 1),
+          batching(batching), acks(PublishAcks::Leader), inFlight(0), throttled(false), openBatchBytes(0), nextSequence(1), sock(-1), binaryProtocol(false),
+          running(true) {
+    // A batch must fit in one frame.
+    this->batching.maxBytes = std::min<size_t>(this->batching.maxBytes, WIRE_MAX_PAYLOAD);
     std::srand(std::time(nullptr));
     clientId = std::rand();
 }
 
+Publisher::~Publisher() {
+    close();
+}
+
 void Publisher::publish(const std::string& topic, const std::string& message) {
+    publish(topic, message, std::string());
+}
+
+std::future<PublishAck> Publisher::publishAsync(const std::string& topic, const std::string& message) {
+    return publishAsync(topic, message, std::string());
+}
+
+uint64_t Publisher::publishAsync(const std::string& topic, const std::string& message, AckCallback callback) {
+    return publishAsync(topic, message, std::string(), std::move(callback));
+}
+
+static void reportAck(std::future<PublishAck>& future, const std::string& topic) {
+    if (future.wait_for(std::chrono::milliseconds(PUBLISH_TIMEOUT_MS)) != std::future_status::ready) {
+        std::cerr << "Timed out waiting for the broker to acknowledge a message on " << topic << std::endl;
+        return;
+    }
+    PublishAck ack = future.get();
+    std::cout << "Server response: " << (ack.success ? "PUBLISHED:" : "FAILED:") << topic << std::endl;
+}
+
+void Publisher::publish(const std::string& topic, const std::string& message, const std::string& key) {
+    std::future<PublishAck> future = publishAsync(topic, message, key);
+    reportAck(future, topic);
+}
+
+std::future<PublishAck> Publisher::publishAsync(const std::string& topic, const std::string& message,
+                                                const std::string& key) {
+    auto promise = std::make_shared<std::promise<PublishAck>>();
+    std::future<PublishAck> future = promise->get_future();
+    publishAsync(topic, message, key, [promise](const PublishAck& ack) { promise->set_value(ack); });
+    return future;
+}
+
+uint64_t Publisher::publishAsync(const std::string& topic, const std::string& message, const std::string& key,
+                                 AckCallback callback) {
     Message msg;
-    msg.type = "PUBLISH";
     msg.topic = topic;
     msg.content = message;
+    msg.partition = key.empty() ? 0 : partitionKeyHash(key);
+    return publishAsync(std::move(msg), std::move(callback));
+}
+
+void Publisher::publish(const Message& message) {
+    std::future<PublishAck> future = publishAsync(message);
+    reportAck(future, message.topic);
+}
+
+std::future<PublishAck> Publisher::publishAsync(const Message& message) {
+    auto promise = std::make_shared<std::promise<PublishAck>>();
+    std::future<PublishAck> future = promise->get_future();
+    publishAsync(message, [promise](const PublishAck& ack) { promise->set_value(ack); });
+    return future;
+}
+
+// A batch entry's payload: the content, preceded by an attributes block when
+// the batch carries them. Entries without attributes then get an empty block.
+static std::string batchEntryPayload(const Message& msg, bool withAttributes) {
+    if (!withAttributes) {
+        return msg.content;
+    }
+    std::string payload = msg.hasAttributes() ? msg.encodeAttributes() : std::string();
+    if (payload.empty()) {
+        appendAttributes(0, 0, {}, payload);
+    }
+    return payload + msg.content;
+}
+
+uint64_t Publisher::publishAsync(Message msg, AckCallback callback) {
+    msg.type = "PUBLISH";
     msg.clientId = clientId;
     msg.uuid = generateUUID();
+    if (msg.hasAttributes() && msg.encodeAttributes().empty()) {
+        std::cerr << "Attributes of message on topic " << msg.topic << " are too large" << std::endl;
+        callback(PublishAck{0, false});
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(mtx);
+    stateChanged.wait(lock, [this] { return inFlight < (throttled ? 1 : maxInFlight) || !running; });
+    if (!running) {
+        lock.unlock();
+        callback(PublishAck{0, false});
+        return 0;
+    }
+
+    uint64_t sequence = nextSequence++;
+    ++inFlight;
+    if (!ioThread.joinable()) {
+        ioThread = std::thread(&Publisher::ioLoop, this);
+    }
+
+    size_t entryBytes = batchEntrySize(msg.topic, batchEntryPayload(msg, msg.hasAttributes()));
+    PendingPublish publish{sequence, std::move(msg), std::move(callback)};
+
+    // Text-only brokers cannot take batches, so there is no point lingering.
+    if (batching.maxMessages <= 1 || (sock != -1 && !binaryProtocol)) {
+        PendingRequest request;
+        request.publishes.push_back(std::move(publish));
+        submitLocked(std::move(request));
+        lock.unlock();
+        drainOutbox();
+        return sequence;
+    }
 
-    std::string response = sendRequest(msg.serialize());
-    std::cout << "Server response: " << response << std::endl;
+    if (!openBatch.publishes.empty() && openBatchBytes + entryBytes > batching.maxBytes) {
+        sealBatchLocked();
+    }
+    if (openBatch.publishes.empty()) {
+        openBatchBytes = WIRE_BATCH_COUNT_SIZE;
+        openBatchDeadline = std::chrono::steady_clock::now() + batching.linger;
+        if (!lingerThread.joinable()) {
+            lingerThread = std::thread(&Publisher::lingerLoop, this);
+        }
+        lingerWakeup.notify_one();
+    }
+    openBatch.publishes.push_back(std::move(publish));
+    openBatchBytes += entryBytes;
+    if (openBatch.publishes.size() >= batching.maxMessages || openBatchBytes >= batching.maxBytes) {
+        sealBatchLocked();
+    }
+    lock.unlock();
+    drainOutbox();
+    return sequence;
 }
 
-std::string Publisher::sendRequest(const std::string& request) {
-    int sock = createConnection(serverAddress, serverPort);
-    if (sock < 0) {
-        std::cerr << "Failed to create connection: " << strerror(errno) << std::endl;
-        return "";
+void Publisher::setAcks(PublishAcks level) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (level != acks) {
+            sealBatchLocked();
+            acks = level;
+        }
+    }
+    drainOutbox();
+}
+
+bool Publisher::flush(int timeoutMs) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        sealBatchLocked();
+    }
+    drainOutbox();
+    std::unique_lock<std::mutex> lock(mtx);
+    return stateChanged.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return inFlight == 0; });
+}
+
+void Publisher::close() {
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!running) {
+            return;
+        }
+        running = false;
+        if (sock != -1) {
+            shutdown(sock, SHUT_RDWR);
+        }
+    }
+    stateChanged.notify_all();
+    lingerWakeup.notify_all();
+    if (ioThread.joinable()) {
+        ioThread.join();
+    }
+    if (lingerThread.joinable()) {
+        lingerThread.join();
     }
 
-    if (sendMessage(sock, request) < 0) {
-        std::cerr << "Failed to send message: " << strerror(errno) << std::endl;
-        closeConnection(sock);
-        return "";
+    {
+        std::lock_guard<std::mutex> sending(sendMutex);
+        std::lock_guard<std::mutex> lock(mtx);
+        if (sock != -1) {
+            closeConnection(sock);
+            sock = -1;
+        }
+        outbox.clear();
     }
+    failAllPending();
+}
+
+void Publisher::sealBatchLocked() {
+    if (openBatch.publishes.empty()) {
+        return;
+    }
+    PendingRequest request = std::move(openBatch);
+    openBatch = PendingRequest();
+    openBatchBytes = 0;
+    submitLocked(std::move(request));
+}
+
+void Publisher::submitLocked(PendingRequest request) {
+    uint64_t sequence = request.publishes.front().sequence;
+    request.acks = acks;
+    PendingRequest& entry = pending[sequence] = std::move(request);
+    if (sock != -1) {
+        // The caller sends it with drainOutbox() once it releases the lock.
+        outbox.push_back(encodeRequest(sequence, entry));
+    } else {
+        // The I/O thread connects and sends everything that is pending.
+        stateChanged.notify_all();
+    }
+}
+
+std::string Publisher::encodeRequest(uint64_t sequence, const PendingRequest& request) const {
+    std::string data;
+    uint8_t quorum = request.acks == PublishAcks::Quorum ? WIRE_FLAG_QUORUM : 0;
+    if (!binaryProtocol) {
+        for (const auto& publish : request.publishes) {
+            data += publish.msg.serialize() + "\n";
+        }
+    } else if (request.publishes.size() == 1) {
+        data = request.publishes.front().msg.serializeBinary(sequence, quorum);
+    } else {
+        FrameHeader header;
+        header.opcode = Opcode::PublishBatch;
+        header.clientId = static_cast<uint32_t>(clientId);
+        header.sequence = sequence;
+        header.flags = quorum;
+
+        bool withAttributes = std::any_of(request.publishes.begin(), request.publishes.end(),
+                                          [](const PendingPublish& publish) { return publish.msg.hasAttributes(); });
+        if (withAttributes) {
+            header.flags |= WIRE_FLAG_ATTRIBUTES;
+        }
+
+        std::vector<std::string> entryPayloads;
+        size_t payloadSize = WIRE_BATCH_COUNT_SIZE;
+        for (const auto& publish : request.publishes) {
+            entryPayloads.push_back(batchEntryPayload(publish.msg, withAttributes));
+            payloadSize += batchEntrySize(publish.msg.topic, entryPayloads.back());
+        }
+        std::string payload(payloadSize, '\0');
+        encodeBatchCount(static_cast<uint32_t>(request.publishes.size()), &payload[0]);
+        size_t offset = WIRE_BATCH_COUNT_SIZE;
+        for (size_t i = 0; i < request.publishes.size(); ++i) {
+            const Message& msg = request.publishes[i].msg;
+            uint8_t uuid[WIRE_UUID_SIZE];
+            parseUuid(msg.uuid, uuid);
+            offset += encodeBatchEntry(msg.topic, entryPayloads[i], uuid, msg.partition,
+                                       &payload[offset], payload.size() - offset);
+        }
+
+        data.resize(frameSize("", payload));
+        encodeFrame(header, "", payload, &data[0], data.size());
+    }
+    return data;
+}
+
+void Publisher::drainOutbox() {
+    std::lock_guard<std::mutex> sending(sendMutex);
+    while (true) {
+        std::string data;
+        int fd;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (outbox.empty() || sock == -1) {
+                return;
+            }
+            data = std::move(outbox.front());
+            outbox.pop_front();
+            fd = sock;
+        }
+        // fd stays open while sendMutex is held.
+        if (sendMessage(fd, data) < 0) {
+            std::cerr << "Failed to send message: " << strerror(errno) << std::endl;
+            // Wake the I/O thread; it reconnects and resends whatever is unacknowledged.
+            shutdown(fd, SHUT_RDWR);
+            return;
+        }
+    }
+}
 
-    std::string response = receiveMessage(sock);
+// Called by the I/O thread when the connection failed.
+void Publisher::disconnect() {
+    {
+        // Unblocks a send in progress, so sendMutex is released.
+        std::lock_guard<std::mutex> lock(mtx);
+        shutdown(sock, SHUT_RDWR);
+    }
+    std::lock_guard<std::mutex> sending(sendMutex);
+    std::lock_guard<std::mutex> lock(mtx);
     closeConnection(sock);
+    sock = -1;
+    outbox.clear();
+    if (running) {
+        std::cerr << "Connection to broker lost, reconnecting" << std::endl;
+    }
+}
+
+bool Publisher::connectAndNegotiate() {
+    int fd = createConnection(serverAddress, serverPort);
+    if (fd < 0) {
+        std::cerr << "Failed to create connection: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    FrameReader freshReader;
+    if (sendMessage(fd, WIRE_HELLO_REQUEST) < 0) {
+        std::cerr << "Failed to send protocol negotiation: " << strerror(errno) << std::endl;
+        closeConnection(fd);
+        return false;
+    }
+    std::string response = receiveMessage(fd, freshReader);
+    if (response.empty()) {
+        std::cerr << "Broker closed the connection during negotiation" << std::endl;
+        closeConnection(fd);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        // Brokers that predate the binary protocol answer INVALID_COMMAND; keep using text then.
+        binaryProtocol = response == WIRE_HELLO_RESPONSE;
+        reader = std::move(freshReader);
+        sock = fd;
+
+        // Resend everything not yet acknowledged, in sequence order.
+        outbox.clear();
+        for (const auto& entry : pending) {
+            outbox.push_back(encodeRequest(entry.first, entry.second));
+        }
+    }
+    drainOutbox();
+    return true;
+}
+
+void Publisher::ioLoop() {
+    int attempts = 0;
+    while (true) {
+        int current;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            stateChanged.wait(lock, [this] { return !running || sock != -1 || !pending.empty(); });
+            if (!running) {
+                return;
+            }
+            current = sock;
+        }
+
+        if (current == -1) {
+            if (connectAndNegotiate()) {
+                attempts = 0;
+                continue;
+            }
+            if (++attempts >= MAX_RECONNECT_ATTEMPTS) {
+                std::cerr << "Giving up on broker after " << attempts << " attempts" << std::endl;
+                failAllPending();
+                attempts = 0;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            stateChanged.wait_for(lock, std::chrono::milliseconds(RECONNECT_BACKOFF_MS << attempts),
+                                  [this] { return !running; });
+            continue;
+        }
+
+        long bytesRead = reader.readFrom(current);
+        if (bytesRead > 0) {
+            StreamFrame frame;
+            FrameStatus status;
+            while ((status = reader.next(frame)) == FrameStatus::Ready) {
+                handleResponse(frame);
+            }
+            if (status != FrameStatus::Invalid) {
+                continue;
+            }
+            std::cerr << "Undecodable response from broker" << std::endl;
+        } else if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+
+        disconnect();
+    }
+}
+
+void Publisher::lingerLoop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (running) {
+        if (openBatch.publishes.empty()) {
+            lingerWakeup.wait(lock);
+        } else if (std::chrono::steady_clock::now() >= openBatchDeadline) {
+            sealBatchLocked();
+            lock.unlock();
+            drainOutbox();
+            lock.lock();
+        } else {
+            lingerWakeup.wait_until(lock, openBatchDeadline);
+        }
+    }
+}
+
+void Publisher::handleResponse(const StreamFrame& frame) {
+    std::vector<PendingPublish> completed;
+    bool success;
+    bool backpressure = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (pending.empty()) {
+            return;
+        }
+
+        // Binary acks carry the request's sequence number and cover the whole
+        // batch; text responses arrive one per message, in request order.
+        if (frame.binary) {
+            auto it = pending.find(frame.frame.header.sequence);
+            if (it == pending.end()) {
+                return;
+            }
+            success = frame.frame.header.opcode == Opcode::Published;
+            backpressure = (frame.frame.header.flags & WIRE_FLAG_BACKPRESSURE) != 0;
+            for (auto& publish : it->second.publishes) {
+                completed.push_back(std::move(publish));
+            }
+            pending.erase(it);
+        } else {
+            success = frame.text.compare(0, 10, "PUBLISHED:") == 0;
+            auto it = pending.begin();
+            completed.push_back(std::move(it->second.publishes.front()));
+            it->second.publishes.pop_front();
+            if (it->second.publishes.empty()) {
+                pending.erase(it);
+            }
+        }
+        inFlight -= completed.size();
+        throttled = backpressure;
+    }
+    stateChanged.notify_all();
+
+    for (auto& publish : completed) {
+        if (publish.callback) {
+            publish.callback(PublishAck{publish.sequence, success, backpressure});
+        }
+    }
+}
+
+void Publisher::failAllPending() {
+    std::map<uint64_t, PendingRequest> failed;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        failed.swap(pending);
+        if (!openBatch.publishes.empty()) {
+            failed[openBatch.publishes.front().sequence] = std::move(openBatch);
+            openBatch = PendingRequest();
+            openBatchBytes = 0;
+        }
+        inFlight = 0;
+    }
+    stateChanged.notify_all();
 
-    return response;
+    for (auto& entry : failed) {
+        for (auto& publish : entry.second.publishes) {
+            if (publish.callback) {
+                publish.callback(PublishAck{publish.sequence, false});
+            }
+        }
+    }
 }
 
 std::string Publisher::generateUUID() {
@@ -51,4 +494,4 @@ std::string Publisher::generateUUID() {
     char uuidStr[37];
     uuid_unparse(newUuid, uuidStr);
     return std::string(uuidStr);
-}
\ No newline at end of file
+}
@@ -2,21 +2,147 @@
 #define PUBLISHER_H
 
 #include <string>
+#include <map>
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <functional>
+#include <condition_variable>
 #include <uuid/uuid.h>
+#include "../common/message.h"
+#include "../common/frame_reader.h"
 
+struct PublishAck {
+    uint64_t sequence;
+    bool success; // false if the broker rejected the message or it could not be delivered
+    // Flow-controlled subscribers of the partition are falling behind (see
+    // WIRE_FLAG_BACKPRESSURE). The publisher then sends one request at a time
+    // until an ack without the flag arrives.
+    bool backpressure = false;
+};
+
+// When a clustered broker acknowledges a publish (see --replicas): once the
+// partition's leader has it, or once a majority of its replicas do, so that it
+// survives the leader failing. Standalone brokers treat both the same.
+enum class PublishAcks {
+    Leader,
+    Quorum,
+};
+
+// Client-side batching, Kafka-producer style. Publishes are gathered into one
+// PUBLISH_BATCH request that is sent when it reaches maxMessages or maxBytes,
+// or when its oldest message has waited for linger. maxMessages = 1 disables
+// batching. Brokers without binary framing always get individual publishes.
+struct BatchConfig {
+    size_t maxMessages = 1;
+    size_t maxBytes = 64 * 1024;
+    std::chrono::microseconds linger{1000};
+};
+
+// Keeps one long-lived connection to the broker. Publishes are pipelined: each
+// is tagged with a sequence number, written immediately, and acknowledged
+// asynchronously when the broker's PUBLISHED response for that sequence
+// arrives. If the connection drops, the publisher reconnects and resends every
+// unacknowledged message; the broker's UUID dedup makes the resend safe.
 class Publisher {
 public:
-    Publisher(const std::string& serverAddress, int serverPort);
+    using AckCallback = std::function<void(const PublishAck&)>;
+
+    Publisher(const std::string& serverAddress, int serverPort, size_t maxInFlight = 1024,
+              const BatchConfig& batching = BatchConfig());
+    ~Publisher();
+
+    // Blocks until the broker acknowledges the message, or gives up after
+    // PUBLISH_TIMEOUT_MS; the message may still be delivered after that.
     void publish(const std::string& topic, const std::string& message);
+    std::future<PublishAck> publishAsync(const std::string& topic, const std::string& message);
+    // The callback runs on the publisher's I/O thread. Returns the sequence number.
+    uint64_t publishAsync(const std::string& topic, const std::string& message, AckCallback callback);
+
+    // Keyed publishes: on a partitioned topic, messages with the same key go to
+    // the same partition and so stay in order. An empty key means no key.
+    // Text-only brokers ignore the key.
+    void publish(const std::string& topic, const std::string& message, const std::string& key);
+    std::future<PublishAck> publishAsync(const std::string& topic, const std::string& message,
+                                         const std::string& key);
+    uint64_t publishAsync(const std::string& topic, const std::string& message, const std::string& key,
+                          AckCallback callback);
+
+    // Publishes message.topic and message.content along with its attributes,
+    // priority and timestamp; type, clientId and uuid are filled in. For a
+    // keyed publish set partition to partitionKeyHash(key). Text-only brokers
+    // get the content alone.
+    void publish(const Message& message);
+    std::future<PublishAck> publishAsync(const Message& message);
+    uint64_t publishAsync(Message message, AckCallback callback);
+
+    // Applies to publishes made from now on; the open batch is sent first.
+    void setAcks(PublishAcks level);
+
+    // Sends the open batch now, then waits until every in-flight publish is
+    // acknowledged or failed.
+    bool flush(int timeoutMs = 5000);
+    void close();
 
 private:
+    struct PendingPublish {
+        uint64_t sequence;
+        Message msg;
+        AckCallback callback;
+    };
+
+    // One request on the wire: a single PUBLISH or a PUBLISH_BATCH. It is keyed
+    // by the sequence of its first publish; in text mode each message is sent
+    // and acknowledged separately, so publishes are completed from the front.
+    struct PendingRequest {
+        std::deque<PendingPublish> publishes;
+        PublishAcks acks = PublishAcks::Leader; // kept for resends
+    };
+
     std::string serverAddress;
     int serverPort;
     int clientId;
     uuid_t uuid;
+    size_t maxInFlight;
+    BatchConfig batching;
+    PublishAcks acks;
+
+    std::mutex mtx;
+    // Requests are encoded into outbox under mtx and written out under
+    // sendMutex alone, so a stalled socket never blocks the I/O thread from
+    // resolving acks. sendMutex keeps them in order and is taken before mtx;
+    // the socket is only closed while holding both.
+    std::mutex sendMutex;
+    std::deque<std::string> outbox;
+    std::condition_variable stateChanged;
+    std::condition_variable lingerWakeup;
+    std::map<uint64_t, PendingRequest> pending; // ordered by sequence for resends
+    size_t inFlight;                            // publishes in pending and openBatch
+    bool throttled;                             // the last ack signalled backpressure
+    PendingRequest openBatch;
+    size_t openBatchBytes;
+    std::chrono::steady_clock::time_point openBatchDeadline;
+    uint64_t nextSequence;
+    int sock;
+    bool binaryProtocol;
+    bool running;
+    std::thread ioThread;
+    std::thread lingerThread;
+    FrameReader reader;
 
-    std::string sendRequest(const std::string& request);
+    bool connectAndNegotiate();
+    void sealBatchLocked();
+    void submitLocked(PendingRequest request);
+    std::string encodeRequest(uint64_t sequence, const PendingRequest& request) const;
+    void drainOutbox();
+    void disconnect();
+    void ioLoop();
+    void lingerLoop();
+    void handleResponse(const StreamFrame& frame);
+    void failAllPending();
     std::string generateUUID();
 };
 
-#endif // PUBLISHER_H
\ No newline at end of file
+#endif // PUBLISHER_H
@@ -1,14 +1,27 @@
 #include "subscriber.h"
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
-#include <fcntl.h>
 #include <errno.h>
-#include <sstream>
+#include <algorithm>
+#include <chrono>
 
-Subscriber::Subscriber(const std::string& host, int port) : host(host), port(port), socket(-1) {}
+// Enough to cover the redeliveries of any realistic backlog of unacknowledged
+// messages, at about 1.5 MiB for each of the two windows.
+#define DEDUP_WINDOW_MESSAGES (1 << 14)
+
+static DedupConfig subscriberDedupConfig() {
+    DedupConfig config;
+    config.windowMessages = DEDUP_WINDOW_MESSAGES;
+    return config;
+}
+
+Subscriber::Subscriber(const std::string& host, int port)
+        : host(host), port(port), socket(-1), binaryProtocol(false), recentIds(subscriberDedupConfig()),
+          ackedIds(subscriberDedupConfig()), dedupResets(0), flowWindow(0), consumedSinceGrant(0), connected(false) {}
 
 Subscriber::~Subscriber() {
     disconnect();
@@ -38,48 +51,61 @@ bool Subscriber::connect() {
         return false;
     }
 
-    // Set socket to non-blocking mode
-    int flags = fcntl(socket, F_GETFL, 0);
-    if (flags == -1) {
-        std::cerr << "Failed to get socket flags: " << strerror(errno) << std::endl;
-        close(socket);
-        socket = -1;
-        return false;
-    }
-    if (fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1) {
-        std::cerr << "Failed to set socket to non-blocking mode: " << strerror(errno) << std::endl;
+    if (!negotiateProtocol()) {
         close(socket);
         socket = -1;
         return false;
     }
 
+    // The socket stays blocking: the I/O thread sleeps in recv until data arrives.
+    connected = true;
+    ioThread = std::thread(&Subscriber::ioLoop, this);
     return true;
 }
 
 void Subscriber::disconnect() {
     if (socket != -1) {
+        // Wakes the I/O thread, whose recv then returns 0.
+        shutdown(socket, SHUT_RDWR);
+        if (ioThread.joinable()) {
+            ioThread.join();
+        }
         close(socket);
         socket = -1;
+        reader = FrameReader();
     }
 }
 
-bool Subscriber::subscribe(const std::string& topic) {
-    std::cout << "Attempting to subscribe to topic: " << topic << std::endl;
+bool Subscriber::negotiateProtocol() {
+    binaryProtocol = false;
+    if (send(socket, WIRE_HELLO_REQUEST, strlen(WIRE_HELLO_REQUEST), 0) == -1) {
+        std::cerr << "Failed to send protocol negotiation: " << strerror(errno) << std::endl;
+        return false;
+    }
 
-    std::string request = "SUBSCRIBE:" + topic;
-    if (send(socket, request.c_str(), request.length(), 0) == -1) {
-        std::cerr << "Failed to send subscription request: " << strerror(errno) << std::endl;
+    if (!waitReadable(5)) {
         return false;
     }
 
-    std::cout << "Subscription request sent, waiting for response..." << std::endl;
+    long bytes_received = reader.readFrom(socket);
+    StreamFrame frame;
+    if (bytes_received <= 0 || reader.next(frame) != FrameStatus::Ready) {
+        std::cerr << "Failed to receive protocol negotiation response" << std::endl;
+        return false;
+    }
 
-    // Wait for response with timeout
+    // Brokers that predate the binary protocol answer INVALID_COMMAND; keep using text then.
+    binaryProtocol = frame.raw == WIRE_HELLO_RESPONSE;
+    std::cout << "Using " << (binaryProtocol ? "binary" : "text") << " protocol" << std::endl;
+    return true;
+}
+
+bool Subscriber::waitReadable(int timeoutSeconds) {
     fd_set readfds;
     struct timeval tv;
     FD_ZERO(&readfds);
     FD_SET(socket, &readfds);
-    tv.tv_sec = 5;  // 5 seconds timeout
+    tv.tv_sec = timeoutSeconds;
     tv.tv_usec = 0;
 
     int select_result = select(socket + 1, &readfds, NULL, NULL, &tv);
@@ -90,22 +116,93 @@ bool Subscriber::subscribe(const std::string& topic) {
         std::cerr << "Timeout waiting for server response" << std::endl;
         return false;
     }
+    return true;
+}
+
+bool Subscriber::sendRequest(const std::string& type, const std::string& topic, const std::string& content,
+                             uint16_t partition, uint8_t flags) {
+    Message msg;
+    msg.type = type;
+    msg.topic = topic;
+    msg.content = content;
+    msg.clientId = 0;
+    msg.partition = partition;
+
+    std::string request = binaryProtocol ? msg.serializeBinary(0, flags) : msg.serialize() + "\n";
+    std::lock_guard<std::mutex> lock(sendMutex);
+    return send(socket, request.c_str(), request.length(), 0) != -1;
+}
+
+bool Subscriber::setFlowWindow(uint32_t messages) {
+    flowWindow = messages;
+    consumedSinceGrant = 0;
+    return grantCredit(messages);
+}
 
-    char buffer[1024];
-    int bytes_received = recv(socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received == -1) {
-        std::cerr << "Error receiving server response: " << strerror(errno) << std::endl;
+bool Subscriber::grantCredit(uint32_t messages, uint32_t bytes) {
+    std::string content;
+    if (binaryProtocol) {
+        content.resize(WIRE_CREDIT_SIZE);
+        encodeCredit(messages, bytes, &content[0]);
+    } else {
+        content = std::to_string(messages) + ":" + std::to_string(bytes);
+    }
+    if (!sendRequest("CREDIT", "", content)) {
+        std::cerr << "Failed to send credit: " << strerror(errno) << std::endl;
         return false;
-    } else if (bytes_received == 0) {
+    }
+    return true;
+}
+
+void Subscriber::messageConsumed() {
+    uint32_t window = flowWindow.load();
+    if (window == 0) {
+        return;
+    }
+    uint32_t consumed = consumedSinceGrant.fetch_add(1) + 1;
+    if (consumed >= std::max<uint32_t>(window / 2, 1) && consumedSinceGrant.compare_exchange_strong(consumed, 0)) {
+        grantCredit(consumed);
+    }
+}
+
+void Subscriber::expectResponse(Opcode expected, const std::string& topic) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    pendingResponse = PendingResponse();
+    pendingResponse.expected = expected;
+    pendingResponse.topic = topic;
+}
+
+bool Subscriber::awaitResponse() {
+    // Notifications for other topics can arrive ahead of the response; the I/O
+    // thread dispatches them as usual and wakes us once the response is in.
+    std::unique_lock<std::mutex> lock(stateMutex);
+    bool done = responded.wait_for(lock, std::chrono::seconds(5),
+                                   [this] { return pendingResponse.done || !connected; });
+    bool ok = done && pendingResponse.done && !pendingResponse.failed;
+    if (!done) {
+        std::cerr << "Timeout waiting for server response" << std::endl;
+    } else if (!pendingResponse.done) {
         std::cerr << "Server closed the connection" << std::endl;
+    }
+    pendingResponse = PendingResponse();
+    return ok;
+}
+
+bool Subscriber::request(const std::string& type, const std::string& topic, const std::string& content,
+                         uint16_t partition, Opcode expected, uint8_t flags) {
+    std::lock_guard<std::mutex> serial(requestMutex);
+    expectResponse(expected, topic);
+    if (!sendRequest(type, topic, content, partition, flags)) {
+        std::cerr << "Failed to send " << type << " request: " << strerror(errno) << std::endl;
         return false;
     }
+    return awaitResponse();
+}
 
-    buffer[bytes_received] = '\0';
-    std::string response(buffer);
-    std::cout << "Received response: " << response << std::endl;
+bool Subscriber::subscribe(const std::string& topic, const std::string& filter) {
+    std::cout << "Attempting to subscribe to topic: " << topic << std::endl;
 
-    if (response.find("SUBSCRIBED:" + topic) != std::string::npos) {
+    if (request("SUBSCRIBE", topic, filter, 0, Opcode::Subscribed)) {
         std::cout << "Successfully subscribed to topic: " << topic << std::endl;
         return true;
     } else {
@@ -114,108 +211,438 @@ bool Subscriber::subscribe(const std::string& topic) {
     }
 }
 
+bool Subscriber::subscribe(const std::string& topic, MessageHandler handler, const std::string& filter) {
+    setMessageHandler(topic, std::move(handler));
+    if (!subscribe(topic, filter)) {
+        setMessageHandler(topic, nullptr);
+        return false;
+    }
+    return true;
+}
+
 bool Subscriber::unsubscribe(const std::string& topic) {
-    std::string message = "UNSUBSCRIBE " + topic + "\n";
-    if (send(socket, message.c_str(), message.length(), 0) == -1) {
-        std::cerr << "Failed to send unsubscribe message: " << strerror(errno) << std::endl;
+    if (!request("UNSUBSCRIBE", topic, "", 0, Opcode::Unsubscribed)) {
+        std::cerr << "Unexpected server response while unsubscribing from " << topic << std::endl;
         return false;
     }
+    std::lock_guard<std::mutex> lock(messageMutex);
+    ackedTopics.erase(topic);
+    return true;
+}
 
-    char buffer[1024] = {0};
-    int bytesRead = 0;
-    int totalBytesRead = 0;
+bool Subscriber::subscribeWithAcks(const std::string& topic, const std::string& consumer, MessageHandler handler,
+                                   const std::string& filter) {
+    if (!binaryProtocol || consumer.empty() || consumer.size() > UINT8_MAX) {
+        std::cerr << "Acknowledged subscriptions need the binary protocol and a consumer name" << std::endl;
+        return false;
+    }
+    std::string content(1, static_cast<char>(consumer.size()));
+    content += consumer;
+    content += filter;
+
+    {
+        // The broker redelivers whatever was not acknowledged, including
+        // messages dispatched on an earlier connection, so those must reach
+        // the handler again rather than be dropped as duplicates.
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        dedupSalts[topic] = dedupKeyFromText(topic + "#" + std::to_string(++dedupResets)).low;
+    }
+    {
+        std::lock_guard<std::mutex> lock(messageMutex);
+        ackedTopics.insert(topic);
+    }
+    // The broker sends the consumer's backlog ahead of the response.
+    if (handler) {
+        setMessageHandler(topic, std::move(handler));
+    }
+    if (!request("SUBSCRIBE", topic, content, 0, Opcode::Subscribed, WIRE_FLAG_ACKED)) {
+        std::cerr << "Failed to subscribe to topic " << topic << " as consumer " << consumer << std::endl;
+        setMessageHandler(topic, nullptr);
+        std::lock_guard<std::mutex> lock(messageMutex);
+        ackedTopics.erase(topic);
+        return false;
+    }
+    return true;
+}
 
-    fd_set readfds;
-    struct timeval tv;
-    tv.tv_sec = 5;  // 5 seconds timeout
-    tv.tv_usec = 0;
+bool Subscriber::ack(const Message& message) {
+    DedupKey key = dedupKeyFromText(message.uuid);
+    if (!message.uuid.empty() && !key.isZero()) {
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        ackedIds.insert(key);
+    }
+    return sendAck(message.topic, message.partition, message.offset, false);
+}
 
-    FD_ZERO(&readfds);
-    FD_SET(socket, &readfds);
+bool Subscriber::ackUpTo(const std::string& topic, uint16_t partition, uint64_t nextOffset) {
+    {
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        uint64_t& acked = ackedUpTo[std::make_pair(topic, partition)];
+        acked = std::max(acked, nextOffset);
+    }
+    return sendAck(topic, partition, nextOffset, true);
+}
 
-    int selectResult = select(socket + 1, &readfds, NULL, NULL, &tv);
-    if (selectResult == -1) {
-        std::cerr << "Select failed: " << strerror(errno) << std::endl;
+bool Subscriber::sendAck(const std::string& topic, uint16_t partition, uint64_t offset, bool cumulative) {
+    if (!binaryProtocol) {
         return false;
-    } else if (selectResult == 0) {
-        std::cerr << "Timeout waiting for server response" << std::endl;
+    }
+    std::string content(WIRE_ACK_OFFSET_SIZE, '\0');
+    encodeAckOffset(offset, &content[0]);
+    if (!sendRequest("ACK", topic, content, partition, cumulative ? WIRE_FLAG_CUMULATIVE : 0)) {
+        std::cerr << "Failed to send ack: " << strerror(errno) << std::endl;
         return false;
     }
+    return true;
+}
 
-    while ((bytesRead = recv(socket, buffer + totalBytesRead, sizeof(buffer) - totalBytesRead - 1, 0)) > 0) {
-        totalBytesRead += bytesRead;
-        if (totalBytesRead > 0 && buffer[totalBytesRead - 1] == '\n') {
-            break;
-        }
+void Subscriber::setMessageHandler(const std::string& topic, MessageHandler handler) {
+    std::lock_guard<std::mutex> lock(messageMutex);
+    if (handler) {
+        handlers[topic] = std::make_shared<const MessageHandler>(std::move(handler));
+    } else {
+        handlers.erase(topic);
     }
+}
 
-    if (bytesRead == -1 && errno != EWOULDBLOCK && errno != EAGAIN) {
-        std::cerr << "Failed to receive server response: " << strerror(errno) << std::endl;
-        return false;
+bool Subscriber::fetch(const std::string& topic, const std::string& consumer, uint64_t offset,
+                       size_t maxMessages, std::vector<Message>& messages, uint64_t& nextOffset, uint16_t partition) {
+    std::string content;
+    if (binaryProtocol) {
+        content.resize(WIRE_FETCH_HEADER_SIZE);
+        encodeFetchHeader(offset, static_cast<uint32_t>(maxMessages), &content[0]);
+        content += consumer;
+    } else {
+        content = consumer + ":" + (offset == WIRE_OFFSET_COMMITTED ? std::string("committed")
+                                    : offset == WIRE_OFFSET_LATEST ? std::string("latest")
+                                    : std::to_string(offset)) + ":" + std::to_string(maxMessages)
+                  + ":" + std::to_string(partition);
     }
 
-    buffer[totalBytesRead] = '\0';
-    std::string response(buffer);
+    std::lock_guard<std::mutex> serial(requestMutex);
+    expectResponse(Opcode::Fetched, topic);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        pendingFetch = PendingFetch();
+        pendingFetch.topic = topic;
+        pendingFetch.partition = partition;
+        pendingFetch.out = &messages;
+    }
+    bool ok = sendRequest("FETCH", topic, content, partition) && awaitResponse();
+    std::lock_guard<std::mutex> lock(stateMutex);
+    nextOffset = pendingFetch.next;
+    pendingFetch = PendingFetch();
+    if (!ok) {
+        std::cerr << "Fetch from topic " << topic << " failed" << std::endl;
+    }
+    return ok;
+}
 
-    // Update this part to handle the "UNSUBSCRIBED:topic" response
-    if (response == "OK\n" || response == "UNSUBSCRIBED:" + topic + "\n") {
-        return true;
+bool Subscriber::seek(const std::string& topic, const std::string& consumer, uint64_t offset, uint16_t partition) {
+    std::string content;
+    if (binaryProtocol) {
+        content.resize(WIRE_SEEK_HEADER_SIZE);
+        encodeSeekHeader(offset, &content[0]);
+        content += consumer;
     } else {
-        std::cerr << "Unexpected server response: " << response << std::endl;
+        content = consumer + ":" + (offset == WIRE_OFFSET_LATEST ? std::string("latest") : std::to_string(offset))
+                  + ":" + std::to_string(partition);
+    }
+    if (!request("SEEK", topic, content, partition, Opcode::SeekOk)) {
+        std::cerr << "Seek on topic " << topic << " failed" << std::endl;
         return false;
     }
+    return true;
 }
 
-void Subscriber::processIncomingMessage(const std::string& serializedMessage) {
-    std::cout << "Processing message: " << serializedMessage << std::endl;  // Debug output
-    try {
-        Message msg = Message::deserialize(serializedMessage);
-        if (msg.type == "PUBLISH") {
-            std::lock_guard<std::mutex> lock(messageMutex);
-            receivedMessages[msg.topic].push_back(msg);
-            std::cout << "Stored message for topic '" << msg.topic
-                      << "': content='" << msg.content
-                      << "', clientId=" << msg.clientId
-                      << ", uuid=" << msg.uuid << std::endl;  // Debug output
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "Error processing message: " << e.what() << std::endl;
+bool Subscriber::joinGroup(const std::string& topic, const std::string& group) {
+    if (!request("JOIN_GROUP", topic, group, 0, Opcode::Joined)) {
+        std::cerr << "Failed to join group " << group << " on topic " << topic << std::endl;
+        return false;
     }
+    return true;
 }
 
-bool Subscriber::getNextMessage(const std::string& topic, Message& message) {
-    char buffer[1024];
-    int bytesRead;
+bool Subscriber::leaveGroup(const std::string& topic, const std::string& group) {
+    if (!request("LEAVE_GROUP", topic, group, 0, Opcode::Left)) {
+        std::cerr << "Failed to leave group " << group << " on topic " << topic << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(stateMutex);
+    assignments.erase(std::make_pair(topic, group));
+    return true;
+}
+
+std::vector<uint16_t> Subscriber::assignedPartitions(const std::string& topic, const std::string& group) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    auto it = assignments.find(std::make_pair(topic, group));
+    return it == assignments.end() ? std::vector<uint16_t>() : it->second;
+}
+
+// "ASSIGNED:topic:group:partition count:p1,p2,..."
+void Subscriber::handleTextAssignment(std::string_view text) {
+    size_t topicEnd = text.find(':', 9);
+    size_t listStart = text.rfind(':');
+    size_t countStart = listStart == std::string_view::npos ? listStart : text.rfind(':', listStart - 1);
+    if (topicEnd == std::string_view::npos || countStart == std::string_view::npos || countStart <= topicEnd) {
+        return;
+    }
+    std::vector<uint16_t> partitions;
+    std::string list(text.substr(listStart + 1));
+    for (const char* p = list.c_str(); *p;) {
+        char* end;
+        unsigned long partition = std::strtoul(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        partitions.push_back(static_cast<uint16_t>(partition));
+        p = *end == ',' ? end + 1 : end;
+    }
+    assignments[std::make_pair(std::string(text.substr(9, topicEnd - 9)),
+                               std::string(text.substr(topicEnd + 1, countStart - topicEnd - 1)))] = partitions;
+}
 
-    // Set socket to non-blocking mode
-    int flags = fcntl(socket, F_GETFL, 0);
-    fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+// Runs under stateMutex. Completes the pending FETCH once all of it has arrived.
+void Subscriber::handleFetchResponse(std::string_view topic, uint64_t first, uint64_t next) {
+    if (topic != pendingFetch.topic || pendingFetch.answered) {
+        return;
+    }
+    pendingFetch.answered = true;
+    pendingFetch.next = next;
+    pendingFetch.remaining = static_cast<size_t>(next - first);
+    if (pendingFetch.remaining == 0) {
+        finishResponse(false);
+    }
+}
 
-    bytesRead = recv(socket, buffer, sizeof(buffer) - 1, 0);
+// Runs under stateMutex.
+void Subscriber::finishResponse(bool failed) {
+    pendingResponse.done = true;
+    pendingResponse.failed = failed;
+    responded.notify_all();
+}
 
-    if (bytesRead > 0) {
-        buffer[bytesRead] = '\0';
-        std::string msg(buffer);
-        std::cout << "Received raw message: " << msg << std::endl;  // Debug output
+// Runs under stateMutex. Messages that answer the pending FETCH go to its
+// caller instead of being dispatched.
+bool Subscriber::takeFetched(Message& msg) {
+    if (pendingFetch.remaining == 0 || msg.topic != pendingFetch.topic
+            || (binaryProtocol && msg.partition != pendingFetch.partition)) {
+        return false;
+    }
+    pendingFetch.out->push_back(std::move(msg));
+    if (--pendingFetch.remaining == 0) {
+        finishResponse(false);
+    }
+    return true;
+}
 
-        std::istringstream iss(msg);
-        std::string line;
-        while (std::getline(iss, line)) {
-            processIncomingMessage(line);
+void Subscriber::ioLoop() {
+    while (true) {
+        long bytesRead = reader.readFrom(socket);
+        if (bytesRead > 0) {
+            processFrames();
+            continue;
         }
-    } else if (bytesRead == -1) {
-        if (errno != EWOULDBLOCK && errno != EAGAIN) {
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead == -1) {
             std::cerr << "Error receiving message: " << strerror(errno) << std::endl;
         }
+        break;
     }
 
+    // Wake anyone waiting on a response or a message that will not come.
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        connected = false;
+        responded.notify_all();
+    }
     std::lock_guard<std::mutex> lock(messageMutex);
-    auto& messages = receivedMessages[topic];
-    if (!messages.empty()) {
-        message = messages.front();
-        messages.erase(messages.begin());
-        return true;
+    messageArrived.notify_all();
+}
+
+void Subscriber::processFrames() {
+    StreamFrame frame;
+    FrameStatus status;
+    while ((status = reader.next(frame)) == FrameStatus::Ready) {
+        Message msg;
+        bool isMessage = false;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (frame.binary) {
+                const FrameView& view = frame.frame;
+                uint64_t first, next;
+                Assignment assignment;
+                if (view.header.opcode == Opcode::Message) {
+                    msg = Message::fromFrame(view);
+                    isMessage = !takeFetched(msg);
+                } else if (view.header.opcode == Opcode::Fetched && decodeOffsetRange(view.payload, first, next)) {
+                    handleFetchResponse(view.topic, first, next);
+                } else if (view.header.opcode == Opcode::Assigned && decodeAssignment(view.payload, assignment)) {
+                    assignments[std::make_pair(std::string(view.topic), std::string(assignment.group))] =
+                        assignment.partitions;
+                } else if (!pendingResponse.done && view.topic == pendingResponse.topic
+                           && (view.header.opcode == pendingResponse.expected
+                               || view.header.opcode == Opcode::Invalid)) {
+                    finishResponse(view.header.opcode == Opcode::Invalid);
+                }
+            } else if (frame.text.compare(0, 8, "MESSAGE:") == 0) {
+                if (!parseNotification(std::string(frame.text), msg)) {
+                    std::cerr << "Error processing message: malformed notification" << std::endl;
+                    continue;
+                }
+                isMessage = !takeFetched(msg);
+            } else if (frame.text.compare(0, 8, "FETCHED:") == 0) {
+                // "FETCHED:topic:first:next"; the topic may contain ':'.
+                std::string_view text = frame.text;
+                size_t nextStart = text.rfind(':');
+                size_t firstStart = text.rfind(':', nextStart - 1);
+                if (firstStart > 8 && firstStart != std::string_view::npos) {
+                    uint64_t first = std::strtoull(std::string(text.substr(firstStart + 1)).c_str(), nullptr, 10);
+                    uint64_t next = std::strtoull(std::string(text.substr(nextStart + 1)).c_str(), nullptr, 10);
+                    handleFetchResponse(text.substr(8, firstStart - 8), first, next);
+                }
+            } else if (frame.text.compare(0, 9, "ASSIGNED:") == 0) {
+                handleTextAssignment(frame.text);
+            } else if (!pendingResponse.done && pendingResponse.expected != Opcode::Invalid) {
+                Opcode expected = pendingResponse.expected;
+                std::string expectedLine = std::string(opcodeName(expected)) + ":" + pendingResponse.topic;
+                if (frame.text == expectedLine || frame.text == "OK"
+                        || ((expected == Opcode::SeekOk || expected == Opcode::Joined || expected == Opcode::Left)
+                            && frame.text.compare(0, expectedLine.size() + 1, expectedLine + ":") == 0)) {
+                    finishResponse(false);
+                } else if (frame.text == "INVALID_COMMAND") {
+                    finishResponse(true);
+                }
+            }
+        }
+        // Dispatched outside stateMutex, so handlers never delay a response.
+        if (isMessage) {
+            dispatch(std::move(msg));
+        }
+    }
+
+    if (status == FrameStatus::Invalid) {
+        std::cerr << "Dropping undecodable data from server" << std::endl;
+        reader = FrameReader();
+    }
+}
+
+bool Subscriber::parseNotification(const std::string& serializedMessage, Message& msg) {
+    // Notifications are "MESSAGE:topic:content:uuid"; content may itself contain ':'.
+    size_t topicStart = serializedMessage.find(':');
+    size_t topicEnd = serializedMessage.find(':', topicStart + 1);
+    size_t uuidStart = serializedMessage.rfind(':');
+    if (topicStart == std::string::npos || topicEnd == std::string::npos || uuidStart <= topicEnd) {
+        return false;
+    }
+
+    msg.type = serializedMessage.substr(0, topicStart);
+    msg.topic = serializedMessage.substr(topicStart + 1, topicEnd - topicStart - 1);
+    msg.content = serializedMessage.substr(topicEnd + 1, uuidStart - topicEnd - 1);
+    msg.clientId = 0;
+    msg.uuid = serializedMessage.substr(uuidStart + 1);
+    return true;
+}
+
+// Matches a topic against a subscription pattern (see broker/subscription_trie.h).
+static bool topicMatches(std::string_view pattern, std::string_view topic) {
+    while (true) {
+        size_t patternEnd = pattern.find('.');
+        size_t topicEnd = topic.find('.');
+        std::string_view level = pattern.substr(0, patternEnd);
+        if (level == "#") {
+            return true;
+        }
+        if (level != "+" && level != topic.substr(0, topicEnd)) {
+            return false;
+        }
+        if (topicEnd == std::string_view::npos) {
+            return patternEnd == std::string_view::npos || pattern.substr(patternEnd + 1) == "#";
+        }
+        if (patternEnd == std::string_view::npos) {
+            return false;
+        }
+        pattern.remove_prefix(patternEnd + 1);
+        topic.remove_prefix(topicEnd + 1);
+    }
+}
+
+// Called with dedupMutex held.
+DedupKey Subscriber::topicKey(DedupKey key, const std::string& topic) const {
+    auto it = dedupSalts.find(topic);
+    if (it != dedupSalts.end()) {
+        key.low ^= it->second;
+    }
+    return key;
+}
+
+void Subscriber::dispatch(Message msg) {
+    // Ids that were not UUIDs arrive in binary frames as zeros and cannot be
+    // told apart, so those are never deduplicated.
+    bool duplicate = false;
+    bool acked = false;
+    DedupKey key = dedupKeyFromText(msg.uuid);
+    if (!msg.uuid.empty() && !key.isZero()) {
+        std::lock_guard<std::mutex> lock(dedupMutex);
+        duplicate = !recentIds.insert(topicKey(key, msg.topic));
+        if (duplicate) {
+            auto it = ackedUpTo.find(std::make_pair(msg.topic, msg.partition));
+            acked = ackedIds.contains(key) || (it != ackedUpTo.end() && msg.offset < it->second);
+        }
+    }
+    if (duplicate) {
+        bool ackedTopic;
+        {
+            std::lock_guard<std::mutex> lock(messageMutex);
+            ackedTopic = ackedTopics.count(msg.topic) > 0;
+        }
+        if (!ackedTopic || acked) {
+            // The broker holds a redelivered copy until it is acknowledged
+            // itself, even when the first copy already was.
+            if (ackedTopic) {
+                sendAck(msg.topic, msg.partition, msg.offset, false);
+            }
+            // A replayed copy may have used flow credit; give it back.
+            messageConsumed();
+            return;
+        }
+        // The first copy was never acknowledged, so the broker would keep
+        // redelivering this one; hand it over again.
     }
 
-    return false;
-}
\ No newline at end of file
+    std::shared_ptr<const MessageHandler> handler;
+    {
+        std::lock_guard<std::mutex> lock(messageMutex);
+        auto it = handlers.find(msg.topic);
+        if (it == handlers.end()) {
+            it = std::find_if(handlers.begin(), handlers.end(), [&](const auto& entry) {
+                return topicMatches(entry.first, msg.topic);
+            });
+        }
+        if (it == handlers.end()) {
+            receivedMessages[msg.topic].push_back(std::move(msg));
+            messageArrived.notify_all();
+            return;
+        }
+        handler = it->second;
+    }
+    (*handler)(msg);
+    messageConsumed();
+}
+
+bool Subscriber::getNextMessage(const std::string& topic, Message& message, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(messageMutex);
+    auto& messages = receivedMessages[topic];
+    messageArrived.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                            [&] { return !messages.empty() || !connected; });
+    if (messages.empty()) {
+        return false;
+    }
+    message = std::move(messages.front());
+    messages.pop_front();
+    lock.unlock();
+    messageConsumed();
+    return true;
+}
@@ -1,31 +1,158 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
-#include <mutex>
 #include <set>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
 #include "../common/message.h" // Include the Message header
+#include "../common/frame_reader.h"
+#include "../common/dedup_window.h"
 
+// A connection to the broker with one I/O thread, started by connect(). The
+// thread blocks reading the socket and dispatches each message as soon as it
+// is parsed: to the handler registered for its topic, or else to a per-topic
+// queue drained by getNextMessage. Requests such as subscribe() send a frame
+// and wait for the I/O thread to see the response.
 class Subscriber {
 public:
+    // Runs on the I/O thread, so it must not call the blocking methods below.
+    using MessageHandler = std::function<void(const Message&)>;
+
     Subscriber(const std::string& host, int port);
     ~Subscriber();
 
     bool connect();
     void disconnect();
-    bool subscribe(const std::string& topic);
+    // filter, if not empty, is evaluated by the broker (see broker/message_filter.h),
+    // so only matching messages are sent, e.g. "payload^=ERROR" or "price>=10&price<20".
+    bool subscribe(const std::string& topic, const std::string& filter = "");
+    // Registers handler for topic before subscribing, so no message is queued.
+    bool subscribe(const std::string& topic, MessageHandler handler, const std::string& filter = "");
     bool unsubscribe(const std::string& topic);
-    bool getNextMessage(const std::string& topic, Message& message);
+    // topic may be a wildcard pattern; an empty handler removes it. Messages
+    // without a handler are queued for getNextMessage.
+    void setMessageHandler(const std::string& topic, MessageHandler handler);
+    // Waits up to timeoutMs for a queued message on topic.
+    bool getNextMessage(const std::string& topic, Message& message, int timeoutMs = 0);
+
+    // Flow control (see CREDIT in wire.h): the broker sends at most `messages`
+    // that this subscriber has not consumed yet, handled or taken by
+    // getNextMessage, and keeps the rest in the topic log. Call it before
+    // subscribing; it covers exact-topic subscriptions made afterwards.
+    // Credit is returned in chunks of half the window as messages are consumed.
+    bool setFlowWindow(uint32_t messages);
+    // Grants credit directly, for callers that pace consumption themselves.
+    bool grantCredit(uint32_t messages, uint32_t bytes = 0);
+
+    // At-least-once delivery (see ACK in wire.h; binary protocol only). The
+    // broker pushes topic's messages from the consumer's committed cursor and
+    // pushes each again, after the broker's ack timeout, until it is
+    // acknowledged, so a subscriber that disconnects mid-burst loses nothing:
+    // the next subscription under the same consumer name picks them up. Any
+    // message whose UUID is still in the dedup window is dropped before it
+    // reaches a handler or queue. On an acknowledged topic, a duplicate whose
+    // first copy was acknowledged is acknowledged again, and one whose first
+    // copy was not is delivered again, so the broker never waits on it
+    // forever. Subscribing again, e.g. after reconnecting, clears the topic's
+    // dedup window, since the broker then redelivers everything unacknowledged.
+    bool subscribeWithAcks(const std::string& topic, const std::string& consumer, MessageHandler handler,
+                           const std::string& filter = "");
+    // Acknowledges one message (selective), or every message of a topic
+    // partition before nextOffset (cumulative). Neither waits for the broker.
+    bool ack(const Message& message);
+    bool ackUpTo(const std::string& topic, uint16_t partition, uint64_t nextOffset);
+
+    // Reads up to maxMessages from offset (WIRE_OFFSET_COMMITTED resumes at the
+    // consumer's committed cursor) and commits the position after them for the
+    // named consumer. nextOffset receives that position. Offsets and cursors
+    // are per partition.
+    bool fetch(const std::string& topic, const std::string& consumer, uint64_t offset, size_t maxMessages,
+               std::vector<Message>& messages, uint64_t& nextOffset, uint16_t partition = 0);
+    // Moves the consumer's cursor, e.g. back to 0 to replay a topic.
+    bool seek(const std::string& topic, const std::string& consumer, uint64_t offset, uint16_t partition = 0);
+
+    // Joins a consumer group: the broker assigns this subscriber a share of the
+    // topic's partitions and pushes only their messages to it, rebalancing as
+    // members join and leave. Messages then arrive like any other.
+    bool joinGroup(const std::string& topic, const std::string& group);
+    bool leaveGroup(const std::string& topic, const std::string& group);
+    // The partitions last assigned to this member.
+    std::vector<uint16_t> assignedPartitions(const std::string& topic, const std::string& group);
 
 private:
     std::string host;
     int port;
     int socket;
-    std::map<std::string, std::vector<Message>> receivedMessages;
-    std::mutex messageMutex;
-    std::set<std::string> processedUUIDs;
-    std::mutex uuidMutex;
+    bool binaryProtocol;
+    FrameReader reader; // I/O thread only, once connected
+    std::thread ioThread;
+
+    std::map<std::string, std::deque<Message>> receivedMessages;
+    std::map<std::string, std::shared_ptr<const MessageHandler>> handlers; // copied out, then run unlocked
+    std::set<std::string> ackedTopics; // subscribed with subscribeWithAcks
+    std::mutex messageMutex; // guards receivedMessages, handlers and ackedTopics
+    std::condition_variable messageArrived;
+    DedupWindow recentIds; // UUIDs of messages already dispatched, salted per topic
+    DedupWindow ackedIds;  // UUIDs of messages passed to ack()
+    std::map<std::pair<std::string, uint16_t>, uint64_t> ackedUpTo; // highest ackUpTo per partition
+    std::map<std::string, uint64_t> dedupSalts; // topics whose window was cleared
+    uint64_t dedupResets;
+    std::mutex dedupMutex; // guards the five above
+    std::mutex sendMutex; // requests and credit grants come from different threads
+    std::atomic<uint32_t> flowWindow;
+    std::atomic<uint32_t> consumedSinceGrant;
+
+    // The request waiting for its response; one at a time.
+    struct PendingResponse {
+        Opcode expected = Opcode::Invalid;
+        std::string topic;
+        bool done = false;
+        bool failed = false; // the broker rejected the request
+    };
+    std::mutex requestMutex; // held for a whole request/response round trip
+    std::mutex stateMutex;   // guards the members below
+    std::condition_variable responded;
+    PendingResponse pendingResponse;
+    std::atomic<bool> connected;
+
+    // The FETCH being answered: after its FETCHED response, the next
+    // `remaining` messages on the topic belong to it.
+    struct PendingFetch {
+        std::string topic;
+        uint16_t partition = 0;
+        bool answered = false;
+        size_t remaining = 0;
+        uint64_t next = 0;
+        std::vector<Message>* out = nullptr;
+    };
+    PendingFetch pendingFetch;
+    std::map<std::pair<std::string, std::string>, std::vector<uint16_t>> assignments;
 
-    void processIncomingMessage(const std::string& serializedMessage);
+    bool negotiateProtocol();
+    bool waitReadable(int timeoutSeconds);
+    // Callers hold requestMutex from expectResponse until awaitResponse returns.
+    void expectResponse(Opcode expected, const std::string& topic);
+    bool sendRequest(const std::string& type, const std::string& topic, const std::string& content = "",
+                     uint16_t partition = 0, uint8_t flags = 0);
+    bool awaitResponse();
+    bool request(const std::string& type, const std::string& topic, const std::string& content,
+                 uint16_t partition, Opcode expected, uint8_t flags = 0);
+    bool sendAck(const std::string& topic, uint16_t partition, uint64_t offset, bool cumulative);
+    void ioLoop();
+    void processFrames();
+    void finishResponse(bool failed);
+    bool takeFetched(Message& msg);
+    void handleFetchResponse(std::string_view topic, uint64_t first, uint64_t next);
+    void handleTextAssignment(std::string_view text);
+    static bool parseNotification(const std::string& serializedMessage, Message& msg);
+    void dispatch(Message msg);
+    DedupKey topicKey(DedupKey key, const std::string& topic) const;
+    void messageConsumed();
 };
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "dedup_window.h"
+#include <algorithm>
+
+static size_t roundUpPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t fnv1a(std::string_view data, uint64_t seed) {
+    uint64_t hash = seed;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t loadBigEndian64(const uint8_t* data) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+DedupKey dedupKeyFromUuid(const uint8_t uuid[WIRE_UUID_SIZE]) {
+    DedupKey key;
+    key.high = loadBigEndian64(uuid);
+    key.low = loadBigEndian64(uuid + 8);
+    return key;
+}
+
+DedupKey dedupKeyFromText(std::string_view id) {
+    uint8_t uuid[WIRE_UUID_SIZE];
+    if (parseUuid(id, uuid)) {
+        return dedupKeyFromUuid(uuid);
+    }
+    DedupKey key;
+    key.high = mix64(fnv1a(id, 0xcbf29ce484222325ULL));
+    key.low = mix64(fnv1a(id, 0x84222325cbf29ce4ULL) ^ id.size());
+    return key;
+}
+
+DedupWindow::DedupWindow(const DedupConfig& config) : config(config), current(0), previous(1), spare(2) {
+    this->config.windowMessages = std::max<size_t>(this->config.windowMessages, 1);
+    // Load factor stays at or below one half, so probe sequences stay short.
+    size_t capacity = roundUpPowerOfTwo(this->config.windowMessages * 2);
+    mask = capacity - 1;
+    spareCleared = capacity;
+    clearStep = (capacity + this->config.windowMessages - 1) / this->config.windowMessages;
+    // About 8 bits per id and three probes: roughly a 3% false-positive rate.
+    size_t bloomBits = roundUpPowerOfTwo(std::max<size_t>(this->config.windowMessages * 8, 64));
+    bloomMask = bloomBits - 1;
+
+    Clock::time_point now = Clock::now();
+    for (Table& table : tables) {
+        table.slots.assign(capacity, DedupKey());
+        if (this->config.bloomFilter) {
+            table.bloom.assign(bloomBits / 64, 0);
+        }
+        table.opened = now;
+    }
+}
+
+bool DedupWindow::insert(const DedupKey& key, Clock::time_point now) {
+    uint64_t hash = mix64(key.high ^ mix64(key.low));
+    if (tableContains(tables[current], key, hash) || tableContains(tables[previous], key, hash)) {
+        return false;
+    }
+
+    Table& active = tables[current];
+    if (active.count >= config.windowMessages
+            || (config.windowMs > 0 && now - active.opened >= std::chrono::milliseconds(config.windowMs))) {
+        rotate(now);
+    }
+    tableInsert(tables[current], key, hash);
+    clearSpare(clearStep);
+    return true;
+}
+
+bool DedupWindow::contains(const DedupKey& key) const {
+    uint64_t hash = mix64(key.high ^ mix64(key.low));
+    return tableContains(tables[current], key, hash) || tableContains(tables[previous], key, hash);
+}
+
+size_t DedupWindow::memoryBytes() const {
+    size_t bytes = 0;
+    for (const Table& table : tables) {
+        bytes += table.slots.size() * sizeof(DedupKey) + table.bloom.size() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+bool DedupWindow::tableContains(const Table& table, const DedupKey& key, uint64_t hash) const {
+    if (key.isZero()) {
+        return table.hasZeroKey;
+    }
+    if (!table.bloom.empty()) {
+        uint64_t step = mix64(hash) | 1;
+        for (uint64_t i = 0; i < 3; ++i) {
+            size_t bit = (hash + i * step) & bloomMask;
+            if (!(table.bloom[bit >> 6] & (1ULL << (bit & 63)))) {
+                return false;
+            }
+        }
+    }
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        const DedupKey& entry = table.slots[slot];
+        if (entry == key) {
+            return true;
+        }
+        if (entry.isZero()) {
+            return false;
+        }
+    }
+}
+
+void DedupWindow::tableInsert(Table& table, const DedupKey& key, uint64_t hash) {
+    if (key.isZero()) {
+        table.hasZeroKey = true;
+        table.count++;
+        return;
+    }
+    if (!table.bloom.empty()) {
+        uint64_t step = mix64(hash) | 1;
+        for (uint64_t i = 0; i < 3; ++i) {
+            size_t bit = (hash + i * step) & bloomMask;
+            table.bloom[bit >> 6] |= 1ULL << (bit & 63);
+        }
+    }
+    size_t slot = hash & mask;
+    while (!table.slots[slot].isZero()) {
+        slot = (slot + 1) & mask;
+    }
+    table.slots[slot] = key;
+    table.count++;
+}
+
+void DedupWindow::rotate(Clock::time_point now) {
+    // Only a rotation by age can come before clearSpare() has finished.
+    clearSpare(tables[spare].slots.size());
+    // The previous generation is forgotten and its table becomes the next spare.
+    int retired = previous;
+    previous = current;
+    current = spare;
+    spare = retired;
+    spareCleared = 0;
+    Table& table = tables[current];
+    table.count = 0;
+    table.hasZeroKey = false;
+    table.opened = now;
+}
+
+void DedupWindow::clearSpare(size_t slots) {
+    Table& table = tables[spare];
+    size_t end = spareCleared + std::min(slots, table.slots.size() - spareCleared);
+    if (end == spareCleared) {
+        return;
+    }
+    std::fill(table.slots.begin() + spareCleared, table.slots.begin() + end, DedupKey());
+    if (!table.bloom.empty()) {
+        // Bloom words are cleared in proportion, so both finish together.
+        size_t from = spareCleared * table.bloom.size() / table.slots.size();
+        size_t to = end * table.bloom.size() / table.slots.size();
+        std::fill(table.bloom.begin() + from, table.bloom.begin() + to, 0);
+    }
+    spareCleared = end;
+}
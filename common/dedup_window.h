@@ -0,0 +1,81 @@
+#ifndef DEDUP_WINDOW_H
+#define DEDUP_WINDOW_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "wire.h"
+
+// A message id as a 128-bit value. UUIDs map to their binary form; other ids
+// (text clients may send any string) are hashed to 128 bits.
+struct DedupKey {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    bool operator==(const DedupKey& other) const { return high == other.high && low == other.low; }
+    bool isZero() const { return high == 0 && low == 0; }
+};
+
+DedupKey dedupKeyFromUuid(const uint8_t uuid[WIRE_UUID_SIZE]);
+DedupKey dedupKeyFromText(std::string_view id);
+
+// How long ids are remembered. A new generation starts when the current one
+// holds windowMessages ids or is windowMs old, and the generation before it is
+// forgotten. Every id seen within the last windowMs is therefore remembered,
+// unless more than windowMessages ids arrived in that time, in which case at
+// least the most recent windowMessages are. 0 disables the time limit.
+struct DedupConfig {
+    size_t windowMessages = 1 << 16;
+    size_t windowMs = 10 * 60 * 1000;
+    bool bloomFilter = false; // skip table probes for ids that are certainly new
+};
+
+// Bounded duplicate detector: open-addressing tables of 128-bit keys for the
+// current generation and the previous one, rotated as described above. A third,
+// spare table is cleared a few slots per insert, so a rotation swaps in an empty
+// table instead of clearing one all at once. Memory is fixed at construction
+// (about 96 bytes per windowMessages slot, plus 3 bytes with the Bloom filter)
+// and lookups probe at most two tables, however many ids have been seen. Not
+// thread-safe.
+class DedupWindow {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit DedupWindow(const DedupConfig& config = DedupConfig());
+
+    // Records key. Returns false if it was already seen within the window.
+    bool insert(const DedupKey& key, Clock::time_point now = Clock::now());
+    bool contains(const DedupKey& key) const;
+
+    // Ids currently remembered, across both generations.
+    size_t size() const { return tables[current].count + tables[previous].count; }
+    size_t memoryBytes() const;
+
+private:
+    struct Table {
+        std::vector<DedupKey> slots; // a zero key marks an empty slot
+        std::vector<uint64_t> bloom;
+        size_t count = 0;
+        bool hasZeroKey = false;     // the one id that cannot live in a slot
+        Clock::time_point opened;
+    };
+
+    bool tableContains(const Table& table, const DedupKey& key, uint64_t hash) const;
+    void tableInsert(Table& table, const DedupKey& key, uint64_t hash);
+    void rotate(Clock::time_point now);
+    void clearSpare(size_t slots);
+
+    DedupConfig config;
+    Table tables[3];
+    int current;
+    int previous;
+    int spare;
+    size_t spareCleared; // slots of the spare table already cleared
+    size_t clearStep;    // slots cleared per insert; enough to finish before a rotation
+    size_t mask;
+    size_t bloomMask;
+};
+
+#endif // DEDUP_WINDOW_H
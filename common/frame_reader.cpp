@@ -0,0 +1,98 @@
+#include "frame_reader.h"
+
+FrameReader::FrameReader(size_t maxFrameSize) : pendingConsume(0), maxFrameSize(maxFrameSize), framed(false) {}
+
+void FrameReader::releasePending() {
+    if (pendingConsume > 0) {
+        buffer.consume(pendingConsume);
+        pendingConsume = 0;
+    }
+}
+
+long FrameReader::readFrom(int fd) {
+    releasePending();
+    return buffer.readFrom(fd);
+}
+
+void FrameReader::append(const char* data, size_t length) {
+    releasePending();
+    buffer.append(data, length);
+}
+
+const char* FrameReader::view(size_t length) {
+    // Frames that wrap around the end of the ring are unwrapped into scratch,
+    // whose capacity is reused across frames.
+    if (buffer.contiguous() >= length) {
+        return buffer.data();
+    }
+    scratch.resize(length);
+    buffer.copyOut(0, &scratch[0], length);
+    return scratch.data();
+}
+
+FrameStatus FrameReader::next(StreamFrame& out) {
+    releasePending();
+    if (buffer.empty()) {
+        return FrameStatus::NeedMore;
+    }
+
+    if (static_cast<uint8_t>(buffer.at(0)) == WIRE_MAGIC) {
+        if (buffer.size() < WIRE_HEADER_SIZE) {
+            return FrameStatus::NeedMore;
+        }
+        char headerBytes[WIRE_HEADER_SIZE];
+        buffer.copyOut(0, headerBytes, WIRE_HEADER_SIZE);
+        FrameHeader header;
+        if (decodeHeader(headerBytes, WIRE_HEADER_SIZE, header) != DecodeResult::Ok ||
+            frameSize(header) > maxFrameSize) {
+            return FrameStatus::Invalid;
+        }
+
+        size_t total = frameSize(header);
+        if (buffer.size() < total) {
+            buffer.reserve(total - buffer.size());
+            return FrameStatus::NeedMore;
+        }
+
+        const char* frame = view(total);
+        size_t consumed = 0;
+        if (decodeFrame(frame, total, out.frame, consumed) != DecodeResult::Ok) {
+            return FrameStatus::Invalid;
+        }
+        out.binary = true;
+        out.raw = std::string_view(frame, total);
+        pendingConsume = total;
+        framed = true;
+        return FrameStatus::Ready;
+    }
+
+    size_t newline = buffer.find('\n');
+    if (newline == buffer.size()) {
+        return buffer.size() > maxFrameSize ? FrameStatus::Invalid : FrameStatus::NeedMore;
+    }
+
+    size_t length = newline;
+    const char* line = view(length + 1);
+    if (length > 0 && line[length - 1] == '\r') {
+        --length;
+    }
+    out.binary = false;
+    out.text = std::string_view(line, length);
+    out.raw = std::string_view(line, newline + 1);
+    pendingConsume = newline + 1;
+    framed = true;
+    return FrameStatus::Ready;
+}
+
+bool FrameReader::takeUnterminatedText(StreamFrame& out) {
+    releasePending();
+    if (framed || buffer.empty() || static_cast<uint8_t>(buffer.at(0)) == WIRE_MAGIC) {
+        return false;
+    }
+    size_t length = buffer.size();
+    out.binary = false;
+    out.text = std::string_view(view(length), length);
+    out.raw = out.text;
+    pendingConsume = length;
+    return true;
+}
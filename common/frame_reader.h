@@ -0,0 +1,55 @@
+#ifndef FRAME_READER_H
+#define FRAME_READER_H
+
+#include <string>
+#include <string_view>
+#include "ring_buffer.h"
+#include "wire.h"
+
+// One complete request or notification pulled off a byte stream: either a
+// binary frame (see wire.h) or a newline-terminated text line.
+struct StreamFrame {
+    bool binary = false;
+    FrameView frame;       // valid when binary
+    std::string_view text; // valid when !binary, without the trailing newline
+    std::string_view raw;  // the whole frame as it arrived on the wire
+};
+
+enum class FrameStatus {
+    Ready,
+    NeedMore,
+    Invalid,
+};
+
+// Splits a TCP byte stream into frames. Handles frames split across reads as
+// well as many frames arriving in one read. Views returned by next() stay
+// valid until the following call to next(), readFrom() or append().
+class FrameReader {
+public:
+    explicit FrameReader(size_t maxFrameSize = WIRE_HEADER_SIZE + UINT16_MAX + WIRE_MAX_PAYLOAD);
+
+    long readFrom(int fd);
+    void append(const char* data, size_t length);
+
+    FrameStatus next(StreamFrame& out);
+
+    // Legacy text clients do not terminate requests with a newline. Once the
+    // socket has been drained, whatever text is left is taken as one request,
+    // but only on a stream that has never carried a newline-terminated or
+    // binary frame; anything else is a request split across reads.
+    bool takeUnterminatedText(StreamFrame& out);
+
+    size_t buffered() const { return buffer.size(); }
+
+private:
+    void releasePending();
+    const char* view(size_t length);
+
+    RingBuffer buffer;
+    std::string scratch;
+    size_t pendingConsume;
+    size_t maxFrameSize;
+    bool framed; // a terminated or binary frame has been seen
+};
+
+#endif // FRAME_READER_H
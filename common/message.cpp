@@ -1,5 +1,6 @@
 #include "message.h"
 #include <sstream>
+#include <cstdlib>
 
 std::string Message::serialize() const {
     std::ostringstream oss;
@@ -9,14 +10,97 @@ std::string Message::serialize() const {
 
 Message Message::deserialize(const std::string& data) {
     Message msg;
-    std::istringstream iss(data);
+    msg.clientId = 0;
 
-    std::getline(iss, msg.type, ':');
-    std::getline(iss, msg.topic, ':');
-    std::getline(iss, msg.content, ':');
-    iss >> msg.clientId;
-    iss.ignore(); // Ignore the space after clientId
-    std::getline(iss, msg.uuid);
+    // type and topic are taken from the front and clientId/uuid from the back,
+    // so a ':' inside content no longer shifts the remaining fields.
+    size_t typeEnd = data.find(':');
+    if (typeEnd == std::string::npos) {
+        msg.type = data;
+        return msg;
+    }
+    msg.type = data.substr(0, typeEnd);
 
+    size_t topicEnd = data.find(':', typeEnd + 1);
+    if (topicEnd == std::string::npos) {
+        msg.topic = data.substr(typeEnd + 1);
+        return msg;
+    }
+    msg.topic = data.substr(typeEnd + 1, topicEnd - typeEnd - 1);
+
+    size_t uuidStart = data.rfind(':');
+    size_t clientIdStart = uuidStart > topicEnd ? data.rfind(':', uuidStart - 1) : std::string::npos;
+    if (clientIdStart == std::string::npos || clientIdStart < topicEnd) {
+        msg.content = data.substr(topicEnd + 1);
+        return msg;
+    }
+
+    msg.content = data.substr(topicEnd + 1, clientIdStart - topicEnd - 1);
+    msg.clientId = std::atoi(data.c_str() + clientIdStart + 1);
+    msg.uuid = data.substr(uuidStart + 1);
+    while (!msg.uuid.empty() && (msg.uuid.back() == '\n' || msg.uuid.back() == '\r')) {
+        msg.uuid.pop_back();
+    }
+
+    return msg;
+}
+
+std::string Message::encodeAttributes() const {
+    std::vector<std::pair<std::string_view, std::string_view>> entries(attributes.begin(), attributes.end());
+    std::string block;
+    return appendAttributes(priority, timestampMs, entries, block) ? block : std::string();
+}
+
+std::string Message::serializeBinary(uint64_t sequence, uint8_t flags) const {
+    FrameHeader header;
+    header.opcode = opcodeFromName(type);
+    header.flags = flags;
+    header.clientId = static_cast<uint32_t>(clientId);
+    header.sequence = sequence;
+    header.partition = partition;
+    parseUuid(uuid, header.uuid);
+
+    std::string payload;
+    if (hasAttributes()) {
+        payload = encodeAttributes();
+        if (payload.empty()) {
+            return "";
+        }
+        header.flags |= WIRE_FLAG_ATTRIBUTES;
+        payload += content;
+    }
+    std::string_view body = hasAttributes() ? std::string_view(payload) : std::string_view(content);
+
+    std::string frame(frameSize(topic, body), '\0');
+    if (encodeFrame(header, topic, body, &frame[0], frame.size()) == 0) {
+        return "";
+    }
+    return frame;
+}
+
+Message Message::fromFrame(const FrameView& frame) {
+    Message msg;
+    msg.type = opcodeName(frame.header.opcode);
+    msg.topic = std::string(frame.topic);
+
+    AttributesView attributes;
+    std::string_view body = frame.payload;
+    if ((frame.header.flags & WIRE_FLAG_ATTRIBUTES) && AttributesView::split(frame.payload, attributes, body)) {
+        msg.priority = attributes.priority();
+        msg.timestampMs = attributes.timestampMs();
+        attributes.forEach([&](std::string_view key, std::string_view value) {
+            msg.attributes.emplace(std::string(key), std::string(value));
+        });
+    }
+    msg.content = std::string(body);
+    msg.clientId = static_cast<int>(frame.header.clientId);
+    msg.partition = frame.header.partition;
+    if (frame.header.opcode == Opcode::Message) {
+        msg.offset = frame.header.sequence;
+    }
+
+    char uuidText[WIRE_UUID_TEXT_SIZE];
+    formatUuid(frame.header.uuid, uuidText);
+    msg.uuid.assign(uuidText, WIRE_UUID_TEXT_SIZE);
     return msg;
-}
\ No newline at end of file
+}
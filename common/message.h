@@ -1,7 +1,10 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
+#include <cstdint>
+#include <map>
 #include <string>
+#include "wire.h"
 
 struct Message {
     std::string type;
@@ -9,9 +12,27 @@ struct Message {
     std::string content;
     int clientId;
     std::string uuid;
+    uint16_t partition = 0; // see the partition field in wire.h; binary frames only
+    uint64_t offset = 0;    // position in the partition of a message received in a binary frame
 
+    // Attributes travel ahead of the content in binary frames (see
+    // AttributesView in wire.h) and are dropped by the text format.
+    std::map<std::string, std::string> attributes;
+    int64_t timestampMs = 0; // set by the publisher; 0 = unset
+    uint8_t priority = 0;
+
+    bool hasAttributes() const { return !attributes.empty() || timestampMs != 0 || priority != 0; }
+    // The encoded attributes block, or "" if a key or value is too long.
+    std::string encodeAttributes() const;
+
+    // Legacy text form: "type:topic:content:clientId:uuid".
     std::string serialize() const;
     static Message deserialize(const std::string& data);
+
+    // Binary frame form, see wire.h. flags are added to the header's. Returns
+    // an empty string if a field is too large.
+    std::string serializeBinary(uint64_t sequence = 0, uint8_t flags = 0) const;
+    static Message fromFrame(const FrameView& frame);
 };
 
-#endif // MESSAGE_H
\ No newline at end of file
+#endif // MESSAGE_H
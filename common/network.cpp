@@ -3,6 +3,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
+#include <cerrno>
 #include <iostream>
 
 int createServerSocket(int port) {
@@ -61,16 +62,39 @@ int createConnection(const std::string& address, int port) {
 }
 
 int sendMessage(int sock, const std::string& message) {
-    return send(sock, message.c_str(), message.length(), 0);
+    size_t sent = 0;
+    while (sent < message.length()) {
+        ssize_t result = send(sock, message.data() + sent, message.length() - sent, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += static_cast<size_t>(result);
+    }
+    return static_cast<int>(sent);
 }
 
-std::string receiveMessage(int sock) {
-    char buffer[1024] = {0};
-    int valread = read(sock, buffer, 1024);
-    if (valread < 0) {
-        return "";
+std::string receiveMessage(int sock, FrameReader& reader) {
+    while (true) {
+        StreamFrame frame;
+        FrameStatus status = reader.next(frame);
+        if (status == FrameStatus::Ready) {
+            return std::string(frame.raw);
+        }
+        if (status == FrameStatus::Invalid) {
+            return "";
+        }
+
+        long valread = reader.readFrom(sock);
+        if (valread <= 0) {
+            if (valread < 0 && errno == EINTR) {
+                continue;
+            }
+            return "";
+        }
     }
-    return std::string(buffer, valread);
 }
 
 void closeConnection(int sock) {
@@ -2,12 +2,16 @@
 #define NETWORK_H
 
 #include <string>
+#include "frame_reader.h"
 
 int createServerSocket(int port);
 int acceptConnection(int server_fd);
 int createConnection(const std::string& address, int port);
 int sendMessage(int sock, const std::string& message);
-std::string receiveMessage(int sock);
+// Blocks until reader holds one complete frame and returns its raw bytes (text
+// lines keep their trailing newline). Bytes of any following frames stay
+// buffered in reader. Returns an empty string on error or EOF.
+std::string receiveMessage(int sock, FrameReader& reader);
 void closeConnection(int sock);
 
 #endif // NETWORK_H
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "ring_buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/uio.h>
+
+static size_t roundUpPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+RingBuffer::RingBuffer(size_t initialCapacity)
+        : storage(roundUpPowerOfTwo(std::max<size_t>(initialCapacity, 64))),
+          mask(storage.size() - 1), head(0), tail(0) {}
+
+size_t RingBuffer::contiguous() const {
+    return std::min(size(), storage.size() - (head & mask));
+}
+
+void RingBuffer::copyOut(size_t offset, char* out, size_t length) const {
+    size_t start = (head + offset) & mask;
+    size_t first = std::min(length, storage.size() - start);
+    std::memcpy(out, storage.data() + start, first);
+    std::memcpy(out + first, storage.data(), length - first);
+}
+
+size_t RingBuffer::find(char c, size_t from) const {
+    size_t total = size();
+    while (from < total) {
+        size_t start = (head + from) & mask;
+        size_t span = std::min(total - from, storage.size() - start);
+        const void* hit = std::memchr(storage.data() + start, c, span);
+        if (hit) {
+            return from + (static_cast<const char*>(hit) - (storage.data() + start));
+        }
+        from += span;
+    }
+    return total;
+}
+
+void RingBuffer::consume(size_t length) {
+    head += std::min(length, size());
+    if (head == tail) {
+        head = tail = 0;
+    }
+}
+
+void RingBuffer::reserve(size_t minimumFree) {
+    if (storage.size() - size() < minimumFree) {
+        grow(size() + minimumFree);
+    }
+}
+
+void RingBuffer::grow(size_t minimumCapacity) {
+    std::vector<char> larger(roundUpPowerOfTwo(std::max(minimumCapacity, storage.size() * 2)));
+    size_t used = size();
+    copyOut(0, larger.data(), used);
+    storage.swap(larger);
+    mask = storage.size() - 1;
+    head = 0;
+    tail = used;
+}
+
+void RingBuffer::append(const char* data, size_t length) {
+    reserve(length);
+    size_t start = tail & mask;
+    size_t first = std::min(length, storage.size() - start);
+    std::memcpy(storage.data() + start, data, first);
+    std::memcpy(storage.data(), data + first, length - first);
+    tail += length;
+}
+
+long RingBuffer::readFrom(int fd) {
+    if (size() == storage.size()) {
+        grow(storage.size() * 2);
+    }
+
+    size_t freeSpace = storage.size() - size();
+    size_t start = tail & mask;
+    size_t first = std::min(freeSpace, storage.size() - start);
+
+    struct iovec iov[2];
+    iov[0].iov_base = storage.data() + start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = storage.data();
+    iov[1].iov_len = freeSpace - first;
+
+    ssize_t result = readv(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+    if (result > 0) {
+        tail += static_cast<size_t>(result);
+    }
+    return static_cast<long>(result);
+}
@@ -0,0 +1,47 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <cstddef>
+#include <vector>
+
+// Growable byte ring buffer used as a per-connection receive buffer. Capacity
+// is always a power of two; the buffer doubles when it is full, so a partially
+// received frame is never dropped.
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t initialCapacity = 4096);
+
+    size_t size() const { return tail - head; }
+    bool empty() const { return head == tail; }
+    size_t capacity() const { return storage.size(); }
+
+    // Reads as much as the socket has available into the free space, using one
+    // readv over both free segments. Returns the recv-style result: bytes read,
+    // 0 on orderly shutdown, -1 on error (errno set, EAGAIN included).
+    long readFrom(int fd);
+
+    void append(const char* data, size_t length);
+    void consume(size_t length);
+    void clear() { head = tail = 0; }
+
+    char at(size_t offset) const { return storage[(head + offset) & mask]; }
+    // Number of bytes readable at data() without wrapping.
+    size_t contiguous() const;
+    const char* data() const { return storage.data() + (head & mask); }
+    // Copies length bytes starting at offset into out, unwrapping as needed.
+    void copyOut(size_t offset, char* out, size_t length) const;
+    // Position of c in [from, size()), or size() if absent.
+    size_t find(char c, size_t from = 0) const;
+
+    void reserve(size_t minimumFree);
+
+private:
+    void grow(size_t minimumCapacity);
+
+    std::vector<char> storage;
+    size_t mask;
+    size_t head; // monotonically increasing read position
+    size_t tail; // monotonically increasing write position
+};
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,492 @@
+#include "wire.h"
+#include <cstring>
+
+static void putU16(char* out, uint16_t value) {
+    out[0] = static_cast<char>(value >> 8);
+    out[1] = static_cast<char>(value);
+}
+
+static void putU32(char* out, uint32_t value) {
+    for (int i = 3; i >= 0; --i) {
+        out[i] = static_cast<char>(value);
+        value >>= 8;
+    }
+}
+
+static void putU64(char* out, uint64_t value) {
+    for (int i = 7; i >= 0; --i) {
+        out[i] = static_cast<char>(value);
+        value >>= 8;
+    }
+}
+
+static uint16_t getU16(const char* in) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(in);
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static uint32_t getU32(const char* in) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(in);
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static uint64_t getU64(const char* in) {
+    return (uint64_t(getU32(in)) << 32) | getU32(in + 4);
+}
+
+const char* opcodeName(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::Subscribe: return "SUBSCRIBE";
+        case Opcode::Unsubscribe: return "UNSUBSCRIBE";
+        case Opcode::Publish: return "PUBLISH";
+        case Opcode::GetMessages: return "GET_MESSAGES";
+        case Opcode::Message: return "MESSAGE";
+        case Opcode::Subscribed: return "SUBSCRIBED";
+        case Opcode::Unsubscribed: return "UNSUBSCRIBED";
+        case Opcode::Published: return "PUBLISHED";
+        case Opcode::NoMessages: return "NO_MESSAGES";
+        case Opcode::PublishBatch: return "PUBLISH_BATCH";
+        case Opcode::Fetch: return "FETCH";
+        case Opcode::Seek: return "SEEK";
+        case Opcode::Fetched: return "FETCHED";
+        case Opcode::SeekOk: return "SEEK_OK";
+        case Opcode::JoinGroup: return "JOIN_GROUP";
+        case Opcode::LeaveGroup: return "LEAVE_GROUP";
+        case Opcode::Joined: return "JOINED";
+        case Opcode::Left: return "LEFT";
+        case Opcode::Assigned: return "ASSIGNED";
+        case Opcode::Credit: return "CREDIT";
+        case Opcode::Ack: return "ACK";
+        case Opcode::Peer: return "PEER";
+        case Opcode::Unavailable: return "UNAVAILABLE";
+        case Opcode::Replicate: return "REPLICATE";
+        case Opcode::Replicated: return "REPLICATED";
+        case Opcode::Stats: return "STATS";
+        case Opcode::StatsReport: return "STATS_REPORT";
+        case Opcode::Invalid: break;
+    }
+    return "INVALID_COMMAND";
+}
+
+Opcode opcodeFromName(std::string_view name) {
+    static const Opcode known[] = {
+        Opcode::Subscribe, Opcode::Unsubscribe, Opcode::Publish, Opcode::GetMessages, Opcode::Message,
+        Opcode::Subscribed, Opcode::Unsubscribed, Opcode::Published, Opcode::NoMessages, Opcode::PublishBatch,
+        Opcode::Fetch, Opcode::Seek, Opcode::Fetched, Opcode::SeekOk, Opcode::JoinGroup, Opcode::LeaveGroup,
+        Opcode::Joined, Opcode::Left, Opcode::Assigned, Opcode::Credit, Opcode::Ack, Opcode::Peer,
+        Opcode::Unavailable, Opcode::Replicate, Opcode::Replicated, Opcode::Stats, Opcode::StatsReport,
+    };
+    for (Opcode opcode : known) {
+        if (name == opcodeName(opcode)) {
+            return opcode;
+        }
+    }
+    return Opcode::Invalid;
+}
+
+size_t encodeFrame(const FrameHeader& header, std::string_view topic, std::string_view payload,
+                   char* out, size_t capacity) {
+    if (topic.size() > UINT16_MAX || payload.size() > WIRE_MAX_PAYLOAD) {
+        return 0;
+    }
+    size_t total = frameSize(topic, payload);
+    if (total > capacity) {
+        return 0;
+    }
+
+    out[0] = static_cast<char>(WIRE_MAGIC);
+    out[1] = static_cast<char>(header.version);
+    out[2] = static_cast<char>(header.opcode);
+    out[3] = static_cast<char>(header.flags);
+    putU16(out + 4, static_cast<uint16_t>(topic.size()));
+    putU16(out + 6, header.partition);
+    putU32(out + 8, static_cast<uint32_t>(payload.size()));
+    putU32(out + 12, header.clientId);
+    putU64(out + 16, header.sequence);
+    std::memcpy(out + 24, header.uuid, WIRE_UUID_SIZE);
+    if (!topic.empty()) {
+        std::memcpy(out + WIRE_HEADER_SIZE, topic.data(), topic.size());
+    }
+    if (!payload.empty()) {
+        std::memcpy(out + WIRE_HEADER_SIZE + topic.size(), payload.data(), payload.size());
+    }
+    return total;
+}
+
+void setFrameSequence(char* frame, uint64_t sequence) {
+    putU64(frame + 16, sequence);
+}
+
+DecodeResult decodeHeader(const char* data, size_t size, FrameHeader& header) {
+    if (size == 0) {
+        return DecodeResult::NeedMore;
+    }
+    if (static_cast<uint8_t>(data[0]) != WIRE_MAGIC) {
+        return DecodeResult::Invalid;
+    }
+    if (size < WIRE_HEADER_SIZE) {
+        return DecodeResult::NeedMore;
+    }
+
+    header.version = static_cast<uint8_t>(data[1]);
+    header.opcode = static_cast<Opcode>(data[2]);
+    header.flags = static_cast<uint8_t>(data[3]);
+    header.topicLength = getU16(data + 4);
+    header.partition = getU16(data + 6);
+    header.payloadLength = getU32(data + 8);
+    header.clientId = getU32(data + 12);
+    header.sequence = getU64(data + 16);
+    std::memcpy(header.uuid, data + 24, WIRE_UUID_SIZE);
+
+    if (header.version != WIRE_VERSION || header.payloadLength > WIRE_MAX_PAYLOAD) {
+        return DecodeResult::Invalid;
+    }
+    return DecodeResult::Ok;
+}
+
+DecodeResult decodeFrame(const char* data, size_t size, FrameView& frame, size_t& consumed) {
+    DecodeResult result = decodeHeader(data, size, frame.header);
+    if (result != DecodeResult::Ok) {
+        return result;
+    }
+
+    size_t total = frameSize(frame.header);
+    if (size < total) {
+        return DecodeResult::NeedMore;
+    }
+
+    frame.topic = std::string_view(data + WIRE_HEADER_SIZE, frame.header.topicLength);
+    frame.payload = std::string_view(data + WIRE_HEADER_SIZE + frame.header.topicLength, frame.header.payloadLength);
+    consumed = total;
+    return DecodeResult::Ok;
+}
+
+bool AttributesView::split(std::string_view payload, AttributesView& attributes, std::string_view& body) {
+    if (payload.size() < WIRE_ATTRIBUTES_FIXED_SIZE) {
+        return false;
+    }
+    size_t size = 2 + static_cast<size_t>(getU16(payload.data()));
+    if (size < WIRE_ATTRIBUTES_FIXED_SIZE || size > payload.size()) {
+        return false;
+    }
+    AttributesView view;
+    view.block = payload.substr(0, size);
+    // Validate the entries once, so lookups can trust the lengths.
+    size_t position = WIRE_ATTRIBUTES_FIXED_SIZE;
+    std::string_view key, value;
+    while (view.nextEntry(position, key, value)) {
+    }
+    if (position != size) {
+        return false;
+    }
+    attributes = view;
+    body = payload.substr(size);
+    return true;
+}
+
+uint8_t AttributesView::priority() const {
+    return block.empty() ? 0 : static_cast<uint8_t>(block[2]);
+}
+
+int64_t AttributesView::timestampMs() const {
+    return block.empty() ? 0 : static_cast<int64_t>(getU64(block.data() + 3));
+}
+
+bool AttributesView::get(std::string_view key, std::string_view& value) const {
+    std::string_view entryKey, entryValue;
+    for (size_t position = WIRE_ATTRIBUTES_FIXED_SIZE; nextEntry(position, entryKey, entryValue);) {
+        if (entryKey == key) {
+            value = entryValue;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AttributesView::nextEntry(size_t& position, std::string_view& key, std::string_view& value) const {
+    if (position + WIRE_ATTRIBUTE_ENTRY_HEADER_SIZE > block.size()) {
+        return false;
+    }
+    size_t keyLength = static_cast<uint8_t>(block[position]);
+    size_t valueLength = getU16(block.data() + position + 1);
+    size_t start = position + WIRE_ATTRIBUTE_ENTRY_HEADER_SIZE;
+    if (start + keyLength + valueLength > block.size()) {
+        return false;
+    }
+    key = block.substr(start, keyLength);
+    value = block.substr(start + keyLength, valueLength);
+    position = start + keyLength + valueLength;
+    return true;
+}
+
+void setAttributesTimestamp(char* block, int64_t timestampMs) {
+    putU64(block + 3, static_cast<uint64_t>(timestampMs));
+}
+
+bool appendAttributes(uint8_t priority, int64_t timestampMs,
+                      const std::vector<std::pair<std::string_view, std::string_view>>& entries, std::string& out) {
+    size_t size = WIRE_ATTRIBUTES_FIXED_SIZE;
+    for (const auto& entry : entries) {
+        if (entry.first.size() > UINT8_MAX || entry.second.size() > UINT16_MAX) {
+            return false;
+        }
+        size += WIRE_ATTRIBUTE_ENTRY_HEADER_SIZE + entry.first.size() + entry.second.size();
+    }
+    if (size - 2 > UINT16_MAX) {
+        return false;
+    }
+
+    size_t start = out.size();
+    out.resize(start + size);
+    char* p = &out[start];
+    putU16(p, static_cast<uint16_t>(size - 2));
+    p[2] = static_cast<char>(priority);
+    putU64(p + 3, static_cast<uint64_t>(timestampMs));
+    p += WIRE_ATTRIBUTES_FIXED_SIZE;
+    for (const auto& entry : entries) {
+        p[0] = static_cast<char>(entry.first.size());
+        putU16(p + 1, static_cast<uint16_t>(entry.second.size()));
+        p += WIRE_ATTRIBUTE_ENTRY_HEADER_SIZE;
+        std::memcpy(p, entry.first.data(), entry.first.size());
+        std::memcpy(p + entry.first.size(), entry.second.data(), entry.second.size());
+        p += entry.first.size() + entry.second.size();
+    }
+    return true;
+}
+
+void encodeBatchCount(uint32_t count, char* out) {
+    putU32(out, count);
+}
+
+uint16_t partitionKeyHash(std::string_view key) {
+    // 32-bit FNV-1a, folded into 1..65535.
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    return static_cast<uint16_t>(hash % UINT16_MAX + 1);
+}
+
+size_t encodeBatchEntry(std::string_view topic, std::string_view payload, const uint8_t uuid[WIRE_UUID_SIZE],
+                        uint16_t keyHash, char* out, size_t capacity) {
+    if (topic.size() > UINT16_MAX || payload.size() > WIRE_MAX_PAYLOAD) {
+        return 0;
+    }
+    size_t total = batchEntrySize(topic, payload);
+    if (total > capacity) {
+        return 0;
+    }
+    putU16(out, static_cast<uint16_t>(topic.size()));
+    putU16(out + 2, keyHash);
+    putU32(out + 4, static_cast<uint32_t>(payload.size()));
+    std::memcpy(out + 8, uuid, WIRE_UUID_SIZE);
+    std::memcpy(out + WIRE_BATCH_ENTRY_HEADER_SIZE, topic.data(), topic.size());
+    std::memcpy(out + WIRE_BATCH_ENTRY_HEADER_SIZE + topic.size(), payload.data(), payload.size());
+    return total;
+}
+
+BatchReader::BatchReader(std::string_view payload) : data(payload), total(0), seen(0), ok(true) {
+    if (data.size() < WIRE_BATCH_COUNT_SIZE) {
+        ok = false;
+        return;
+    }
+    total = getU32(data.data());
+    data.remove_prefix(WIRE_BATCH_COUNT_SIZE);
+}
+
+bool BatchReader::next(BatchEntryView& entry) {
+    if (!ok || seen == total) {
+        if (ok && !data.empty()) {
+            ok = false; // trailing bytes after the last entry
+        }
+        return false;
+    }
+    if (data.size() < WIRE_BATCH_ENTRY_HEADER_SIZE) {
+        ok = false;
+        return false;
+    }
+    size_t topicLength = getU16(data.data());
+    size_t payloadLength = getU32(data.data() + 4);
+    if (data.size() < WIRE_BATCH_ENTRY_HEADER_SIZE + topicLength + payloadLength) {
+        ok = false;
+        return false;
+    }
+
+    entry.keyHash = getU16(data.data() + 2);
+    entry.uuid = reinterpret_cast<const uint8_t*>(data.data() + 8);
+    entry.topic = data.substr(WIRE_BATCH_ENTRY_HEADER_SIZE, topicLength);
+    entry.payload = data.substr(WIRE_BATCH_ENTRY_HEADER_SIZE + topicLength, payloadLength);
+    data.remove_prefix(WIRE_BATCH_ENTRY_HEADER_SIZE + topicLength + payloadLength);
+    ++seen;
+    return true;
+}
+
+void encodeFetchHeader(uint64_t offset, uint32_t maxMessages, char* out) {
+    putU64(out, offset);
+    putU32(out + 8, maxMessages);
+}
+
+void encodeSeekHeader(uint64_t offset, char* out) {
+    putU64(out, offset);
+}
+
+bool decodeFetchRequest(std::string_view payload, FetchRequest& request) {
+    if (payload.size() < WIRE_FETCH_HEADER_SIZE) {
+        return false;
+    }
+    request.offset = getU64(payload.data());
+    request.maxMessages = getU32(payload.data() + 8);
+    request.consumer = payload.substr(WIRE_FETCH_HEADER_SIZE);
+    return true;
+}
+
+bool decodeSeekRequest(std::string_view payload, std::string_view& consumer, uint64_t& offset) {
+    if (payload.size() < WIRE_SEEK_HEADER_SIZE) {
+        return false;
+    }
+    offset = getU64(payload.data());
+    consumer = payload.substr(WIRE_SEEK_HEADER_SIZE);
+    return true;
+}
+
+void encodeOffsetRange(uint64_t first, uint64_t next, char* out) {
+    putU64(out, first);
+    putU64(out + 8, next);
+}
+
+bool decodeOffsetRange(std::string_view payload, uint64_t& first, uint64_t& next) {
+    if (payload.size() != WIRE_OFFSET_RANGE_SIZE) {
+        return false;
+    }
+    first = getU64(payload.data());
+    next = getU64(payload.data() + 8);
+    return true;
+}
+
+void encodeCredit(uint32_t messages, uint32_t bytes, char* out) {
+    putU32(out, messages);
+    putU32(out + 4, bytes);
+}
+
+bool decodeCredit(std::string_view payload, uint32_t& messages, uint32_t& bytes) {
+    if (payload.size() != WIRE_CREDIT_SIZE) {
+        return false;
+    }
+    messages = getU32(payload.data());
+    bytes = getU32(payload.data() + 4);
+    return true;
+}
+
+bool decodeAckedSubscription(std::string_view payload, std::string_view& consumer, std::string_view& filter) {
+    if (payload.empty()) {
+        return false;
+    }
+    size_t length = static_cast<uint8_t>(payload[0]);
+    if (length == 0 || 1 + length > payload.size()) {
+        return false;
+    }
+    consumer = payload.substr(1, length);
+    filter = payload.substr(1 + length);
+    return true;
+}
+
+void encodeAckOffset(uint64_t offset, char* out) {
+    putU64(out, offset);
+}
+
+bool decodeAckOffsets(std::string_view payload, std::vector<uint64_t>& offsets) {
+    if (payload.empty() || payload.size() % WIRE_ACK_OFFSET_SIZE != 0) {
+        return false;
+    }
+    for (size_t position = 0; position < payload.size(); position += WIRE_ACK_OFFSET_SIZE) {
+        offsets.push_back(getU64(payload.data() + position));
+    }
+    return true;
+}
+
+void encodeReplicaOffset(uint64_t offset, char* out) {
+    putU64(out, offset);
+}
+
+bool decodeReplicaOffset(std::string_view payload, uint64_t& offset, std::string_view& rest) {
+    if (payload.size() < WIRE_REPLICA_OFFSET_SIZE) {
+        return false;
+    }
+    offset = getU64(payload.data());
+    rest = payload.substr(WIRE_REPLICA_OFFSET_SIZE);
+    return true;
+}
+
+size_t encodeAssignment(const Assignment& assignment, char* out) {
+    putU16(out, assignment.partitionCount);
+    putU16(out + 2, static_cast<uint16_t>(assignment.partitions.size()));
+    size_t offset = WIRE_ASSIGNMENT_HEADER_SIZE;
+    for (uint16_t partition : assignment.partitions) {
+        putU16(out + offset, partition);
+        offset += 2;
+    }
+    if (!assignment.group.empty()) {
+        std::memcpy(out + offset, assignment.group.data(), assignment.group.size());
+    }
+    return offset + assignment.group.size();
+}
+
+bool decodeAssignment(std::string_view payload, Assignment& assignment) {
+    if (payload.size() < WIRE_ASSIGNMENT_HEADER_SIZE) {
+        return false;
+    }
+    assignment.partitionCount = getU16(payload.data());
+    size_t count = getU16(payload.data() + 2);
+    if (payload.size() < WIRE_ASSIGNMENT_HEADER_SIZE + 2 * count) {
+        return false;
+    }
+    assignment.partitions.clear();
+    for (size_t i = 0; i < count; ++i) {
+        assignment.partitions.push_back(getU16(payload.data() + WIRE_ASSIGNMENT_HEADER_SIZE + 2 * i));
+    }
+    assignment.group = payload.substr(WIRE_ASSIGNMENT_HEADER_SIZE + 2 * count);
+    return true;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool parseUuid(std::string_view text, uint8_t out[WIRE_UUID_SIZE]) {
+    if (text.size() != WIRE_UUID_TEXT_SIZE) {
+        return false;
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < WIRE_UUID_SIZE; ++i) {
+        if (pos == 8 || pos == 13 || pos == 18 || pos == 23) {
+            if (text[pos] != '-') {
+                return false;
+            }
+            ++pos;
+        }
+        int hi = hexValue(text[pos]);
+        int lo = hexValue(text[pos + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        out[i] = static_cast<uint8_t>((hi << 4) | lo);
+        pos += 2;
+    }
+    return true;
+}
+
+void formatUuid(const uint8_t uuid[WIRE_UUID_SIZE], char out[WIRE_UUID_TEXT_SIZE]) {
+    static const char digits[] = "0123456789abcdef";
+    size_t pos = 0;
+    for (size_t i = 0; i < WIRE_UUID_SIZE; ++i) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            out[pos++] = '-';
+        }
+        out[pos++] = digits[uuid[i] >> 4];
+        out[pos++] = digits[uuid[i] & 0x0F];
+    }
+}
@@ -0,0 +1,374 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Binary frame format (all integers big-endian):
+//
+//   offset  size  field
+//   0       1     magic (0xB5, never the first byte of a text request)
+//   1       1     version
+//   2       1     opcode
+//   3       1     flags
+//   4       2     topic length
+//   6       2     partition
+//   8       4     payload length
+//   12      4     client id
+//   16      8     sequence
+//   24      16    uuid (binary)
+//   40      ...   topic bytes, then payload bytes
+//
+// The partition field names the topic partition a MESSAGE came from or a
+// FETCH or SEEK targets (SUBSCRIBE and GET_MESSAGES cover every partition).
+// On PUBLISH it carries the message key's hash instead (see
+// partitionKeyHash); 0 means no key, and the broker spreads such messages
+// over the topic's partitions. Unpartitioned topics have the single
+// partition 0.
+//
+// Requests carry a client-chosen sequence number that the response echoes. A
+// MESSAGE frame carries the message's offset within its partition instead.
+//
+// The encoder and decoder only touch caller-provided memory; a decoded frame
+// holds string_views into the buffer it was decoded from.
+
+const uint8_t WIRE_MAGIC = 0xB5;
+const uint8_t WIRE_VERSION = 1;
+const size_t WIRE_HEADER_SIZE = 40;
+const size_t WIRE_UUID_SIZE = 16;
+const size_t WIRE_UUID_TEXT_SIZE = 36;
+const uint32_t WIRE_MAX_PAYLOAD = 16 * 1024 * 1024;
+
+// Text request a client sends to switch its connection to binary frames.
+// A broker that understands it answers "HELLO:BIN1\n"; older brokers answer
+// INVALID_COMMAND and the client keeps using the text format.
+const char WIRE_HELLO_REQUEST[] = "HELLO::BIN1:0:\n";
+const char WIRE_HELLO_RESPONSE[] = "HELLO:BIN1\n";
+
+enum class Opcode : uint8_t {
+    Subscribe = 1,
+    Unsubscribe = 2,
+    Publish = 3,
+    GetMessages = 4,
+    Message = 5,
+    Subscribed = 6,
+    Unsubscribed = 7,
+    Published = 8,
+    NoMessages = 9,
+    Invalid = 10,
+    PublishBatch = 11,
+    Fetch = 12,
+    Seek = 13,
+    Fetched = 14,
+    SeekOk = 15,
+    JoinGroup = 16,
+    LeaveGroup = 17,
+    Joined = 18,
+    Left = 19,
+    Assigned = 20,
+    Credit = 21,
+    Ack = 22,
+    Peer = 23,
+    Unavailable = 24,
+    Replicate = 25,
+    Replicated = 26,
+    Stats = 27,
+    StatsReport = 28,
+};
+
+struct FrameHeader {
+    uint8_t version = WIRE_VERSION;
+    Opcode opcode = Opcode::Invalid;
+    uint8_t flags = 0;
+    uint16_t topicLength = 0;
+    uint16_t partition = 0;
+    uint32_t payloadLength = 0;
+    uint32_t clientId = 0;
+    uint64_t sequence = 0;
+    uint8_t uuid[WIRE_UUID_SIZE] = {0};
+};
+
+struct FrameView {
+    FrameHeader header;
+    std::string_view topic;
+    std::string_view payload;
+};
+
+// Message attributes. When a PUBLISH or MESSAGE frame has the
+// WIRE_FLAG_ATTRIBUTES flag, its payload starts with an attributes block:
+//
+//   u16 block length (of the rest of the block)
+//   u8  priority
+//   u64 timestamp, ms since the epoch (0 = unset)
+//   entries until the block ends: u8 key length, u16 value length, key, value
+//
+// and the message body follows. On PUBLISH_BATCH the flag means every entry's
+// payload starts with a block. Text frames never carry attributes.
+const uint8_t WIRE_FLAG_ATTRIBUTES = 0x01;
+const size_t WIRE_ATTRIBUTES_FIXED_SIZE = 2 + 1 + 8;
+const size_t WIRE_ATTRIBUTE_ENTRY_HEADER_SIZE = 1 + 2;
+
+// Reads an attributes block in place. Nothing is parsed up front; lookups
+// walk the entries, which stays cheap for the handful a message carries.
+class AttributesView {
+public:
+    AttributesView() = default;
+
+    // Splits payload into its attributes block and the body after it.
+    // Returns false if the block is malformed.
+    static bool split(std::string_view payload, AttributesView& attributes, std::string_view& body);
+
+    bool empty() const { return block.empty(); }
+    uint8_t priority() const;
+    int64_t timestampMs() const;
+    bool get(std::string_view key, std::string_view& value) const;
+    // Calls fn(key, value) for every entry, in encoded order.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        std::string_view key, value;
+        for (size_t position = WIRE_ATTRIBUTES_FIXED_SIZE; nextEntry(position, key, value);) {
+            fn(key, value);
+        }
+    }
+    // The whole block, as it appears on the wire.
+    std::string_view raw() const { return block; }
+
+private:
+    bool nextEntry(size_t& position, std::string_view& key, std::string_view& value) const;
+
+    std::string_view block;
+};
+
+// Appends an attributes block to out. Returns false if a key or value is
+// too long.
+bool appendAttributes(uint8_t priority, int64_t timestampMs,
+                      const std::vector<std::pair<std::string_view, std::string_view>>& entries, std::string& out);
+// Rewrites the timestamp of an encoded block in place.
+void setAttributesTimestamp(char* block, int64_t timestampMs);
+
+// Attributes the broker acts on, with decimal millisecond values. "ttl": the
+// message expires that long after its timestamp (which the broker sets on
+// arrival if the publisher did not); it is then no longer pushed, and the log
+// drops it once its whole segment has expired. "delay": the broker holds the
+// message that long before publishing it. Held messages are not persisted.
+const char WIRE_ATTRIBUTE_TTL[] = "ttl";
+const char WIRE_ATTRIBUTE_DELAY[] = "delay";
+
+enum class DecodeResult {
+    Ok,
+    NeedMore,
+    Invalid,
+};
+
+inline size_t frameSize(std::string_view topic, std::string_view payload) {
+    return WIRE_HEADER_SIZE + topic.size() + payload.size();
+}
+
+inline bool isBinaryFrame(const char* data, size_t size) {
+    return size > 0 && static_cast<uint8_t>(data[0]) == WIRE_MAGIC;
+}
+
+// Maps a message key to the value a publisher puts in the partition field;
+// never 0. The broker picks partition (hash - 1) % partitions, so equal keys
+// always land in the same partition.
+uint16_t partitionKeyHash(std::string_view key);
+
+// PUBLISH_BATCH payload: a u32 entry count followed by that many entries of
+//   topic length (u16), key hash (u16), payload length (u32), uuid (16),
+//   topic, payload.
+// The frame's own topic is empty; it is acknowledged with one PUBLISHED frame
+// carrying the batch's sequence number.
+const size_t WIRE_BATCH_COUNT_SIZE = 4;
+const size_t WIRE_BATCH_ENTRY_HEADER_SIZE = 2 + 2 + 4 + WIRE_UUID_SIZE;
+
+struct BatchEntryView {
+    std::string_view topic;
+    std::string_view payload;
+    const uint8_t* uuid = nullptr;
+    uint16_t keyHash = 0;
+};
+
+inline size_t batchEntrySize(std::string_view topic, std::string_view payload) {
+    return WIRE_BATCH_ENTRY_HEADER_SIZE + topic.size() + payload.size();
+}
+
+void encodeBatchCount(uint32_t count, char* out);
+// Returns the bytes written, or 0 if out is too small or a field is too large.
+size_t encodeBatchEntry(std::string_view topic, std::string_view payload, const uint8_t uuid[WIRE_UUID_SIZE],
+                        uint16_t keyHash, char* out, size_t capacity);
+
+// Walks the entries of a PUBLISH_BATCH payload without copying them.
+class BatchReader {
+public:
+    explicit BatchReader(std::string_view payload);
+
+    uint32_t count() const { return total; }
+    // Returns false at the end of the batch or on a malformed entry; valid()
+    // tells the two apart.
+    bool next(BatchEntryView& entry);
+    bool valid() const { return ok; }
+
+private:
+    std::string_view data;
+    uint32_t total;
+    uint32_t seen;
+    bool ok;
+};
+
+// Consumer positions. A FETCH payload is offset (u64), max messages (u32) and
+// the consumer name; an empty name fetches anonymously and commits nothing.
+// A SEEK payload is offset (u64) and the consumer name. The FETCHED response
+// payload is the first and next offset (u64 each), and exactly next - first
+// MESSAGE frames for the topic follow it. SEEK_OK carries the new offset.
+// In the text format the same fields are colon-separated in the content:
+// "FETCH:topic:consumer:offset:max:0:" and "SEEK:topic:consumer:offset:0:",
+// answered by "FETCHED:topic:first:next" and "SEEK_OK:topic:offset".
+const uint64_t WIRE_OFFSET_COMMITTED = UINT64_MAX; // fetch from the consumer's cursor
+const uint64_t WIRE_OFFSET_LATEST = UINT64_MAX - 1;
+const size_t WIRE_FETCH_HEADER_SIZE = 12;
+const size_t WIRE_SEEK_HEADER_SIZE = 8;
+const size_t WIRE_OFFSET_RANGE_SIZE = 16;
+
+struct FetchRequest {
+    std::string_view consumer;
+    uint64_t offset = WIRE_OFFSET_COMMITTED;
+    uint32_t maxMessages = 0;
+};
+
+// out must hold WIRE_FETCH_HEADER_SIZE (or WIRE_SEEK_HEADER_SIZE) bytes; the
+// consumer name is appended by the caller.
+void encodeFetchHeader(uint64_t offset, uint32_t maxMessages, char* out);
+void encodeSeekHeader(uint64_t offset, char* out);
+bool decodeFetchRequest(std::string_view payload, FetchRequest& request);
+bool decodeSeekRequest(std::string_view payload, std::string_view& consumer, uint64_t& offset);
+void encodeOffsetRange(uint64_t first, uint64_t next, char* out);
+bool decodeOffsetRange(std::string_view payload, uint64_t& first, uint64_t& next);
+
+// Consumer groups. JOIN_GROUP and LEAVE_GROUP carry the group name as payload
+// and are answered by JOINED and LEFT. Whenever the group's partitions are
+// rebalanced, every member whose share changed gets an ASSIGNED frame with
+// payload partition count (u16), assigned count (u16), that many partition
+// numbers (u16 each), then the group name. Text forms:
+// "JOIN_GROUP:topic:group:0:" and "LEAVE_GROUP:topic:group:0:", answered by
+// "JOINED:topic:group" and "LEFT:topic:group", with assignments pushed as
+// "ASSIGNED:topic:group:partition count:p1,p2,...".
+const size_t WIRE_ASSIGNMENT_HEADER_SIZE = 4;
+
+struct Assignment {
+    std::string_view group;
+    uint16_t partitionCount = 0;
+    std::vector<uint16_t> partitions;
+};
+
+// Returns the encoded payload size; out must hold at least that many bytes.
+inline size_t assignmentSize(const Assignment& assignment) {
+    return WIRE_ASSIGNMENT_HEADER_SIZE + 2 * assignment.partitions.size() + assignment.group.size();
+}
+size_t encodeAssignment(const Assignment& assignment, char* out);
+bool decodeAssignment(std::string_view payload, Assignment& assignment);
+
+// Flow control. A subscriber that sends CREDIT becomes flow controlled: the
+// exact-topic subscriptions it makes afterwards are served from the topic
+// log, and the broker pushes only as many messages (and, once any byte credit
+// has been granted, bytes) as the subscriber has granted. Each CREDIT adds to
+// the remaining credit; its payload is messages (u32) then bytes (u32), and it
+// gets no response. Text form: "CREDIT::messages:bytes:0:". When flow
+// controlled subscribers fall too far behind a partition, the PUBLISHED
+// response for it carries WIRE_FLAG_BACKPRESSURE.
+const uint8_t WIRE_FLAG_BACKPRESSURE = 0x02;
+const size_t WIRE_CREDIT_SIZE = 8;
+
+void encodeCredit(uint32_t messages, uint32_t bytes, char* out);
+bool decodeCredit(std::string_view payload, uint32_t& messages, uint32_t& bytes);
+
+// Acknowledged delivery. A SUBSCRIBE with WIRE_FLAG_ACKED asks for at-least-
+// once delivery to a named consumer; its payload is the consumer name length
+// (u8), the name, then the optional filter. Delivery starts at the consumer's
+// committed cursor, and every message pushed stays unacknowledged until an
+// ACK names its offset (the MESSAGE frame's sequence). Unacknowledged
+// messages are pushed again after a timeout. An ACK's partition field names
+// the partition and its payload is a list of offsets (u64 each); with
+// WIRE_FLAG_CUMULATIVE it is a single offset and acknowledges everything
+// before it. ACK gets no response. Binary frames only.
+const uint8_t WIRE_FLAG_ACKED = 0x04;
+const uint8_t WIRE_FLAG_CUMULATIVE = 0x08;
+const size_t WIRE_ACK_OFFSET_SIZE = 8;
+
+bool decodeAckedSubscription(std::string_view payload, std::string_view& consumer, std::string_view& filter);
+void encodeAckOffset(uint64_t offset, char* out);
+bool decodeAckOffsets(std::string_view payload, std::vector<uint64_t>& offsets);
+
+// Clustering. A broker opens a link to every other member of its cluster and
+// starts it with PEER, whose payload is its node id in decimal (no response).
+// On a link, the key hash of a PUBLISH_BATCH entry names the partition itself:
+// members only forward publishes for partitions the receiver owns. SUBSCRIBE
+// and UNSUBSCRIBE on a link register the topics and patterns the sender's
+// clients want, and the receiver pushes the matching messages it owns back as
+// MESSAGE frames. A member that cannot reach a partition's owner answers a
+// publish for it with UNAVAILABLE ("UNAVAILABLE:topic" in text form); the
+// publish may be retried.
+
+// Replication. With replicas, each partition is kept by its leader and a few
+// followers (see cluster.h). The leader pushes what it appends to every
+// follower as REPLICATE over the link the follower opened: the payload is the
+// first offset (u64) followed by the messages' MESSAGE frames, back to back.
+// WIRE_FLAG_SYNC marks a frame that replaces the follower's copy from that
+// offset on. The follower answers with REPLICATED, whose payload is the end
+// offset of its copy (u64). With WIRE_FLAG_RESEND, the copy ends before the
+// frame's first offset and the leader resends from its end.
+//
+// A PUBLISH or PUBLISH_BATCH with WIRE_FLAG_QUORUM is answered once each
+// partition's in-sync followers (linked and ready) hold its messages, and they
+// make a majority of its replicas with the leader; or with UNAVAILABLE if that
+// takes too long. A member sets WIRE_FLAG_READY on PEER once it has caught up
+// and may lead partitions. Before that, the receiver first syncs the sender's
+// partitions to it, then answers with PEER.
+const uint8_t WIRE_FLAG_QUORUM = 0x10;
+const uint8_t WIRE_FLAG_SYNC = 0x20;
+const uint8_t WIRE_FLAG_RESEND = 0x40;
+const uint8_t WIRE_FLAG_READY = 0x80;
+const size_t WIRE_REPLICA_OFFSET_SIZE = 8;
+
+void encodeReplicaOffset(uint64_t offset, char* out);
+// Splits the offset off the front of a REPLICATE or REPLICATED payload.
+bool decodeReplicaOffset(std::string_view payload, uint64_t& offset, std::string_view& rest);
+
+// Stats. STATS asks the broker for its counters, request latencies and, per
+// topic partition, offsets, retained bytes, subscribers and consumer lag; a
+// non-empty topic restricts the per-topic section to that topic. The answer is
+// STATS_REPORT, whose payload is one line of JSON ("STATS_REPORT:" followed by
+// the JSON in text form).
+
+// Maps between opcodes and the type names used by the text format.
+const char* opcodeName(Opcode opcode);
+Opcode opcodeFromName(std::string_view name);
+
+// Writes header + topic + payload into out. The length fields of header are
+// ignored and taken from topic/payload. Returns the number of bytes written,
+// or 0 if out is too small or a field exceeds the format limits.
+size_t encodeFrame(const FrameHeader& header, std::string_view topic, std::string_view payload,
+                   char* out, size_t capacity);
+
+// Rewrites the sequence field of an encoded frame in place.
+void setFrameSequence(char* frame, uint64_t sequence);
+
+// Decodes only the fixed header; data must hold at least WIRE_HEADER_SIZE bytes
+// for Ok. Lets stream readers learn the full frame size before it has arrived.
+DecodeResult decodeHeader(const char* data, size_t size, FrameHeader& header);
+
+inline size_t frameSize(const FrameHeader& header) {
+    return WIRE_HEADER_SIZE + header.topicLength + header.payloadLength;
+}
+
+// Decodes the frame at the start of data. On Ok, consumed is the frame size.
+DecodeResult decodeFrame(const char* data, size_t size, FrameView& frame, size_t& consumed);
+
+// Conversions between the 36-character text form and the 16-byte binary form.
+bool parseUuid(std::string_view text, uint8_t out[WIRE_UUID_SIZE]);
+void formatUuid(const uint8_t uuid[WIRE_UUID_SIZE], char out[WIRE_UUID_TEXT_SIZE]);
+
+#endif // WIRE_H